@@ -0,0 +1,536 @@
+/**
+ * Microbenchmarks of the multigrid kernels.
+ *
+ * Each configuration (grid size, stencil order, number of coupled
+ * equations, solution layout, Jacobian block sweeps, OpenMP threads) sets up
+ * the problem
+ *
+ *   lap(u_e) - u_e + c u_{e+1} + rho_e = 0,   e = 0 .. eqns-1 (periodic in e)
+ *
+ * with the exact solution u_e = a_e sin(2 pi x) sin(2 pi y) sin(2 pi z)
+ * (c = 0 for a single equation), and times every kernel in isolation:
+ *
+ *   eval        _evaluateEllipticEquation, all equations, fine grid
+ *   jacobian    _evaluateIterationForJacEquation at every fine point
+ *   restrict    _restrictFine2coarse of one fine grid
+ *   prolong     _interpolateCoarse2fine to one fine grid
+ *   line_search one _getLambda trial (residual of all equations + update)
+ *   pow         pow(x, -7) of a positive fine grid, point by point
+ *   pow_lanes   the same with fas_pow_lanes, one x-plane at a time
+ *   vcycle      one VCycle from a zero initial guess
+ *   solve       V-cycles from a zero initial guess until the fine grid
+ *               residual is below --tol (time to tolerance)
+ *
+ * Output is one line per (configuration, kernel), as CSV (default) or JSON
+ * lines, with the best and median time over --reps runs, grid points per
+ * second and an estimate of the memory bandwidth from the number of grids
+ * each kernel has to stream (stencil neighbours assumed cached). Use --tag to
+ * label the version being measured. With --autotune CACHE it instead tunes
+ * every (size, eqns, order) problem with FASAutoTuner, solving to --tol, and
+ * stores the settings in CACHE.
+ *
+ * Example:
+ *   g++ benchmark.cpp full_multigrid.cpp fas_batch.cpp fas_instrumentation.cpp \
+ *     fas_trace.cpp fas_perf_counters.cpp fas_checkpoint.cpp fas_field_output.cpp fas_out_of_core.cpp fas_autotune.cpp fas_refinement.cpp fas_equations.cpp -O3 -Wall --std=c++11 -fopenmp -o benchmark
+ *   ./benchmark --sizes 32,64,128 --orders 2,4 --eqns 1,2 --threads 1,4 \
+ *     --layouts separate,interleaved --format json --tag v1 > bench.jsonl
+ *   ./benchmark --autotune fas_tuning.cache --sizes 64,128 --orders 4 --eqns 1 --reps 1
+ */
+#include "full_multigrid.h"
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+
+using namespace cosmo;
+
+// coupling between consecutive equations
+#define BENCH_COUPLING 0.1
+
+// exponent of the pow kernels (psi^-7 of a Hamiltonian constraint)
+#define BENCH_POW_EXPONENT -7.0
+
+typedef struct {
+  std::vector<idx_t> sizes, orders, eqns, threads, blocks;
+  std::vector<std::string> layouts, kernels;
+  idx_t reps, max_cycles, max_relax_iters;
+  real_t tol;
+  bool json;
+  std::string tag;
+  std::string autotune;  ///< tuning cache to write (autotune mode)
+} bench_config;
+
+typedef struct {
+  double time_min, time_median;
+  double points;  ///< grid points processed per run
+  double bytes;   ///< bytes streamed per run (model), 0 if not modelled
+  idx_t cycles;   ///< V-cycles (solve only)
+  real_t residual;
+} bench_result;
+
+static std::vector<std::string> splitList(const std::string & list)
+{
+  std::vector<std::string> res;
+  std::stringstream ss(list);
+  std::string item;
+  while(std::getline(ss, item, ','))
+    if(!item.empty())
+      res.push_back(item);
+  return res;
+}
+
+static std::vector<idx_t> splitIdxList(const std::string & list)
+{
+  std::vector<std::string> items = splitList(list);
+  std::vector<idx_t> res;
+  for(size_t i = 0; i < items.size(); i++)
+    res.push_back(atol(items[i].c_str()));
+  return res;
+}
+
+static void usage()
+{
+  std::cout << "Usage: benchmark [--sizes 32,64,128] [--orders 2,4,6,8] [--eqns 1,2]\n"
+            << "  [--threads 1,2,...] [--layouts separate,interleaved] [--blocks 1]\n"
+            << "  [--kernels eval,jacobian,restrict,prolong,line_search,pow,pow_lanes,vcycle,solve]\n"
+            << "  [--reps 5] [--tol 1e-3] [--max-cycles 20] [--relax-iters 5]\n"
+            << "  [--format csv|json] [--tag label]\n"
+            << "  [--autotune CACHE (tune sizes x eqns x orders instead)]\n";
+}
+
+static real_t benchAmplitude(idx_t e)
+{
+  return 1.0 + 0.5 * e;
+}
+
+static real_t benchShape(idx_t n, idx_t i, idx_t j, idx_t k)
+{
+  return sin(2.0 * PI * i / n) * sin(2.0 * PI * j / n) * sin(2.0 * PI * k / n);
+}
+
+/**
+ * @brief add the equations and sources of the benchmark problem
+ * @details molecules: 3 per equation, 4 if coupled
+ */
+static void setupBenchEquations(FASMultigrid & mg, idx_t n, idx_t u_n,
+  idx_t order)
+{
+  mg.setStencilOrder(order);
+
+  real_t k2 = 3.0 * pow(2.0 * PI, 2);
+  for(idx_t e = 0; e < u_n; e++)
+  {
+    atom a_lap = {FASMultigrid::lap, e, 0};
+    atom a_u = {FASMultigrid::poly, e, 1.0};
+    atom a_next = {FASMultigrid::poly, (e + 1) % u_n, 1.0};
+
+    mg.eqns[e][0].init(1, 1.0);
+    mg.add_atom_to_eqn(a_lap, 0, e);
+    mg.eqns[e][1].init(1, -1.0);
+    mg.add_atom_to_eqn(a_u, 1, e);
+    mg.eqns[e][2].init(0, 1.0);
+    if(u_n > 1)
+    {
+      mg.eqns[e][3].init(1, BENCH_COUPLING);
+      mg.add_atom_to_eqn(a_next, 3, e);
+    }
+
+    real_t a = benchAmplitude(e), a_n = benchAmplitude((e + 1) % u_n);
+    real_t c = (u_n > 1) ? BENCH_COUPLING : 0.0;
+    for(idx_t i = 0; i < n; i++)
+      for(idx_t j = 0; j < n; j++)
+        for(idx_t k = 0; k < n; k++)
+          mg.setPolySrcAtPt(e, 2, i, j, k,
+            ((1.0 + k2) * a - c * a_n) * benchShape(n, i, j, k));
+  }
+  mg.initializeRhoHeirarchy();
+}
+
+/**
+ * @brief solver set up for the benchmark problem
+ * @details settings are the ones given, never from a tuning cache
+ */
+class BenchProblem
+{
+ public:
+  idx_t n, u_n, max_depth, total_depths;
+  arr_t * u;           ///< fine grid solutions
+  arr_t * scratch;     ///< heirarchy for kernels writing to a grid
+  arr_t base;          ///< positive fine grid raised to a power by pow kernels
+  idx_t * molecule_n;
+  FASMultigrid * mg;
+
+  BenchProblem(idx_t n_in, idx_t u_n_in, idx_t order,
+    FASMultigrid::layout_t layout, idx_t block_sweeps, idx_t max_relax_iters,
+    real_t tol)
+  {
+    n = n_in;
+    u_n = u_n_in;
+
+    // coarsest grid has 4 points per side
+    max_depth = 1;
+    for(idx_t m = n; m > 4; m /= 2)
+      max_depth++;
+    total_depths = max_depth;
+
+    u = new arr_t[u_n];
+    for(idx_t e = 0; e < u_n; e++)
+      u[e].init(n, n, n);
+
+    molecule_n = new idx_t[u_n];
+    for(idx_t e = 0; e < u_n; e++)
+      molecule_n[e] = (u_n > 1) ? 4 : 3;
+
+    mg = new FASMultigrid(u, u_n, molecule_n, max_depth, max_relax_iters,
+      tol, layout);
+    mg->jacobian_block_sweeps = block_sweeps;
+    mg->tuning_cache_file = "";
+    setupBenchEquations(*mg, n, u_n, order);
+
+    scratch = new arr_t[total_depths];
+    for(idx_t d = 0; d < total_depths; d++)
+    {
+      idx_t m = n >> (total_depths - 1 - d);
+      scratch[d].init(m, m, m);
+    }
+
+    base.init(n, n, n);
+    for(idx_t i = 0; i < n; i++)
+      for(idx_t j = 0; j < n; j++)
+        for(idx_t k = 0; k < n; k++)
+          base[H_INDEX(i, j, k, n, n, n)] = 1.5 + 0.5 * benchShape(n, i, j, k);
+  }
+
+  ~BenchProblem()
+  {
+    delete mg;
+    for(idx_t e = 0; e < u_n; e++)
+      delete [] u[e]._array;
+    for(idx_t d = 0; d < total_depths; d++)
+      delete [] scratch[d]._array;
+    delete [] u;
+    delete [] scratch;
+    delete [] base._array;
+    delete [] molecule_n;
+  }
+
+  /**
+   * @brief reset the solution to the zero initial guess
+   */
+  void resetSolution()
+  {
+    idx_t pts = n * n * n;
+    for(idx_t e = 0; e < u_n; e++)
+    {
+      #pragma omp parallel for schedule(static)
+      for(idx_t idx = 0; idx < pts; idx++)
+        u[e][idx] = 0.0;
+    }
+  }
+};
+
+/**
+ * @brief run a kernel once
+ * @return wall time
+ */
+static double runKernel(BenchProblem & p, const std::string & kernel,
+  real_t tol, idx_t max_cycles, bench_result & res)
+{
+  FASMultigrid & mg = *p.mg;
+  idx_t n = p.n, max_depth = p.max_depth;
+  double start, time;
+
+  res.cycles = 0;
+  res.residual = 0.0;
+
+  if(kernel == "eval")
+  {
+    start = omp_get_wtime();
+    for(idx_t e = 0; e < p.u_n; e++)
+      mg._evaluateEllipticEquation(p.scratch, e, max_depth);
+    return omp_get_wtime() - start;
+  }
+  if(kernel == "jacobian")
+  {
+    real_t sum = 0.0;
+    idx_t depth_idx = p.total_depths - 1;
+    start = omp_get_wtime();
+    for(idx_t e = 0; e < p.u_n; e++)
+    {
+      #pragma omp parallel for schedule(static) reduction(+:sum)
+      for(idx_t i = 0; i < n; i++)
+        for(idx_t j = 0; j < n; j++)
+          for(idx_t k = 0; k < n; k++)
+          {
+            real_t coef_a = 0.0, coef_b = 0.0;
+            mg._evaluateIterationForJacEquation(e, depth_idx, coef_a, coef_b,
+              i, j, k, e);
+            sum += coef_a + coef_b;
+          }
+    }
+    time = omp_get_wtime() - start;
+    // keep the coefficients alive
+    volatile real_t sink = sum;
+    (void) sink;
+    return time;
+  }
+  if(kernel == "restrict")
+  {
+    start = omp_get_wtime();
+    mg._restrictFine2coarse(p.scratch, max_depth);
+    return omp_get_wtime() - start;
+  }
+  if(kernel == "prolong")
+  {
+    start = omp_get_wtime();
+    mg._interpolateCoarse2fine(p.scratch, max_depth - 1);
+    return omp_get_wtime() - start;
+  }
+  if(kernel == "line_search")
+  {
+    // the correction is zero and any norm is accepted: a single trial
+    real_t any_norm = 1e300;
+    start = omp_get_wtime();
+    mg._getLambda(max_depth, &any_norm);
+    return omp_get_wtime() - start;
+  }
+  if(kernel == "pow" || kernel == "pow_lanes")
+  {
+    idx_t plane = n * n;
+    real_t * x = p.base._array, * res = p.scratch[p.total_depths - 1]._array;
+    start = omp_get_wtime();
+    if(kernel == "pow")
+    {
+      #pragma omp parallel for schedule(static)
+      for(idx_t idx = 0; idx < n * plane; idx++)
+        res[idx] = pow(x[idx], (real_t) BENCH_POW_EXPONENT);
+    }
+    else
+    {
+      #pragma omp parallel for schedule(static)
+      for(idx_t i = 0; i < n; i++)
+        fas_pow_lanes(x + i * plane, BENCH_POW_EXPONENT, plane, res + i * plane);
+    }
+    return omp_get_wtime() - start;
+  }
+  if(kernel == "vcycle" || kernel == "solve")
+  {
+    p.resetSolution();
+    mg._syncInterleavedSolution(true);
+    start = omp_get_wtime();
+    do
+    {
+      mg.VCycle();
+      res.cycles++;
+      res.residual = mg._getMaxResidualAllEqs(max_depth);
+    } while(kernel == "solve" && res.residual > tol && res.cycles < max_cycles);
+    time = omp_get_wtime() - start;
+    mg._syncInterleavedSolution(false);
+    return time;
+  }
+
+  std::cout << "Unknown kernel " << kernel << "\n";
+  throw -1;
+}
+
+/**
+ * @brief grid points processed and bytes streamed by one run of a kernel
+ * @details bytes count each grid a kernel reads or writes once per point:
+ *  equations read the solutions they contain and their rho, atomics in
+ *  the prolongation read and write the fine grid
+ */
+static void kernelModel(BenchProblem & p, const std::string & kernel,
+  bench_result & res)
+{
+  double pts = (double) p.n * p.n * p.n;
+  double grids_per_eqn = (p.u_n > 1 ? 2 : 1) + 1; // solutions + rho
+
+  res.points = pts * p.u_n;
+  res.bytes = 0.0;
+
+  if(kernel == "eval")
+    res.bytes = 8.0 * pts * p.u_n * (grids_per_eqn + 1);
+  else if(kernel == "jacobian")
+    res.bytes = 8.0 * pts * p.u_n * (grids_per_eqn + 1);
+  else if(kernel == "restrict")
+  {
+    res.points = pts;
+    res.bytes = 8.0 * pts * (1.0 + 1.0/8.0);
+  }
+  else if(kernel == "prolong")
+  {
+    res.points = pts;
+    res.bytes = 8.0 * pts * (3.0 + 1.0/8.0);
+  }
+  else if(kernel == "line_search")
+    res.bytes = 8.0 * pts * p.u_n * (3.0 + grids_per_eqn + 1);
+  else if(kernel == "pow" || kernel == "pow_lanes")
+  {
+    res.points = pts;
+    res.bytes = 8.0 * pts * 2.0;
+  }
+  else
+    res.points = pts * p.u_n * std::max((idx_t) 1, res.cycles);
+}
+
+static void printResult(const bench_config & cfg, const std::string & kernel,
+  idx_t n, idx_t order, idx_t eqns, const std::string & layout, idx_t blocks,
+  idx_t threads, const bench_result & r)
+{
+  double pps = r.points / r.time_min;
+  double gbs = r.bytes / r.time_min / 1e9;
+
+  if(cfg.json)
+    std::cout << "{\"tag\": \"" << cfg.tag << "\", \"kernel\": \"" << kernel
+              << "\", \"n\": " << n << ", \"order\": " << order
+              << ", \"eqns\": " << eqns << ", \"layout\": \"" << layout
+              << "\", \"block_sweeps\": " << blocks << ", \"threads\": " << threads
+              << ", \"reps\": " << cfg.reps << ", \"time_min\": " << r.time_min
+              << ", \"time_median\": " << r.time_median
+              << ", \"points_per_s\": " << pps << ", \"gb_per_s\": " << gbs
+              << ", \"cycles\": " << r.cycles << ", \"residual\": " << r.residual
+              << "}\n";
+  else
+    std::cout << cfg.tag << "," << kernel << "," << n << "," << order << ","
+              << eqns << "," << layout << "," << blocks << "," << threads << ","
+              << cfg.reps << "," << r.time_min << "," << r.time_median << ","
+              << pps << "," << gbs << "," << r.cycles << "," << r.residual << "\n";
+  std::cout << std::flush;
+}
+
+/**
+ * @brief tune every problem and store the settings in cfg.autotune
+ * @details trials solve to --tol in at most --max-cycles V-cycles
+ */
+static int autotune(const bench_config & cfg)
+{
+  bool ok = true;
+
+  std::cout << "n,order,eqns,depths,relax_iters,block_sweeps,adaptive_rate,"
+            << "threads,time\n";
+
+  for(size_t s = 0; s < cfg.sizes.size(); s++)
+  for(size_t e = 0; e < cfg.eqns.size(); e++)
+  for(size_t o = 0; o < cfg.orders.size(); o++)
+  {
+    idx_t n = cfg.sizes[s], u_n = cfg.eqns[e], order = cfg.orders[o];
+    std::vector<idx_t> molecule_n(u_n, (u_n > 1) ? 4 : 3);
+
+    FASAutoTuner tuner(n, n, n, u_n, &molecule_n[0], cfg.tol,
+      [=](FASMultigrid & mg, arr_t *) { setupBenchEquations(mg, n, u_n, order); });
+    tuner.max_cycles = cfg.max_cycles;
+    tuner.reps = cfg.reps;
+
+    FASTuningCache::config_t best;
+    if(!tuner.tune(cfg.autotune, best))
+    {
+      ok = false;
+      continue;
+    }
+
+    std::cout << n << "," << order << "," << u_n << "," << best.depths << ","
+              << best.relax_iters << "," << best.block_sweeps << ","
+              << best.adaptive_rate << "," << best.threads << "," << best.time
+              << "\n" << std::flush;
+  }
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char **argv)
+{
+  bench_config cfg;
+  cfg.sizes = splitIdxList("32,64,128");
+  cfg.orders = splitIdxList("2,4,6,8");
+  cfg.eqns = splitIdxList("1,2");
+  cfg.threads.push_back(omp_get_max_threads());
+  cfg.blocks = splitIdxList("1");
+  cfg.layouts = splitList("separate,interleaved");
+  cfg.kernels = splitList("eval,jacobian,restrict,prolong,line_search,pow,pow_lanes,vcycle,solve");
+  cfg.reps = 5;
+  cfg.max_cycles = 20;
+  cfg.max_relax_iters = 5;
+  cfg.tol = 1e-3;
+  cfg.json = false;
+  cfg.tag = "";
+
+  for(int a = 1; a < argc; a++)
+  {
+    std::string opt = argv[a];
+    if(opt == "--help" || opt == "-h" || a + 1 >= argc)
+    {
+      usage();
+      return opt == "--help" || opt == "-h" ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    std::string val = argv[++a];
+
+    if(opt == "--sizes") cfg.sizes = splitIdxList(val);
+    else if(opt == "--orders") cfg.orders = splitIdxList(val);
+    else if(opt == "--eqns") cfg.eqns = splitIdxList(val);
+    else if(opt == "--threads") cfg.threads = splitIdxList(val);
+    else if(opt == "--blocks") cfg.blocks = splitIdxList(val);
+    else if(opt == "--layouts") cfg.layouts = splitList(val);
+    else if(opt == "--kernels") cfg.kernels = splitList(val);
+    else if(opt == "--reps") cfg.reps = std::max(1L, atol(val.c_str()));
+    else if(opt == "--tol") cfg.tol = atof(val.c_str());
+    else if(opt == "--max-cycles") cfg.max_cycles = atol(val.c_str());
+    else if(opt == "--relax-iters") cfg.max_relax_iters = atol(val.c_str());
+    else if(opt == "--format") cfg.json = (val == "json");
+    else if(opt == "--tag") cfg.tag = val;
+    else if(opt == "--autotune") cfg.autotune = val;
+    else
+    {
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if(!cfg.autotune.empty())
+    return autotune(cfg);
+
+  if(!cfg.json)
+    std::cout << "tag,kernel,n,order,eqns,layout,block_sweeps,threads,reps,"
+              << "time_min,time_median,points_per_s,gb_per_s,cycles,residual\n";
+
+  for(size_t t = 0; t < cfg.threads.size(); t++)
+  {
+    // set before the solver allocates its grids (first-touch placement)
+    omp_set_num_threads(cfg.threads[t]);
+
+    for(size_t s = 0; s < cfg.sizes.size(); s++)
+    for(size_t e = 0; e < cfg.eqns.size(); e++)
+    for(size_t l = 0; l < cfg.layouts.size(); l++)
+    for(size_t o = 0; o < cfg.orders.size(); o++)
+    for(size_t b = 0; b < cfg.blocks.size(); b++)
+    {
+      FASMultigrid::layout_t layout = (cfg.layouts[l] == "interleaved") ?
+        FASMultigrid::layout_interleaved : FASMultigrid::layout_separate;
+
+      BenchProblem p(cfg.sizes[s], cfg.eqns[e], cfg.orders[o], layout,
+        cfg.blocks[b], cfg.max_relax_iters, cfg.tol);
+
+      for(size_t k = 0; k < cfg.kernels.size(); k++)
+      {
+        const std::string & kernel = cfg.kernels[k];
+        std::vector<double> times;
+        bench_result r;
+
+        runKernel(p, kernel, cfg.tol, cfg.max_cycles, r); // warm up
+        for(idx_t rep = 0; rep < cfg.reps; rep++)
+          times.push_back(runKernel(p, kernel, cfg.tol, cfg.max_cycles, r));
+
+        std::sort(times.begin(), times.end());
+        r.time_min = times.front();
+        r.time_median = times[times.size() / 2];
+        kernelModel(p, kernel, r);
+
+        printResult(cfg, kernel, cfg.sizes[s], cfg.orders[o], cfg.eqns[e],
+          cfg.layouts[l], cfg.blocks[b], cfg.threads[t], r);
+      }
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
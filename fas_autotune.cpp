@@ -0,0 +1,313 @@
+#include "fas_autotune.h"
+#include "full_multigrid.h"
+#include <omp.h>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+namespace cosmo
+{
+
+/**
+ * @brief model name of the CPU ("unknown" if not found)
+ * @details from /proc/cpuinfo; tabs are replaced so the name can be a
+ *  field of the cache file
+ */
+std::string FASTuningCache::cpuModel()
+{
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while(std::getline(cpuinfo, line))
+  {
+    if(line.compare(0, 10, "model name") != 0)
+      continue;
+
+    size_t start = line.find(':');
+    if(start == std::string::npos)
+      break;
+    start = line.find_first_not_of(" \t", start + 1);
+    if(start == std::string::npos)
+      break;
+
+    std::string model = line.substr(start);
+    std::replace(model.begin(), model.end(), '\t', ' ');
+    return model;
+  }
+  return "unknown";
+}
+
+/**
+ * @brief cache key of a problem on this machine
+ *
+ * @param nx, ny, nz fine grid dimensions
+ * @param signature see FASMultigrid::equationSignature
+ */
+std::string FASTuningCache::key(idx_t nx, idx_t ny, idx_t nz,
+  const std::string & signature)
+{
+  std::ostringstream key;
+  key << nx << "x" << ny << "x" << nz << "\t" << signature << "\t"
+      << cpuModel();
+  return key.str();
+}
+
+/**
+ * @brief look up the settings of a problem
+ * @return false if the file or the key does not exist
+ */
+bool FASTuningCache::find(const std::string & file_name,
+  const std::string & key, config_t & config)
+{
+  std::ifstream in(file_name.c_str());
+  std::string line, prefix = key + "\t";
+  while(std::getline(in, line))
+  {
+    if(line.compare(0, prefix.size(), prefix) != 0)
+      continue;
+
+    std::istringstream values(line.substr(prefix.size()));
+    config_t c;
+    if(values >> c.depths >> c.relax_iters >> c.block_sweeps
+      >> c.adaptive_rate >> c.threads >> c.time)
+    {
+      config = c;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief add or replace the settings of a problem
+ * @details the file is rewritten to file_name.tmp and renamed over it
+ */
+bool FASTuningCache::store(const std::string & file_name,
+  const std::string & key, const config_t & config)
+{
+  std::vector<std::string> lines;
+  std::ifstream in(file_name.c_str());
+  std::string line, prefix = key + "\t";
+  while(std::getline(in, line))
+    if(!line.empty() && line.compare(0, prefix.size(), prefix) != 0)
+      lines.push_back(line);
+  in.close();
+
+  std::ostringstream entry;
+  entry << prefix << config.depths << " " << config.relax_iters << " "
+        << config.block_sweeps << " " << config.adaptive_rate << " "
+        << config.threads << " " << config.time;
+  lines.push_back(entry.str());
+
+  std::string tmp_name = file_name + ".tmp";
+  std::ofstream out(tmp_name.c_str());
+  for(size_t l = 0; l < lines.size(); l++)
+    out << lines[l] << "\n";
+  out.close();
+
+  if(!out || std::rename(tmp_name.c_str(), file_name.c_str()) != 0)
+  {
+    std::cout << "Unable to write tuning cache " << file_name << "\n";
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief set up a tuner with the default search space
+ *
+ * @param nx_in, ny_in, nz_in fine grid dimensions
+ * @param u_n_in number of variables (equations)
+ * @param molecule_n_in molecules of each equation
+ * @param tolerance_in max. fine grid residual to reach
+ * @param setup_in sets up the problem of a trial, see FASAutoTuner
+ */
+FASAutoTuner::FASAutoTuner(idx_t nx_in, idx_t ny_in, idx_t nz_in,
+  idx_t u_n_in, idx_t molecule_n_in[], real_t tolerance_in,
+  setup_fn_t setup_in)
+{
+  nx = nx_in;
+  ny = ny_in;
+  nz = nz_in;
+  u_n = u_n_in;
+  molecule_n.assign(molecule_n_in, molecule_n_in + u_n_in);
+  tolerance = tolerance_in;
+  setup = setup_in;
+
+  max_cycles = 20;
+  reps = 1;
+  verbosity = 0;
+
+  // coarsest grid has at least 4 points per side
+  idx_t deepest = 1;
+  for(idx_t m = std::min(nx, std::min(ny, nz)); m > 4; m /= 2)
+    deepest++;
+  for(idx_t d = std::min((idx_t) 2, deepest); d <= deepest; d++)
+    depths.push_back(d);
+
+  relax_iters.push_back(2);
+  relax_iters.push_back(3);
+  relax_iters.push_back(5);
+  relax_iters.push_back(10);
+
+  block_sweeps.push_back(1);
+  block_sweeps.push_back(2);
+  block_sweeps.push_back(4);
+
+  adaptive_rates.push_back(0.0);
+  adaptive_rates.push_back(0.05);
+
+  idx_t all_threads = omp_get_max_threads();
+  for(idx_t t = 1; t < all_threads; t *= 2)
+    threads.push_back(t);
+  threads.push_back(all_threads);
+}
+
+/**
+ * @brief time to tolerance of a configuration
+ *
+ * @param config settings to try
+ * @param cycles V-cycles taken by the last trial
+ * @return fastest time over reps trials; infinity if the trials failed
+ */
+double FASAutoTuner::_trial(const FASTuningCache::config_t & config,
+  idx_t & cycles)
+{
+  double best = std::numeric_limits<double>::infinity();
+
+  // fine grids are first touched by the threads of the trial
+  omp_set_num_threads(config.threads);
+
+  for(idx_t rep = 0; rep < reps; rep++)
+  {
+    arr_t * u = new arr_t[u_n];
+    for(idx_t e = 0; e < u_n; e++)
+    {
+      u[e].init(nx, ny, nz);
+      idx_t pts = nx * ny * nz;
+      #pragma omp parallel for schedule(static)
+      for(idx_t idx = 0; idx < pts; idx++)
+        u[e][idx] = 0.0;
+    }
+
+    FASMultigrid * mg = new FASMultigrid(u, u_n, &molecule_n[0],
+      config.depths, config.relax_iters, tolerance);
+    mg->tuning_cache_file = "";
+
+    cycles = 0;
+    try
+    {
+      setup(*mg, u);
+      mg->applyTuning(config);
+      if(key.empty())
+        key = FASTuningCache::key(nx, ny, nz, mg->equationSignature());
+
+      double start = omp_get_wtime();
+      real_t residual;
+      do
+      {
+        mg->VCycle();
+        cycles++;
+        residual = mg->_getMaxResidualAllEqs(config.depths);
+      } while(residual > tolerance && cycles < max_cycles);
+
+      if(residual <= tolerance)
+        best = std::min(best, omp_get_wtime() - start);
+    }
+    catch(int)
+    {
+      // line search failed; the configuration is discarded
+    }
+
+    delete mg;
+    for(idx_t e = 0; e < u_n; e++)
+      delete [] u[e]._array;
+    delete [] u;
+  }
+
+  if(verbosity > 0)
+  {
+    std::cout << "  depths " << config.depths << ", relax_iters "
+              << config.relax_iters << ", block_sweeps " << config.block_sweeps
+              << ", adaptive_rate " << config.adaptive_rate << ", threads "
+              << config.threads << ": ";
+    if(best < std::numeric_limits<double>::infinity())
+      std::cout << best << " s, " << cycles << " cycles\n" << std::flush;
+    else
+      std::cout << "did not reach the tolerance\n" << std::flush;
+  }
+
+  return best;
+}
+
+/**
+ * @brief try the values of one setting, keeping the best configuration
+ */
+template<typename T>
+void FASAutoTuner::_searchField(const std::vector<T> & values,
+  T FASTuningCache::config_t::* field, FASTuningCache::config_t & best)
+{
+  idx_t cycles;
+  for(size_t v = 0; v < values.size(); v++)
+  {
+    if(best.*field == values[v])
+      continue;
+
+    FASTuningCache::config_t config = best;
+    config.*field = values[v];
+    config.time = _trial(config, cycles);
+    if(config.time < best.time)
+      best = config;
+  }
+}
+
+/**
+ * @brief search for the fastest configuration
+ * @details the OpenMP thread count is restored afterwards
+ *
+ * @param best fastest configuration found
+ * @return false if no configuration reached the tolerance
+ */
+bool FASAutoTuner::tune(FASTuningCache::config_t & best)
+{
+  idx_t all_threads = omp_get_max_threads();
+  idx_t cycles;
+
+  best.depths = depths.empty() ? 1 : depths.back();
+  best.relax_iters = 5;
+  best.block_sweeps = 1;
+  best.adaptive_rate = 0.0;
+  best.threads = all_threads;
+  best.time = _trial(best, cycles);
+
+  _searchField(depths, &FASTuningCache::config_t::depths, best);
+  _searchField(relax_iters, &FASTuningCache::config_t::relax_iters, best);
+  _searchField(block_sweeps, &FASTuningCache::config_t::block_sweeps, best);
+  _searchField(adaptive_rates, &FASTuningCache::config_t::adaptive_rate, best);
+  _searchField(threads, &FASTuningCache::config_t::threads, best);
+
+  omp_set_num_threads(all_threads);
+
+  if(!(best.time < std::numeric_limits<double>::infinity()))
+  {
+    std::cout << "No configuration reached the tolerance of the tuning.\n";
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief search for the fastest configuration and store it in a cache
+ * @details solvers of the same problem (grid dimensions and equation
+ *  signature) on the same CPU model pick it up from the cache file in
+ *  initializeRhoHeirarchy
+ */
+bool FASAutoTuner::tune(const std::string & cache_file,
+  FASTuningCache::config_t & best)
+{
+  if(!tune(best))
+    return false;
+  return FASTuningCache::store(cache_file, key, best);
+}
+
+} // namespace cosmo
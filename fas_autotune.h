@@ -0,0 +1,116 @@
+#ifndef FAS_AUTOTUNE_H
+#define FAS_AUTOTUNE_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "../../cosmo_types.h"
+
+// cache file read by FASMultigrid::initializeRhoHeirarchy ("": none, the
+// default; tuned settings are only used when asked for)
+#ifndef FAS_TUNING_CACHE_FILE
+  #define FAS_TUNING_CACHE_FILE ""
+#endif
+
+namespace cosmo
+{
+
+class FASMultigrid;
+
+/**
+ * @brief solver settings found by FASAutoTuner, cached per problem
+ * @details The cache is a text file with one line per problem, the fields
+ *  separated by tabs:
+ *
+ *    <nx>x<ny>x<nz>  <equation signature>  <CPU model>  <settings>
+ *
+ *  where the signature (FASMultigrid::equationSignature) describes the
+ *  stencil order and the atoms of every molecule, but not coefficients or
+ *  sources, and the settings are depths, relax_iters, block_sweeps,
+ *  adaptive_rate, threads and the measured time to tolerance.
+ */
+class FASTuningCache
+{
+ public:
+
+  typedef struct {
+    idx_t depths;         ///< levels used by the V-cycles
+    idx_t relax_iters;    ///< max. Newton iterations per smoothing call
+    idx_t block_sweeps;   ///< jacobian_block_sweeps
+    real_t adaptive_rate; ///< min_rate of adaptive smoothing (0: off)
+    idx_t threads;        ///< OpenMP threads (0: leave unchanged)
+    double time;          ///< time to tolerance of the trial solve
+  } config_t;
+
+  static std::string cpuModel();
+
+  static std::string key(idx_t nx, idx_t ny, idx_t nz,
+    const std::string & signature);
+
+  static bool find(const std::string & file_name, const std::string & key,
+    config_t & config);
+
+  static bool store(const std::string & file_name, const std::string & key,
+    const config_t & config);
+};
+
+/**
+ * @brief pick V-cycle depth, smoother settings and thread count by trial
+ * @details Runs short solves of a representative problem from a zero
+ *  initial guess and measures the wall time of the V-cycles needed to bring
+ *  the max. fine grid residual below the tolerance. The search is by
+ *  coordinates: starting from the deepest V-cycle, max_relax_iters 5,
+ *  unblocked Jacobi sweeps, no adaptive smoothing and all threads, the
+ *  values of depths, relax_iters, block_sweeps, adaptive_rates and threads
+ *  are tried in turn, each keeping the best of the ones before. Trials that
+ *  fail (line search) or do not reach the tolerance in max_cycles are
+ *  discarded.
+ *
+ *  setup is called for every trial on a fresh solver (tolerance,
+ *  layout_separate, tuning cache disabled) and its fine grids, which are
+ *  zero. It must add the equations and sources, set the stencil order and
+ *  call initializeRhoHeirarchy, as for a real solve.
+ */
+class FASAutoTuner
+{
+ public:
+
+  typedef std::function<void(FASMultigrid &, arr_t *)> setup_fn_t;
+
+  // search space
+  std::vector<idx_t> depths;         ///< default: 2 .. coarsest grid with 4 points per side
+  std::vector<idx_t> relax_iters;    ///< default: 2, 3, 5, 10
+  std::vector<idx_t> block_sweeps;   ///< default: 1, 2, 4
+  std::vector<real_t> adaptive_rates; ///< default: 0 (off), 0.05
+  std::vector<idx_t> threads;        ///< default: powers of 2 up to all threads, and all
+
+  idx_t max_cycles; ///< V-cycles a trial may take
+  idx_t reps;       ///< trials per configuration (the fastest counts)
+  idx_t verbosity;  ///< 1: print every trial
+
+  FASAutoTuner(idx_t nx_in, idx_t ny_in, idx_t nz_in, idx_t u_n_in,
+    idx_t molecule_n_in[], real_t tolerance_in, setup_fn_t setup_in);
+
+  bool tune(FASTuningCache::config_t & best);
+
+  bool tune(const std::string & cache_file, FASTuningCache::config_t & best);
+
+ private:
+
+  idx_t nx, ny, nz, u_n;
+  std::vector<idx_t> molecule_n;
+  real_t tolerance;
+  setup_fn_t setup;
+  std::string key;  ///< cache key of the problem, set by the first trial
+
+  double _trial(const FASTuningCache::config_t & config, idx_t & cycles);
+
+  template<typename T>
+  void _searchField(const std::vector<T> & values,
+    T FASTuningCache::config_t::* field, FASTuningCache::config_t & best);
+};
+
+} // namespace cosmo
+
+#endif
@@ -0,0 +1,203 @@
+#include "fas_batch.h"
+
+namespace cosmo
+{
+
+/**
+ * @brief Method to initialize internal variables, allocate memory
+ * @param[in]  input arrays at finest grid, u_in[member * u_n + eqn_id];
+ *  copied in, and the solution is copied back at the end of VCycles
+ * @param[in]  number of variables, equals to number of equations
+ * @param[in]  number of problems (sources) solved together
+ * @param[in]  array stores term number for each equation
+ * @param[in]  set how many layers we want
+ * @param[in]  set number of interations for each relaxation
+ * @param[in]  set relaxation jump out precision
+ */
+FASMultigridBatch::FASMultigridBatch(fas_grid_t u_in[], idx_t u_n_in,
+  idx_t batch_n_in, idx_t molecule_n_in [], idx_t max_depth_in,
+  idx_t max_relax_iters_in, real_t relaxation_tolerance_in)
+{
+  if(batch_n_in < 1 || batch_n_in > FAS_BATCH_MAX)
+  {
+    std::cout << "Batch size " << batch_n_in << " is not between 1 and"
+              << " FAS_BATCH_MAX (" << FAS_BATCH_MAX << ").\n";
+    throw -1;
+  }
+
+  u_n = u_n_in;
+  batch_n = batch_n_in;
+  molecule_n = molecule_n_in;
+
+  mg_molecule_n = new idx_t[u_n * batch_n];
+  for(idx_t b = 0; b < batch_n; b++)
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+      mg_molecule_n[b * u_n + eqn_id] = molecule_n[eqn_id];
+
+  mg = new FASMultigrid(u_in, u_n * batch_n, mg_molecule_n, max_depth_in,
+    max_relax_iters_in, relaxation_tolerance_in,
+    FASMultigrid::layout_interleaved);
+
+  // members are groups of u_n variables of mg
+  mg->batch_n = batch_n;
+  mg->member_u_n = u_n;
+
+  eqns = mg->eqns;
+
+  for(idx_t b = 0; b < FAS_BATCH_MAX; b++)
+  {
+    converged[b] = false;
+    cycles_n[b] = 0;
+    final_residual[b] = 0.0;
+  }
+  _setActive();
+
+  verbosity = 0;
+}
+
+/**
+ * @brief select the finite difference order of the stencils (2, 4, 6 or 8)
+ */
+void FASMultigridBatch::setStencilOrder(idx_t order)
+{
+  mg->setStencilOrder(order);
+}
+
+void FASMultigridBatch::add_atom_to_eqn(atom atom_in, idx_t molecule_id, idx_t eqn_id)
+{
+  mg->add_atom_to_eqn(atom_in, molecule_id, eqn_id);
+}
+
+/**
+ * @brief set rho for a single member at a point on the finest grid
+ */
+void FASMultigridBatch::setPolySrcAtPt(idx_t eqn_id, idx_t mol_id, idx_t member,
+  idx_t i, idx_t j, idx_t k, real_t value)
+{
+  mg->setPolySrcAtPt(member * u_n + eqn_id, mol_id, i, j, k, value);
+}
+
+/**
+ * @brief copy the equations of member 0 to the other members
+ * @details atoms are moved to the member's variables; a molecule with a
+ *  rho for some member gets a (zero) rho for all of them
+ */
+void FASMultigridBatch::_replicateEquations()
+{
+  idx_t max_depth_idx = mg->max_depth_idx;
+  idx_t nx = mg->nx_h[max_depth_idx], ny = mg->ny_h[max_depth_idx],
+        nz = mg->nz_h[max_depth_idx];
+
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+    {
+      molecule & mol = mg->eqns[eqn_id][mol_id];
+      bool has_rho = false;
+
+      for(idx_t b = 0; b < batch_n; b++)
+        has_rho = has_rho
+          || mg->rho_h[b * u_n + eqn_id][mol_id][max_depth_idx].pts > 0;
+
+      for(idx_t b = 0; b < batch_n; b++)
+      {
+        idx_t member_eqn = b * u_n + eqn_id;
+        fas_grid_t & rho = mg->rho_h[member_eqn][mol_id][max_depth_idx];
+        if(has_rho && rho.pts == 0)
+          mg->_initGrid(rho, nx, ny, nz);
+
+        if(b == 0)
+          continue;
+
+        molecule & member_mol = mg->eqns[member_eqn][mol_id];
+        delete [] member_mol.atoms;
+        member_mol.init(mol.atom_n, mol.const_coef);
+        for(idx_t atom_id = 0; atom_id < mol.atom_n; atom_id++)
+        {
+          atom a = mol.atoms[atom_id];
+          a.u_id += b * u_n;
+          mg->add_atom_to_eqn(a, mol_id, member_eqn);
+        }
+      }
+    }
+}
+
+/**
+ * @brief      Copy the equations to all members and restrict rho to all
+ *  depths
+ */
+void FASMultigridBatch::initializeRhoHeirarchy()
+{
+  _replicateEquations();
+  mg->initializeRhoHeirarchy();
+}
+
+/**
+ * @brief members that have not converged are the ones updated by mg
+ */
+void FASMultigridBatch::_setActive()
+{
+  for(idx_t b = 0; b < batch_n; b++)
+    mg->member_active[b] = !converged[b];
+}
+
+/**
+ * @brief run V-cycles until every member reaches the tolerance (or
+ *  num_cycles), then copy solutions back to the user's grids
+ */
+void FASMultigridBatch::VCycles(idx_t num_cycles)
+{
+  idx_t max_depth = mg->max_depth;
+  real_t max_res[FAS_BATCH_MAX];
+
+  mg->_syncInterleavedSolution(true);
+
+  for(idx_t cycle = 0; cycle < num_cycles; ++cycle)
+  {
+    bool any = false;
+    _setActive();
+    for(idx_t b = 0; b < batch_n; b++)
+      any = any || mg->member_active[b];
+    if(!any)
+      break;
+
+    mg->VCycle();
+
+    mg->_getMaxResidualMembers(max_depth, max_res);
+    for(idx_t b = 0; b < batch_n; b++)
+    {
+      if(mg->member_active[b])
+      {
+        cycles_n[b]++;
+        converged[b] = max_res[b] < mg->relaxation_tolerance;
+      }
+    }
+
+    if(verbosity > 0)
+    {
+      std::cout << "  Cycle " << cycle << " max. residual per member: {";
+      for(idx_t b = 0; b < batch_n; b++)
+        std::cout << " " << max_res[b];
+      std::cout << " }\n" << std::flush;
+    }
+  }
+
+  _setActive();
+  mg->_relaxSolution_GaussSeidel(max_depth, 10);
+
+  for(idx_t b = 0; b < batch_n; b++)
+    mg->member_active[b] = true;
+  mg->_getMaxResidualMembers(max_depth, final_residual);
+  for(idx_t b = 0; b < batch_n && verbosity > 0; b++)
+    std::cout << "  Member " << b << ": final residual " << final_residual[b]
+              << " after " << cycles_n[b] << " V-cycles.\n" << std::flush;
+
+  mg->_syncInterleavedSolution(false);
+}
+
+FASMultigridBatch::~FASMultigridBatch()
+{
+  delete mg;
+  delete [] mg_molecule_n;
+}
+
+} // namespace cosmo
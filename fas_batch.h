@@ -0,0 +1,80 @@
+#ifndef FAS_BATCH_H
+#define FAS_BATCH_H
+
+#include "full_multigrid.h"
+
+namespace cosmo
+{
+
+/**
+ * @brief FAS multigrid solving one set of equations for several sources
+ * @details Holds batch_n independent problems sharing the same equations
+ *  (e.g. different rho fields or trial solutions). They are solved as one
+ *  FASMultigrid system of u_n * batch_n variables, variable
+ *  member * u_n + eqn_id belonging to member, stored interleaved so the
+ *  values of all members at a point are contiguous. The solver runs its
+ *  Newton iterations, line searches and convergence checks per member (see
+ *  FASMultigrid::batch_n), so every member follows the same path as a solve
+ *  on its own, with the same kernels, operator cache, smoothing and
+ *  constrained Newton. Members whose fine-grid residual reaches the
+ *  tolerance are no longer updated, and levels stop relaxing members that
+ *  already satisfy their tolerance.
+ */
+class FASMultigridBatch
+{
+  private:
+
+  // grid (array) type
+  typedef arr_t fas_grid_t;
+
+  FASMultigrid * mg;  ///< solver of all members
+
+  idx_t u_n;          ///< number of variables of a member ( = number of equations)
+  idx_t batch_n;      ///< number of problems solved together
+
+  idx_t * molecule_n;     ///< number of molecules for each equation
+  idx_t * mg_molecule_n;  ///< molecule_n of every member, for mg
+
+  bool converged[FAS_BATCH_MAX]; ///< members that reached the tolerance on the fine grid
+
+  void _replicateEquations();
+
+  void _setActive();
+
+ public:
+
+  molecule ** eqns; ///< All terms in all equations (those of member 0, in variables 0 .. u_n - 1)
+
+  idx_t cycles_n[FAS_BATCH_MAX]; ///< V-cycles each member needed
+  real_t final_residual[FAS_BATCH_MAX]; ///< max. fine grid residual of each member after VCycles
+
+  idx_t verbosity; ///< 0: silent, 1: residuals after each V-cycle
+
+  FASMultigridBatch(fas_grid_t u_in[], idx_t u_n_in, idx_t batch_n_in,
+    idx_t molecule_n_in [], idx_t max_depth_in, idx_t max_relax_iters_in,
+    real_t relaxation_tolerance_in);
+  ~FASMultigridBatch();
+
+  /**
+   * @brief solver of all members, e.g. for its relaxation scheme or
+   *  instrumentation
+   */
+  inline FASMultigrid & getSolver()
+  {
+    return *mg;
+  }
+
+  void add_atom_to_eqn(atom atom_in, idx_t molecule_id, idx_t eqn_id);
+
+  void setStencilOrder(idx_t order);
+
+  void setPolySrcAtPt(idx_t eqn_id, idx_t mol_id, idx_t member, idx_t i,
+    idx_t j, idx_t k, real_t value);
+
+  void initializeRhoHeirarchy();
+
+  void VCycles(idx_t num_cycles);
+};
+
+} // namespace cosmo
+#endif
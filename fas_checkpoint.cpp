@@ -0,0 +1,242 @@
+#include "fas_checkpoint.h"
+#include <omp.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cosmo
+{
+
+// grid data starts on page boundaries
+#define FAS_CHECKPOINT_ALIGN 4096
+
+static int64_t fas_checkpoint_align(int64_t offset)
+{
+  return (offset + FAS_CHECKPOINT_ALIGN - 1) / FAS_CHECKPOINT_ALIGN
+    * FAS_CHECKPOINT_ALIGN;
+}
+
+/**
+ * @brief copy between a grid and a file image in parallel
+ * @details static schedule over contiguous chunks, as the kernels use, so
+ *  restored pages stay with the threads that work on them
+ */
+static void fas_checkpoint_copy(char * to, const char * from, int64_t bytes)
+{
+  #pragma omp parallel
+  {
+    int64_t threads = omp_get_num_threads(), tid = omp_get_thread_num();
+    int64_t chunk = (bytes + threads - 1) / threads;
+    int64_t begin = std::min(bytes, tid * chunk);
+    int64_t end = std::min(bytes, begin + chunk);
+    if(end > begin)
+      std::memcpy(to + begin, from + begin, end - begin);
+  }
+}
+
+/**
+ * @brief fill in the format fields of a header
+ */
+void FASCheckpoint::initHeader(header_t & header)
+{
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, "FASCHKPT", 8);
+  header.version = FAS_CHECKPOINT_VERSION;
+  header.real_bytes = sizeof(real_t);
+  header.idx_bytes = sizeof(idx_t);
+}
+
+/**
+ * @brief write a checkpoint
+ * @details waits for the previous write, copies the grids into the staging
+ *  image and writes it, in a background thread if async
+ *
+ * @param file_name checkpoint file
+ * @param header solver state (see initHeader)
+ * @param grids grids to write; offsets are filled in
+ * @param async return once the grids are copied
+ * @return false if the (synchronous) write failed; always true if async,
+ *  see wait()
+ */
+bool FASCheckpoint::write(const std::string & file_name, header_t header,
+  std::vector<grid_t> & grids, bool async)
+{
+  wait();
+
+  int64_t offset = fas_checkpoint_align(sizeof(header_t)
+    + grids.size() * sizeof(entry_t));
+  for(size_t g = 0; g < grids.size(); g++)
+  {
+    entry_t & e = grids[g].entry;
+    e.offset = offset;
+    offset = fas_checkpoint_align(offset + e.nx * e.ny * e.nz * e.elem_bytes);
+  }
+
+  header.grid_n = grids.size();
+  header.file_bytes = offset;
+
+  // padding between grids is left as is
+  image.resize(offset);
+  std::memcpy(&image[0], &header, sizeof(header_t));
+  for(size_t g = 0; g < grids.size(); g++)
+  {
+    entry_t & e = grids[g].entry;
+    std::memcpy(&image[sizeof(header_t) + g * sizeof(entry_t)], &e, sizeof(entry_t));
+    fas_checkpoint_copy(&image[e.offset], (const char *) grids[g].data,
+      e.nx * e.ny * e.nz * e.elem_bytes);
+  }
+
+  if(!async)
+    return _writeImage(file_name, image);
+
+  writing = true;
+  writer = std::thread([this, file_name]() {
+    write_ok = _writeImage(file_name, image);
+  });
+  return true;
+}
+
+/**
+ * @brief wait for an asynchronous write
+ * @return false if the last write failed
+ */
+bool FASCheckpoint::wait()
+{
+  if(writing)
+  {
+    writer.join();
+    writing = false;
+  }
+  return write_ok;
+}
+
+bool FASCheckpoint::_writeImage(const std::string & file_name,
+  const std::vector<char> & image)
+{
+  std::string tmp_name = file_name + ".tmp";
+  int fd = ::open(tmp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0)
+  {
+    std::cout << "Unable to write checkpoint " << tmp_name << "\n";
+    return false;
+  }
+
+  size_t done = 0;
+  while(done < image.size())
+  {
+    ssize_t n = ::write(fd, &image[done], image.size() - done);
+    if(n <= 0)
+      break;
+    done += n;
+  }
+
+  bool ok = (done == image.size()) && fsync(fd) == 0;
+  ok = (::close(fd) == 0) && ok;
+  ok = ok && std::rename(tmp_name.c_str(), file_name.c_str()) == 0;
+  if(!ok)
+    std::cout << "Unable to write checkpoint " << file_name << "\n";
+  return ok;
+}
+
+/**
+ * @brief map a checkpoint and check its format
+ * @details header() and entry() are valid until close()
+ * @return false if the file can not be read or is not a checkpoint of
+ *  this version and precision
+ */
+bool FASCheckpoint::open(const std::string & file_name)
+{
+  close();
+
+  int fd = ::open(file_name.c_str(), O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(header_t))
+  {
+    std::cout << "Unable to read checkpoint " << file_name << "\n";
+    if(fd >= 0)
+      ::close(fd);
+    return false;
+  }
+
+  map_bytes = st.st_size;
+  map = mmap(NULL, map_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if(map == MAP_FAILED)
+  {
+    map = NULL;
+    std::cout << "Unable to map checkpoint " << file_name << "\n";
+    return false;
+  }
+  madvise(map, map_bytes, MADV_SEQUENTIAL);
+  madvise(map, map_bytes, MADV_WILLNEED);
+
+  const header_t & h = header();
+  if(std::memcmp(h.magic, "FASCHKPT", 8) != 0 || h.version != FAS_CHECKPOINT_VERSION
+    || h.real_bytes != sizeof(real_t) || h.idx_bytes != sizeof(idx_t)
+    || h.file_bytes != (int64_t) map_bytes
+    || sizeof(header_t) + h.grid_n * sizeof(entry_t) > map_bytes)
+  {
+    std::cout << "Checkpoint " << file_name << " has an unsupported format"
+      << " or is truncated\n";
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief copy the grids of an open checkpoint into the solver's grids
+ * @details grids must match the file's table (kind, ids, dimensions and
+ *  element size) in order
+ * @return false on mismatch
+ */
+bool FASCheckpoint::restore(std::vector<grid_t> & grids)
+{
+  if(map == NULL || header().grid_n != (int64_t) grids.size())
+  {
+    std::cout << "Checkpoint does not match the solver's grids\n";
+    return false;
+  }
+
+  for(size_t g = 0; g < grids.size(); g++)
+  {
+    const entry_t & f = entry(g);
+    const entry_t & e = grids[g].entry;
+    int64_t bytes = e.nx * e.ny * e.nz * e.elem_bytes;
+
+    if(f.kind != e.kind || f.var != e.var || f.sub != e.sub
+      || f.depth_idx != e.depth_idx || f.nx != e.nx || f.ny != e.ny
+      || f.nz != e.nz || f.elem_bytes != e.elem_bytes
+      || f.offset + bytes > (int64_t) map_bytes)
+    {
+      std::cout << "Checkpoint does not match the solver's grids\n";
+      return false;
+    }
+  }
+
+  for(size_t g = 0; g < grids.size(); g++)
+  {
+    const entry_t & e = grids[g].entry;
+    fas_checkpoint_copy((char *) grids[g].data,
+      (const char *) map + entry(g).offset, e.nx * e.ny * e.nz * e.elem_bytes);
+  }
+
+  return true;
+}
+
+void FASCheckpoint::close()
+{
+  if(map != NULL)
+    munmap(map, map_bytes);
+  map = NULL;
+  map_bytes = 0;
+}
+
+} // namespace cosmo
@@ -0,0 +1,135 @@
+#ifndef FAS_CHECKPOINT_H
+#define FAS_CHECKPOINT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+
+#include "../../cosmo_types.h"
+
+// bump when the layout of the header, the grid table or the set of grids
+// written by FASMultigrid changes
+#define FAS_CHECKPOINT_VERSION 2
+
+namespace cosmo
+{
+
+/**
+ * @brief binary checkpoint of a multigrid solver
+ * @details File layout: a fixed-size header, a table with one entry per
+ *  grid, and the grids themselves, each starting on a page boundary and
+ *  stored as in memory (native endianness and precision, recorded in the
+ *  header and checked on restart). Restarting maps the file and copies each
+ *  grid straight into the solver's arrays, so it costs about one sequential
+ *  read of the file.
+ *
+ *  write() first copies all grids into a staging image of the file (a
+ *  parallel memory copy) and then, if asynchronous, hands the image to a
+ *  background thread that writes it to file_name.tmp and renames it over
+ *  file_name, so an interrupted write never replaces a good checkpoint.
+ *  The solver may continue to modify its grids as soon as write() returns;
+ *  the staging image costs as much memory as the checkpoint. Only one write
+ *  is in flight at a time: write() and wait() block until the previous one
+ *  is done.
+ */
+class FASCheckpoint
+{
+ public:
+
+  // kinds of grids, see FASMultigrid::_checkpointGrids
+  enum grid_kind_t
+  {
+    grid_u,          // u_h
+    grid_u_aos,      // u_aos_h
+    grid_coarse_src, // coarse_src_h
+    grid_tmp,        // tmp_h
+    grid_damping_v,  // damping_v_h
+    grid_jac_rhs,    // jac_rhs_h
+    grid_rho,        // rho_h
+    grid_smoothing   // FASSmoothingController::budget (nx slots)
+  };
+
+  typedef struct {
+    char magic[8];          ///< "FASCHKPT"
+    int64_t version;        ///< FAS_CHECKPOINT_VERSION
+    int64_t real_bytes;     ///< sizeof(real_t)
+    int64_t idx_bytes;      ///< sizeof(idx_t)
+    int64_t grid_n;         ///< entries in the grid table
+    int64_t file_bytes;     ///< total size of the file
+
+    // solver state
+    int64_t u_n, total_depths, min_depth, layout;
+    int64_t stencil_order, relax_scheme, max_relax_iters, jacobian_block_sweeps;
+    int64_t cycle;          ///< V-cycles completed
+    double relaxation_tolerance;
+    int64_t smoothing_enabled;  ///< adaptive smoothing, see FASSmoothingController
+    double smoothing_min_rate;
+  } header_t;
+
+  typedef struct {
+    int64_t kind, var, sub, depth_idx;  ///< grid_kind_t, variable, molecule (rho), depth index
+    int64_t nx, ny, nz, elem_bytes;
+    int64_t offset;         ///< position of the data in the file
+  } entry_t;
+
+  // grid of the solver to write or restore
+  typedef struct {
+    entry_t entry;  ///< offset is set by write()
+    void * data;
+  } grid_t;
+
+  FASCheckpoint()
+  {
+    writing = false;
+    write_ok = true;
+    map = NULL;
+    map_bytes = 0;
+  }
+
+  ~FASCheckpoint()
+  {
+    wait();
+    close();
+  }
+
+  bool write(const std::string & file_name, header_t header,
+    std::vector<grid_t> & grids, bool async);
+
+  bool wait();
+
+  bool open(const std::string & file_name);
+
+  const header_t & header() const
+  {
+    return *(const header_t *) map;
+  }
+
+  const entry_t & entry(idx_t n) const
+  {
+    return ((const entry_t *) ((const char *) map + sizeof(header_t)))[n];
+  }
+
+  bool restore(std::vector<grid_t> & grids);
+
+  void close();
+
+  static void initHeader(header_t & header);
+
+ private:
+
+  std::vector<char> image;  ///< staging image of the file being written
+  std::thread writer;
+  bool writing;
+  bool write_ok;            ///< result of the last write
+
+  void * map;               ///< mapped checkpoint (open)
+  size_t map_bytes;
+
+  static bool _writeImage(const std::string & file_name,
+    const std::vector<char> & image);
+};
+
+} // namespace cosmo
+
+#endif
@@ -0,0 +1,586 @@
+#include "fas_equations.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
+
+namespace cosmo
+{
+
+// stencils by name; the transposed mixed derivatives are aliases
+static const struct
+{
+  const char * name;
+  idx_t type;
+} fas_stencil_names[] = {
+  {"lap", FASMultigrid::lap},
+  {"d1", FASMultigrid::der1}, {"d2", FASMultigrid::der2},
+  {"d3", FASMultigrid::der3}, {"d11", FASMultigrid::der11},
+  {"d22", FASMultigrid::der22}, {"d33", FASMultigrid::der33},
+  {"d12", FASMultigrid::der12}, {"d13", FASMultigrid::der13},
+  {"d23", FASMultigrid::der23}, {"d21", FASMultigrid::der12},
+  {"d31", FASMultigrid::der13}, {"d32", FASMultigrid::der23}
+};
+
+static const idx_t fas_stencil_name_n
+  = sizeof(fas_stencil_names) / sizeof(fas_stencil_names[0]);
+
+static bool fas_atom_less(const atom & a, const atom & b)
+{
+  if(a.u_id != b.u_id)
+    return a.u_id < b.u_id;
+  if(a.type != b.type)
+    return a.type < b.type;
+  return a.value < b.value;
+}
+
+static bool fas_atom_equal(const atom & a, const atom & b)
+{
+  return a.type == b.type && a.u_id == b.u_id && a.value == b.value;
+}
+
+/**
+ * @brief set up equations of u_n variables
+ */
+FASEquations::FASEquations(idx_t u_n_in)
+{
+  u_n = u_n_in;
+  eqns.resize(u_n);
+  molecule_n.assign(u_n, 0);
+  pos = 0;
+}
+
+/**
+ * @brief parse and simplify an equation
+ * @details replaces an equation set before; throws -1 (with a message)
+ *  on syntax errors, unsupported terms and equations that simplify to 0
+ *
+ * @param eqn_id equation (0 .. u_n - 1)
+ * @param text_in equation, see FASEquations
+ */
+void FASEquations::setEquation(idx_t eqn_id, const std::string & text_in)
+{
+  if(eqn_id < 0 || eqn_id >= u_n)
+  {
+    std::cout << "Equation " << eqn_id << " does not exist (" << u_n
+              << " equations).\n";
+    throw -1;
+  }
+
+  text = text_in;
+  pos = 0;
+
+  sum_t s = _parseSum();
+  if(_accept('='))
+  {
+    sum_t rhs = _parseSum();
+    for(size_t t = 0; t < rhs.size(); t++)
+    {
+      rhs[t].coef = -rhs[t].coef;
+      s.push_back(rhs[t]);
+    }
+    _simplify(s);
+  }
+
+  _skipSpace();
+  if(pos < text.size())
+    _error("unexpected character");
+  if(s.empty())
+    _error("equation is zero");
+
+  eqns[eqn_id] = s;
+  molecule_n[eqn_id] = s.size();
+}
+
+/**
+ * @brief number of molecules of each equation, for the solver constructor
+ * @details the array belongs to this object and must outlive the solver
+ */
+idx_t * FASEquations::moleculeCounts()
+{
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    if(molecule_n[eqn_id] == 0)
+    {
+      std::cout << "Equation " << eqn_id << " was not set.\n";
+      throw -1;
+    }
+
+  return &molecule_n[0];
+}
+
+/**
+ * @brief add the molecules to a solver built with moleculeCounts()
+ * @details sources are set afterwards with setSrcAtPt
+ */
+void FASEquations::apply(FASMultigrid & mg)
+{
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+    {
+      term_t & term = eqns[eqn_id][mol_id];
+      mg.eqns[eqn_id][mol_id].init(term.atoms.size(), term.coef);
+      for(size_t a = 0; a < term.atoms.size(); a++)
+        mg.add_atom_to_eqn(term.atoms[a], mol_id, eqn_id);
+    }
+}
+
+/**
+ * @brief molecules of an equation multiplied by a source
+ * @details for setting the source directly, e.g. with
+ *  FASRefinement::setPolySrcAtPt
+ */
+std::vector<idx_t> FASEquations::sourceMolecules(idx_t eqn_id,
+  const std::string & src)
+{
+  std::vector<idx_t> mols;
+  for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+    if(eqns[eqn_id][mol_id].src == src)
+      mols.push_back(mol_id);
+  return mols;
+}
+
+/**
+ * @brief set a source of an equation at a fine grid point
+ * @details sets the rho of every molecule the source multiplies; throws -1
+ *  if the equation has no such source
+ */
+void FASEquations::setSrcAtPt(FASMultigrid & mg, idx_t eqn_id,
+  const std::string & src, idx_t i, idx_t j, idx_t k, real_t value)
+{
+  std::vector<idx_t> mols = sourceMolecules(eqn_id, src);
+  if(mols.empty())
+  {
+    std::cout << "Equation " << eqn_id << " has no source " << src << ".\n";
+    throw -1;
+  }
+
+  for(size_t m = 0; m < mols.size(); m++)
+    mg.setPolySrcAtPt(eqn_id, mols[m], i, j, k, value);
+}
+
+/**
+ * @brief simplified equation, in the syntax accepted by setEquation
+ */
+std::string FASEquations::toString(idx_t eqn_id)
+{
+  std::ostringstream out;
+  out.precision(15);
+
+  for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+  {
+    term_t & term = eqns[eqn_id][mol_id];
+    real_t coef = term.coef;
+    if(coef < 0.0)
+    {
+      out << (mol_id > 0 ? " - " : "-");
+      coef = -coef;
+    }
+    else if(mol_id > 0)
+      out << " + ";
+
+    bool first = true;
+    if(coef != 1.0 || (term.src.empty() && term.atoms.empty()))
+    {
+      out << coef;
+      first = false;
+    }
+    if(!term.src.empty())
+    {
+      out << (first ? "" : "*") << term.src;
+      first = false;
+    }
+    for(size_t a = 0; a < term.atoms.size(); a++)
+    {
+      const atom & at = term.atoms[a];
+      out << (first ? "" : "*");
+      first = false;
+
+      if(at.type == FASMultigrid::poly)
+      {
+        out << "u" << at.u_id;
+        if(at.value != 1.0)
+          out << "^" << at.value;
+        continue;
+      }
+      for(idx_t s = 0; s < fas_stencil_name_n; s++)
+        if(fas_stencil_names[s].type == at.type)
+        {
+          out << fas_stencil_names[s].name << "(u" << at.u_id << ")";
+          break;
+        }
+    }
+  }
+  return out.str();
+}
+
+void FASEquations::_skipSpace()
+{
+  while(pos < text.size() && std::isspace((unsigned char) text[pos]))
+    pos++;
+}
+
+/**
+ * @brief consume character c if it is next
+ */
+bool FASEquations::_accept(char c)
+{
+  _skipSpace();
+  if(pos < text.size() && text[pos] == c)
+  {
+    pos++;
+    return true;
+  }
+  return false;
+}
+
+void FASEquations::_error(const std::string & msg)
+{
+  std::cout << "Error in equation \"" << text << "\" at position " << pos
+            << ": " << msg << ".\n";
+  throw -1;
+}
+
+/**
+ * @brief [+-] product {(+|-) product}
+ */
+FASEquations::sum_t FASEquations::_parseSum()
+{
+  sum_t s;
+  bool first = true;
+
+  for(;;)
+  {
+    real_t sign = 1.0;
+    if(_accept('-'))
+      sign = -1.0;
+    else if(!_accept('+') && !first)
+      break;
+    first = false;
+
+    sum_t p = _parseProduct();
+    for(size_t t = 0; t < p.size(); t++)
+    {
+      p[t].coef *= sign;
+      s.push_back(p[t]);
+    }
+  }
+
+  _simplify(s);
+  return s;
+}
+
+/**
+ * @brief power {(*|/) power}, dividing by numbers only
+ */
+FASEquations::sum_t FASEquations::_parseProduct()
+{
+  sum_t s = _parsePower();
+
+  for(;;)
+  {
+    if(_accept('*'))
+      s = _multiply(s, _parsePower());
+    else if(_accept('/'))
+    {
+      real_t value = 0.0;
+      if(!_isNumber(_parsePower(), value))
+        _error("can only divide by numbers");
+      if(value == 0.0)
+        _error("division by zero");
+      for(size_t t = 0; t < s.size(); t++)
+        s[t].coef /= value;
+    }
+    else
+      return s;
+  }
+}
+
+/**
+ * @brief primary [^ exponent]
+ */
+FASEquations::sum_t FASEquations::_parsePower()
+{
+  sum_t base = _parsePrimary();
+  if(!_accept('^'))
+    return base;
+  return _power(base, _parseExponent());
+}
+
+/**
+ * @brief number, variable, source, stencil(variable) or (sum)
+ */
+FASEquations::sum_t FASEquations::_parsePrimary()
+{
+  _skipSpace();
+  sum_t s;
+  term_t term;
+  term.coef = 1.0;
+
+  if(_accept('('))
+  {
+    s = _parseSum();
+    if(!_accept(')'))
+      _error("expected )");
+    return s;
+  }
+
+  if(pos < text.size()
+    && (std::isdigit((unsigned char) text[pos]) || text[pos] == '.'))
+  {
+    const char * start = text.c_str() + pos;
+    char * end;
+    term.coef = std::strtod(start, &end);
+    pos += end - start;
+    if(term.coef != 0.0)
+      s.push_back(term);
+    return s;
+  }
+
+  size_t name_start = pos;
+  while(pos < text.size() && (std::isalnum((unsigned char) text[pos])
+    || text[pos] == '_'))
+    pos++;
+  std::string name = text.substr(name_start, pos - name_start);
+  if(name.empty() || std::isdigit((unsigned char) name[0]))
+  {
+    pos = name_start;
+    _error("expected a number, variable, source or stencil");
+  }
+
+  // variable u<id>
+  if(name.size() > 1 && name[0] == 'u'
+    && name.find_first_not_of("0123456789", 1) == std::string::npos)
+  {
+    atom a = {FASMultigrid::poly, std::atol(name.c_str() + 1), 1.0};
+    if(a.u_id >= u_n)
+    {
+      pos = name_start;
+      _error("unknown variable " + name);
+    }
+    term.atoms.push_back(a);
+    s.push_back(term);
+    return s;
+  }
+
+  if(!_accept('('))
+  {
+    term.src = name;
+    s.push_back(term);
+    return s;
+  }
+
+  // stencil(u<id>)
+  idx_t type = 0;
+  for(idx_t n = 0; n < fas_stencil_name_n; n++)
+    if(name == fas_stencil_names[n].name)
+      type = fas_stencil_names[n].type;
+  if(type == 0)
+  {
+    pos = name_start;
+    _error("unknown stencil " + name);
+  }
+
+  sum_t arg = _parseSum();
+  if(arg.size() != 1 || arg[0].coef != 1.0 || !arg[0].src.empty()
+    || arg[0].atoms.size() != 1 || arg[0].atoms[0].value != 1.0)
+    _error("stencils apply to a single variable");
+  if(!_accept(')'))
+    _error("expected )");
+
+  atom a = {type, arg[0].atoms[0].u_id, 0.0};
+  term.atoms.push_back(a);
+  s.push_back(term);
+  return s;
+}
+
+/**
+ * @brief [+-] number, or a parenthesized sum that folds to a number
+ */
+real_t FASEquations::_parseExponent()
+{
+  real_t value = 0.0;
+  _skipSpace();
+  if(_accept('('))
+  {
+    if(!_isNumber(_parseSum(), value))
+      _error("exponents must be numbers");
+    if(!_accept(')'))
+      _error("expected )");
+    return value;
+  }
+
+  real_t sign = 1.0;
+  if(_accept('-'))
+    sign = -1.0;
+  else
+    _accept('+');
+
+  _skipSpace();
+  if(!_isNumber(_parsePrimary(), value))
+    _error("exponents must be numbers");
+  return sign * value;
+}
+
+/**
+ * @brief distribute the product of two sums
+ */
+FASEquations::sum_t FASEquations::_multiply(const sum_t & a, const sum_t & b)
+{
+  sum_t s;
+  for(size_t ta = 0; ta < a.size(); ta++)
+    for(size_t tb = 0; tb < b.size(); tb++)
+    {
+      term_t term = a[ta];
+      term.coef *= b[tb].coef;
+      if(!b[tb].src.empty())
+      {
+        if(!term.src.empty())
+          _error("terms can only have one source");
+        term.src = b[tb].src;
+      }
+      term.atoms.insert(term.atoms.end(), b[tb].atoms.begin(),
+        b[tb].atoms.end());
+      _canonicalize(term);
+      s.push_back(term);
+    }
+
+  _simplify(s);
+  return s;
+}
+
+/**
+ * @brief base^p: numbers and single terms of variables to any power,
+ *  other sums to non-negative integer powers
+ */
+FASEquations::sum_t FASEquations::_power(const sum_t & base, real_t p)
+{
+  real_t value;
+  sum_t s;
+
+  if(_isNumber(base, value))
+  {
+    if(value == 0.0 && p <= 0.0)
+      _error("division by zero");
+    if(value < 0.0 && p != std::floor(p))
+      _error("non-integer power of a negative number");
+    term_t term;
+    term.coef = std::pow(value, p);
+    if(value != 0.0)
+      s.push_back(term);
+    return s;
+  }
+
+  bool polys = base.size() == 1 && base[0].src.empty()
+    && (base[0].coef > 0.0 || p == std::floor(p));
+  for(size_t a = 0; polys && a < base[0].atoms.size(); a++)
+    polys = base[0].atoms[a].type == FASMultigrid::poly;
+  if(polys)
+  {
+    s = base;
+    s[0].coef = std::pow(s[0].coef, p);
+    for(size_t a = 0; a < s[0].atoms.size(); a++)
+      s[0].atoms[a].value *= p;
+    _canonicalize(s[0]);
+    return s;
+  }
+
+  if(p < 0.0 || p != std::floor(p))
+    _error("only numbers and variables can have negative or fractional "
+      "powers");
+
+  term_t one;
+  one.coef = 1.0;
+  s.push_back(one);
+  for(idx_t n = 0; n < (idx_t) p; n++)
+    s = _multiply(s, base);
+  return s;
+}
+
+/**
+ * @brief a sum is a number (0 if empty)
+ */
+bool FASEquations::_isNumber(const sum_t & s, real_t & value)
+{
+  if(s.empty())
+  {
+    value = 0.0;
+    return true;
+  }
+  if(s.size() == 1 && s[0].src.empty() && s[0].atoms.empty())
+  {
+    value = s[0].coef;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief sort the atoms of a term and merge powers of the same variable
+ */
+void FASEquations::_canonicalize(term_t & term)
+{
+  std::vector<atom> & atoms = term.atoms;
+  std::sort(atoms.begin(), atoms.end(), fas_atom_less);
+
+  // polynomials of a variable are adjacent (poly is the lowest type)
+  std::vector<atom> merged;
+  for(size_t a = 0; a < atoms.size(); a++)
+  {
+    if(atoms[a].type == FASMultigrid::poly && !merged.empty()
+      && merged.back().type == FASMultigrid::poly
+      && merged.back().u_id == atoms[a].u_id)
+      merged.back().value += atoms[a].value;
+    else
+      merged.push_back(atoms[a]);
+
+    if(merged.back().type == FASMultigrid::poly && merged.back().value == 0.0)
+      merged.pop_back();
+  }
+
+  // merging changes the order only if the powers of a variable were split
+  std::sort(merged.begin(), merged.end(), fas_atom_less);
+  atoms = merged;
+}
+
+/**
+ * @brief add like terms (same source and atoms) and drop cancelled ones
+ * @details terms keep the order of their first appearance; a sum is
+ *  cancelled if it is below 64 epsilon times its largest addend
+ */
+void FASEquations::_simplify(sum_t & s)
+{
+  sum_t merged;
+  std::vector<real_t> scale;
+
+  for(size_t t = 0; t < s.size(); t++)
+  {
+    size_t m = 0;
+    for(; m < merged.size(); m++)
+      if(merged[m].src == s[t].src
+        && merged[m].atoms.size() == s[t].atoms.size()
+        && std::equal(merged[m].atoms.begin(), merged[m].atoms.end(),
+          s[t].atoms.begin(), fas_atom_equal))
+        break;
+
+    if(m == merged.size())
+    {
+      merged.push_back(s[t]);
+      scale.push_back(std::fabs(s[t].coef));
+    }
+    else
+    {
+      merged[m].coef += s[t].coef;
+      scale[m] = std::max(scale[m], std::fabs(s[t].coef));
+    }
+  }
+
+  s.clear();
+  for(size_t m = 0; m < merged.size(); m++)
+    if(std::fabs(merged[m].coef)
+      > 64.0 * std::numeric_limits<real_t>::epsilon() * scale[m])
+      s.push_back(merged[m]);
+}
+
+} // namespace cosmo
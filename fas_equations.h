@@ -0,0 +1,108 @@
+#ifndef FAS_EQUATIONS_H
+#define FAS_EQUATIONS_H
+
+#include <string>
+#include <vector>
+
+#include "full_multigrid.h"
+
+namespace cosmo
+{
+
+/**
+ * @brief equations of a solver written as text
+ * @details Each equation F(u) = 0 is a sum of products of numbers, sources,
+ *  variables and stencils of variables:
+ *
+ *    lap(u0) + 2*rho0*u0^5 - u1*d1(u0)
+ *
+ *  Variables are u0 .. u(u_n - 1), stencils are lap, d1, d2, d3 (first
+ *  derivatives), d11, d22, d33, d12, d13 and d23 (second derivatives; d21,
+ *  d31 and d32 are the same) applied to a variable, and any other name is a
+ *  source, i.e. a field set point by point (setSrcAtPt). Terms are combined
+ *  with +, -, *, / (by numbers), ^ (numeric powers of variables, numbers and
+ *  sums; sums only to non-negative integer powers) and parentheses, and
+ *  "lhs = rhs" stands for lhs - rhs = 0.
+ *
+ *  The text is expanded into molecules and simplified before the solver
+ *  sees it: products of sums are distributed, numbers are folded into the
+ *  coefficients, powers of a variable within a term are merged (u0*u0^2 is
+ *  u0^3, u0*u0^-1 disappears), like terms (same source and atoms) are added
+ *  and cancelled terms dropped, and the atoms of every molecule are sorted
+ *  by variable and type, so molecules sharing factors list them in the same
+ *  order for the operator cache. A molecule carries at most one source, and
+ *  every molecule of a source has its own rho grid in the solver.
+ *
+ *  Usage: setEquation for every equation, then construct the solver with
+ *  moleculeCounts() (which must stay valid as long as the solver) and call
+ *  apply.
+ */
+class FASEquations
+{
+ public:
+
+  // simplified molecule: coef * src * (product of atoms)
+  typedef struct
+  {
+    real_t coef;              ///< constant coefficient
+    std::string src;          ///< source multiplying the molecule ("": none)
+    std::vector<atom> atoms;  ///< sorted by u_id, type and value
+  } term_t;
+
+  FASEquations(idx_t u_n_in);
+
+  void setEquation(idx_t eqn_id, const std::string & text);
+
+  idx_t * moleculeCounts();
+
+  void apply(FASMultigrid & mg);
+
+  std::vector<idx_t> sourceMolecules(idx_t eqn_id, const std::string & src);
+
+  void setSrcAtPt(FASMultigrid & mg, idx_t eqn_id, const std::string & src,
+    idx_t i, idx_t j, idx_t k, real_t value);
+
+  std::string toString(idx_t eqn_id);
+
+  /**
+   * @brief simplified molecules of an equation, in solver order
+   */
+  inline const std::vector<term_t> & terms(idx_t eqn_id)
+  {
+    return eqns[eqn_id];
+  }
+
+ private:
+
+  // sum of terms, the value of every parsed (sub)expression
+  typedef std::vector<term_t> sum_t;
+
+  idx_t u_n;
+  std::vector<sum_t> eqns;
+  std::vector<idx_t> molecule_n;
+
+  // parser state
+  std::string text;
+  size_t pos;
+
+  void _skipSpace();
+  bool _accept(char c);
+  void _error(const std::string & msg);
+
+  sum_t _parseSum();
+  sum_t _parseProduct();
+  sum_t _parsePower();
+  sum_t _parsePrimary();
+  real_t _parseExponent();
+
+  sum_t _multiply(const sum_t & a, const sum_t & b);
+  sum_t _power(const sum_t & base, real_t p);
+  bool _isNumber(const sum_t & s, real_t & value);
+
+  void _canonicalize(term_t & term);
+  void _simplify(sum_t & s);
+};
+
+} // namespace cosmo
+
+#endif
@@ -0,0 +1,219 @@
+#include "fas_field_output.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace cosmo
+{
+
+// alignment of buffers, offsets and write sizes (O_DIRECT)
+#define FAS_FIELD_ALIGN 4096
+
+static int64_t fas_field_align(int64_t bytes)
+{
+  return (bytes + FAS_FIELD_ALIGN - 1) / FAS_FIELD_ALIGN * FAS_FIELD_ALIGN;
+}
+
+static char * fas_field_alloc(int64_t bytes)
+{
+  void * p = NULL;
+  if(posix_memalign(&p, FAS_FIELD_ALIGN, bytes) != 0)
+  {
+    std::cout << "Unable to allocate " << bytes << " bytes for field output\n";
+    throw -1;
+  }
+  return (char *) p;
+}
+
+/**
+ * @brief create the output file and start the writer thread
+ *
+ * @param file_name output file
+ * @param max_fields_in fields reserved in the table
+ * @param direct open with O_DIRECT; falls back to buffered I/O if the file
+ *  system does not support it
+ * @return false if the file could not be created
+ */
+bool FASFieldWriter::open(const std::string & file_name_in,
+  idx_t max_fields_in, bool direct)
+{
+  close();
+
+  file_name = file_name_in;
+  max_fields = max_fields_in;
+  header_bytes = fas_field_align(sizeof(header_t) + max_fields * sizeof(entry_t));
+  end_offset = header_bytes;
+  entries.clear();
+  write_ok = true;
+  stopping = false;
+
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_DIRECT
+  if(direct)
+  {
+    fd = ::open(file_name.c_str(), flags | O_DIRECT, 0644);
+    if(fd < 0)
+      std::cout << "O_DIRECT not supported for " << file_name
+        << ", using buffered writes\n";
+  }
+#else
+  (void) direct;
+#endif
+  if(fd < 0)
+    fd = ::open(file_name.c_str(), flags, 0644);
+  if(fd < 0)
+  {
+    std::cout << "Unable to write fields to " << file_name << "\n";
+    return false;
+  }
+
+  writer = std::thread(&FASFieldWriter::_writerLoop, this);
+  return true;
+}
+
+/**
+ * @brief staging buffer of the next field
+ * @details fill with nx * ny * nz values in H_INDEX order, then call
+ *  commitField(); waits while max_buffer_bytes are queued
+ *
+ * @return buffer, NULL if the file is not open or the table is full
+ */
+real_t * FASFieldWriter::beginField(const std::string & name, idx_t depth,
+  idx_t nx, idx_t ny, idx_t nz)
+{
+  if(fd < 0 || pending != NULL || (idx_t) entries.size() >= max_fields)
+  {
+    std::cout << "Unable to add field " << name << " to " << file_name << "\n";
+    return NULL;
+  }
+
+  entry_t e;
+  std::memset(&e, 0, sizeof(e));
+  std::strncpy(e.name, name.c_str(), sizeof(e.name) - 1);
+  e.depth = depth;
+  e.nx = nx;
+  e.ny = ny;
+  e.nz = nz;
+  e.elem_bytes = sizeof(real_t);
+  e.offset = end_offset;
+  entries.push_back(e);
+
+  pending_bytes = fas_field_align(nx * ny * nz * e.elem_bytes);
+  end_offset += pending_bytes;
+
+  if(max_buffer_bytes > 0)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [this]() {
+      return queued_bytes == 0 || queued_bytes + pending_bytes <= max_buffer_bytes;
+    });
+  }
+
+  pending = fas_field_alloc(pending_bytes);
+  // padding is written too, keep it deterministic
+  std::memset(pending + nx * ny * nz * e.elem_bytes, 0,
+    pending_bytes - nx * ny * nz * e.elem_bytes);
+  return (real_t *) pending;
+}
+
+/**
+ * @brief queue the field from beginField() for writing
+ */
+void FASFieldWriter::commitField()
+{
+  if(pending == NULL)
+    return;
+
+  job_t job = {pending, pending_bytes, entries.back().offset};
+  pending = NULL;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  queue.push_back(job);
+  queued_bytes += job.bytes;
+  queue_cv.notify_one();
+}
+
+void FASFieldWriter::_writerLoop()
+{
+  for(;;)
+  {
+    job_t job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      queue_cv.wait(lock, [this]() { return stopping || !queue.empty(); });
+      if(queue.empty())
+        return;
+      job = queue.front();
+      queue.pop_front();
+    }
+
+    bool ok = true;
+    for(int64_t done = 0; done < job.bytes && ok; )
+    {
+      int64_t n = pwrite(fd, job.data + done,
+        std::min(chunk_bytes, job.bytes - done), job.offset + done);
+      ok = n > 0;
+      done += n;
+    }
+    free(job.data);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    write_ok = write_ok && ok;
+    queued_bytes -= job.bytes;
+    done_cv.notify_all();
+  }
+}
+
+/**
+ * @brief wait for all queued fields, write the header and close the file
+ * @return false if any write failed
+ */
+bool FASFieldWriter::close()
+{
+  if(fd < 0)
+    return true;
+
+  if(pending != NULL)
+  {
+    free(pending);
+    pending = NULL;
+    entries.pop_back();
+    end_offset -= pending_bytes;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    queue_cv.notify_one();
+  }
+  writer.join();
+
+  // header and table, in an aligned block
+  char * block = fas_field_alloc(header_bytes);
+  std::memset(block, 0, header_bytes);
+  header_t * header = (header_t *) block;
+  std::memcpy(header->magic, "FASFIELD", 8);
+  header->version = FAS_FIELD_OUTPUT_VERSION;
+  header->real_bytes = sizeof(real_t);
+  header->header_bytes = header_bytes;
+  header->field_n = entries.size();
+  header->file_bytes = end_offset;
+  if(!entries.empty())
+    std::memcpy(block + sizeof(header_t), &entries[0],
+      entries.size() * sizeof(entry_t));
+
+  bool ok = write_ok && pwrite(fd, block, header_bytes, 0) == header_bytes;
+  free(block);
+  ok = (::close(fd) == 0) && ok;
+  fd = -1;
+
+  if(!ok)
+    std::cout << "Unable to write fields to " << file_name << "\n";
+  return ok;
+}
+
+} // namespace cosmo
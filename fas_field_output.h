@@ -0,0 +1,126 @@
+#ifndef FAS_FIELD_OUTPUT_H
+#define FAS_FIELD_OUTPUT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "../../cosmo_types.h"
+
+#define FAS_FIELD_OUTPUT_VERSION 1
+
+namespace cosmo
+{
+
+/**
+ * @brief streaming writer of 3D fields to a self-describing binary file
+ * @details File layout: a header and a table with one entry per field
+ *  (name, depth, dimensions, element size, offset) in a reserved block at
+ *  the start of the file, then each field as a raw C-ordered (i slowest,
+ *  k fastest) array of real_t starting on a 4096 byte boundary. Each field is
+ *  contiguous, so it can be read with a plain seek, mapped (e.g.
+ *  numpy.memmap(file, dtype, 'r', offset, (nx, ny, nz))) or described as an
+ *  HDF5 external dataset.
+ *
+ *  beginField() returns a page-aligned staging buffer for a field; after it
+ *  is filled, commitField() queues it for a background thread that writes it
+ *  in chunk_bytes pieces with pwrite, so filling the next field (or the next
+ *  solve) overlaps with the disk writes. Buffers are freed once written;
+ *  beginField() waits while more than max_buffer_bytes are queued (0 = no
+ *  limit). With direct, the file is opened with O_DIRECT (where supported),
+ *  bypassing the page cache; buffers, offsets and write sizes are aligned
+ *  for it. close() waits for all writes and writes the header.
+ */
+class FASFieldWriter
+{
+ public:
+
+  typedef struct {
+    char magic[8];          ///< "FASFIELD"
+    int64_t version;        ///< FAS_FIELD_OUTPUT_VERSION
+    int64_t real_bytes;     ///< sizeof(real_t)
+    int64_t header_bytes;   ///< size of the reserved block (header and table)
+    int64_t field_n;        ///< entries in the table
+    int64_t file_bytes;     ///< total size of the file
+  } header_t;
+
+  typedef struct {
+    char name[32];
+    int64_t depth;          ///< multigrid depth, -1 if not applicable
+    int64_t nx, ny, nz, elem_bytes;
+    int64_t offset;         ///< position of the field in the file
+  } entry_t;
+
+  int64_t chunk_bytes;      ///< bytes per write call
+  int64_t max_buffer_bytes; ///< limit of queued bytes, 0 = no limit
+
+  FASFieldWriter()
+  {
+    chunk_bytes = 16 << 20;
+    max_buffer_bytes = 0;
+    fd = -1;
+    max_fields = 0;
+    header_bytes = 0;
+    end_offset = 0;
+    queued_bytes = 0;
+    write_ok = true;
+    stopping = false;
+    pending = NULL;
+    pending_bytes = 0;
+  }
+
+  ~FASFieldWriter()
+  {
+    close();
+  }
+
+  bool open(const std::string & file_name, idx_t max_fields_in = 64,
+    bool direct = false);
+
+  real_t * beginField(const std::string & name, idx_t depth, idx_t nx,
+    idx_t ny, idx_t nz);
+
+  void commitField();
+
+  bool close();
+
+  inline bool isOpen()
+  {
+    return fd >= 0;
+  }
+
+ private:
+
+  typedef struct {
+    char * data;
+    int64_t bytes;   ///< padded to the alignment
+    int64_t offset;
+  } job_t;
+
+  int fd;
+  std::string file_name;
+  idx_t max_fields;
+  int64_t header_bytes, end_offset;
+  std::vector<entry_t> entries;
+
+  std::thread writer;
+  std::mutex mutex;
+  std::condition_variable queue_cv, done_cv;
+  std::deque<job_t> queue;
+  int64_t queued_bytes;   ///< bytes queued or being written
+  bool write_ok;
+  bool stopping;
+
+  char * pending;         ///< buffer returned by beginField
+  int64_t pending_bytes;
+
+  void _writerLoop();
+};
+
+} // namespace cosmo
+
+#endif
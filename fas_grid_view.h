@@ -0,0 +1,117 @@
+#ifndef FAS_GRID_VIEW_H
+#define FAS_GRID_VIEW_H
+
+#include "../../cosmo_types.h"
+
+namespace cosmo
+{
+
+/**
+ * @brief strided view of a grid
+ * @details Indexed like arr_t, but element idx lives at data[idx * stride].
+ *  Used to address a single variable in storage where several variables of
+ *  a point are interleaved (stride = number of variables); a view of an
+ *  ordinary grid has stride 1.
+ */
+template<typename RT>
+class FASGridView
+{
+ public:
+  RT * data;     ///< first element of this variable
+  idx_t stride;  ///< distance between consecutive points
+  idx_t nx, ny, nz, pts;
+
+  FASGridView(RT * data_in, idx_t stride_in, idx_t nx_in, idx_t ny_in,
+    idx_t nz_in)
+  {
+    data = data_in;
+    stride = stride_in;
+    nx = nx_in;
+    ny = ny_in;
+    nz = nz_in;
+    pts = nx * ny * nz;
+  }
+
+  inline RT & operator[](idx_t idx)
+  {
+    return data[idx * stride];
+  }
+};
+
+/**
+ * @brief view of the slab of a distributed grid held by one process
+ * @details The slab stores consecutive i planes first_plane ...
+ *  first_plane + planes - 1 (owned planes and the halos around them, i
+ *  wrapping periodically); the view is indexed with H_INDEX over the whole
+ *  (global) grid, so the stencils work unchanged. An index outside the
+ *  stored planes is moved by one period, which finds the copy of the plane
+ *  a stencil reaching across the periodic boundary needs.
+ */
+template<typename RT>
+class FASSlabView
+{
+ public:
+  RT * data;     ///< first stored plane
+  idx_t origin;  ///< H_INDEX of the first stored plane
+  idx_t span;    ///< stored points
+  idx_t nx, ny, nz, pts;  ///< dimensions of the whole grid
+
+  FASSlabView(RT * data_in, idx_t first_plane, idx_t planes, idx_t nx_in,
+    idx_t ny_in, idx_t nz_in)
+  {
+    data = data_in;
+    nx = nx_in;
+    ny = ny_in;
+    nz = nz_in;
+    pts = nx * ny * nz;
+    origin = first_plane * ny * nz;
+    span = planes * ny * nz;
+  }
+
+  inline RT & operator[](idx_t idx)
+  {
+    idx_t l = idx - origin;
+    if(l < 0)
+      l += pts;
+    else if(l >= span)
+      l -= pts;
+    return data[l];
+  }
+};
+
+/**
+ * @brief view of a refinement patch
+ * @details Indexed like arr_t, but carries the grid spacing of the patch,
+ *  which is not H_LEN_FRAC over the dimensions of the (non-periodic) patch
+ *  storage; the stencils pick it up through fas_grid_spacing.
+ */
+template<typename RT>
+class FASPatchView
+{
+ public:
+  RT * data;
+  idx_t nx, ny, nz, pts;
+  real_t dx[3];  ///< spacing along x, y and z
+
+  FASPatchView(RT * data_in, idx_t nx_in, idx_t ny_in, idx_t nz_in,
+    const real_t dx_in[3])
+  {
+    data = data_in;
+    nx = nx_in;
+    ny = ny_in;
+    nz = nz_in;
+    pts = nx * ny * nz;
+    dx[0] = dx_in[0];
+    dx[1] = dx_in[1];
+    dx[2] = dx_in[2];
+  }
+
+  inline RT & operator[](idx_t idx)
+  {
+    return data[idx];
+  }
+};
+
+} // namespace cosmo
+
+#endif
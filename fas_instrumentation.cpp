@@ -0,0 +1,241 @@
+#include "fas_instrumentation.h"
+#include <fstream>
+#include <iomanip>
+
+namespace cosmo
+{
+
+/**
+ * @brief set up (empty) statistics for a heirarchy of grids
+ * @param total_depths number of levels
+ * @param min_depth_in depth of the coarsest level
+ * @param nx_in, ny_in, nz_in grid dimensions of each level
+ */
+void FASInstrumentation::init(idx_t total_depths, idx_t min_depth_in,
+  idx_t * nx_in, idx_t * ny_in, idx_t * nz_in)
+{
+  min_depth = min_depth_in;
+  nx.assign(nx_in, nx_in + total_depths);
+  ny.assign(ny_in, ny_in + total_depths);
+  nz.assign(nz_in, nz_in + total_depths);
+  levels.assign(total_depths, std::vector<phase_stats>(phase_n));
+  reset();
+}
+
+/**
+ * @brief zero all timers and counters
+ */
+void FASInstrumentation::reset()
+{
+  for(size_t l = 0; l < levels.size(); l++)
+    for(idx_t p = 0; p < phase_n; p++)
+    {
+      levels[l][p].time = 0.0;
+      levels[l][p].calls = 0;
+      levels[l][p].iters = 0;
+      levels[l][p].points = 0;
+      for(idx_t c = 0; c < FASPerfCounters::hw_n; c++)
+        levels[l][p].hw[c] = 0;
+    }
+
+  cycle_residuals.clear();
+  cycle_times.clear();
+  jacobi_failures = 0;
+}
+
+const char * FASInstrumentation::phaseName(idx_t phase)
+{
+  switch(phase)
+  {
+    case phase_smooth:      return "smooth";
+    case phase_jacobi:      return "jacobi";
+    case phase_line_search: return "line_search";
+    case phase_residual:    return "residual";
+    case phase_restrict:    return "restrict";
+    case phase_prolong:     return "prolong";
+    default:                return "unknown";
+  }
+}
+
+/**
+ * @brief measure the STREAM triad bandwidth and open hardware counters
+ * @details called from FASMultigrid's constructor when compiled with
+ *  FAS_PERF_COUNTERS=1; counters are read around every timed phase
+ *
+ * @param stream_n length of the STREAM arrays (3 arrays of doubles)
+ * @param stream_reps STREAM repetitions
+ * @return true if the counters could be opened
+ */
+bool FASInstrumentation::enablePerfCounters(idx_t stream_n, idx_t stream_reps)
+{
+  stream_bandwidth = FASPerfCounters::streamTriad(stream_n, stream_reps);
+  return perf.open();
+}
+
+/**
+ * @brief statistics of a phase summed over all levels
+ */
+FASInstrumentation::phase_stats FASInstrumentation::total(idx_t phase)
+{
+  phase_stats res = {0.0, 0, 0, 0, {0}};
+  for(size_t l = 0; l < levels.size(); l++)
+  {
+    res.time += levels[l][phase].time;
+    res.calls += levels[l][phase].calls;
+    res.iters += levels[l][phase].iters;
+    res.points += levels[l][phase].points;
+    for(idx_t c = 0; c < FASPerfCounters::hw_n; c++)
+      res.hw[c] += levels[l][phase].hw[c];
+  }
+  return res;
+}
+
+/**
+ * @brief print a table of time per level and phase
+ */
+void FASInstrumentation::print(std::ostream & out)
+{
+  std::streamsize precision = out.precision();
+
+  out << std::setw(7) << "depth";
+  for(idx_t p = 0; p < phase_n; p++)
+    out << std::setw(13) << phaseName(p);
+  out << "\n";
+
+  for(size_t l = levels.size(); l-- > 0; )
+  {
+    out << std::setw(7) << min_depth + (idx_t) l;
+    for(idx_t p = 0; p < phase_n; p++)
+      out << std::setw(13) << std::setprecision(4) << levels[l][p].time;
+    out << "\n";
+  }
+
+  out << std::setw(7) << "total";
+  for(idx_t p = 0; p < phase_n; p++)
+    out << std::setw(13) << std::setprecision(4) << total(p).time;
+  out << "\n" << std::flush;
+  out.precision(precision);
+}
+
+/**
+ * @brief print hardware counter derived metrics per level and phase
+ * @details DRAM traffic is estimated as LLC misses * 64 bytes (hardware
+ *  prefetches and write-backs are not included), so bandwidth and
+ *  arithmetic intensity are approximate. A phase running at a large
+ *  fraction of the STREAM bandwidth is memory bound; far below it, it is
+ *  limited by computation or latency.
+ */
+void FASInstrumentation::printRoofline(std::ostream & out)
+{
+  std::streamsize precision = out.precision(3);
+
+  if(!perf.available)
+  {
+    out << "Hardware counters not available.\n" << std::flush;
+    out.precision(precision);
+    return;
+  }
+
+  out << "STREAM triad bandwidth: " << stream_bandwidth / 1e9 << " GB/s\n";
+  out << std::setw(7) << "depth" << std::setw(13) << "phase"
+      << std::setw(11) << "time" << std::setw(8) << "IPC"
+      << std::setw(11) << "GB/s" << std::setw(9) << "%STREAM"
+      << std::setw(11) << "GFlop/s" << std::setw(11) << "Flop/B" << "\n";
+
+  for(size_t l = levels.size(); l-- > 0; )
+    for(idx_t p = 0; p < phase_n; p++)
+    {
+      phase_stats & s = levels[l][p];
+      if(s.calls == 0 || s.time <= 0.0)
+        continue;
+
+      double bytes = 64.0 * s.hw[FASPerfCounters::hw_llc_misses];
+      double flops = (double) FASPerfCounters::flops(s.hw);
+      double bandwidth = bytes / s.time;
+
+      out << std::setw(7) << min_depth + (idx_t) l << std::setw(13) << phaseName(p)
+          << std::setw(11) << s.time
+          << std::setw(8) << (s.hw[FASPerfCounters::hw_cycles] > 0 ?
+            (double) s.hw[FASPerfCounters::hw_instructions] / s.hw[FASPerfCounters::hw_cycles] : 0.0)
+          << std::setw(11) << bandwidth / 1e9
+          << std::setw(9) << (stream_bandwidth > 0 ? 100.0 * bandwidth / stream_bandwidth : 0.0);
+      if(perf.fp_available)
+        out << std::setw(11) << flops / s.time / 1e9
+            << std::setw(11) << (bytes > 0 ? flops / bytes : 0.0);
+      else
+        out << std::setw(11) << "-" << std::setw(11) << "-";
+      out << "\n";
+    }
+
+  out << std::flush;
+  out.precision(precision);
+}
+
+/**
+ * @brief write all statistics as a JSON object
+ */
+void FASInstrumentation::writeJSON(std::ostream & out)
+{
+  std::streamsize precision = out.precision(9);
+
+  out << "{\n  \"levels\": [\n";
+  for(size_t l = 0; l < levels.size(); l++)
+  {
+    out << "    {\"depth\": " << min_depth + (idx_t) l
+        << ", \"nx\": " << nx[l] << ", \"ny\": " << ny[l]
+        << ", \"nz\": " << nz[l] << ", \"phases\": {";
+    for(idx_t p = 0; p < phase_n; p++)
+    {
+      phase_stats & s = levels[l][p];
+      out << (p ? ", " : "") << "\"" << phaseName(p) << "\": {"
+          << "\"time\": " << s.time << ", \"calls\": " << s.calls
+          << ", \"iters\": " << s.iters << ", \"points\": " << s.points;
+      if(perf.available)
+      {
+        double bytes = 64.0 * s.hw[FASPerfCounters::hw_llc_misses];
+        out << ", \"hw\": {";
+        for(idx_t c = 0; c < FASPerfCounters::hw_n; c++)
+          out << (c ? ", " : "") << "\"" << FASPerfCounters::counterName(c)
+              << "\": " << s.hw[c];
+        out << ", \"dram_bytes\": " << bytes
+            << ", \"bandwidth\": " << (s.time > 0 ? bytes / s.time : 0.0);
+        if(perf.fp_available)
+          out << ", \"flops\": " << FASPerfCounters::flops(s.hw)
+              << ", \"intensity\": " << (bytes > 0 ? FASPerfCounters::flops(s.hw) / bytes : 0.0);
+        out << "}";
+      }
+      out << "}";
+    }
+    out << "}}" << (l + 1 < levels.size() ? "," : "") << "\n";
+  }
+  out << "  ],\n";
+
+  out << "  \"cycles\": [";
+  for(size_t c = 0; c < cycle_times.size(); c++)
+  {
+    out << (c ? ", " : "") << "{\"time\": " << cycle_times[c];
+    if(c < cycle_residuals.size())
+      out << ", \"residual\": " << cycle_residuals[c];
+    out << "}";
+  }
+  out << "],\n";
+
+  out << "  \"stream_bandwidth\": " << stream_bandwidth << ",\n";
+  out << "  \"jacobi_failures\": " << jacobi_failures << "\n}\n";
+  out.precision(precision);
+}
+
+/**
+ * @brief write all statistics as JSON to a file
+ * @return false if the file could not be written
+ */
+bool FASInstrumentation::writeJSON(const std::string & file_name)
+{
+  std::ofstream out(file_name.c_str());
+  if(!out)
+    return false;
+  writeJSON(out);
+  return (bool) out;
+}
+
+} // namespace cosmo
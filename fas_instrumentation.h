@@ -0,0 +1,156 @@
+#ifndef FAS_INSTRUMENTATION_H
+#define FAS_INSTRUMENTATION_H
+
+#include <omp.h>
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "../../cosmo_types.h"
+#include "fas_perf_counters.h"
+
+// per-level, per-phase timers and counters in the multigrid solver;
+// set to 0 to compile all of them out
+#ifndef FAS_INSTRUMENTATION
+  #define FAS_INSTRUMENTATION 1
+#endif
+
+namespace cosmo
+{
+
+/**
+ * @brief timers and counters of a multigrid solve
+ * @details Statistics are kept for each depth and phase of the solver.
+ *  Timers are wall clock (omp_get_wtime) and inclusive: a smoothing phase
+ *  contains the Jacobi sweeps, line searches and residual evaluations it
+ *  performs. Phases are only entered from serial code (the parallel loops
+ *  are inside them), so no synchronization is needed.
+ */
+class FASInstrumentation
+{
+ public:
+
+  enum phase_t
+  {
+    phase_smooth,      // _relaxSolution_GaussSeidel
+    phase_jacobi,      // _jacobianRelax
+    phase_line_search, // _getLambda
+    phase_residual,    // residual evaluations
+    phase_restrict,    // _computeCoarseRestrictions (at the coarse depth)
+    phase_prolong,     // _correctFineFromCoarseErr_Err2Appx (at the fine depth)
+    phase_n
+  };
+
+  typedef struct {
+    double time;       ///< accumulated wall time (s)
+    long long calls;   ///< number of times the phase was entered
+    long long iters;   ///< inner iterations (Newton steps, sweeps, line search trials)
+    long long points;  ///< grid point updates / evaluations (summed over equations)
+    long long hw[FASPerfCounters::hw_n]; ///< hardware counts (FAS_PERF_COUNTERS)
+  } phase_stats;
+
+  idx_t min_depth;  ///< depth of level 0
+  std::vector<idx_t> nx, ny, nz;  ///< grid dimensions of each level
+  std::vector< std::vector<phase_stats> > levels;  ///< statistics [depth_idx][phase]
+
+  bool record_residuals;                ///< fill cycle_residuals (an extra residual sweep per V-cycle)
+  std::vector<real_t> cycle_residuals;  ///< max. fine grid residual after each V-cycle
+  std::vector<double> cycle_times;      ///< wall time of each V-cycle
+  long long jacobi_failures;            ///< Jacobi relaxations that did not converge
+
+  FASPerfCounters perf;     ///< hardware counters, if available
+  real_t stream_bandwidth;  ///< STREAM triad bandwidth (bytes / s), 0 if not measured
+
+  FASInstrumentation()
+  {
+    min_depth = 0;
+    record_residuals = false;
+    jacobi_failures = 0;
+    stream_bandwidth = 0.0;
+  }
+
+  void init(idx_t total_depths, idx_t min_depth_in, idx_t * nx_in,
+    idx_t * ny_in, idx_t * nz_in);
+
+  void reset();
+
+  bool enablePerfCounters(idx_t stream_n = 1 << 23, idx_t stream_reps = 5);
+
+  static const char * phaseName(idx_t phase);
+
+  inline phase_stats & at(idx_t depth_idx, idx_t phase)
+  {
+    return levels[depth_idx][phase];
+  }
+
+  phase_stats total(idx_t phase);
+
+  void print(std::ostream & out);
+
+  void printRoofline(std::ostream & out);
+
+  void writeJSON(std::ostream & out);
+
+  bool writeJSON(const std::string & file_name);
+};
+
+/**
+ * @brief times a phase from construction to the end of the enclosing scope
+ */
+class FASScopedTimer
+{
+  FASInstrumentation::phase_stats & stats;
+  double start;
+#if FAS_PERF_COUNTERS
+  FASPerfCounters & perf;
+  long long hw_start[FASPerfCounters::hw_n];
+#endif
+
+ public:
+  FASScopedTimer(FASInstrumentation & instr, idx_t depth_idx, idx_t phase)
+    : stats(instr.at(depth_idx, phase))
+#if FAS_PERF_COUNTERS
+    , perf(instr.perf)
+#endif
+  {
+    stats.calls++;
+#if FAS_PERF_COUNTERS
+    if(perf.available)
+      perf.read(hw_start);
+#endif
+    start = omp_get_wtime();
+  }
+
+  ~FASScopedTimer()
+  {
+    stats.time += omp_get_wtime() - start;
+#if FAS_PERF_COUNTERS
+    if(perf.available)
+    {
+      long long hw_end[FASPerfCounters::hw_n];
+      perf.read(hw_end);
+      for(idx_t c = 0; c < FASPerfCounters::hw_n; c++)
+        stats.hw[c] += hw_end[c] - hw_start[c];
+    }
+#endif
+  }
+};
+
+} // namespace cosmo
+
+#if FAS_INSTRUMENTATION
+  #define FAS_TIME_PHASE(instr, depth_idx, phase) \
+    FASScopedTimer fas_timer_##phase((instr), (depth_idx), FASInstrumentation::phase)
+  #define FAS_COUNT_PHASE(instr, depth_idx, phase, iters_n, points_n) \
+    do {                                                              \
+      FASInstrumentation::phase_stats & fas_stats_ =                  \
+        (instr).at((depth_idx), FASInstrumentation::phase);           \
+      fas_stats_.iters += (iters_n);                                  \
+      fas_stats_.points += (points_n);                                \
+    } while(0)
+#else
+  #define FAS_TIME_PHASE(instr, depth_idx, phase)
+  #define FAS_COUNT_PHASE(instr, depth_idx, phase, iters_n, points_n)
+#endif
+
+#endif
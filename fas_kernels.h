@@ -0,0 +1,229 @@
+#ifndef FAS_KERNELS_H
+#define FAS_KERNELS_H
+
+#include "full_multigrid.h"
+#include "fas_stencils.h"
+
+namespace cosmo
+{
+
+/**
+ * @brief point kernels shared by the solvers
+ * @details Symbolic evaluation of an equation and of its derivatives at a
+ *  point, atom by atom, for any storage of the grids. The kernels read the
+ *  grids through a field set FS providing
+ *  - view_t, the type of its views (indexed with H_INDEX over nx, ny, nz);
+ *  - nx, ny, nz, the dimensions points are indexed with;
+ *  - molecules(eqn_id) and mol(eqn_id, mol_id), the equations;
+ *  - u(u_id), a view of the solution of a variable;
+ *  - coef(eqn_id, mol_id, pos_idx), const_coef of a molecule times its rho
+ *    at a point (if it has one).
+ *  Stencil spacings come from the views (fas_grid_spacing), so a depth of
+ *  FASMultigrid (without the operator cache) and a refinement patch of
+ *  FASRefinement are evaluated by the same code.
+ */
+
+/**
+ * @brief apply the stencil of a (non-polynomial) atom to a field at a point
+ * @details each case is a separate instantiation with directions, offsets
+ *  and coefficients known at compile time
+ */
+template<int ORDER, typename GT>
+inline real_t fas_atom_stencil(idx_t type, idx_t i, idx_t j, idx_t k,
+  GT & field)
+{
+  idx_t nx = field.nx, ny = field.ny, nz = field.nz;
+
+  switch(type)
+  {
+    case FASMultigrid::der1:  return fas_derivative<ORDER, 1>(i, j, k, nx, ny, nz, field);
+    case FASMultigrid::der2:  return fas_derivative<ORDER, 2>(i, j, k, nx, ny, nz, field);
+    case FASMultigrid::der3:  return fas_derivative<ORDER, 3>(i, j, k, nx, ny, nz, field);
+    case FASMultigrid::der11: return fas_double_derivative<ORDER, 1, 1>(i, j, k, nx, ny, nz, field);
+    case FASMultigrid::der22: return fas_double_derivative<ORDER, 2, 2>(i, j, k, nx, ny, nz, field);
+    case FASMultigrid::der33: return fas_double_derivative<ORDER, 3, 3>(i, j, k, nx, ny, nz, field);
+    case FASMultigrid::der12: return fas_double_derivative<ORDER, 1, 2>(i, j, k, nx, ny, nz, field);
+    case FASMultigrid::der13: return fas_double_derivative<ORDER, 1, 3>(i, j, k, nx, ny, nz, field);
+    case FASMultigrid::der23: return fas_double_derivative<ORDER, 2, 3>(i, j, k, nx, ny, nz, field);
+    default:                  return fas_laplacian<ORDER>(i, j, k, nx, ny, nz, field);
+  }
+}
+
+/**
+ * @brief coefficient of the point itself in the stencil of an atom applied
+ *  to a field
+ * @details zero for first and mixed derivatives; spacings are per axis
+ */
+template<int ORDER, typename GT>
+inline real_t fas_atom_diag_coef(idx_t type, GT & field)
+{
+  idx_t nx = field.nx, ny = field.ny, nz = field.nz;
+  real_t dx = fas_grid_spacing<1>(field, nx, ny, nz),
+         dy = fas_grid_spacing<2>(field, nx, ny, nz),
+         dz = fas_grid_spacing<3>(field, nx, ny, nz);
+
+  switch(type)
+  {
+    case FASMultigrid::der11: return FASStencilCoefs<ORDER>::d2(0) / (dx*dx);
+    case FASMultigrid::der22: return FASStencilCoefs<ORDER>::d2(0) / (dy*dy);
+    case FASMultigrid::der33: return FASStencilCoefs<ORDER>::d2(0) / (dz*dz);
+    case FASMultigrid::lap:   return FASStencilCoefs<ORDER>::d2(0)
+                                * (1.0/(dx*dx) + 1.0/(dy*dy) + 1.0/(dz*dz));
+    default:                  return 0.0;
+  }
+}
+
+/**
+ * @brief value of an atom at a point, and u^(p-1) for the derivative of a
+ *  polynomial atom of u_id
+ * @details both come from one power, see fas_pow_pair
+ */
+template<int ORDER, typename GT>
+inline void fas_atom_value(atom & ad, idx_t u_id, idx_t i, idx_t j, idx_t k,
+  idx_t pos_idx, GT & vd, real_t & val, real_t & der_pow)
+{
+  real_t u = vd[pos_idx];
+
+  if(ad.type != FASMultigrid::poly)
+    val = fas_atom_stencil<ORDER>(ad.type, i, j, k, vd);
+  else if(ad.u_id != u_id)
+    val = fas_pow(u, ad.value);
+  else
+    fas_pow_pair(u, ad.value, val, der_pow);
+}
+
+/**
+ * @brief value of an equation at a point
+ */
+template<int ORDER, typename FS>
+inline real_t fas_equation_pt(FS & fields, idx_t eqn_id, idx_t i, idx_t j,
+  idx_t k)
+{
+  real_t res = 0.0;
+  idx_t pos_idx = H_INDEX(i, j, k, fields.nx, fields.ny, fields.nz);
+
+  for(idx_t mol_id = 0; mol_id < fields.molecules(eqn_id); mol_id++)
+  {
+    molecule & mol = fields.mol(eqn_id, mol_id);
+    // value will end up being the value of a particular term in an equation
+    real_t val = fields.coef(eqn_id, mol_id, pos_idx);
+
+    for(idx_t atom_id = 0; atom_id < mol.atom_n; atom_id++)
+    {
+      atom & ad = mol.atoms[atom_id];
+      typename FS::view_t vd = fields.u(ad.u_id);
+
+      if(ad.type == FASMultigrid::poly)
+        val *= fas_pow(vd[pos_idx], ad.value);
+      else
+        val *= fas_atom_stencil<ORDER>(ad.type, i, j, k, vd);
+    }
+    res += val;
+  }
+  return res;
+}
+
+/**
+ * @brief coefficients of the Newton iteration for v at a point
+ * @details v * \partial F(u) / \partial u_id = coef_a + coef_b v(i, j, k):
+ *  the off-diagonal part of the stencils applied to v goes to coef_a, the
+ *  diagonal to coef_b; the product rule is applied atom by atom. Without
+ *  v (jac_vd NULL) only coef_b, the diagonal of the Jacobian, is computed.
+ *
+ * @param jac_vd correction v (NULL: none)
+ */
+template<int ORDER, typename FS, typename VT>
+inline void fas_iteration_pt(FS & fields, idx_t eqn_id, real_t & coef_a,
+  real_t & coef_b, idx_t i, idx_t j, idx_t k, idx_t u_id, VT * jac_vd)
+{
+  idx_t pos_idx = H_INDEX(i, j, k, fields.nx, fields.ny, fields.nz);
+
+  for(idx_t mol_id = 0; mol_id < fields.molecules(eqn_id); mol_id++)
+  {
+    molecule & mol = fields.mol(eqn_id, mol_id);
+    real_t mol_to_a = 0.0, mol_to_b = 0.0;
+    real_t non_der_val = fields.coef(eqn_id, mol_id, pos_idx);
+
+    // non_der_val keeps track of the product of the atoms so far
+    for(idx_t atom_id = 0; atom_id < mol.atom_n; atom_id++)
+    {
+      atom & ad = mol.atoms[atom_id];
+      typename FS::view_t vd = fields.u(ad.u_id);
+      real_t val, der_pow = 0.0;
+      fas_atom_value<ORDER>(ad, u_id, i, j, k, pos_idx, vd, val, der_pow);
+
+      if(u_id == ad.u_id)
+      {
+        if(ad.type == FASMultigrid::poly)
+        {
+          mol_to_b = mol_to_b * val + non_der_val * ad.value * der_pow;
+          mol_to_a *= val;
+        }
+        else
+        {
+          real_t diag = fas_atom_diag_coef<ORDER>(ad.type, vd);
+          if(jac_vd)
+            mol_to_a = mol_to_a * val + non_der_val
+              * (fas_atom_stencil<ORDER>(ad.type, i, j, k, *jac_vd)
+                - diag * (*jac_vd)[pos_idx]);
+          mol_to_b = mol_to_b * val + non_der_val * diag;
+        }
+        non_der_val *= val;
+      }
+      else
+      {
+        non_der_val *= val;
+        mol_to_a *= val;
+        mol_to_b *= val;
+      }
+    }
+    coef_a += mol_to_a;
+    coef_b += mol_to_b;
+  }
+}
+
+/**
+ * @brief value of v * \partial F(u) / \partial u_id at a point
+ * @details product rule applied atom by atom
+ */
+template<int ORDER, typename FS, typename VT>
+inline real_t fas_der_equation_pt(FS & fields, idx_t eqn_id, idx_t i,
+  idx_t j, idx_t k, idx_t u_id, VT & jac_vd)
+{
+  real_t res = 0.0;
+  idx_t pos_idx = H_INDEX(i, j, k, fields.nx, fields.ny, fields.nz);
+
+  for(idx_t mol_id = 0; mol_id < fields.molecules(eqn_id); mol_id++)
+  {
+    molecule & mol = fields.mol(eqn_id, mol_id);
+    real_t non_der_val = fields.coef(eqn_id, mol_id, pos_idx), der_val = 0.0;
+
+    // product rule: der_val accumulates the derivative of the atoms so far
+    for(idx_t atom_id = 0; atom_id < mol.atom_n; atom_id++)
+    {
+      atom & ad = mol.atoms[atom_id];
+      typename FS::view_t vd = fields.u(ad.u_id);
+      real_t val, der_pow = 0.0;
+      fas_atom_value<ORDER>(ad, u_id, i, j, k, pos_idx, vd, val, der_pow);
+
+      if(u_id == ad.u_id)
+      {
+        real_t der_atom = (ad.type == FASMultigrid::poly)
+          ? ad.value * der_pow * jac_vd[pos_idx]
+          : fas_atom_stencil<ORDER>(ad.type, i, j, k, jac_vd);
+
+        der_val = non_der_val * der_atom + der_val * val;
+      }
+      else
+        der_val *= val;
+
+      non_der_val *= val;
+    }
+    res += der_val;
+  }
+  return res;
+}
+
+} // namespace cosmo
+
+#endif
@@ -0,0 +1,1380 @@
+#include "fas_mpi.h"
+#include "../../utils/math.h"
+#include <limits>
+
+namespace cosmo
+{
+
+static MPI_Datatype fas_mpi_real()
+{
+  return sizeof(real_t) == sizeof(float) ? MPI_FLOAT : MPI_DOUBLE;
+}
+
+static idx_t fas_mpi_mod(idx_t a, idx_t n)
+{
+  return (a % n + n) % n;
+}
+
+// floor(a / 2), also for negative a
+static idx_t fas_mpi_floor2(idx_t a)
+{
+  return a >= 0 ? a / 2 : -((1 - a) / 2);
+}
+
+/**
+ * @brief Method to initialize internal variables, allocate memory
+ * @param[in]  communicator of the ranks sharing the domain
+ * @param[in]  fine grid dimensions
+ * @param[in]  number of variables, equals to number of equations
+ * @param[in]  array stores term number for each equation
+ * @param[in]  set how many layers we want
+ * @param[in]  set number of interations for each relaxation
+ * @param[in]  set relaxation jump out precision
+ * @param[in]  finite difference order of the stencils (2, 4, 6 or 8),
+ *  sets the halo width
+ */
+FASMultigridMPI::FASMultigridMPI(MPI_Comm comm_in, idx_t nx, idx_t ny,
+  idx_t nz, idx_t u_n_in, idx_t molecule_n_in [], idx_t max_depth_in,
+  idx_t max_relax_iters_in, real_t relaxation_tolerance_in,
+  idx_t stencil_order_in)
+{
+  comm = comm_in;
+  MPI_Comm_rank(comm, &rank);
+  MPI_Comm_size(comm, &ranks);
+
+  verbosity = 0;
+  cycle = 0;
+  relax_scheme = FASMultigrid::inexact_newton;
+  relax_sweeps = 0;
+  line_search_norm = 0.0;
+
+  max_relax_iters = max_relax_iters_in;
+  max_depth = max_depth_in;
+  min_depth = 1;
+  max_depth_idx = _dIdx(max_depth);
+  min_depth_idx = _dIdx(min_depth);
+  total_depths = max_depth - min_depth + 1;
+  relaxation_tolerance = relaxation_tolerance_in;
+  u_n = u_n_in;
+
+  molecule_n = molecule_n_in;
+
+  if(stencil_order_in != 2 && stencil_order_in != 4 && stencil_order_in != 6
+    && stencil_order_in != 8)
+  {
+    std::cout << "Unsupported stencil order " << stencil_order_in
+      << " (2, 4, 6 or 8 expected)\n";
+    throw -1;
+  }
+  stencil_order = stencil_order_in;
+  halo = stencil_order / 2;
+  op_cache_valid = false;
+  _setEvaluators();
+
+  idx_t coarsening = (idx_t) 1 << (total_depths - 1);
+  if(nx % coarsening != 0 || ny % coarsening != 0 || nz % coarsening != 0)
+  {
+    std::cout << "Grid dimensions must be divisible by " << coarsening
+      << " for " << total_depths << " distributed levels.\n";
+    throw -1;
+  }
+  if(nx / ranks < halo)
+  {
+    std::cout << "Unable to split " << nx << " planes over " << ranks
+      << " ranks with " << halo << " halo planes.\n";
+    throw -1;
+  }
+
+  nx_h = new idx_t[total_depths];
+  ny_h = new idx_t[total_depths];
+  nz_h = new idx_t[total_depths];
+  ranks_h = new idx_t[total_depths];
+  begin_h = new idx_t[total_depths];
+  end_h = new idx_t[total_depths];
+  plane_h = new MPI_Datatype[total_depths];
+
+  // levels too small for all ranks are agglomerated onto the first ones
+  idx_t min_planes = std::max((idx_t) FAS_MPI_MIN_PLANES, halo);
+  for(idx_t depth_idx = max_depth_idx; depth_idx >= min_depth_idx; --depth_idx)
+  {
+    if(depth_idx == max_depth_idx)
+    {
+      nx_h[depth_idx] = nx;
+      ny_h[depth_idx] = ny;
+      nz_h[depth_idx] = nz;
+      ranks_h[depth_idx] = ranks;
+    }
+    else
+    {
+      nx_h[depth_idx] = nx_h[depth_idx+1] / 2;
+      ny_h[depth_idx] = ny_h[depth_idx+1] / 2;
+      nz_h[depth_idx] = nz_h[depth_idx+1] / 2;
+      ranks_h[depth_idx] = std::max((idx_t) 1, std::min(ranks_h[depth_idx+1],
+        nx_h[depth_idx] / min_planes));
+    }
+
+    begin_h[depth_idx] = _planeBegin(depth_idx, rank);
+    end_h[depth_idx] = _planeBegin(depth_idx, rank + 1);
+
+    MPI_Type_contiguous(ny_h[depth_idx] * nz_h[depth_idx], fas_mpi_real(),
+      &plane_h[depth_idx]);
+    MPI_Type_commit(&plane_h[depth_idx]);
+  }
+
+  // slot for each depth index, and one for the fine grid pre-smoothing
+  smoothing.init(total_depths + 1);
+  jac_rhs_mean.assign(u_n, 0.0);
+  damping_v_mean.assign(u_n, 0.0);
+
+  u_h = new fas_heirarchy_t[u_n];
+  coarse_src_h = new fas_heirarchy_t[u_n];
+  damping_v_h = new fas_heirarchy_t[u_n];
+  jac_rhs_h = new fas_heirarchy_t[u_n];
+  tmp_h = new fas_heirarchy_t[u_n];
+  src_cache_h = new fas_heirarchy_t[u_n];
+
+  eqns = new molecule *[u_n];
+
+  rho_h = new fas_heirarchy_set_t[u_n];
+  rho_set = new bool *[u_n];
+
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    u_h[eqn_id] = new fas_grid_t[total_depths];
+    coarse_src_h[eqn_id] = new fas_grid_t[total_depths];
+    damping_v_h[eqn_id] = new fas_grid_t[total_depths];
+    jac_rhs_h[eqn_id] = new fas_grid_t[total_depths];
+    tmp_h[eqn_id] = new fas_grid_t[total_depths];
+    src_cache_h[eqn_id] = NULL;
+
+    for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+    {
+      _initGrid(u_h[eqn_id][depth_idx], depth_idx);
+      _initGrid(coarse_src_h[eqn_id][depth_idx], depth_idx);
+      _initGrid(damping_v_h[eqn_id][depth_idx], depth_idx);
+      _initGrid(jac_rhs_h[eqn_id][depth_idx], depth_idx);
+      _initGrid(tmp_h[eqn_id][depth_idx], depth_idx);
+    }
+
+    eqns[eqn_id] = new molecule[molecule_n[eqn_id]];
+
+    rho_h[eqn_id] = new fas_heirarchy_t[molecule_n[eqn_id]];
+    rho_set[eqn_id] = new bool[molecule_n[eqn_id]];
+    for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+    {
+      rho_h[eqn_id][mol_id] = new fas_grid_t[total_depths];
+      rho_set[eqn_id][mol_id] = false;
+    }
+  }
+}
+
+FASMultigridMPI::~FASMultigridMPI()
+{
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+    {
+      delete [] u_h[eqn_id][depth_idx]._array;
+      delete [] coarse_src_h[eqn_id][depth_idx]._array;
+      delete [] damping_v_h[eqn_id][depth_idx]._array;
+      delete [] jac_rhs_h[eqn_id][depth_idx]._array;
+      delete [] tmp_h[eqn_id][depth_idx]._array;
+      if(src_cache_h[eqn_id])
+        delete [] src_cache_h[eqn_id][depth_idx]._array;
+    }
+    for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+    {
+      if(rho_set[eqn_id][mol_id])
+        for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+          delete [] rho_h[eqn_id][mol_id][depth_idx]._array;
+      delete [] rho_h[eqn_id][mol_id];
+    }
+    delete [] u_h[eqn_id];
+    delete [] coarse_src_h[eqn_id];
+    delete [] damping_v_h[eqn_id];
+    delete [] jac_rhs_h[eqn_id];
+    delete [] tmp_h[eqn_id];
+    delete [] src_cache_h[eqn_id];
+    delete [] rho_h[eqn_id];
+    delete [] rho_set[eqn_id];
+    delete [] eqns[eqn_id];
+  }
+
+  for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+    MPI_Type_free(&plane_h[depth_idx]);
+
+  delete [] u_h;
+  delete [] coarse_src_h;
+  delete [] damping_v_h;
+  delete [] jac_rhs_h;
+  delete [] tmp_h;
+  delete [] src_cache_h;
+  delete [] rho_h;
+  delete [] rho_set;
+  delete [] eqns;
+  delete [] nx_h;
+  delete [] ny_h;
+  delete [] nz_h;
+  delete [] ranks_h;
+  delete [] begin_h;
+  delete [] end_h;
+  delete [] plane_h;
+}
+
+void FASMultigridMPI::add_atom_to_eqn(atom atom_in, idx_t molecule_id, idx_t eqn_id)
+{
+  _dropOperatorCache();
+  eqns[eqn_id][molecule_id].add_atom(atom_in);
+}
+
+/**
+ * @brief point evaluators of one stencil order, using op_cache if valid
+ * @details also sets the diagonal weights of the cache, which depend on
+ *  the order
+ */
+template<int ORDER>
+void FASMultigridMPI::_selectEvaluators()
+{
+  if(op_cache_valid)
+  {
+    eval_pt_fn = &FASMultigridMPI::_evaluateEllipticEquationPtOrd<ORDER, true>;
+    iter_jac_fn = &FASMultigridMPI::_evaluateIterationForJacEquationOrd<ORDER, true>;
+    der_eqn_fn = &FASMultigridMPI::_evaluateDerEllipticEquationOrd<ORDER, true>;
+    op_cache.setDiagonals<ORDER>(nx_h, ny_h, nz_h);
+  }
+  else
+  {
+    eval_pt_fn = &FASMultigridMPI::_evaluateEllipticEquationPtOrd<ORDER, false>;
+    iter_jac_fn = &FASMultigridMPI::_evaluateIterationForJacEquationOrd<ORDER, false>;
+    der_eqn_fn = &FASMultigridMPI::_evaluateDerEllipticEquationOrd<ORDER, false>;
+  }
+}
+
+/**
+ * @brief point evaluators of the stencil order of the solver
+ */
+void FASMultigridMPI::_setEvaluators()
+{
+  switch(stencil_order)
+  {
+    case 2:  _selectEvaluators<2>(); break;
+    case 4:  _selectEvaluators<4>(); break;
+    case 6:  _selectEvaluators<6>(); break;
+    default: _selectEvaluators<8>(); break;
+  }
+}
+
+/**
+ * @brief set up the operator cache (see FASOperatorCache)
+ * @details the sums of the molecules without atoms are stored for the
+ *  planes of this rank at every depth; called by initializeRhoHeirarchy
+ */
+void FASMultigridMPI::_buildOperatorCache()
+{
+#if FAS_OPERATOR_CACHE
+  fas_slab_fields_t fine(*this, max_depth_idx);
+  op_cache.build(fine, u_n, total_depths);
+
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    if(!op_cache[eqn_id].cached_src)
+      continue;
+
+    if(!src_cache_h[eqn_id])
+    {
+      src_cache_h[eqn_id] = new fas_grid_t[total_depths];
+      for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+        _initGrid(src_cache_h[eqn_id][depth_idx], depth_idx);
+    }
+
+    for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+    {
+      idx_t i, j, k;
+      idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+      fas_slab_fields_t fields(*this, depth_idx);
+      fas_slab_t src = _view(src_cache_h[eqn_id][depth_idx], depth_idx);
+
+      #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+      FAS_LOOP3_SLAB(i, j, k, begin_h[depth_idx], end_h[depth_idx], ny, nz)
+      {
+        idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+        real_t val = 0.0;
+        for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+          if(eqns[eqn_id][mol_id].atom_n == 0)
+            val += fields.coef(eqn_id, mol_id, idx);
+        src[idx] = val;
+      }
+    }
+  }
+
+  op_cache_valid = true;
+  _setEvaluators();
+#endif
+}
+
+/**
+ * @brief go back to symbolic evaluation of every molecule
+ */
+void FASMultigridMPI::_dropOperatorCache()
+{
+  if(op_cache_valid)
+  {
+    op_cache_valid = false;
+    _setEvaluators();
+  }
+}
+
+/**
+ * @brief first plane of rank r at a depth
+ * @details planes are split evenly over the ranks_h[depth_idx] first
+ *  ranks; the others hold none (begin = nx)
+ */
+idx_t FASMultigridMPI::_planeBegin(idx_t depth_idx, idx_t r)
+{
+  if(r >= ranks_h[depth_idx])
+    return nx_h[depth_idx];
+  return r * nx_h[depth_idx] / ranks_h[depth_idx];
+}
+
+/**
+ * @brief allocate the local slab of a grid (with halos) and zero it in
+ *  parallel, see FASMultigrid::_initGrid
+ */
+void FASMultigridMPI::_initGrid(fas_grid_t & grid, idx_t depth_idx)
+{
+  idx_t planes = end_h[depth_idx] - begin_h[depth_idx];
+  if(planes > 0)
+    planes += 2 * halo;
+
+  grid.nx = planes;
+  grid.ny = ny_h[depth_idx];
+  grid.nz = nz_h[depth_idx];
+  grid.pts = grid.nx * grid.ny * grid.nz;
+  grid._array = new real_t[grid.pts];
+
+  #pragma omp parallel for schedule(static)
+  for(idx_t p = 0; p < grid.pts; p++)
+    grid[p] = 0.0;
+}
+
+/**
+ * @brief first owned (non-halo) plane of a local slab
+ */
+real_t * FASMultigridMPI::_ownedPlanes(fas_grid_t & grid)
+{
+  if(grid.pts == 0)
+    return grid._array;
+  return grid._array + halo * grid.ny * grid.nz;
+}
+
+/**
+ * @brief evaluating the value of equation at a point (global indexes)
+ * @details with CACHED from the operator cache, see
+ *  FASMultigrid::_evaluateEllipticEquationPtOrd
+ */
+template<int ORDER, bool CACHED>
+real_t FASMultigridMPI::_evaluateEllipticEquationPtOrd(idx_t eqn_id,
+  idx_t depth_idx, idx_t i, idx_t j, idx_t k)
+{
+  fas_slab_fields_t fields(*this, depth_idx);
+  if(CACHED)
+    return fas_cached_equation_pt<ORDER>(fields, op_cache, eqn_id, i, j, k);
+  return fas_equation_pt<ORDER>(fields, eqn_id, i, j, k);
+}
+
+/**
+ * @brief evaluate value of v * \partial F(u) / \partial u, storing
+ *  coefficient a and b for interation, see
+ *  FASMultigrid::_evaluateIterationForJacEquationOrd
+ */
+template<int ORDER, bool CACHED>
+void FASMultigridMPI::_evaluateIterationForJacEquationOrd(idx_t eqn_id,
+  idx_t depth_idx, real_t &coef_a, real_t &coef_b,
+  idx_t i, idx_t j, idx_t k, idx_t u_id)
+{
+  fas_slab_fields_t fields(*this, depth_idx);
+  fas_slab_t jac_vd = _view(damping_v_h[u_id][depth_idx], depth_idx);
+
+  if(CACHED)
+    fas_cached_iteration_pt<ORDER>(fields, op_cache, eqn_id, coef_a, coef_b,
+      i, j, k, u_id, jac_vd);
+  else
+    fas_iteration_pt<ORDER>(fields, eqn_id, coef_a, coef_b, i, j, k, u_id,
+      &jac_vd);
+}
+
+/**
+ * @brief evaluate value of v * \partial F(u) / \partial u
+ */
+template<int ORDER, bool CACHED>
+real_t FASMultigridMPI::_evaluateDerEllipticEquationOrd(idx_t eqn_id,
+  idx_t depth_idx, idx_t i, idx_t j, idx_t k, idx_t u_id)
+{
+  fas_slab_fields_t fields(*this, depth_idx);
+  fas_slab_t jac_vd = _view(damping_v_h[u_id][depth_idx], depth_idx);
+
+  if(CACHED)
+    return fas_cached_der_equation_pt<ORDER>(fields, op_cache, eqn_id, i, j,
+      k, u_id, jac_vd);
+  return fas_der_equation_pt<ORDER>(fields, eqn_id, i, j, k, u_id, jac_vd);
+}
+
+/**
+ * @brief start refreshing the halos of a local slab from the neighbouring
+ *  ranks
+ * @details the first owned planes go to the left neighbour's right halo,
+ *  the last ones to the right neighbour's left halo (periodically). With a
+ *  single rank at this depth the view wraps within the owned planes and
+ *  the halos are not used. Neither the halos nor the planes next to them
+ *  may be touched before _finishHaloExchange().
+ */
+void FASMultigridMPI::_beginHaloExchange(fas_grid_t & grid, idx_t depth_idx)
+{
+  idx_t p = ranks_h[depth_idx];
+  if(p < 2 || rank >= p)
+    return;
+
+  idx_t planes = end_h[depth_idx] - begin_h[depth_idx];
+  idx_t plane_pts = ny_h[depth_idx] * nz_h[depth_idx];
+  int left = (rank + p - 1) % p, right = (rank + 1) % p;
+  real_t * g = grid._array;
+  MPI_Request req[4];
+
+  // messages between the same ranks with the same tag match in order, so
+  // the halos of several grids can be in flight at once
+  MPI_Irecv(g + (halo + planes) * plane_pts, halo, plane_h[depth_idx], right,
+    0, comm, &req[0]);
+  MPI_Irecv(g, halo, plane_h[depth_idx], left, 1, comm, &req[1]);
+  MPI_Isend(g + halo * plane_pts, halo, plane_h[depth_idx], left, 0, comm,
+    &req[2]);
+  MPI_Isend(g + planes * plane_pts, halo, plane_h[depth_idx], right, 1, comm,
+    &req[3]);
+  halo_req.insert(halo_req.end(), req, req + 4);
+
+#if !FAS_MPI_OVERLAP
+  _finishHaloExchange();
+#endif
+}
+
+/**
+ * @brief start refreshing the halos of one grid of every variable
+ */
+void FASMultigridMPI::_beginHaloExchange(fas_heirarchy_set_t grid_h,
+  idx_t depth_idx)
+{
+  for(idx_t u_id = 0; u_id < u_n; u_id++)
+    _beginHaloExchange(grid_h[u_id][depth_idx], depth_idx);
+}
+
+/**
+ * @brief wait for the halo exchanges in progress
+ */
+void FASMultigridMPI::_finishHaloExchange()
+{
+  if(halo_req.empty())
+    return;
+
+  MPI_Waitall(halo_req.size(), &halo_req[0], MPI_STATUSES_IGNORE);
+  halo_req.clear();
+}
+
+/**
+ * @brief split the planes of this rank for a stencil kernel overlapping a
+ *  halo exchange
+ * @details ranges[0] are the planes whose stencils stay within the owned
+ *  planes (computed while the exchange proceeds), ranges[1] and ranges[2]
+ *  the planes within halo of either end (computed after it). Each range is
+ *  {first plane, one past the last}; ranges may be empty.
+ */
+void FASMultigridMPI::_splitPlanes(idx_t depth_idx, idx_t ranges[3][2])
+{
+  idx_t b = begin_h[depth_idx], e = end_h[depth_idx];
+  idx_t ib = b, ie = e;
+
+  if(ranks_h[depth_idx] > 1)
+  {
+    ib = std::min(b + halo, e);
+    ie = std::max(ib, e - halo);
+  }
+
+  ranges[0][0] = ib; ranges[0][1] = ie;
+  ranges[1][0] = b;  ranges[1][1] = ib;
+  ranges[2][0] = ie; ranges[2][1] = e;
+}
+
+/**
+ * @brief redistribute the planes of a grid between ranks
+ * @details collective; rank q holds planes from_begin[q] ...
+ *  from_end[q] - 1 (non overlapping, within the grid) at from, and receives
+ *  planes to_begin[q] ... to_end[q] - 1 at to. Destination ranges may
+ *  overlap and extend past the grid, they wrap periodically.
+ *
+ * @param depth_idx index of depth of the grid
+ */
+void FASMultigridMPI::_movePlanes(idx_t depth_idx, const real_t * from,
+  const std::vector<idx_t> & from_begin, const std::vector<idx_t> & from_end,
+  real_t * to, const std::vector<idx_t> & to_begin,
+  const std::vector<idx_t> & to_end)
+{
+  idx_t nx = nx_h[depth_idx];
+  idx_t plane_pts = ny_h[depth_idx] * nz_h[depth_idx];
+  std::vector<int> send_n(ranks, 0), send_off(ranks, 0);
+  std::vector<int> recv_n(ranks, 0), recv_off(ranks, 0);
+  idx_t recv_total = 0;
+
+  send_buf.clear();
+  for(int q = 0; q < ranks; q++)
+  {
+    send_off[q] = send_buf.size() / plane_pts;
+    for(idx_t g = to_begin[q]; g < to_end[q]; g++)
+    {
+      idx_t gm = fas_mpi_mod(g, nx);
+      if(gm >= from_begin[rank] && gm < from_end[rank])
+      {
+        const real_t * plane = from + (gm - from_begin[rank]) * plane_pts;
+        send_buf.insert(send_buf.end(), plane, plane + plane_pts);
+        send_n[q]++;
+      }
+    }
+
+    recv_off[q] = recv_total;
+    for(idx_t g = to_begin[rank]; g < to_end[rank]; g++)
+    {
+      idx_t gm = fas_mpi_mod(g, nx);
+      if(gm >= from_begin[q] && gm < from_end[q])
+        recv_n[q]++;
+    }
+    recv_total += recv_n[q];
+  }
+
+  recv_buf.resize(recv_total * plane_pts);
+  MPI_Alltoallv(send_buf.data(), &send_n[0], &send_off[0], plane_h[depth_idx],
+    recv_buf.data(), &recv_n[0], &recv_off[0], plane_h[depth_idx], comm);
+
+  for(int q = 0; q < ranks; q++)
+  {
+    idx_t n = recv_off[q];
+    for(idx_t g = to_begin[rank]; g < to_end[rank]; g++)
+    {
+      idx_t gm = fas_mpi_mod(g, nx);
+      if(gm >= from_begin[q] && gm < from_end[q])
+      {
+        std::copy(&recv_buf[n * plane_pts], &recv_buf[n * plane_pts] + plane_pts,
+          to + (g - to_begin[rank]) * plane_pts);
+        n++;
+      }
+    }
+  }
+}
+
+/**
+ * @brief "restrict" a fine grid to a coarser grid
+ * @details same scheme as FASMultigrid::_restrictFine2coarse; coarse plane
+ *  i is computed by the rank owning fine plane 2 i (which needs one halo
+ *  plane on each side) and then moved to its owner at the coarse depth.
+ *
+ * @param fine_grid grid to restrict
+ * @param coarse_grid grid to store result in
+ * @param fine_depth "depth" of finer grid
+ */
+void FASMultigridMPI::_restrictGrid(fas_grid_t & fine_grid,
+  fas_grid_t & coarse_grid, idx_t fine_depth)
+{
+  static const real_t weight[4] = {0.125, 0.0625, 0.03125, 0.015625};
+  idx_t fine_idx = _dIdx(fine_depth), coarse_idx = fine_idx - 1;
+  idx_t n_fine_x = nx_h[fine_idx], n_fine_y = ny_h[fine_idx],
+    n_fine_z = nz_h[fine_idx];
+  idx_t n_coarse_y = ny_h[coarse_idx], n_coarse_z = nz_h[coarse_idx];
+
+  std::vector<idx_t> from_begin(ranks), from_end(ranks), to_begin(ranks),
+    to_end(ranks);
+  for(int q = 0; q < ranks; q++)
+  {
+    from_begin[q] = (_planeBegin(fine_idx, q) + 1) / 2;
+    from_end[q] = (_planeBegin(fine_idx, q + 1) + 1) / 2;
+    to_begin[q] = _planeBegin(coarse_idx, q);
+    to_end[q] = _planeBegin(coarse_idx, q + 1);
+  }
+  idx_t c_begin = from_begin[rank], c_end = from_end[rank];
+
+  // coarse plane i reads fine planes 2 i - 1 ... 2 i + 1; the ones within
+  // the owned fine planes a ... b - 1 are restricted during the exchange
+  idx_t a = begin_h[fine_idx], b = end_h[fine_idx];
+  idx_t ranges[3][2];
+  ranges[0][0] = std::min(std::max(c_begin, (a + 2) / 2), c_end);
+  ranges[0][1] = std::max(ranges[0][0], std::min(c_end, b / 2));
+  ranges[1][0] = c_begin;      ranges[1][1] = ranges[0][0];
+  ranges[2][0] = ranges[0][1]; ranges[2][1] = c_end;
+
+  _beginHaloExchange(fine_grid, fine_idx);
+
+  fas_slab_t fine = _view(fine_grid, fine_idx);
+  stage.resize((c_end - c_begin) * n_coarse_y * n_coarse_z);
+  real_t * coarse = stage.data();
+
+  idx_t i, j, k;
+  for(idx_t r = 0; r < 3; r++)
+  {
+    if(r == 1)
+      _finishHaloExchange();
+
+    #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+    FAS_LOOP3_SLAB(i, j, k, ranges[r][0], ranges[r][1], n_coarse_y, n_coarse_z)
+    {
+      idx_t fi = i*2, fj = j*2, fk = k*2;
+      real_t val = 0.0;
+
+      for(idx_t da = -1; da <= 1; da++)
+        for(idx_t db = -1; db <= 1; db++)
+          for(idx_t dc = -1; dc <= 1; dc++)
+            val += weight[std::abs(da) + std::abs(db) + std::abs(dc)]
+              * fine[H_INDEX(fi+da, fj+db, fk+dc, n_fine_x, n_fine_y, n_fine_z)];
+
+      coarse[((i - c_begin) * n_coarse_y + j) * n_coarse_z + k] = val;
+    }
+  }
+
+  _movePlanes(coarse_idx, stage.data(), from_begin, from_end,
+    _ownedPlanes(coarse_grid), to_begin, to_end);
+}
+
+/**
+ * @brief interpolate a coarse grid to a finer grid
+ * @details trilinear, as FASMultigrid::_interpolateCoarse2fine; every rank
+ *  first receives the coarse planes around its fine planes.
+ */
+void FASMultigridMPI::_interpolateCoarse2fine(fas_grid_t & coarse_grid,
+  fas_grid_t & fine_grid, idx_t coarse_depth)
+{
+  idx_t coarse_idx = _dIdx(coarse_depth), fine_idx = coarse_idx + 1;
+  idx_t n_fine_x = nx_h[fine_idx], n_fine_y = ny_h[fine_idx],
+    n_fine_z = nz_h[fine_idx];
+  idx_t n_coarse_y = ny_h[coarse_idx], n_coarse_z = nz_h[coarse_idx];
+
+  // fine planes a ... b - 1 need coarse planes floor((a - 1) / 2) ... b / 2
+  std::vector<idx_t> from_begin(ranks), from_end(ranks), to_begin(ranks),
+    to_end(ranks);
+  for(int q = 0; q < ranks; q++)
+  {
+    idx_t a = _planeBegin(fine_idx, q), b = _planeBegin(fine_idx, q + 1);
+    from_begin[q] = _planeBegin(coarse_idx, q);
+    from_end[q] = _planeBegin(coarse_idx, q + 1);
+    to_begin[q] = (a < b) ? fas_mpi_floor2(a - 1) : 0;
+    to_end[q] = (a < b) ? b / 2 + 1 : 0;
+  }
+  idx_t c_first = to_begin[rank];
+
+  stage.resize((to_end[rank] - to_begin[rank]) * n_coarse_y * n_coarse_z);
+  _movePlanes(coarse_idx, _ownedPlanes(coarse_grid), from_begin, from_end,
+    stage.data(), to_begin, to_end);
+
+  fas_slab_t fine = _view(fine_grid, fine_idx);
+  const real_t * coarse = stage.data();
+  idx_t i, j, k;
+
+  #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+  FAS_LOOP3_SLAB(i, j, k, begin_h[fine_idx], end_h[fine_idx], n_fine_y, n_fine_z)
+  {
+    idx_t ci = i/2 - c_first, cj = j/2, ck = k/2;
+    idx_t di = i%2, dj = j%2, dk = k%2;
+    real_t val = 0.0;
+
+    // odd fine points average the coarse points on either side
+    for(idx_t a = 0; a <= di; a++)
+      for(idx_t b = 0; b <= dj; b++)
+        for(idx_t c = 0; c <= dk; c++)
+          val += coarse[((ci + a) * n_coarse_y + (cj + b) % n_coarse_y)
+            * n_coarse_z + (ck + c) % n_coarse_z];
+
+    fine[H_INDEX(i, j, k, n_fine_x, n_fine_y, n_fine_z)]
+      = val / (real_t) (1 << (di + dj + dk));
+  }
+}
+
+/**
+ * @brief      Evaluate elliptic equation, stores in an array
+ *
+ * @param      result_h  grid to store result on
+ * @param      eqn_id    id of equation to deal with
+ * @param[in]  depth     depth to evaluate at
+ */
+void FASMultigridMPI::_evaluateEllipticEquation(fas_heirarchy_t result_h,
+  idx_t eqn_id, idx_t depth)
+{
+  idx_t i, j, k;
+  idx_t depth_idx = _dIdx(depth);
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+
+  idx_t ranges[3][2];
+  _splitPlanes(depth_idx, ranges);
+  _beginHaloExchange(u_h, depth_idx);
+
+  fas_slab_t result = _view(result_h[depth_idx], depth_idx);
+
+  for(idx_t r = 0; r < 3; r++)
+  {
+    if(r == 1)
+      _finishHaloExchange();
+
+    #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+    FAS_LOOP3_SLAB(i, j, k, ranges[r][0], ranges[r][1], ny, nz)
+    {
+      idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+      result[idx] = _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k);
+    }
+  }
+}
+
+/**
+ * @brief      Computes residual, stores result in residual_h
+ */
+void FASMultigridMPI::_computeResidual(fas_heirarchy_t residual_h,
+  idx_t eqn_id, idx_t depth)
+{
+  idx_t i, j, k;
+  idx_t depth_idx = _dIdx(depth);
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+
+  _evaluateEllipticEquation(residual_h, eqn_id, depth);
+
+  fas_slab_t coarse_src = _view(coarse_src_h[eqn_id][depth_idx], depth_idx);
+  fas_slab_t residual = _view(residual_h[depth_idx], depth_idx);
+
+  #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+  FAS_LOOP3_SLAB(i, j, k, begin_h[depth_idx], end_h[depth_idx], ny, nz)
+  {
+    idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+    residual[idx] = coarse_src[idx] - residual[idx];
+  }
+}
+
+/**
+ * @brief max residual of an equation over planes i_begin ... i_end - 1 of
+ *  this rank; halos of u must be current if the stencils reach them
+ */
+real_t FASMultigridMPI::_localMaxResidual(idx_t eqn_id, idx_t depth_idx,
+  idx_t i_begin, idx_t i_end)
+{
+  idx_t i, j, k;
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+  fas_slab_t coarse_src = _view(coarse_src_h[eqn_id][depth_idx], depth_idx);
+  real_t max_residual = 0.0;
+
+  #pragma omp parallel for default(shared) private(i,j,k) reduction(max:max_residual) schedule(static)
+  FAS_LOOP3_SLAB(i, j, k, i_begin, i_end, ny, nz)
+  {
+    idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+    max_residual = std::max(max_residual, (real_t) std::fabs(coarse_src[idx]
+      - _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k)));
+  }
+
+  return max_residual;
+}
+
+/**
+ * @brief get maximum residual among all equations and ranks
+ *
+ * @param depth to perform calculation
+ * @return residual (on every rank)
+ */
+real_t FASMultigridMPI::_getMaxResidualAllEqs(idx_t depth)
+{
+  idx_t depth_idx = _dIdx(depth);
+  real_t max_for_all = 0;
+
+  idx_t ranges[3][2];
+  _splitPlanes(depth_idx, ranges);
+  _beginHaloExchange(u_h, depth_idx);
+
+  for(idx_t r = 0; r < 3; r++)
+  {
+    if(r == 1)
+      _finishHaloExchange();
+
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+      max_for_all = std::max(max_for_all, _localMaxResidual(eqn_id, depth_idx,
+        ranges[r][0], ranges[r][1]));
+  }
+
+  MPI_Allreduce(MPI_IN_PLACE, &max_for_all, 1, fas_mpi_real(), MPI_MAX, comm);
+  return max_for_all;
+}
+
+/**
+ * @brief      Compute coarse_src and u on a coarser grid
+ * using tmp_h for some computations
+ * @param id of equation
+ * @param[in]  fine_depth  depth of grid to coarsen
+ */
+void FASMultigridMPI::_computeCoarseRestrictions(idx_t eqn_id, idx_t fine_depth)
+{
+  idx_t i, j, k;
+  idx_t fine_idx = _dIdx(fine_depth), coarse_idx = fine_idx - 1;
+
+  _restrictGrid(u_h[eqn_id][fine_idx], u_h[eqn_id][coarse_idx], fine_depth);
+
+  _computeResidual(tmp_h[eqn_id], eqn_id, fine_depth);
+
+  _restrictGrid(tmp_h[eqn_id][fine_idx], tmp_h[eqn_id][coarse_idx], fine_depth);
+
+  _evaluateEllipticEquation(coarse_src_h[eqn_id], eqn_id, fine_depth - 1);
+
+  idx_t nx = nx_h[coarse_idx], ny = ny_h[coarse_idx], nz = nz_h[coarse_idx];
+
+  fas_slab_t coarse_src = _view(coarse_src_h[eqn_id][coarse_idx], coarse_idx);
+  fas_slab_t tmp = _view(tmp_h[eqn_id][coarse_idx], coarse_idx);
+
+  #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+  FAS_LOOP3_SLAB(i, j, k, begin_h[coarse_idx], end_h[coarse_idx], ny, nz)
+  {
+    idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+    coarse_src[idx] += tmp[idx];
+  }
+}
+
+/**
+ * @brief      Convert a grid containing an approximate solution
+ *  to a grid containing the solution error, err = true - appx.
+ */
+void FASMultigridMPI::_changeApproximateSolutionToError(
+  fas_heirarchy_t appx_to_err_h, idx_t u_id, idx_t depth)
+{
+  idx_t i, j, k;
+  idx_t depth_idx = _dIdx(depth);
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+
+  fas_slab_t appx_to_err = _view(appx_to_err_h[depth_idx], depth_idx);
+  fas_slab_t exact_soln = _uView(u_id, depth_idx);
+
+  #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+  FAS_LOOP3_SLAB(i, j, k, begin_h[depth_idx], end_h[depth_idx], ny, nz)
+  {
+    idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+    appx_to_err[idx] = exact_soln[idx] - appx_to_err[idx];
+  }
+}
+
+/**
+ * @brief Compute and add in correction to fine grid from error
+ * on coarser grid; replace error with appx. solution
+ */
+void FASMultigridMPI::_correctFineFromCoarseErr_Err2Appx(
+  fas_heirarchy_t err2appx_h, idx_t u_id, idx_t fine_depth)
+{
+  idx_t i, j, k;
+  idx_t fine_idx = _dIdx(fine_depth);
+  idx_t nx = nx_h[fine_idx], ny = ny_h[fine_idx], nz = nz_h[fine_idx];
+
+  _interpolateCoarse2fine(err2appx_h[fine_idx - 1], err2appx_h[fine_idx],
+    fine_depth - 1);
+
+  fas_slab_t err2appx = _view(err2appx_h[fine_idx], fine_idx);
+  fas_slab_t appx_soln = _uView(u_id, fine_idx);
+
+  #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+  FAS_LOOP3_SLAB(i, j, k, begin_h[fine_idx], end_h[fine_idx], ny, nz)
+  {
+    idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+    real_t appx_val = appx_soln[idx];
+    appx_soln[idx] += err2appx[idx];
+    err2appx[idx] = appx_val;
+  }
+}
+
+/**
+ * @brief Copy the solution of a variable to a grid in another heirarchy
+ */
+void FASMultigridMPI::_copySolution(fas_heirarchy_t to_h, idx_t u_id, idx_t depth)
+{
+  idx_t i, j, k;
+  idx_t depth_idx = _dIdx(depth);
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+
+  fas_slab_t from = _uView(u_id, depth_idx);
+  fas_slab_t to = _view(to_h[depth_idx], depth_idx);
+
+  #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+  FAS_LOOP3_SLAB(i, j, k, begin_h[depth_idx], end_h[depth_idx], ny, nz)
+  {
+    idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+    to[idx] = from[idx];
+  }
+}
+
+/**
+ * @brief iterative method to find a \lambda between 1 and zero,
+ *        returning the largest value that satisfies
+ *        norm less than the norm of F(u)
+ * @details the norm of every trial is summed over all ranks; with
+ *  inexact_newton_constrained the mean of the corrections is removed
+ * @param depth
+ * @param norm
+ */
+bool FASMultigridMPI::_getLambda(idx_t depth, real_t norm)
+{
+  idx_t i, j, k, s;
+  idx_t depth_idx = _dIdx(depth);
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+  idx_t i_begin = begin_h[depth_idx], i_end = end_h[depth_idx];
+  idx_t ranges[3][2];
+  real_t sum = 0.0;
+
+  _splitPlanes(depth_idx, ranges);
+  line_search_norm = 0.0;
+
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    fas_slab_t u = _uView(eqn_id, depth_idx);
+    fas_slab_t damping_v = _view(damping_v_h[eqn_id][depth_idx], depth_idx);
+    real_t v_mean = damping_v_mean[eqn_id];
+
+    #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+    FAS_LOOP3_SLAB(i, j, k, i_begin, i_end, ny, nz)
+    {
+      idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+      u[idx] += 1.0 * (damping_v[idx] - v_mean);
+    }
+  }
+
+  for(s = 0; s < 100; s++)
+  {
+    sum = 0.0;
+
+    _beginHaloExchange(u_h, depth_idx);
+    for(idx_t r = 0; r < 3; r++)
+    {
+      if(r == 1)
+        _finishHaloExchange();
+
+      for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+      {
+        fas_slab_t coarse_src = _view(coarse_src_h[eqn_id][depth_idx], depth_idx);
+
+        #pragma omp parallel for default(shared) private(i,j,k) reduction(+:sum) schedule(static)
+        FAS_LOOP3_SLAB(i, j, k, ranges[r][0], ranges[r][1], ny, nz)
+        {
+          idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+          real_t temp = _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k)
+            - coarse_src[idx];
+          sum += temp * temp;
+        }
+      }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &sum, 1, fas_mpi_real(), MPI_SUM, comm);
+    relax_sweeps++;
+
+    if(sum <= norm)  // when | F(u + \lambda v) | < | F(u) | stop
+    {
+      line_search_norm = sum;
+      return 1;
+    }
+
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    {
+      fas_slab_t u = _uView(eqn_id, depth_idx);
+      fas_slab_t damping_v = _view(damping_v_h[eqn_id][depth_idx], depth_idx);
+      real_t v_mean = damping_v_mean[eqn_id];
+
+      #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+      FAS_LOOP3_SLAB(i, j, k, i_begin, i_end, ny, nz)
+      {
+        idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+        u[idx] -= (0.01) * (damping_v[idx] - v_mean);
+      }
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * @brief compute the updated value of v for one equation at a point
+ */
+real_t FASMultigridMPI::_jacobianUpdatePt(idx_t eqn_id, idx_t depth_idx,
+  idx_t i, idx_t j, idx_t k)
+{
+  idx_t idx = H_INDEX(i,j,k,nx_h[depth_idx],ny_h[depth_idx],nz_h[depth_idx]);
+  real_t coef_a = 0, coef_b = 0, temp = 0;
+  _evaluateIterationForJacEquation(eqn_id, depth_idx, coef_a, coef_b, i, j, k, eqn_id);
+  for(idx_t u_id = 0; u_id < u_n; u_id++)
+  {
+    if(u_id != eqn_id)
+      temp += _evaluateDerEllipticEquation(eqn_id, depth_idx, i, j, k, u_id);
+  }
+  return (coef_a - (_view(jac_rhs_h[eqn_id][depth_idx], depth_idx)[idx]
+    - jac_rhs_mean[eqn_id]) + temp) / (-coef_b);
+}
+
+/**
+ * @brief squared residual of the linearized (Jacobian) equations at a point,
+ *  summed over all equations
+ */
+real_t FASMultigridMPI::_jacobianResidualPt(idx_t depth_idx, idx_t i, idx_t j,
+  idx_t k)
+{
+  idx_t idx = H_INDEX(i,j,k,nx_h[depth_idx],ny_h[depth_idx],nz_h[depth_idx]);
+  real_t res = 0;
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    real_t temp = 0;
+    for(idx_t u_id = 0; u_id < u_n; u_id++)
+      temp += _evaluateDerEllipticEquation(eqn_id, depth_idx, i, j, k, u_id);
+    temp -= _view(jac_rhs_h[eqn_id][depth_idx], depth_idx)[idx]
+      - jac_rhs_mean[eqn_id];
+    res += temp * temp;
+  }
+  return res;
+}
+
+/**
+ * @brief perform Jacobian relaxation until a desired precision is reached
+ * @details updates are in place within a rank; halos of the corrections
+ *  are refreshed after every sweep and the residual (and, with
+ *  inexact_newton_constrained, the mean of the corrections) is summed
+ *  over all ranks
+ * @param depth
+ * @param norm of F(u)
+ * @param parameter can control the converge speed
+ * @param parameter can control the converge speed
+ */
+bool FASMultigridMPI::_jacobianRelax(idx_t depth, real_t norm, real_t C, idx_t p)
+{
+  idx_t i, j, k;
+  idx_t depth_idx = _dIdx(depth);
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx], cnt = 0;
+  idx_t i_begin = begin_h[depth_idx], i_end = end_h[depth_idx];
+  idx_t ranges[3][2];
+  bool constrained = (relax_scheme == FASMultigrid::inexact_newton_constrained);
+
+  real_t norm_r = 1e100, norm_pre;
+  // norm_r, then the total correction of each variable
+  std::vector<real_t> sums(u_n + 1);
+
+  _splitPlanes(depth_idx, ranges);
+
+  // halos included, so no exchange is needed before the first sweep
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    fas_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
+    #pragma omp parallel for schedule(static)
+    for(idx_t q = 0; q < damping_v.pts; q++)
+      damping_v[q] = 0.0;
+  }
+
+  real_t target = std::min(pow(norm, (real_t)(p+1)) * C, norm);
+  target = std::max(target,
+    norm * pw2(16 * std::numeric_limits<real_t>::epsilon()));
+
+  while(norm_r >= target)
+  {
+    norm_pre = 0.0;
+    std::fill(sums.begin(), sums.end(), 0.0);
+    real_t * v_total = &sums[1];
+
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    {
+      fas_slab_t damping_v = _view(damping_v_h[eqn_id][depth_idx], depth_idx);
+
+      #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+      FAS_LOOP3_SLAB(i, j, k, i_begin, i_end, ny, nz)
+      {
+        idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+        damping_v[idx] = _jacobianUpdatePt(eqn_id, depth_idx, i, j, k);
+      }
+    }
+
+    // the next sweep needs the new halos, the residual only near them
+    _beginHaloExchange(damping_v_h, depth_idx);
+    for(idx_t r = 0; r < 3; r++)
+    {
+      if(r == 1)
+        _finishHaloExchange();
+
+      real_t range_norm = 0.0;
+      #pragma omp parallel for default(shared) private(i,j,k) reduction(+:range_norm, v_total[:u_n]) schedule(static)
+      FAS_LOOP3_SLAB(i, j, k, ranges[r][0], ranges[r][1], ny, nz)
+      {
+        range_norm += _jacobianResidualPt(depth_idx, i, j, k);
+        if(constrained)
+          for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+            v_total[eqn_id] += _view(damping_v_h[eqn_id][depth_idx],
+              depth_idx)[H_INDEX(i, j, k, nx, ny, nz)];
+      }
+      sums[0] += range_norm;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &sums[0], u_n + 1, fas_mpi_real(), MPI_SUM,
+      comm);
+    norm_r = sums[0];
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+      damping_v_mean[eqn_id] = v_total[eqn_id] / (real_t) (nx*ny*nz);
+
+    cnt++;
+
+    if(cnt > 500 && norm_r > norm_pre)
+    {
+      if(verbosity > 0 && rank == 0)
+        std::cout << "Unable to achieve a precise enough solution within "
+                  << cnt << " iterations.\n";
+      relax_sweeps += cnt;
+      return false;
+    }
+  }
+
+  relax_sweeps += cnt;
+  return true;
+}
+
+/**
+ * @brief relax u using the inexact Newton iterative method
+ * @details as FASMultigrid::_relaxSolution_GaussSeidel, with norms summed
+ *  over all ranks; with adaptive smoothing enabled and a slot given, the
+ *  number of iterations comes from the smoothing controller
+ * @param depth
+ * @param max interation number
+ * @param slot of the smoothing controller, -1 for a fixed number of iterations
+ */
+void FASMultigridMPI::_relaxSolution_GaussSeidel(idx_t depth,
+  idx_t max_iterations, idx_t slot)
+{
+  idx_t i, j, k, s;
+  idx_t depth_idx = _dIdx(depth);
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+  bool constrained = (relax_scheme == FASMultigrid::inexact_newton_constrained);
+  // |F(u)|^2, then the total residual of each equation
+  std::vector<real_t> sums(u_n + 1);
+
+  bool adaptive = smoothing.enabled && slot >= 0;
+  idx_t iterations = smoothing.iterations(slot, max_iterations);
+  bool wasted = false, converged = false;
+  // work of a sweep over this level, in sweeps over the fine grid
+  real_t level_work = (real_t) (nx*ny*nz)
+    / (real_t) (nx_h[max_depth_idx]*ny_h[max_depth_idx]*nz_h[max_depth_idx]);
+
+  for(s = 0; s < iterations; ++s)
+  {
+    // set tolenrance precision, which should be smaller when grids become more coarse
+    if(_getMaxResidualAllEqs(depth) < (relaxation_tolerance / pw2(1<<(max_depth_idx - depth_idx))))
+    {
+      converged = true;
+      break;
+    }
+
+    // this residual and the one setting up jac_rhs
+    relax_sweeps = 2;
+    std::fill(sums.begin(), sums.end(), 0.0);
+
+    // halos of u are current after _getMaxResidualAllEqs
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    {
+      fas_slab_t jac_rhs = _view(jac_rhs_h[eqn_id][depth_idx], depth_idx);
+      fas_slab_t coarse_src = _view(coarse_src_h[eqn_id][depth_idx], depth_idx);
+      real_t eqn_norm = 0.0, total = 0.0;
+
+      #pragma omp parallel for default(shared) private(i,j,k) reduction(+:eqn_norm,total) schedule(static)
+      FAS_LOOP3_SLAB(i, j, k, begin_h[depth_idx], end_h[depth_idx], ny, nz)
+      {
+        idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+        real_t temp = _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k)
+          - coarse_src[idx];
+        eqn_norm += temp * temp;
+        total += temp;
+        jac_rhs[idx] = -temp;
+      }
+
+      sums[0] += eqn_norm;
+      sums[1 + eqn_id] = total;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &sums[0], u_n + 1, fas_mpi_real(), MPI_SUM,
+      comm);
+
+    // the Jacobian equations are solved with a zero-mean rhs, which a
+    // periodic Laplacian (constant null space) can satisfy
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+      jac_rhs_mean[eqn_id] = constrained
+        ? -sums[1 + eqn_id] / (real_t) (nx*ny*nz) : 0.0;
+
+    if(_jacobianRelax(depth, sums[0], 1, 0) == false)
+      break;
+
+    if(_getLambda(depth, sums[0]) == false)
+    {
+      std::cout << "Can't fine suitable damping factor!!!\n";
+      throw -1;
+    }
+
+    // the line search leaves |F(u)|^2 after the step in line_search_norm
+    if(adaptive && !smoothing.worthwhile(slot, std::sqrt(sums[0]),
+      std::sqrt(line_search_norm), relax_sweeps * level_work))
+    {
+      wasted = true;
+      s++;
+      break;
+    }
+  }
+
+  if(adaptive)
+    smoothing.update(slot, s, wasted, converged, max_iterations);
+}
+
+/**
+ * @brief set the fine grid solution at a point (global indexes)
+ * @details ignored unless plane i belongs to this rank
+ */
+void FASMultigridMPI::setSolutionAtPt(idx_t u_id, idx_t i, idx_t j, idx_t k,
+  real_t value)
+{
+  if(i < begin_h[max_depth_idx] || i >= end_h[max_depth_idx])
+    return;
+
+  _uView(u_id, max_depth_idx)[H_INDEX(i, j, k, nx_h[max_depth_idx],
+    ny_h[max_depth_idx], nz_h[max_depth_idx])] = value;
+}
+
+/**
+ * @brief fine grid solution at a point (global indexes) of this rank
+ * @return value, 0 unless plane i belongs to this rank
+ */
+real_t FASMultigridMPI::getSolutionAtPt(idx_t u_id, idx_t i, idx_t j, idx_t k)
+{
+  if(i < begin_h[max_depth_idx] || i >= end_h[max_depth_idx])
+    return 0.0;
+
+  return _uView(u_id, max_depth_idx)[H_INDEX(i, j, k, nx_h[max_depth_idx],
+    ny_h[max_depth_idx], nz_h[max_depth_idx])];
+}
+
+/**
+ * @brief set the source of a molecule at a fine grid point (global indexes)
+ * @details the first call for a molecule enables its source on this rank,
+ *  so every rank must set the same molecules; values at points of other
+ *  ranks are ignored
+ */
+void FASMultigridMPI::setPolySrcAtPt(idx_t eqn_id, idx_t mol_id, idx_t i,
+  idx_t j, idx_t k, real_t value)
+{
+  _dropOperatorCache();
+
+  if(!rho_set[eqn_id][mol_id])
+  {
+    for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+      _initGrid(rho_h[eqn_id][mol_id][depth_idx], depth_idx);
+    rho_set[eqn_id][mol_id] = true;
+  }
+
+  if(i < begin_h[max_depth_idx] || i >= end_h[max_depth_idx])
+    return;
+
+  _view(rho_h[eqn_id][mol_id][max_depth_idx], max_depth_idx)[H_INDEX(i, j, k,
+    nx_h[max_depth_idx], ny_h[max_depth_idx], nz_h[max_depth_idx])] = value;
+}
+
+/**
+ * @brief      restrict the supplied sources to all coarser grids and set
+ *  up the operator cache
+ */
+void FASMultigridMPI::initializeRhoHeirarchy()
+{
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+      if(rho_set[eqn_id][mol_id])
+        for(idx_t depth = max_depth; depth > min_depth; --depth)
+          _restrictGrid(rho_h[eqn_id][mol_id][_dIdx(depth)],
+            rho_h[eqn_id][mol_id][_dIdx(depth) - 1], depth);
+
+  _buildOperatorCache();
+}
+
+/**
+ * @brief collect the fine grid solution of a variable on one rank
+ * @details collective
+ *
+ * @param u_id variable
+ * @param u_out grid of the fine grid size, only used on root
+ * @param root rank receiving the solution
+ */
+void FASMultigridMPI::gatherSolution(idx_t u_id, arr_t & u_out, int root)
+{
+  std::vector<int> counts(ranks), offsets(ranks);
+  for(int q = 0; q < ranks; q++)
+  {
+    offsets[q] = _planeBegin(max_depth_idx, q);
+    counts[q] = _planeBegin(max_depth_idx, q + 1) - offsets[q];
+  }
+
+  MPI_Gatherv(_ownedPlanes(u_h[u_id][max_depth_idx]), counts[rank],
+    plane_h[max_depth_idx], rank == root ? u_out._array : NULL, &counts[0],
+    &offsets[0], plane_h[max_depth_idx], root, comm);
+}
+
+void FASMultigridMPI::VCycle()
+{
+  idx_t depth, coarse_depth;
+
+  // fine grid pre-smoothing has the last smoothing slot
+  _relaxSolution_GaussSeidel(max_depth, max_relax_iters, total_depths);
+
+  if(verbosity > 1)
+  {
+    real_t res = _getMaxResidualAllEqs(max_depth);
+    if(rank == 0)
+      std::cout << "  Initial max. residual on fine grid is: " << res
+        << ".\n" << std::flush;
+  }
+
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    for(depth = max_depth; min_depth < depth; --depth)
+      _computeCoarseRestrictions(eqn_id, depth);
+    _copySolution(tmp_h[eqn_id], eqn_id, min_depth);
+  }
+
+  for(coarse_depth = min_depth; coarse_depth < max_depth; coarse_depth++)
+  {
+    _relaxSolution_GaussSeidel(coarse_depth, max_relax_iters,
+      _dIdx(coarse_depth));
+
+    if(verbosity > 1)
+    {
+      real_t res = _getMaxResidualAllEqs(coarse_depth);
+      if(rank == 0)
+        std::cout << "    Working on upward stroke at depth " << coarse_depth
+                  << " (" << ranks_h[_dIdx(coarse_depth)] << " ranks)"
+                  << "; residual after solving is: " << res << ".\n"
+                  << std::flush;
+    }
+
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+      _changeApproximateSolutionToError(tmp_h[eqn_id], eqn_id, coarse_depth);
+
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+      _correctFineFromCoarseErr_Err2Appx(tmp_h[eqn_id], eqn_id, coarse_depth+1);
+  }
+
+  _relaxSolution_GaussSeidel(max_depth, max_relax_iters, max_depth_idx);
+  cycle++;
+
+  if(verbosity > 0)
+  {
+    real_t res = _getMaxResidualAllEqs(max_depth);
+    if(rank == 0)
+      std::cout << "  Final max. residual on fine grid is: " << res
+        << ".\n" << std::flush;
+  }
+}
+
+void FASMultigridMPI::VCycles(idx_t num_cycles)
+{
+  for(idx_t n = 0; n < num_cycles; ++n)
+    VCycle();
+
+  _relaxSolution_GaussSeidel(max_depth, 10);
+  if(verbosity > 0)
+  {
+    real_t res = _getMaxResidualAllEqs(max_depth);
+    if(rank == 0)
+      std::cout << "  Final solution residual is: " << res << "\n"
+        << std::flush;
+  }
+}
+
+} // namespace cosmo
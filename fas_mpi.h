@@ -0,0 +1,381 @@
+#ifndef FAS_MPI_H
+#define FAS_MPI_H
+
+#include <mpi.h>
+#include <vector>
+
+#include "fas_operator_cache.h"
+
+// levels with fewer i planes per rank are agglomerated onto fewer ranks
+#ifndef FAS_MPI_MIN_PLANES
+  #define FAS_MPI_MIN_PLANES 4
+#endif
+
+// overlap halo exchanges with the interior planes of the kernels using them
+// (0: blocking exchange before each kernel)
+#ifndef FAS_MPI_OVERLAP
+  #define FAS_MPI_OVERLAP 1
+#endif
+
+// FAS_LOOP3_N over the planes i_begin ... i_end - 1 of a slab
+#define FAS_LOOP3_SLAB(i, j, k, i_begin, i_end, ny, nz) \
+  for(i=i_begin; i<i_end; ++i)                          \
+    for(j=0; j<ny; ++j)                                 \
+      for(k=0; k<nz; ++k)
+
+namespace cosmo
+{
+
+/**
+ * @brief FAS multigrid with the domain decomposed over MPI processes
+ * @details The same solver as FASMultigrid (layout_separate) with every
+ *  grid split into slabs of consecutive i planes. Equations are evaluated
+ *  by the point kernels of FASMultigrid (fas_kernels.h, and the operator
+ *  cache of fas_operator_cache.h unless FAS_OPERATOR_CACHE is 0), reading
+ *  the slabs through FASSlabView; relaxation supports inexact_newton and
+ *  inexact_newton_constrained (relax_scheme) and adaptive smoothing
+ *  (getSmoothing()). A rank stores its planes plus stencil_order / 2 halo
+ *  planes on each side, refreshed from the neighbouring ranks
+ *  (periodically) before every kernel that applies a stencil; kernels run
+ *  over the owned planes with OpenMP and index the grids with global
+ *  H_INDEX through FASSlabView. The exchange is nonblocking: kernels update
+ *  the planes that do not reach into the halos while it proceeds and the
+ *  planes next to the halos once it has completed (FAS_MPI_OVERLAP).
+ *  Residual norms, the maximum residual, the means removed by the
+ *  constrained scheme and the line search test of _getLambda are reduced
+ *  over all ranks, so every rank takes the same decisions and the cycle
+ *  matches the serial one (up to the order of the in-place Jacobian
+ *  updates across slab boundaries).
+ *
+ *  Restriction and interpolation are computed by the ranks owning the fine
+ *  planes; coarse planes are then moved to their owners with one
+ *  MPI_Alltoallv per grid. Levels are agglomerated: a level is split over
+ *  at most nx / max(FAS_MPI_MIN_PLANES, halo) ranks and over no more ranks
+ *  than the finer level, so the coarsest levels live on a single rank and
+ *  the others wait in the reductions. Grid sizes must be divisible by
+ *  2^(max_depth - 1) and the fine grid must have at least halo planes per
+ *  rank.
+ *
+ *  Fine grid values are set (and read back) per point with global indexes;
+ *  points of other ranks are ignored, so every rank can run the same
+ *  initialization loop. MPI must be initialized (MPI_THREAD_FUNNELED
+ *  suffices, MPI is only called outside parallel regions).
+ */
+class FASMultigridMPI
+{
+  private:
+
+  // local slab of a grid: owned planes with halos, nx = stored planes
+  typedef arr_t fas_grid_t;
+  // heirarchy type (set of some grids at different depths)
+  typedef arr_t * fas_heirarchy_t;
+  // set of heirarchies (one for each variable/equation)
+  typedef fas_heirarchy_t * fas_heirarchy_set_t;
+
+  // global view of a local slab
+  typedef FASSlabView<real_t> fas_slab_t;
+
+  MPI_Comm comm;
+  int rank, ranks;
+
+  fas_heirarchy_set_t u_h;             ///< field seeking a solution for
+  fas_heirarchy_set_t tmp_h;           ///< reusable grid for storing intermediate calculations
+  fas_heirarchy_set_t coarse_src_h;    ///< multigrid source term
+  fas_heirarchy_set_t jac_rhs_h;       ///< - F(u) which is rhs of Jacob Linear function
+  fas_heirarchy_set_t damping_v_h;     ///< Newton correction, used to calculate F(u + \lambda v)
+  fas_heirarchy_set_t * rho_h;         ///< source matter terms, one per molecule
+  bool ** rho_set;                     ///< molecules with a source term
+
+  idx_t u_n;          ///< number of variables ( = number of equations)
+
+  idx_t * molecule_n; ///< number of molecules for each equation
+
+  idx_t *nx_h, *ny_h, *nz_h;  ///< number of grid points in each direction at different depths
+  idx_t *ranks_h;             ///< ranks the grids are split over at different depths
+  idx_t *begin_h, *end_h;     ///< planes of this rank at different depths
+  MPI_Datatype * plane_h;     ///< one i plane at different depths
+
+  real_t relaxation_tolerance;  ///< desired precision when performing relaxation
+
+  idx_t max_depth, max_depth_idx;
+  idx_t min_depth, min_depth_idx;
+  idx_t total_depths, max_relax_iters;
+
+  idx_t stencil_order; ///< finite difference order of all stencils
+  idx_t halo;          ///< halo planes on each side of a slab
+
+  idx_t cycle; ///< V-cycles completed
+
+  std::vector<real_t> stage, send_buf, recv_buf; ///< staging of moved planes
+  std::vector<MPI_Request> halo_req;  ///< halo exchanges in progress
+
+  // zero-mean projection for inexact_newton_constrained (0 otherwise),
+  // summed over all ranks
+  std::vector<real_t> jac_rhs_mean;    ///< mean of jac_rhs at the depth being relaxed
+  std::vector<real_t> damping_v_mean;  ///< mean of damping_v after the last Jacobian sweep
+
+  FASSmoothingController smoothing; ///< adaptive Newton iterations per level
+
+  idx_t relax_sweeps; ///< grid sweeps of the current Newton iteration (Jacobian solve, line search)
+  real_t line_search_norm; ///< |F(u)|^2 accepted by the last line search
+
+  FASOperatorCache op_cache;       ///< term lists of the equations
+  fas_heirarchy_set_t src_cache_h; ///< sum of the molecules without atoms of an equation, per depth (local slabs)
+  bool op_cache_valid;             ///< evaluators use op_cache (set up by _buildOperatorCache)
+
+  // one depth as read by the point kernels (fas_kernels.h,
+  // fas_operator_cache.h): the local slabs, indexed globally
+  class fas_slab_fields_t
+  {
+   public:
+    typedef fas_slab_t view_t;
+
+    FASMultigridMPI & mg;
+    idx_t depth_idx;
+    idx_t nx, ny, nz;
+
+    fas_slab_fields_t(FASMultigridMPI & mg_in, idx_t depth_idx_in)
+      : mg(mg_in), depth_idx(depth_idx_in), nx(mg_in.nx_h[depth_idx_in]),
+        ny(mg_in.ny_h[depth_idx_in]), nz(mg_in.nz_h[depth_idx_in])
+    {
+    }
+
+    inline idx_t molecules(idx_t eqn_id)
+    {
+      return mg.molecule_n[eqn_id];
+    }
+
+    inline molecule & mol(idx_t eqn_id, idx_t mol_id)
+    {
+      return mg.eqns[eqn_id][mol_id];
+    }
+
+    inline view_t u(idx_t u_id)
+    {
+      return mg._uView(u_id, depth_idx);
+    }
+
+    inline bool hasRho(idx_t eqn_id, idx_t mol_id)
+    {
+      return mg.rho_set[eqn_id][mol_id];
+    }
+
+    inline real_t rho(idx_t eqn_id, idx_t mol_id, idx_t pos_idx)
+    {
+      return mg._view(mg.rho_h[eqn_id][mol_id][depth_idx], depth_idx)[pos_idx];
+    }
+
+    inline real_t src(idx_t eqn_id, idx_t pos_idx)
+    {
+      return mg._view(mg.src_cache_h[eqn_id][depth_idx], depth_idx)[pos_idx];
+    }
+
+    inline real_t coef(idx_t eqn_id, idx_t mol_id, idx_t pos_idx)
+    {
+      real_t val = mg.eqns[eqn_id][mol_id].const_coef;
+      if(mg.rho_set[eqn_id][mol_id])
+        val *= rho(eqn_id, mol_id, pos_idx);
+      return val;
+    }
+  };
+
+  // point evaluators instantiated for the selected stencil order
+  typedef real_t (FASMultigridMPI::*eval_pt_fn_t)(idx_t, idx_t, idx_t, idx_t,
+    idx_t);
+  typedef void (FASMultigridMPI::*iter_jac_fn_t)(idx_t, idx_t, real_t &,
+    real_t &, idx_t, idx_t, idx_t, idx_t);
+  typedef real_t (FASMultigridMPI::*der_eqn_fn_t)(idx_t, idx_t, idx_t, idx_t,
+    idx_t, idx_t);
+
+  eval_pt_fn_t eval_pt_fn;   ///< _evaluateEllipticEquationPtOrd<stencil_order, op_cache_valid>
+  iter_jac_fn_t iter_jac_fn; ///< _evaluateIterationForJacEquationOrd<stencil_order, op_cache_valid>
+  der_eqn_fn_t der_eqn_fn;   ///< _evaluateDerEllipticEquationOrd<stencil_order, op_cache_valid>
+
+  inline idx_t _dIdx(idx_t depth)
+  {
+    return depth - min_depth;
+  }
+
+  /**
+   * @brief global view of the local slab of a grid at a depth
+   */
+  inline fas_slab_t _view(fas_grid_t & grid, idx_t depth_idx)
+  {
+    return fas_slab_t(grid._array, begin_h[depth_idx] - halo, grid.nx,
+      nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
+  }
+
+  inline fas_slab_t _uView(idx_t u_id, idx_t depth_idx)
+  {
+    return _view(u_h[u_id][depth_idx], depth_idx);
+  }
+
+  idx_t _planeBegin(idx_t depth_idx, idx_t r);
+
+  void _initGrid(fas_grid_t & grid, idx_t depth_idx);
+
+  real_t * _ownedPlanes(fas_grid_t & grid);
+
+  template<int ORDER, bool CACHED>
+  real_t _evaluateEllipticEquationPtOrd(idx_t eqn_id, idx_t depth_idx,
+    idx_t i, idx_t j, idx_t k);
+
+  template<int ORDER, bool CACHED>
+  void _evaluateIterationForJacEquationOrd(idx_t eqn_id, idx_t depth_idx,
+    real_t &coef_a, real_t &coef_b, idx_t i, idx_t j, idx_t k, idx_t u_id);
+
+  template<int ORDER, bool CACHED>
+  real_t _evaluateDerEllipticEquationOrd(idx_t eqn_id, idx_t depth_idx,
+    idx_t i, idx_t j, idx_t k, idx_t u_id);
+
+  template<int ORDER>
+  void _selectEvaluators();
+
+  void _setEvaluators();
+
+  void _buildOperatorCache();
+
+  void _dropOperatorCache();
+
+  void _beginHaloExchange(fas_grid_t & grid, idx_t depth_idx);
+
+  void _beginHaloExchange(fas_heirarchy_set_t grid_h, idx_t depth_idx);
+
+  void _finishHaloExchange();
+
+  void _splitPlanes(idx_t depth_idx, idx_t ranges[3][2]);
+
+  void _movePlanes(idx_t depth_idx, const real_t * from,
+    const std::vector<idx_t> & from_begin, const std::vector<idx_t> & from_end,
+    real_t * to, const std::vector<idx_t> & to_begin,
+    const std::vector<idx_t> & to_end);
+
+  real_t _localMaxResidual(idx_t eqn_id, idx_t depth_idx, idx_t i_begin,
+    idx_t i_end);
+
+ public:
+
+  idx_t verbosity; ///< 0: silent, 1: residual after each V-cycle, 2: also each level (printed by rank 0)
+
+  FASMultigrid::relax_t relax_scheme; ///< inexact_newton (default) or inexact_newton_constrained
+
+  molecule ** eqns; ///< All terms in all equations
+
+  FASMultigridMPI(MPI_Comm comm_in, idx_t nx, idx_t ny, idx_t nz,
+    idx_t u_n_in, idx_t molecule_n_in [], idx_t max_depth_in,
+    idx_t max_relax_iters_in, real_t relaxation_tolerance_in,
+    idx_t stencil_order_in = STENCIL_ORDER);
+  ~FASMultigridMPI();
+
+  void add_atom_to_eqn(atom atom_in, idx_t molecule_id, idx_t eqn_id);
+
+  /**
+   * @brief first fine grid plane of this rank
+   */
+  inline idx_t localBegin()
+  {
+    return begin_h[max_depth_idx];
+  }
+
+  /**
+   * @brief one past the last fine grid plane of this rank
+   */
+  inline idx_t localEnd()
+  {
+    return end_h[max_depth_idx];
+  }
+
+  /**
+   * @brief number of ranks the grids at a depth are split over
+   */
+  inline idx_t getRanks(idx_t depth)
+  {
+    return ranks_h[_dIdx(depth)];
+  }
+
+  inline idx_t getCycle()
+  {
+    return cycle;
+  }
+
+  /**
+   * @brief adaptive smoothing, see FASSmoothingController
+   * @details off unless getSmoothing().enabled is set; every rank takes
+   *  the same decisions, as the norms it sees are summed over all ranks
+   */
+  inline FASSmoothingController & getSmoothing()
+  {
+    return smoothing;
+  }
+
+  inline real_t _evaluateEllipticEquationPt(idx_t eqn_id, idx_t depth_idx,
+    idx_t i, idx_t j, idx_t k)
+  {
+    return (this->*eval_pt_fn)(eqn_id, depth_idx, i, j, k);
+  }
+
+  inline void _evaluateIterationForJacEquation(idx_t eqn_id, idx_t depth_idx,
+    real_t &coef_a, real_t &coef_b, idx_t i, idx_t j, idx_t k, idx_t u_id)
+  {
+    (this->*iter_jac_fn)(eqn_id, depth_idx, coef_a, coef_b, i, j, k, u_id);
+  }
+
+  inline real_t _evaluateDerEllipticEquation(idx_t eqn_id, idx_t depth_idx,
+    idx_t i, idx_t j, idx_t k, idx_t var_id)
+  {
+    return (this->*der_eqn_fn)(eqn_id, depth_idx, i, j, k, var_id);
+  }
+
+  void _restrictGrid(fas_grid_t & fine_grid, fas_grid_t & coarse_grid,
+    idx_t fine_depth);
+
+  void _interpolateCoarse2fine(fas_grid_t & coarse_grid,
+    fas_grid_t & fine_grid, idx_t coarse_depth);
+
+  void _evaluateEllipticEquation(fas_heirarchy_t result_h, idx_t eqn_id,
+    idx_t depth);
+
+  void _computeResidual(fas_heirarchy_t residual_h, idx_t eqn_id, idx_t depth);
+
+  real_t _getMaxResidualAllEqs(idx_t depth);
+
+  void _computeCoarseRestrictions(idx_t eqn_id, idx_t fine_depth);
+
+  void _changeApproximateSolutionToError(fas_heirarchy_t appx_to_err_h,
+    idx_t u_id, idx_t depth);
+
+  void _correctFineFromCoarseErr_Err2Appx(fas_heirarchy_t err2appx_h,
+    idx_t u_id, idx_t fine_depth);
+
+  void _copySolution(fas_heirarchy_t to_h, idx_t u_id, idx_t depth);
+
+  bool _getLambda(idx_t depth, real_t norm);
+
+  real_t _jacobianUpdatePt(idx_t eqn_id, idx_t depth_idx, idx_t i, idx_t j,
+    idx_t k);
+
+  real_t _jacobianResidualPt(idx_t depth_idx, idx_t i, idx_t j, idx_t k);
+
+  bool _jacobianRelax(idx_t depth, real_t norm, real_t C, idx_t p);
+
+  void _relaxSolution_GaussSeidel(idx_t depth, idx_t max_iterations,
+    idx_t slot = -1);
+
+  void setSolutionAtPt(idx_t u_id, idx_t i, idx_t j, idx_t k, real_t value);
+
+  real_t getSolutionAtPt(idx_t u_id, idx_t i, idx_t j, idx_t k);
+
+  void setPolySrcAtPt(idx_t eqn_id, idx_t mol_id, idx_t i, idx_t j, idx_t k,
+    real_t value);
+
+  void initializeRhoHeirarchy();
+
+  void gatherSolution(idx_t u_id, arr_t & u_out, int root = 0);
+
+  void VCycle();
+
+  void VCycles(idx_t num_cycles);
+};
+
+} // namespace cosmo
+#endif
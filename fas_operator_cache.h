@@ -0,0 +1,599 @@
+#ifndef FAS_OPERATOR_CACHE_H
+#define FAS_OPERATOR_CACHE_H
+
+#include "fas_kernels.h"
+
+namespace cosmo
+{
+
+// molecule with a single atom that is linear in u (a stencil, or a
+// polynomial with power 1)
+typedef struct
+{
+  idx_t mol_id;              ///< molecule in the equation
+  idx_t u_id, type;          ///< its atom
+  real_t coef;               ///< const_coef of the molecule
+  bool has_rho;              ///< coefficient is multiplied by the molecule's rho
+  std::vector<real_t> diag;  ///< coef times the diagonal stencil weight at each depth
+} fas_linear_term_t;
+
+// term of the derivative of the symbolic molecules of an equation with
+// respect to one variable, applied to the Newton correction v:
+//   coef * rho * (product of factors) * (v, or a stencil applied to v)
+typedef struct
+{
+  real_t coef;                 ///< const_coef times exponents and multiplicity
+  idx_t rho_mol;               ///< molecule whose rho multiplies the term (-1: none)
+  std::vector<idx_t> factors;  ///< indexes into fas_jac_list_t::atoms
+  idx_t d_idx;                 ///< index into fas_jac_list_t::d_types (-1: v itself)
+} fas_jac_term_t;
+
+// derivative of an equation with respect to one variable, generated by
+// FASOperatorCache::_buildJacobianTerms; empty if the symbolic molecules do
+// not depend on it
+typedef struct
+{
+  std::vector<atom> atoms;              ///< distinct atoms multiplying the terms, evaluated once per point
+  std::vector<idx_t> atom_regs;         ///< register of each polynomial atom in powers (-1: stencils)
+  FASPowerChain powers;                 ///< all polynomial atoms of the list from one multiplication chain
+  std::vector<idx_t> d_types;           ///< distinct stencils applied to v
+  std::vector<real_t> d_diag;           ///< diagonal weight of each d_type at each depth (d * total_depths + depth_idx)
+  std::vector<fas_jac_term_t> terms;
+} fas_jac_list_t;
+
+// molecules of an equation grouped by how they are evaluated
+typedef struct
+{
+  bool cached_src;                        ///< has molecules without atoms, summed by the solver per depth
+  std::vector<fas_linear_term_t> linear;  ///< linear molecules
+  std::vector<idx_t> symbolic;            ///< all other molecules
+  std::vector<fas_jac_list_t> jac;        ///< derivative of the symbolic molecules, per variable
+  fas_jac_list_t value;                   ///< the symbolic molecules themselves (terms without v, no d_types)
+} fas_op_cache_t;
+
+/**
+ * @brief per-level operator cache of a set of equations
+ * @details Molecules are grouped once per solve instead of being walked
+ *  atom by atom at every point:
+ *  - molecules without atoms (constants, or const_coef * rho) do not
+ *    change during a solve; the solver stores their sum for every depth
+ *    and they drop out of the Jacobian entirely;
+ *  - molecules with a single stencil atom, or a polynomial atom with
+ *    power 1, are linear in u; they are applied from their coefficient
+ *    (times rho) and their diagonal weights at each depth are
+ *    precomputed (the coarse operators are rediscretized, as in the
+ *    symbolic evaluation);
+ *  - all other molecules and their derivatives are evaluated from term
+ *    lists built by _buildValueTerms and _buildJacobianTerms.
+ *  The cache only depends on the equations and on which molecules have a
+ *  rho, so FASMultigrid and FASMultigridMPI build it alike and evaluate it
+ *  with the fas_cached_* kernels below. Besides the field sets of
+ *  fas_kernels.h, these read
+ *  - depth_idx, the depth of the fields;
+ *  - rho(eqn_id, mol_id, pos_idx), the rho of a molecule at a point;
+ *  - src(eqn_id, pos_idx), the sum of the molecules without atoms.
+ */
+class FASOperatorCache
+{
+ public:
+  std::vector<fas_op_cache_t> ops; ///< one per equation
+  idx_t total_depths;
+
+  FASOperatorCache()
+  {
+    total_depths = 0;
+  }
+
+  inline fas_op_cache_t & operator[](idx_t eqn_id)
+  {
+    return ops[eqn_id];
+  }
+
+  /**
+   * @brief group the molecules of the equations of a field set and build
+   *  their term lists
+   * @details fields also provide hasRho(eqn_id, mol_id); diagonal weights
+   *  are set by setDiagonals
+   */
+  template<typename FS>
+  void build(FS & fields, idx_t u_n, idx_t total_depths_in)
+  {
+    total_depths = total_depths_in;
+    ops.assign(u_n, fas_op_cache_t());
+
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    {
+      fas_op_cache_t & op = ops[eqn_id];
+      op.cached_src = false;
+
+      for(idx_t mol_id = 0; mol_id < fields.molecules(eqn_id); mol_id++)
+      {
+        molecule & mol = fields.mol(eqn_id, mol_id);
+        if(mol.atom_n == 0)
+        {
+          op.cached_src = true;
+          continue;
+        }
+
+        atom & ad = mol.atoms[0];
+        if(mol.atom_n == 1 && ((ad.type == FASMultigrid::poly && ad.value == 1.0)
+          || (ad.type >= FASMultigrid::der1 && ad.type <= FASMultigrid::lap)))
+        {
+          fas_linear_term_t term;
+          term.mol_id = mol_id;
+          term.u_id = ad.u_id;
+          term.type = ad.type;
+          term.coef = mol.const_coef;
+          term.has_rho = fields.hasRho(eqn_id, mol_id);
+          term.diag.assign(total_depths, 0.0);
+          op.linear.push_back(term);
+        }
+        else
+          op.symbolic.push_back(mol_id);
+      }
+
+      _buildJacobianTerms(fields, eqn_id, u_n);
+      _buildValueTerms(fields, eqn_id);
+    }
+  }
+
+  /**
+   * @brief diagonal stencil weights of one stencil order at every depth
+   */
+  template<int ORDER>
+  void setDiagonals(const idx_t * nx_h, const idx_t * ny_h, const idx_t * nz_h)
+  {
+    for(size_t eqn_id = 0; eqn_id < ops.size(); eqn_id++)
+      for(size_t t = 0; t < ops[eqn_id].linear.size(); t++)
+      {
+        fas_linear_term_t & term = ops[eqn_id].linear[t];
+        for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+        {
+          FASGridView<real_t> dims(NULL, 1, nx_h[depth_idx], ny_h[depth_idx],
+            nz_h[depth_idx]);
+          term.diag[depth_idx] = term.coef * ((term.type == FASMultigrid::poly)
+            ? 1.0 : fas_atom_diag_coef<ORDER>(term.type, dims));
+        }
+      }
+
+    for(size_t eqn_id = 0; eqn_id < ops.size(); eqn_id++)
+      for(size_t u_id = 0; u_id < ops[eqn_id].jac.size(); u_id++)
+      {
+        fas_jac_list_t & jac = ops[eqn_id].jac[u_id];
+        for(size_t d = 0; d < jac.d_types.size(); d++)
+          for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+          {
+            FASGridView<real_t> dims(NULL, 1, nx_h[depth_idx],
+              ny_h[depth_idx], nz_h[depth_idx]);
+            jac.d_diag[d * total_depths + depth_idx]
+              = fas_atom_diag_coef<ORDER>(jac.d_types[d], dims);
+          }
+      }
+  }
+
+ private:
+
+  /**
+   * @brief differentiate the symbolic molecules of an equation
+   * @details For every variable the product rule is applied once, here,
+   *  instead of atom by atom at every point:
+   *  - polynomial atoms of one variable in a molecule are merged
+   *    (u^a u^b = u^(a+b)) and powers of 0 dropped;
+   *  - differentiating u^p gives p u^(p-1) v and a stencil atom the stencil
+   *    applied to v, the other atoms of the molecule becoming factors;
+   *  - atoms and stencils of v are shared by all terms, so each is evaluated
+   *    once per point however many terms use it;
+   *  - terms with the same rho, factors and derivative are merged, terms
+   *    that cancel are dropped, and variables the molecules do not depend
+   *    on get no terms at all.
+   */
+  template<typename FS>
+  void _buildJacobianTerms(FS & fields, idx_t eqn_id, idx_t u_n)
+  {
+    fas_op_cache_t & op = ops[eqn_id];
+    op.jac.assign(u_n, fas_jac_list_t());
+
+    for(idx_t u_id = 0; u_id < u_n; u_id++)
+    {
+      fas_jac_list_t & jac = op.jac[u_id];
+      std::vector<atom> atoms;
+      std::vector<idx_t> d_types;
+      std::vector<fas_jac_term_t> terms;
+
+      for(size_t m = 0; m < op.symbolic.size(); m++)
+      {
+        idx_t mol_id = op.symbolic[m];
+        molecule & mol = fields.mol(eqn_id, mol_id);
+        std::vector<atom> mol_atoms = _mergedAtoms(mol);
+
+        for(size_t a = 0; a < mol_atoms.size(); a++)
+        {
+          if(mol_atoms[a].u_id != u_id)
+            continue;
+
+          fas_jac_term_t term;
+          term.coef = mol.const_coef;
+          term.rho_mol = fields.hasRho(eqn_id, mol_id) ? mol_id : -1;
+          term.d_idx = -1;
+
+          std::vector<atom> factors;
+          for(size_t b = 0; b < mol_atoms.size(); b++)
+            if(b != a)
+              factors.push_back(mol_atoms[b]);
+
+          if(mol_atoms[a].type == FASMultigrid::poly)
+          {
+            term.coef *= mol_atoms[a].value;
+            if(mol_atoms[a].value != 1.0)
+            {
+              atom lowered = {FASMultigrid::poly, u_id, mol_atoms[a].value - 1.0};
+              factors.push_back(lowered);
+            }
+          }
+          else
+          {
+            size_t d = std::find(d_types.begin(), d_types.end(),
+              mol_atoms[a].type) - d_types.begin();
+            if(d == d_types.size())
+              d_types.push_back(mol_atoms[a].type);
+            term.d_idx = d;
+          }
+
+          for(size_t f = 0; f < factors.size(); f++)
+          {
+            size_t c = 0;
+            while(c < atoms.size() && !(atoms[c].type == factors[f].type
+                && atoms[c].u_id == factors[f].u_id
+                && (atoms[c].type != FASMultigrid::poly
+                  || atoms[c].value == factors[f].value)))
+              c++;
+            if(c == atoms.size())
+              atoms.push_back(factors[f]);
+            term.factors.push_back(c);
+          }
+          std::sort(term.factors.begin(), term.factors.end());
+
+          size_t t = 0;
+          while(t < terms.size() && !(terms[t].rho_mol == term.rho_mol
+              && terms[t].d_idx == term.d_idx && terms[t].factors == term.factors))
+            t++;
+          if(t < terms.size())
+            terms[t].coef += term.coef;
+          else
+            terms.push_back(term);
+        }
+      }
+
+      // keep the terms that did not cancel, and the atoms and stencils
+      // they use
+      std::vector<idx_t> atom_map(atoms.size(), -1), d_map(d_types.size(), -1);
+      for(size_t t = 0; t < terms.size(); t++)
+      {
+        fas_jac_term_t term = terms[t];
+        if(term.coef == 0.0)
+          continue;
+
+        for(size_t f = 0; f < term.factors.size(); f++)
+        {
+          idx_t & c = atom_map[term.factors[f]];
+          if(c < 0)
+          {
+            c = jac.atoms.size();
+            jac.atoms.push_back(atoms[term.factors[f]]);
+          }
+          term.factors[f] = c;
+        }
+        if(term.d_idx >= 0)
+        {
+          idx_t & d = d_map[term.d_idx];
+          if(d < 0)
+          {
+            d = jac.d_types.size();
+            jac.d_types.push_back(d_types[term.d_idx]);
+          }
+          term.d_idx = d;
+        }
+        jac.terms.push_back(term);
+      }
+
+      if(jac.atoms.size() > FAS_JAC_MAX_ATOMS
+        || jac.d_types.size() > FAS_JAC_MAX_ATOMS)
+      {
+        std::cout << "Equation " << eqn_id << " has more than "
+          << FAS_JAC_MAX_ATOMS << " distinct atoms in its derivative.\n";
+        throw -1;
+      }
+      jac.d_diag.assign(jac.d_types.size() * total_depths, 0.0);
+      _buildPowerChain(eqn_id, jac);
+    }
+  }
+
+  /**
+   * @brief term list of the values of the symbolic molecules of an equation
+   * @details as for the derivative lists, the (merged) atoms are shared by
+   *  all molecules and their powers come from one chain, so e.g. u^5 and
+   *  u^7 in two molecules cost six multiplications per point instead of
+   *  two calls to pow
+   */
+  template<typename FS>
+  void _buildValueTerms(FS & fields, idx_t eqn_id)
+  {
+    fas_op_cache_t & op = ops[eqn_id];
+    fas_jac_list_t & value = op.value;
+    value = fas_jac_list_t();
+
+    for(size_t m = 0; m < op.symbolic.size(); m++)
+    {
+      idx_t mol_id = op.symbolic[m];
+      molecule & mol = fields.mol(eqn_id, mol_id);
+      std::vector<atom> mol_atoms = _mergedAtoms(mol);
+
+      fas_jac_term_t term;
+      term.coef = mol.const_coef;
+      term.rho_mol = fields.hasRho(eqn_id, mol_id) ? mol_id : -1;
+      term.d_idx = -1;
+      if(term.coef == 0.0)
+        continue;
+
+      for(size_t a = 0; a < mol_atoms.size(); a++)
+      {
+        size_t c = 0;
+        while(c < value.atoms.size() && !(value.atoms[c].type == mol_atoms[a].type
+            && value.atoms[c].u_id == mol_atoms[a].u_id
+            && (value.atoms[c].type != FASMultigrid::poly
+              || value.atoms[c].value == mol_atoms[a].value)))
+          c++;
+        if(c == value.atoms.size())
+          value.atoms.push_back(mol_atoms[a]);
+        term.factors.push_back(c);
+      }
+      value.terms.push_back(term);
+    }
+
+    if(value.atoms.size() > FAS_JAC_MAX_ATOMS)
+    {
+      std::cout << "Equation " << eqn_id << " has more than "
+        << FAS_JAC_MAX_ATOMS << " distinct atoms in its molecules.\n";
+      throw -1;
+    }
+    _buildPowerChain(eqn_id, value);
+  }
+
+  /**
+   * @brief chain computing the polynomial atoms of a term list at a point
+   */
+  void _buildPowerChain(idx_t eqn_id, fas_jac_list_t & list)
+  {
+    list.powers = FASPowerChain();
+    list.atom_regs.assign(list.atoms.size(), -1);
+    for(size_t a = 0; a < list.atoms.size(); a++)
+      if(list.atoms[a].type == FASMultigrid::poly)
+        list.atom_regs[a] = list.powers.power(list.atoms[a].u_id,
+          list.atoms[a].value);
+
+    if(list.powers.registers() > FAS_JAC_MAX_REGS)
+    {
+      std::cout << "Powers in equation " << eqn_id << " need more than "
+        << FAS_JAC_MAX_REGS << " registers.\n";
+      throw -1;
+    }
+  }
+
+  /**
+   * @brief atoms of a molecule with the polynomial atoms of each variable
+   *  merged (u^a u^b = u^(a+b)) and powers of 0 dropped
+   */
+  static std::vector<atom> _mergedAtoms(molecule & mol)
+  {
+    std::vector<atom> mol_atoms;
+    for(idx_t a = 0; a < mol.atom_n; a++)
+    {
+      atom ad = mol.atoms[a];
+      size_t b = 0;
+      while(b < mol_atoms.size() && !(ad.type == FASMultigrid::poly
+          && mol_atoms[b].type == FASMultigrid::poly
+          && mol_atoms[b].u_id == ad.u_id))
+        b++;
+      if(b < mol_atoms.size())
+        mol_atoms[b].value += ad.value;
+      else
+        mol_atoms.push_back(ad);
+    }
+    for(size_t b = mol_atoms.size(); b-- > 0; )
+      if(mol_atoms[b].type == FASMultigrid::poly && mol_atoms[b].value == 0.0)
+        mol_atoms.erase(mol_atoms.begin() + b);
+    return mol_atoms;
+  }
+};
+
+/**
+ * @brief values of the atoms of a term list at a point
+ * @details powers are read from the registers of the list's chain
+ */
+template<int ORDER, typename FS>
+inline void fas_cached_atoms(FS & fields, fas_jac_list_t & jac, idx_t i,
+  idx_t j, idx_t k, idx_t pos_idx, real_t * atom_vals)
+{
+  real_t reg[FAS_JAC_MAX_REGS];
+  FASPowerChain & powers = jac.powers;
+  for(size_t v = 0; v < powers.u_ids.size(); v++)
+    reg[powers.base_regs[v]] = fields.u(powers.u_ids[v])[pos_idx];
+  powers.evaluate(reg);
+
+  for(size_t a = 0; a < jac.atoms.size(); a++)
+  {
+    atom & ad = jac.atoms[a];
+    if(ad.type == FASMultigrid::poly)
+      atom_vals[a] = reg[jac.atom_regs[a]];
+    else
+    {
+      typename FS::view_t vd = fields.u(ad.u_id);
+      atom_vals[a] = fas_atom_stencil<ORDER>(ad.type, i, j, k, vd);
+    }
+  }
+}
+
+/**
+ * @brief rho factor of a linear molecule at a point (1 without rho)
+ */
+template<typename FS>
+inline real_t fas_linear_term_rho(FS & fields, idx_t eqn_id,
+  fas_linear_term_t & term, idx_t pos_idx)
+{
+  return term.has_rho ? fields.rho(eqn_id, term.mol_id, pos_idx) : 1.0;
+}
+
+/**
+ * @brief value of a term of a term list at a point, without v
+ * @param atom_vals values of the list's atoms at the point
+ */
+template<typename FS>
+inline real_t fas_cached_term(FS & fields, idx_t eqn_id, fas_jac_term_t & term,
+  idx_t pos_idx, const real_t * atom_vals)
+{
+  real_t val = term.coef;
+  if(term.rho_mol >= 0)
+    val *= fields.rho(eqn_id, term.rho_mol, pos_idx);
+  for(size_t f = 0; f < term.factors.size(); f++)
+    val *= atom_vals[term.factors[f]];
+  return val;
+}
+
+/**
+ * @brief value of an equation at a point: source and linear molecules from
+ *  the cache, the symbolic ones from their term list (shared atoms and
+ *  powers)
+ */
+template<int ORDER, typename FS>
+inline real_t fas_cached_equation_pt(FS & fields, FASOperatorCache & cache,
+  idx_t eqn_id, idx_t i, idx_t j, idx_t k)
+{
+  real_t res = 0.0;
+  idx_t pos_idx = H_INDEX(i, j, k, fields.nx, fields.ny, fields.nz);
+  fas_op_cache_t & op = cache[eqn_id];
+
+  if(op.cached_src)
+    res = fields.src(eqn_id, pos_idx);
+
+  for(size_t t = 0; t < op.linear.size(); t++)
+  {
+    fas_linear_term_t & term = op.linear[t];
+    typename FS::view_t vd = fields.u(term.u_id);
+    real_t val = (term.type == FASMultigrid::poly) ? vd[pos_idx]
+      : fas_atom_stencil<ORDER>(term.type, i, j, k, vd);
+    res += term.coef * fas_linear_term_rho(fields, eqn_id, term, pos_idx) * val;
+  }
+
+  // symbolic molecules from their term list
+  fas_jac_list_t & value = op.value;
+  if(value.terms.empty())
+    return res;
+
+  real_t atom_vals[FAS_JAC_MAX_ATOMS];
+  fas_cached_atoms<ORDER>(fields, value, i, j, k, pos_idx, atom_vals);
+  for(size_t t = 0; t < value.terms.size(); t++)
+    res += fas_cached_term(fields, eqn_id, value.terms[t], pos_idx, atom_vals);
+  return res;
+}
+
+/**
+ * @brief coefficients of the Newton iteration for v at a point (see
+ *  fas_iteration_pt) from the cache
+ * @details source molecules do not depend on u; linear ones use their
+ *  cached diagonal weights and symbolic ones their derivative list
+ */
+template<int ORDER, typename FS, typename VT>
+inline void fas_cached_iteration_pt(FS & fields, FASOperatorCache & cache,
+  idx_t eqn_id, real_t & coef_a, real_t & coef_b, idx_t i, idx_t j, idx_t k,
+  idx_t u_id, VT & jac_vd)
+{
+  idx_t pos_idx = H_INDEX(i, j, k, fields.nx, fields.ny, fields.nz);
+  idx_t depth_idx = fields.depth_idx;
+  fas_op_cache_t & op = cache[eqn_id];
+
+  for(size_t t = 0; t < op.linear.size(); t++)
+  {
+    fas_linear_term_t & term = op.linear[t];
+    if(term.u_id != u_id)
+      continue;
+
+    real_t rho = fas_linear_term_rho(fields, eqn_id, term, pos_idx);
+    if(term.type != FASMultigrid::poly)
+      coef_a += rho * (term.coef * fas_atom_stencil<ORDER>(term.type, i, j, k, jac_vd)
+        - term.diag[depth_idx] * jac_vd[pos_idx]);
+    coef_b += rho * term.diag[depth_idx];
+  }
+
+  // symbolic molecules from their derivative list
+  fas_jac_list_t & jac = op.jac[u_id];
+  if(jac.terms.empty())
+    return;
+
+  real_t atom_vals[FAS_JAC_MAX_ATOMS], d_off[FAS_JAC_MAX_ATOMS];
+  real_t v = jac_vd[pos_idx];
+  fas_cached_atoms<ORDER>(fields, jac, i, j, k, pos_idx, atom_vals);
+
+  // off-diagonal part of the stencils goes to a, the diagonal to b
+  for(size_t d = 0; d < jac.d_types.size(); d++)
+    d_off[d] = fas_atom_stencil<ORDER>(jac.d_types[d], i, j, k, jac_vd)
+      - jac.d_diag[d * cache.total_depths + depth_idx] * v;
+
+  for(size_t t = 0; t < jac.terms.size(); t++)
+  {
+    fas_jac_term_t & term = jac.terms[t];
+    real_t val = fas_cached_term(fields, eqn_id, term, pos_idx, atom_vals);
+    if(term.d_idx < 0)
+      coef_b += val;
+    else
+    {
+      coef_a += val * d_off[term.d_idx];
+      coef_b += val * jac.d_diag[term.d_idx * cache.total_depths + depth_idx];
+    }
+  }
+}
+
+/**
+ * @brief value of v * \partial F(u) / \partial u_id at a point from the
+ *  cache
+ */
+template<int ORDER, typename FS, typename VT>
+inline real_t fas_cached_der_equation_pt(FS & fields, FASOperatorCache & cache,
+  idx_t eqn_id, idx_t i, idx_t j, idx_t k, idx_t u_id, VT & jac_vd)
+{
+  real_t res = 0.0;
+  idx_t pos_idx = H_INDEX(i, j, k, fields.nx, fields.ny, fields.nz);
+  fas_op_cache_t & op = cache[eqn_id];
+
+  for(size_t t = 0; t < op.linear.size(); t++)
+  {
+    fas_linear_term_t & term = op.linear[t];
+    if(term.u_id != u_id)
+      continue;
+
+    real_t der_atom = (term.type == FASMultigrid::poly) ? jac_vd[pos_idx]
+      : fas_atom_stencil<ORDER>(term.type, i, j, k, jac_vd);
+    res += term.coef * fas_linear_term_rho(fields, eqn_id, term, pos_idx) * der_atom;
+  }
+
+  // symbolic molecules from their derivative list
+  fas_jac_list_t & jac = op.jac[u_id];
+  if(jac.terms.empty())
+    return res;
+
+  real_t atom_vals[FAS_JAC_MAX_ATOMS], d_vals[FAS_JAC_MAX_ATOMS];
+  fas_cached_atoms<ORDER>(fields, jac, i, j, k, pos_idx, atom_vals);
+  for(size_t d = 0; d < jac.d_types.size(); d++)
+    d_vals[d] = fas_atom_stencil<ORDER>(jac.d_types[d], i, j, k, jac_vd);
+
+  for(size_t t = 0; t < jac.terms.size(); t++)
+  {
+    fas_jac_term_t & term = jac.terms[t];
+    res += fas_cached_term(fields, eqn_id, term, pos_idx, atom_vals)
+      * (term.d_idx < 0 ? jac_vd[pos_idx] : d_vals[term.d_idx]);
+  }
+  return res;
+}
+
+} // namespace cosmo
+
+#endif
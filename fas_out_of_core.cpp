@@ -0,0 +1,163 @@
+#include "fas_out_of_core.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace cosmo
+{
+
+FASOutOfCore::~FASOutOfCore()
+{
+  for(size_t r = 0; r < regions.size(); r++)
+    munmap(regions[r].base, regions[r].bytes);
+}
+
+/**
+ * @brief enable file-backed fine grids
+ *
+ * @param dir_in scratch directory (should be on a fast local disk)
+ * @param fine_nx_in number of planes of the fine grids
+ */
+void FASOutOfCore::init(const std::string & dir_in, idx_t fine_nx_in)
+{
+  dir = dir_in;
+  fine_nx = fine_nx_in;
+  enabled = true;
+}
+
+/**
+ * @brief map a zero-filled grid backed by a new file in dir
+ * @details the file is unlinked right away, so it disappears with the
+ *  mapping (or the process)
+ *
+ * @param bytes size of the grid
+ * @param plane_bytes size of one i plane
+ * @return start of the grid, page aligned
+ */
+void * FASOutOfCore::allocate(size_t bytes, size_t plane_bytes)
+{
+  std::string path = dir + "/fas_grid_XXXXXX";
+  std::vector<char> name(path.begin(), path.end());
+  name.push_back('\0');
+
+  int fd = mkstemp(&name[0]);
+  if(fd < 0 || ftruncate(fd, bytes) != 0)
+  {
+    std::cout << "Unable to create out-of-core grid in " << dir << "\n";
+    throw -1;
+  }
+  unlink(&name[0]);
+
+  void * base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED)
+  {
+    std::cout << "Unable to map out-of-core grid in " << dir << "\n";
+    throw -1;
+  }
+  madvise(base, bytes, MADV_SEQUENTIAL);
+
+  region_t region = {(char *) base, bytes, plane_bytes};
+  regions.push_back(region);
+  return base;
+}
+
+/**
+ * @brief unmap a grid from allocate()
+ * @return false if base was not allocated here
+ */
+bool FASOutOfCore::release(void * base)
+{
+  for(size_t r = 0; r < regions.size(); r++)
+    if(regions[r].base == base)
+    {
+      munmap(regions[r].base, regions[r].bytes);
+      regions.erase(regions.begin() + r);
+      return true;
+    }
+  return false;
+}
+
+thread_local FASOutOfCore::sweep_t FASOutOfCore::sweep = {NULL, 0, 0, 0, 0};
+
+/**
+ * @brief track the chunk of planes the calling thread sweeps
+ * @details a sweep continues while planes advance by at most two (the
+ *  restriction steps through fine planes two at a time); anything else
+ *  starts a new chunk at plane i
+ */
+void FASOutOfCore::_plane(idx_t i)
+{
+  sweep_t & s = sweep;
+  if(s.owner != this || i < s.last || i > s.last + 2)
+  {
+    s.owner = this;
+    s.next_advance = i + window_planes;
+    // the first planes are also read by the previous chunk's stencils
+    s.released = i + stencil_radius;
+    s.prefetched = i;
+  }
+  s.last = i;
+
+  if(i >= s.next_advance)
+  {
+    idx_t release_end = std::max(s.released,
+      i - window_planes - stencil_radius);
+    _advance(s, i, release_end);
+    s.next_advance = i + window_planes;
+    s.released = release_end;
+    s.prefetched = std::max(s.prefetched, i + 2 * window_planes);
+  }
+}
+
+/**
+ * @brief prefetch up to the window after plane i and release planes
+ *  [s.released, release_end) of the grids the sweep touches
+ * @details a grid is touched if plane i - 1, which lies in the thread's
+ *  chunk, is resident; released ranges are shrunk to whole pages inside
+ *  them, so pages shared with a neighbouring chunk are kept
+ */
+void FASOutOfCore::_advance(const sweep_t & s, idx_t i, idx_t release_end)
+{
+  long page = sysconf(_SC_PAGESIZE);
+
+  for(size_t r = 0; r < regions.size(); r++)
+  {
+    region_t & g = regions[r];
+    size_t nx = g.bytes / g.plane_bytes;
+
+    unsigned char resident = 0;
+    size_t probe = ((i - 1) * g.plane_bytes) / page * page;
+    if(mincore(g.base + probe, 1, &resident) != 0 || !(resident & 1))
+      continue;
+
+    if(release_end > s.released)
+    {
+      size_t begin = (s.released * g.plane_bytes + page - 1) / page * page;
+      size_t end = release_end * g.plane_bytes / page * page;
+      if(end > begin)
+      {
+#ifdef MADV_PAGEOUT
+        madvise(g.base + begin, end - begin, MADV_PAGEOUT);
+#else
+        madvise(g.base + begin, end - begin, MADV_DONTNEED);
+#endif
+      }
+    }
+
+    size_t ahead_begin = std::min(nx, (size_t) std::max(s.prefetched, i));
+    size_t ahead_end = std::min(nx, (size_t) (i + 2 * window_planes));
+    if(ahead_end > ahead_begin)
+    {
+      size_t begin = ahead_begin * g.plane_bytes / page * page;
+      madvise(g.base + begin, ahead_end * g.plane_bytes - begin, MADV_WILLNEED);
+    }
+  }
+}
+
+} // namespace cosmo
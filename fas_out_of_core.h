@@ -0,0 +1,91 @@
+#ifndef FAS_OUT_OF_CORE_H
+#define FAS_OUT_OF_CORE_H
+
+#include <string>
+#include <vector>
+
+#include "../../cosmo_types.h"
+
+namespace cosmo
+{
+
+/**
+ * @brief file-backed storage of the fine grids for solves larger than memory
+ * @details Fine grids are mapped from unlinked temporary files in a scratch
+ *  directory (MAP_SHARED), so the kernel's page cache holds only the parts
+ *  being worked on and pages out the rest. Kernels sweep grids plane by
+ *  plane (i slowest, each thread a contiguous chunk of planes) and call
+ *  plane() at the start of every plane. Every window_planes planes of its
+ *  chunk, a thread prefetches the next window (MADV_WILLNEED) and releases
+ *  the window before the previous one (MADV_PAGEOUT, or MADV_DONTNEED where
+ *  unavailable; data is kept in the file) of the fine grids the sweep
+ *  touches, i.e. whose plane before the current one is resident, so each
+ *  thread keeps about three windows resident. Releases stay within the
+ *  thread's own chunk (whole pages only), so no thread pages out planes
+ *  another one is working on. Grids are released with release() rather
+ *  than delete [].
+ */
+class FASOutOfCore
+{
+ public:
+
+  typedef struct {
+    char * base;
+    size_t bytes;
+    size_t plane_bytes;
+  } region_t;
+
+  bool enabled;
+  std::string dir;       ///< scratch directory of the backing files
+  idx_t fine_nx;         ///< planes of the fine grids
+  idx_t window_planes;   ///< planes prefetched / released at a time
+  idx_t stencil_radius;  ///< planes behind a window kept for the stencils
+
+  std::vector<region_t> regions;
+
+  FASOutOfCore()
+  {
+    enabled = false;
+    fine_nx = 0;
+    window_planes = 8;
+    stencil_radius = 4;
+  }
+
+  ~FASOutOfCore();
+
+  void init(const std::string & dir_in, idx_t fine_nx_in);
+
+  void * allocate(size_t bytes, size_t plane_bytes);
+
+  bool release(void * base);
+
+  /**
+   * @brief start of plane i of a grid with nx planes, see class description
+   */
+  inline void plane(idx_t nx, idx_t i)
+  {
+    if(enabled && nx == fine_nx)
+      _plane(i);
+  }
+
+ private:
+
+  // sweep of the calling thread
+  typedef struct {
+    const FASOutOfCore * owner;
+    idx_t last;          ///< last plane started
+    idx_t next_advance;  ///< plane of the next prefetch / release
+    idx_t released;      ///< planes of the chunk before this are released
+    idx_t prefetched;    ///< planes before this are prefetched
+  } sweep_t;
+
+  static thread_local sweep_t sweep;
+
+  void _plane(idx_t i);
+
+  void _advance(const sweep_t & s, idx_t i, idx_t release_end);
+};
+
+} // namespace cosmo
+
+#endif
@@ -0,0 +1,208 @@
+#include "fas_perf_counters.h"
+#include <omp.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace cosmo
+{
+
+#ifdef __linux__
+/**
+ * @brief open a counter for the calling thread
+ * @return file descriptor, -1 on failure
+ */
+static int fas_perf_open(unsigned int type, unsigned long long config)
+{
+  struct perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  // pid = 0, cpu = -1: the calling thread, on any CPU
+  return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static bool fas_cpu_is_intel()
+{
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while(std::getline(cpuinfo, line))
+    if(line.compare(0, 9, "vendor_id") == 0)
+      return line.find("GenuineIntel") != std::string::npos;
+  return false;
+}
+#endif
+
+/**
+ * @brief open counters on every thread of the OpenMP pool
+ * @return true if at least cycles, instructions and LLC misses could be
+ *  opened on all threads
+ */
+bool FASPerfCounters::open()
+{
+  close();
+
+#ifdef __linux__
+  // FP_ARITH_INST_RETIRED (event 0xc7) umasks for double precision
+  const unsigned long long fp_config[4] = {0x01c7, 0x04c7, 0x10c7, 0x40c7};
+  bool intel = fas_cpu_is_intel();
+  bool ok = true, fp_ok = intel;
+
+  threads = omp_get_max_threads();
+  fds.assign(threads * hw_n, -1);
+
+  #pragma omp parallel num_threads(threads) reduction(&&:ok, fp_ok)
+  {
+    idx_t tid = omp_get_thread_num();
+    int * fd = &fds[tid * hw_n];
+
+    fd[hw_cycles] = fas_perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fd[hw_instructions] = fas_perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fd[hw_llc_misses] = fas_perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    ok = fd[hw_cycles] >= 0 && fd[hw_instructions] >= 0 && fd[hw_llc_misses] >= 0;
+
+    if(fp_ok)
+      for(idx_t c = 0; c < 4; c++)
+      {
+        fd[hw_fp_scalar + c] = fas_perf_open(PERF_TYPE_RAW, fp_config[c]);
+        fp_ok = fp_ok && fd[hw_fp_scalar + c] >= 0;
+      }
+  }
+
+  available = ok;
+  fp_available = ok && fp_ok;
+  if(!available)
+    close();
+  else if(!fp_available)
+    for(idx_t t = 0; t < threads; t++)
+      for(idx_t c = hw_fp_scalar; c < hw_n; c++)
+        if(fds[t * hw_n + c] >= 0)
+        {
+          ::close(fds[t * hw_n + c]);
+          fds[t * hw_n + c] = -1;
+        }
+#endif
+
+  return available;
+}
+
+void FASPerfCounters::close()
+{
+#ifdef __linux__
+  for(size_t c = 0; c < fds.size(); c++)
+    if(fds[c] >= 0)
+      ::close(fds[c]);
+#endif
+  fds.clear();
+  available = false;
+  fp_available = false;
+}
+
+/**
+ * @brief current counts summed over all threads
+ * @param values hw_n counts; zero for counters that are not available
+ */
+void FASPerfCounters::read(long long * values)
+{
+  for(idx_t c = 0; c < hw_n; c++)
+    values[c] = 0;
+
+#ifdef __linux__
+  for(idx_t t = 0; t < threads && available; t++)
+    for(idx_t c = 0; c < hw_n; c++)
+    {
+      int fd = fds[t * hw_n + c];
+      unsigned long long buf[3]; // value, time enabled, time running
+      if(fd < 0 || ::read(fd, buf, sizeof(buf)) != sizeof(buf))
+        continue;
+      if(buf[2] > 0 && buf[2] < buf[1])
+        values[c] += (long long) ((double) buf[0] * buf[1] / buf[2]);
+      else
+        values[c] += buf[0];
+    }
+#endif
+}
+
+/**
+ * @brief double precision floating point operations from FP counts
+ */
+long long FASPerfCounters::flops(const long long * values)
+{
+  return values[hw_fp_scalar] + 2*values[hw_fp_128]
+    + 4*values[hw_fp_256] + 8*values[hw_fp_512];
+}
+
+const char * FASPerfCounters::counterName(idx_t counter)
+{
+  switch(counter)
+  {
+    case hw_cycles:       return "cycles";
+    case hw_instructions: return "instructions";
+    case hw_llc_misses:   return "llc_misses";
+    case hw_fp_scalar:    return "fp_scalar_double";
+    case hw_fp_128:       return "fp_128_packed_double";
+    case hw_fp_256:       return "fp_256_packed_double";
+    case hw_fp_512:       return "fp_512_packed_double";
+    default:              return "unknown";
+  }
+}
+
+/**
+ * @brief STREAM-style triad bandwidth, a[i] = b[i] + s * c[i]
+ * @details arrays are first touched in parallel with the same static
+ *  schedule as the triad; 24 bytes are counted per element as in STREAM
+ *  (write allocate traffic is not counted)
+ *
+ * @param n array length, should be well beyond the last level cache
+ * @param reps repetitions, the best is reported
+ * @return bandwidth in bytes / s
+ */
+real_t FASPerfCounters::streamTriad(idx_t n, idx_t reps)
+{
+  double * a = new double[n];
+  double * b = new double[n];
+  double * c = new double[n];
+  double best = 1e100;
+  const double s = 3.0;
+
+  #pragma omp parallel for schedule(static)
+  for(idx_t i = 0; i < n; i++)
+  {
+    a[i] = 0.0;
+    b[i] = 1.0;
+    c[i] = 2.0;
+  }
+
+  for(idx_t r = 0; r < reps; r++)
+  {
+    double start = omp_get_wtime();
+    #pragma omp parallel for schedule(static)
+    for(idx_t i = 0; i < n; i++)
+      a[i] = b[i] + s * c[i];
+    best = std::min(best, omp_get_wtime() - start);
+  }
+
+  // keep the result alive
+  volatile double sink = a[n/2];
+  (void) sink;
+
+  delete [] a;
+  delete [] b;
+  delete [] c;
+
+  return 3.0 * sizeof(double) * n / best;
+}
+
+} // namespace cosmo
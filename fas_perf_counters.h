@@ -0,0 +1,79 @@
+#ifndef FAS_PERF_COUNTERS_H
+#define FAS_PERF_COUNTERS_H
+
+#include <vector>
+
+#include "../../cosmo_types.h"
+
+// read hardware performance counters (Linux perf_event_open) around each
+// instrumented multigrid phase; requires FAS_INSTRUMENTATION
+#ifndef FAS_PERF_COUNTERS
+  #define FAS_PERF_COUNTERS 0
+#endif
+
+namespace cosmo
+{
+
+/**
+ * @brief hardware performance counters of all OpenMP threads
+ * @details Each thread of the OpenMP pool opens counters for itself
+ *  (perf_event_open on the calling thread), so counts are per thread and
+ *  read() sums them; this assumes the pool is not recreated while the
+ *  counters are open, as is the case with the usual OpenMP runtimes.
+ *  Counts are scaled by time enabled / time running when the kernel has to
+ *  multiplex counters. Floating point operations use the Intel
+ *  FP_ARITH_INST_RETIRED events (double precision, weighted by vector
+ *  width) and are unavailable on other CPUs. Only supported on Linux;
+ *  elsewhere, or if the kernel refuses (see
+ *  /proc/sys/kernel/perf_event_paranoid), available is false.
+ */
+class FASPerfCounters
+{
+ public:
+
+  enum counter_t
+  {
+    hw_cycles,
+    hw_instructions,
+    hw_llc_misses,  // last level cache misses
+    hw_fp_scalar,   // scalar double instructions
+    hw_fp_128,      // 128 bit packed double instructions
+    hw_fp_256,      // 256 bit packed double instructions
+    hw_fp_512,      // 512 bit packed double instructions
+    hw_n
+  };
+
+  bool available;     ///< cycles, instructions and LLC misses are counted
+  bool fp_available;  ///< floating point operations are counted
+
+  std::vector<int> fds;  ///< file descriptors [thread * hw_n + counter], -1 if not opened
+  idx_t threads;
+
+  FASPerfCounters()
+  {
+    available = false;
+    fp_available = false;
+    threads = 0;
+  }
+
+  ~FASPerfCounters()
+  {
+    close();
+  }
+
+  bool open();
+
+  void close();
+
+  void read(long long * values);
+
+  static long long flops(const long long * values);
+
+  static const char * counterName(idx_t counter);
+
+  static real_t streamTriad(idx_t n, idx_t reps);
+};
+
+} // namespace cosmo
+
+#endif
@@ -0,0 +1,335 @@
+#ifndef FAS_POWERS_H
+#define FAS_POWERS_H
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "../../cosmo_types.h"
+
+// largest integer part of an exponent computed by multiplication; larger
+// and non (half-)integer exponents use pow
+#ifndef FAS_POW_MAX_CHAIN
+  #define FAS_POW_MAX_CHAIN 64
+#endif
+
+// lanes processed at once by fas_pow_lanes
+#define FAS_POW_LANE_CHUNK 64
+
+namespace cosmo
+{
+
+/**
+ * @brief powers of solution values
+ * @details Exponents in equations are nearly always small integers (u^5,
+ *  u^-7) or half-integers, for which a few multiplications, at most one
+ *  reciprocal and one sqrt are much cheaper than pow:
+ *  - fas_pow is a drop-in for pow(x, p) at a single point;
+ *  - fas_pow_lanes raises a contiguous array (e.g. a plane of a grid) to
+ *    one power, the multiplication chain shared by all lanes so the loops
+ *    vectorize;
+ *  - fas_pow_pair and fas_pow_pair_lanes give u^p and u^(p-1), the value
+ *    of a polynomial atom and of its derivative, from one power;
+ *  - FASPowerChain computes all powers of some variables needed at a point
+ *    (e.g. u^7, u^6 and u^-1 for the value and the derivative of several
+ *    molecules) from one memoized chain, so shared intermediate powers are
+ *    computed once.
+ *  Results agree with pow up to rounding (a few ulp for large exponents).
+ */
+
+/**
+ * @brief split an exponent into |p| = m (+ 1/2 if half), or return false
+ *  if it is not chained
+ */
+inline bool fas_pow_split(real_t p, idx_t & m, bool & half)
+{
+  real_t a = std::fabs(p);
+  if(!(a <= FAS_POW_MAX_CHAIN))
+    return false;
+
+  m = (idx_t) a;
+  half = (a - m == 0.5);
+  return half || a == (real_t) m;
+}
+
+/**
+ * @brief x^p for an exponent known to be (half-)integer, see fas_pow_split
+ */
+inline real_t fas_pow_chain(real_t x, idx_t m, bool half, bool negative)
+{
+  real_t res = half ? std::sqrt(x) : 1.0, sq = x;
+  for(; m > 0; m >>= 1)
+  {
+    if(m & 1)
+      res *= sq;
+    if(m > 1)
+      sq *= sq;
+  }
+  return negative ? 1.0 / res : res;
+}
+
+/**
+ * @brief x^p, by multiplication for (half-)integer p up to FAS_POW_MAX_CHAIN
+ */
+inline real_t fas_pow(real_t x, real_t p)
+{
+  idx_t m;
+  bool half;
+  if(!fas_pow_split(p, m, half))
+    return std::pow(x, p);
+  return fas_pow_chain(x, m, half, p < 0.0);
+}
+
+/**
+ * @brief res[l] = x[l]^p for n lanes
+ * @details the exponent is decoded once; for (half-)integer p every step
+ *  of the chain is a simd loop over up to FAS_POW_LANE_CHUNK lanes
+ */
+inline void fas_pow_lanes(const real_t * x, real_t p, idx_t n, real_t * res)
+{
+  idx_t m, l;
+  bool half;
+  if(!fas_pow_split(p, m, half))
+  {
+    for(l = 0; l < n; l++)
+      res[l] = std::pow(x[l], p);
+    return;
+  }
+
+  real_t sq[FAS_POW_LANE_CHUNK];
+  for(idx_t c = 0; c < n; c += FAS_POW_LANE_CHUNK)
+  {
+    idx_t lanes = std::min((idx_t) FAS_POW_LANE_CHUNK, n - c);
+    const real_t * xc = x + c;
+    real_t * rc = res + c;
+
+    #pragma omp simd
+    for(l = 0; l < lanes; l++)
+    {
+      rc[l] = half ? std::sqrt(xc[l]) : 1.0;
+      sq[l] = xc[l];
+    }
+
+    for(idx_t e = m; e > 0; e >>= 1)
+    {
+      if(e & 1)
+      {
+        #pragma omp simd
+        for(l = 0; l < lanes; l++)
+          rc[l] *= sq[l];
+      }
+      if(e > 1)
+      {
+        #pragma omp simd
+        for(l = 0; l < lanes; l++)
+          sq[l] *= sq[l];
+      }
+    }
+
+    if(p < 0.0)
+    {
+      #pragma omp simd
+      for(l = 0; l < lanes; l++)
+        rc[l] = 1.0 / rc[l];
+    }
+  }
+}
+
+/**
+ * @brief val = x^p and der_pow = x^(p-1) from one power
+ * @details x^p = x^(p-1) x for p >= 1, x^(p-1) = x^p / x otherwise
+ */
+inline void fas_pow_pair(real_t x, real_t p, real_t & val, real_t & der_pow)
+{
+  if(p >= 1.0)
+  {
+    der_pow = fas_pow(x, p - 1.0);
+    val = der_pow * x;
+  }
+  else
+  {
+    val = fas_pow(x, p);
+    der_pow = val / x;
+  }
+}
+
+/**
+ * @brief fas_pow_pair for n lanes
+ */
+inline void fas_pow_pair_lanes(const real_t * x, real_t p, idx_t n,
+  real_t * val, real_t * der_pow)
+{
+  idx_t l;
+  if(p >= 1.0)
+  {
+    fas_pow_lanes(x, p - 1.0, n, der_pow);
+    #pragma omp simd
+    for(l = 0; l < n; l++)
+      val[l] = der_pow[l] * x[l];
+  }
+  else
+  {
+    fas_pow_lanes(x, p, n, val);
+    #pragma omp simd
+    for(l = 0; l < n; l++)
+      der_pow[l] = val[l] / x[l];
+  }
+}
+
+/**
+ * @brief powers of several variables at a point from one shared chain
+ * @details Values live in registers: the caller stores the value of
+ *  variable u_ids[v] in reg[base_regs[v]] and calls evaluate, after which
+ *  u^p is in the register returned by power(u_id, p) when the chain was
+ *  built. Every intermediate power is memoized, so x^7 (x^2 = x x,
+ *  x^3 = x^2 x, x^6 = x^3 x^3, x^7 = x^6 x) also provides x^6 for the
+ *  derivative, and negative powers share one reciprocal of x.
+ */
+class FASPowerChain
+{
+ public:
+
+  enum op_t
+  {
+    op_mul,   // reg[a] * reg[b]
+    op_recip, // 1 / reg[a]
+    op_sqrt,  // sqrt(reg[a])
+    op_pow    // pow(reg[a], p)
+  };
+
+  typedef struct
+  {
+    op_t op;
+    idx_t dst, a, b;
+    real_t p;
+  } step_t;
+
+  std::vector<idx_t> u_ids;      ///< variables whose values are loaded
+  std::vector<idx_t> base_regs;  ///< register of each of them
+  std::vector<step_t> steps;     ///< operations, in dependency order
+
+  FASPowerChain()
+  {
+    regs = 0;
+  }
+
+  /**
+   * @brief registers used by evaluate
+   */
+  inline idx_t registers() const
+  {
+    return regs;
+  }
+
+  /**
+   * @brief register holding u^p, adding the steps that compute it
+   */
+  idx_t power(idx_t u_id, real_t p)
+  {
+    idx_t x = _base(u_id), m;
+    bool half;
+
+    if(p == 1.0)
+      return x;
+    if(p == 0.0 || !fas_pow_split(p, m, half))
+      return _op(op_pow, x, -1, p);
+
+    // negative powers are powers of 1 / x
+    idx_t b = (p < 0.0) ? _op(op_recip, x, -1, 0.0) : x;
+    idx_t r = (m > 0) ? _intPow(b, m) : -1;
+    if(half)
+    {
+      idx_t s = _op(op_sqrt, b, -1, 0.0);
+      r = (r < 0) ? s : _mul(r, s);
+    }
+    return r;
+  }
+
+  /**
+   * @brief run the chain on loaded base registers
+   */
+  inline void evaluate(real_t * reg) const
+  {
+    for(size_t s = 0; s < steps.size(); s++)
+    {
+      const step_t & st = steps[s];
+      switch(st.op)
+      {
+        case op_mul:   reg[st.dst] = reg[st.a] * reg[st.b]; break;
+        case op_recip: reg[st.dst] = 1.0 / reg[st.a]; break;
+        case op_sqrt:  reg[st.dst] = std::sqrt(reg[st.a]); break;
+        default:       reg[st.dst] = std::pow(reg[st.a], st.p); break;
+      }
+    }
+  }
+
+ private:
+
+  typedef std::pair<idx_t, idx_t> reg_pair_t;
+  typedef std::pair<reg_pair_t, real_t> op_key_t;
+
+  idx_t regs;
+  std::map<reg_pair_t, idx_t> int_pows; ///< (base reg, m) -> reg
+  std::map<op_key_t, idx_t> ops;        ///< ((op, a), b or p) -> reg
+
+  idx_t _base(idx_t u_id)
+  {
+    for(size_t v = 0; v < u_ids.size(); v++)
+      if(u_ids[v] == u_id)
+        return base_regs[v];
+
+    u_ids.push_back(u_id);
+    base_regs.push_back(regs);
+    return regs++;
+  }
+
+  idx_t _op(op_t op, idx_t a, idx_t b, real_t p)
+  {
+    op_key_t key(reg_pair_t(op, a), (op == op_mul) ? (real_t) b : p);
+    std::map<op_key_t, idx_t>::iterator it = ops.find(key);
+    if(it != ops.end())
+      return it->second;
+
+    step_t st = {op, regs, a, b, p};
+    steps.push_back(st);
+    ops[key] = regs;
+    return regs++;
+  }
+
+  idx_t _mul(idx_t a, idx_t b)
+  {
+    return (a < b) ? _op(op_mul, a, b, 0.0) : _op(op_mul, b, a, 0.0);
+  }
+
+  /**
+   * @brief register holding reg[b]^m (m >= 1), by squaring
+   */
+  idx_t _intPow(idx_t b, idx_t m)
+  {
+    if(m == 1)
+      return b;
+
+    reg_pair_t key(b, m);
+    std::map<reg_pair_t, idx_t>::iterator it = int_pows.find(key);
+    if(it != int_pows.end())
+      return it->second;
+
+    idx_t r;
+    if(m % 2 == 0)
+    {
+      idx_t h = _intPow(b, m / 2);
+      r = _mul(h, h);
+    }
+    else
+      r = _mul(_intPow(b, m - 1), b);
+
+    int_pows[key] = r;
+    return r;
+  }
+};
+
+} // namespace cosmo
+
+#endif
@@ -0,0 +1,758 @@
+#include "fas_refinement.h"
+
+namespace cosmo
+{
+
+/**
+ * @brief set every value of a patch grid
+ */
+static void fas_fill_patch_grid(arr_t & grid, real_t value)
+{
+  idx_t i, j, k;
+  idx_t nx = grid.nx, ny = grid.ny, nz = grid.nz;
+
+  #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+  FAS_LOOP3_N(i, j, k, nx, ny, nz)
+  {
+    grid[H_INDEX(i, j, k, nx, ny, nz)] = value;
+  }
+}
+
+/**
+ * @brief allocate a patch grid and zero it
+ */
+static void fas_init_patch_grid(arr_t & grid, idx_t nx, idx_t ny, idx_t nz)
+{
+  grid.init(nx, ny, nz);
+  fas_fill_patch_grid(grid, 0.0);
+}
+
+/**
+ * @brief FAC solver on top of a base solver
+ * @details patches are added with addPatch; the base solver must have its
+ *  equations, sources and stencil order set up (initializeRhoHeirarchy
+ *  called) before initialize
+ *
+ * @param base_in solver of the base grid, used for the coarse solves
+ */
+FASRefinement::FASRefinement(FASMultigrid & base_in)
+  : base(base_in)
+{
+  pre_sweeps = 3;
+  post_sweeps = 3;
+  jacobi_weight = 0.8;
+  verbosity = 0;
+
+  max_level = 0;
+  initialized = false;
+
+  u_n = base.u_n;
+  r = base.stencil_order / 2;
+}
+
+FASRefinement::~FASRefinement()
+{
+  for(size_t p_id = 0; p_id < patch_list.size(); p_id++)
+  {
+    FASRefinementPatch & p = patch_list[p_id];
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    {
+      delete [] p.u[eqn_id]._array;
+      delete [] p.src[eqn_id]._array;
+      delete [] p.tmp[eqn_id]._array;
+      delete [] p.u_old[eqn_id]._array;
+      for(idx_t mol_id = 0; mol_id < base.molecule_n[eqn_id]; mol_id++)
+        delete [] p.rho[eqn_id][mol_id]._array;
+      delete [] p.rho[eqn_id];
+      delete [] p.rho_set[eqn_id];
+    }
+    delete [] p.u;
+    delete [] p.src;
+    delete [] p.tmp;
+    delete [] p.u_old;
+    delete [] p.rho;
+    delete [] p.rho_set;
+  }
+}
+
+/**
+ * @brief register a refined patch
+ * @details The patch covers cells i0 .. i0 + ni - 1 (and likewise along y
+ *  and z) of the grid of level - 1: the fine grid of the base solver for
+ *  level 1, a patch of level - 1 otherwise, with indexes counted in the
+ *  points of the whole (periodic) domain at that level and not wrapped,
+ *  e.g. patch i of level 1 with lo[0] = 10 is at level 1 points 20 .. 20 +
+ *  2 ni. The stencil order of the base solver must be set before.
+ *
+ * @param level refinement level (1: twice as fine as the base grid)
+ * @param i0, j0, k0 first parent point
+ * @param ni, nj, nk parent cells covered
+ * @return id of the patch
+ */
+idx_t FASRefinement::addPatch(idx_t level, idx_t i0, idx_t j0, idx_t k0,
+  idx_t ni, idx_t nj, idx_t nk)
+{
+  FASRefinementPatch p;
+  idx_t base_n[3] = { base.nx_h[base.max_depth_idx],
+    base.ny_h[base.max_depth_idx], base.nz_h[base.max_depth_idx] };
+
+  r = base.stencil_order / 2;
+
+  p.level = level;
+  p.parent = -1;
+  p.lo[0] = i0; p.lo[1] = j0; p.lo[2] = k0;
+  p.n[0] = ni; p.n[1] = nj; p.n[2] = nk;
+
+  if(initialized)
+  {
+    std::cout << "Patches must be added before FASRefinement::initialize.\n";
+    throw -1;
+  }
+
+  for(idx_t d = 0; d < 3; d++)
+    if(p.n[d] < 2 * (r/2 + 1))
+    {
+      std::cout << "Refinement patches must cover at least "
+                << 2 * (r/2 + 1) << " cells along each axis.\n";
+      throw -1;
+    }
+
+  if(level == 1)
+  {
+    for(idx_t d = 0; d < 3; d++)
+    {
+      if(p.lo[d] < 0 || p.lo[d] >= base_n[d] || p.n[d] + 4 > base_n[d])
+      {
+        std::cout << "Refinement patch does not fit in the base grid.\n";
+        throw -1;
+      }
+      p.p_off[d] = p.lo[d];
+    }
+  }
+  else if(level > 1)
+  {
+    // the parent keeps interpolation and restriction of the patch away
+    // from its own interface
+    for(size_t q_id = 0; q_id < patch_list.size() && p.parent < 0; q_id++)
+    {
+      FASRefinementPatch & q = patch_list[q_id];
+      idx_t q_n[3] = { q.nx, q.ny, q.nz };
+      bool inside = (q.level == level - 1);
+      for(idx_t d = 0; d < 3 && inside; d++)
+      {
+        idx_t off = p.lo[d] - 2 * q.lo[d];
+        inside = off >= r && off + p.n[d] <= q_n[d] - 1 - r;
+      }
+      if(inside)
+      {
+        p.parent = q_id;
+        for(idx_t d = 0; d < 3; d++)
+          p.p_off[d] = p.lo[d] - 2 * q.lo[d];
+      }
+    }
+
+    if(p.parent < 0)
+    {
+      std::cout << "Refinement patch of level " << level
+                << " is not inside a patch of level " << level - 1 << ".\n";
+      throw -1;
+    }
+  }
+  else
+  {
+    std::cout << "Refinement levels start at 1.\n";
+    throw -1;
+  }
+
+  // patches of a level restrict to disjoint parent points
+  for(size_t q_id = 0; q_id < patch_list.size(); q_id++)
+  {
+    FASRefinementPatch & q = patch_list[q_id];
+    if(q.level != level)
+      continue;
+
+    bool overlap = true;
+    for(idx_t d = 0; d < 3 && overlap; d++)
+    {
+      // level 1 patches may wrap around the periodic base grid
+      idx_t period = (level == 1) ? base_n[d] : 0;
+      bool axis_overlap = false;
+      for(idx_t s = -1; s <= 1; s++)
+        if(p.lo[d] + s * period <= q.lo[d] + q.n[d]
+          && q.lo[d] <= p.lo[d] + s * period + p.n[d])
+          axis_overlap = true;
+      overlap = axis_overlap;
+    }
+    if(overlap)
+    {
+      std::cout << "Refinement patches of level " << level << " overlap.\n";
+      throw -1;
+    }
+  }
+
+  p.nx = 2 * p.n[0] + 1;
+  p.ny = 2 * p.n[1] + 1;
+  p.nz = 2 * p.n[2] + 1;
+  for(idx_t d = 0; d < 3; d++)
+    p.dx[d] = H_LEN_FRAC / (real_t) (base_n[d] * (1 << level));
+
+  p.u = new arr_t[u_n];
+  p.src = new arr_t[u_n];
+  p.tmp = new arr_t[u_n];
+  p.u_old = new arr_t[u_n];
+  p.rho = new arr_t *[u_n];
+  p.rho_set = new bool *[u_n];
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    fas_init_patch_grid(p.u[eqn_id], p.nx, p.ny, p.nz);
+    fas_init_patch_grid(p.src[eqn_id], p.nx, p.ny, p.nz);
+    fas_init_patch_grid(p.tmp[eqn_id], p.nx, p.ny, p.nz);
+    fas_init_patch_grid(p.u_old[eqn_id], p.n[0] + 3, p.n[1] + 3, p.n[2] + 3);
+
+    p.rho[eqn_id] = new arr_t[base.molecule_n[eqn_id]];
+    p.rho_set[eqn_id] = new bool[base.molecule_n[eqn_id]];
+    for(idx_t mol_id = 0; mol_id < base.molecule_n[eqn_id]; mol_id++)
+      p.rho_set[eqn_id][mol_id] = false;
+  }
+
+  _buildInterpolation(p);
+
+  patch_list.push_back(p);
+  max_level = std::max(max_level, level);
+
+  return patch_list.size() - 1;
+}
+
+/**
+ * @brief set the source (rho) of a molecule at a point of a patch
+ * @details as FASMultigrid::setPolySrcAtPt: points that are not set are
+ *  zero. Molecules whose source is not set on a patch use the interpolated
+ *  source of the parent.
+ */
+void FASRefinement::setPolySrcAtPt(idx_t patch_id, idx_t eqn_id,
+  idx_t mol_id, idx_t i, idx_t j, idx_t k, real_t value)
+{
+  FASRefinementPatch & p = patch_list[patch_id];
+
+  if(!p.rho_set[eqn_id][mol_id])
+  {
+    if(p.rho[eqn_id][mol_id].pts == 0)
+      fas_init_patch_grid(p.rho[eqn_id][mol_id], p.nx, p.ny, p.nz);
+    p.rho_set[eqn_id][mol_id] = true;
+  }
+
+  p.rho[eqn_id][mol_id][H_INDEX(i, j, k, p.nx, p.ny, p.nz)] = value;
+}
+
+/**
+ * @brief cubic interpolation weights from the parent along every axis
+ */
+void FASRefinement::_buildInterpolation(FASRefinementPatch & p)
+{
+  idx_t dims[3] = { p.nx, p.ny, p.nz };
+
+  for(idx_t d = 0; d < 3; d++)
+  {
+    p.interp_first[d].resize(dims[d]);
+    p.interp_w[d].assign(4 * dims[d], 0.0);
+    for(idx_t f = 0; f < dims[d]; f++)
+    {
+      p.interp_first[d][f] = p.p_off[d] + f/2 - 1;
+      real_t * w = &p.interp_w[d][4*f];
+      if(f % 2 == 0)
+        w[1] = 1.0;
+      else
+      {
+        w[0] = -1.0/16.0;
+        w[1] = 9.0/16.0;
+        w[2] = 9.0/16.0;
+        w[3] = -1.0/16.0;
+      }
+    }
+  }
+}
+
+/**
+ * @brief interpolate a parent grid to a point of a patch
+ *
+ * @param coarse view of the parent grid
+ * @param around coarse holds only the parent points around the patch
+ *  (u_old), starting at p_off - 1
+ */
+real_t FASRefinement::_interpolatePt(FASRefinementPatch & p,
+  fas_view_t coarse, idx_t i, idx_t j, idx_t k, bool around)
+{
+  idx_t ci = p.interp_first[0][i], cj = p.interp_first[1][j],
+        ck = p.interp_first[2][k];
+  const real_t * wi = &p.interp_w[0][4*i], * wj = &p.interp_w[1][4*j],
+               * wk = &p.interp_w[2][4*k];
+  real_t res = 0.0;
+
+  if(around)
+  {
+    ci -= p.p_off[0] - 1;
+    cj -= p.p_off[1] - 1;
+    ck -= p.p_off[2] - 1;
+  }
+
+  for(idx_t a = 0; a < 4; a++)
+    for(idx_t b = 0; b < 4; b++)
+    {
+      real_t w_ab = wi[a] * wj[b];
+      if(w_ab == 0.0)
+        continue;
+      for(idx_t c = 0; c < 4; c++)
+        if(wk[c] != 0.0)
+          res += w_ab * wk[c] * coarse[H_INDEX(ci + a, cj + b, ck + c,
+            coarse.nx, coarse.ny, coarse.nz)];
+    }
+
+  return res;
+}
+
+/**
+ * @brief solution of a variable on the parent of a patch
+ */
+FASRefinement::fas_view_t FASRefinement::_parentU(FASRefinementPatch & p,
+  idx_t u_id)
+{
+  if(p.parent < 0)
+    return base._uView(u_id, base.max_depth_idx);
+
+  arr_t & u = patch_list[p.parent].u[u_id];
+  return fas_view_t(u._array, 1, u.nx, u.ny, u.nz);
+}
+
+/**
+ * @brief FAS source of an equation on the parent of a patch
+ */
+FASRefinement::fas_view_t FASRefinement::_parentSrc(FASRefinementPatch & p,
+  idx_t eqn_id)
+{
+  arr_t & src = (p.parent < 0)
+    ? base.coarse_src_h[eqn_id][base.max_depth_idx]
+    : patch_list[p.parent].src[eqn_id];
+  return fas_view_t(src._array, 1, src.nx, src.ny, src.nz);
+}
+
+/**
+ * @brief source of a molecule on the parent of a patch (pts = 0: none)
+ */
+FASRefinement::fas_view_t FASRefinement::_parentRho(FASRefinementPatch & p,
+  idx_t eqn_id, idx_t mol_id)
+{
+  arr_t & rho = (p.parent < 0)
+    ? base.rho_h[eqn_id][mol_id][base.max_depth_idx]
+    : patch_list[p.parent].rho[eqn_id][mol_id];
+  return fas_view_t(rho._array, 1, rho.nx, rho.ny, rho.nz);
+}
+
+/**
+ * @brief value of an equation at a point of the parent of a patch
+ */
+real_t FASRefinement::_parentEquationPt(FASRefinementPatch & p,
+  idx_t eqn_id, idx_t i, idx_t j, idx_t k)
+{
+  if(p.parent < 0)
+    return base._evaluateEllipticEquationPt(eqn_id, base.max_depth_idx,
+      i, j, k);
+  return _evaluateEquationPt(patch_list[p.parent], eqn_id, i, j, k);
+}
+
+/**
+ * @brief value of an equation at a point of a patch
+ */
+real_t FASRefinement::_evaluateEquationPt(FASRefinementPatch & p,
+  idx_t eqn_id, idx_t i, idx_t j, idx_t k)
+{
+  fas_patch_fields_t fields(base, p);
+
+  switch(base.stencil_order)
+  {
+    case 2: return fas_equation_pt<2>(fields, eqn_id, i, j, k);
+    case 6: return fas_equation_pt<6>(fields, eqn_id, i, j, k);
+    case 8: return fas_equation_pt<8>(fields, eqn_id, i, j, k);
+    default: return fas_equation_pt<4>(fields, eqn_id, i, j, k);
+  }
+}
+
+/**
+ * @brief derivative of an equation with respect to its own variable at
+ *  a point of a patch (the diagonal of the Jacobian)
+ */
+real_t FASRefinement::_diagDerivativePt(FASRefinementPatch & p,
+  idx_t eqn_id, idx_t i, idx_t j, idx_t k)
+{
+  fas_patch_fields_t fields(base, p);
+  fas_patch_view_t * no_v = NULL;
+  real_t coef_a = 0.0, coef_b = 0.0;
+
+  switch(base.stencil_order)
+  {
+    case 2: fas_iteration_pt<2>(fields, eqn_id, coef_a, coef_b, i, j, k, eqn_id, no_v); break;
+    case 6: fas_iteration_pt<6>(fields, eqn_id, coef_a, coef_b, i, j, k, eqn_id, no_v); break;
+    case 8: fas_iteration_pt<8>(fields, eqn_id, coef_a, coef_b, i, j, k, eqn_id, no_v); break;
+    default: fas_iteration_pt<4>(fields, eqn_id, coef_a, coef_b, i, j, k, eqn_id, no_v); break;
+  }
+  return coef_b;
+}
+
+/**
+ * @brief parent cells m_first .. m_last along axis d receive the
+ *  restriction of a patch
+ * @details the full weighting of parent point p_off + m reads patch points
+ *  2m - 1 .. 2m + 1, which must all be solved for
+ */
+void FASRefinement::_covered(FASRefinementPatch & p, idx_t d,
+  idx_t & m_first, idx_t & m_last)
+{
+  m_first = r/2 + 1;
+  m_last = p.n[d] - m_first;
+}
+
+/**
+ * @brief damped nonlinear Jacobi sweeps over the solved points of a patch
+ * @details u -= w (F(u) - src) / (dF/du), all equations updated together
+ */
+void FASRefinement::_relaxPatch(FASRefinementPatch & p, idx_t sweeps)
+{
+  idx_t i, j, k;
+  idx_t nx = p.nx, ny = p.ny, nz = p.nz;
+
+  for(idx_t s = 0; s < sweeps; s++)
+  {
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    {
+      arr_t & u = p.u[eqn_id];
+      arr_t & src = p.src[eqn_id];
+      arr_t & tmp = p.tmp[eqn_id];
+
+      #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+      FAS_LOOP3_N(i, j, k, nx, ny, nz)
+      {
+        if(!_solved(p, i, j, k))
+          continue;
+
+        idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+        real_t der = _diagDerivativePt(p, eqn_id, i, j, k);
+        tmp[idx] = u[idx];
+        if(der != 0.0)
+          tmp[idx] -= jacobi_weight
+            * (_evaluateEquationPt(p, eqn_id, i, j, k) - src[idx]) / der;
+      }
+    }
+
+    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    {
+      arr_t & u = p.u[eqn_id];
+      arr_t & tmp = p.tmp[eqn_id];
+
+      #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+      FAS_LOOP3_N(i, j, k, nx, ny, nz)
+      {
+        if(_solved(p, i, j, k))
+          u[H_INDEX(i, j, k, nx, ny, nz)] = tmp[H_INDEX(i, j, k, nx, ny, nz)];
+      }
+    }
+  }
+}
+
+/**
+ * @brief restrict the solution of a patch to its parent and set the FAS
+ *  source there, keeping the parent solution around the patch in u_old
+ */
+void FASRefinement::_restrictToParent(FASRefinementPatch & p)
+{
+  idx_t i, j, k;
+  idx_t nx = p.nx, ny = p.ny, nz = p.nz;
+  idx_t mi0, mi1, mj0, mj1, mk0, mk1;
+  const real_t fw[3] = { 0.25, 0.5, 0.25 };
+
+  _covered(p, 0, mi0, mi1);
+  _covered(p, 1, mj0, mj1);
+  _covered(p, 2, mk0, mk1);
+
+  // residual src - F(u) of the patch
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    arr_t & src = p.src[eqn_id];
+    arr_t & tmp = p.tmp[eqn_id];
+
+    #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+    FAS_LOOP3_N(i, j, k, nx, ny, nz)
+    {
+      if(!_solved(p, i, j, k))
+        continue;
+      idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+      tmp[idx] = src[idx] - _evaluateEquationPt(p, eqn_id, i, j, k);
+    }
+  }
+
+  // solution first: the parent equations below use it around each point.
+  // Injected rather than averaged, so parent values next to the interface,
+  // which the interface interpolation reads, are point values.
+  for(idx_t u_id = 0; u_id < u_n; u_id++)
+  {
+    fas_view_t coarse = _parentU(p, u_id);
+    arr_t & u = p.u[u_id];
+
+    #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+    for(i = mi0; i <= mi1; i++)
+      for(j = mj0; j <= mj1; j++)
+        for(k = mk0; k <= mk1; k++)
+          coarse[H_INDEX(p.p_off[0] + i, p.p_off[1] + j, p.p_off[2] + k,
+            coarse.nx, coarse.ny, coarse.nz)] = u[H_INDEX(2*i, 2*j, 2*k,
+            nx, ny, nz)];
+  }
+
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    fas_view_t coarse_src = _parentSrc(p, eqn_id);
+    arr_t & tmp = p.tmp[eqn_id];
+
+    #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+    for(i = mi0; i <= mi1; i++)
+      for(j = mj0; j <= mj1; j++)
+        for(k = mk0; k <= mk1; k++)
+        {
+          real_t val = 0.0;
+          for(idx_t a = 0; a < 3; a++)
+            for(idx_t b = 0; b < 3; b++)
+              for(idx_t c = 0; c < 3; c++)
+                val += fw[a] * fw[b] * fw[c] * tmp[H_INDEX(2*i + a - 1,
+                  2*j + b - 1, 2*k + c - 1, nx, ny, nz)];
+
+          idx_t ci = p.p_off[0] + i, cj = p.p_off[1] + j,
+                ck = p.p_off[2] + k;
+          coarse_src[H_INDEX(ci, cj, ck, coarse_src.nx, coarse_src.ny,
+            coarse_src.nz)] = _parentEquationPt(p, eqn_id, ci, cj, ck) + val;
+        }
+  }
+
+  // the parent solution the correction will be measured against
+  for(idx_t u_id = 0; u_id < u_n; u_id++)
+  {
+    fas_view_t coarse = _parentU(p, u_id);
+    arr_t & u_old = p.u_old[u_id];
+    idx_t ox = u_old.nx, oy = u_old.ny, oz = u_old.nz;
+
+    #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+    FAS_LOOP3_N(i, j, k, ox, oy, oz)
+    {
+      u_old[H_INDEX(i, j, k, ox, oy, oz)] = coarse[H_INDEX(p.p_off[0] - 1 + i,
+        p.p_off[1] - 1 + j, p.p_off[2] - 1 + k, coarse.nx, coarse.ny, coarse.nz)];
+    }
+  }
+}
+
+/**
+ * @brief add the interpolated change of the parent solution since
+ *  _restrictToParent to a patch; interface points take the interpolated
+ *  parent solution
+ */
+void FASRefinement::_correctFromParent(FASRefinementPatch & p)
+{
+  idx_t i, j, k;
+  idx_t nx = p.nx, ny = p.ny, nz = p.nz;
+
+  for(idx_t u_id = 0; u_id < u_n; u_id++)
+  {
+    fas_view_t coarse = _parentU(p, u_id);
+    arr_t & u_old = p.u_old[u_id];
+    arr_t & u = p.u[u_id];
+    idx_t ox = u_old.nx, oy = u_old.ny, oz = u_old.nz;
+
+    // u_old becomes the change of the parent solution
+    #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+    FAS_LOOP3_N(i, j, k, ox, oy, oz)
+    {
+      idx_t idx = H_INDEX(i, j, k, ox, oy, oz);
+      u_old[idx] = coarse[H_INDEX(p.p_off[0] - 1 + i, p.p_off[1] - 1 + j,
+        p.p_off[2] - 1 + k, coarse.nx, coarse.ny, coarse.nz)] - u_old[idx];
+    }
+
+    fas_view_t change(u_old._array, 1, ox, oy, oz);
+
+    #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+    FAS_LOOP3_N(i, j, k, nx, ny, nz)
+    {
+      idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+      if(_solved(p, i, j, k))
+        u[idx] += _interpolatePt(p, change, i, j, k, true);
+      else
+        u[idx] = _interpolatePt(p, coarse, i, j, k, false);
+    }
+  }
+}
+
+/**
+ * @brief set the whole solution of a patch from its parent
+ */
+void FASRefinement::_setFromParent(FASRefinementPatch & p)
+{
+  idx_t i, j, k;
+  idx_t nx = p.nx, ny = p.ny, nz = p.nz;
+
+  for(idx_t u_id = 0; u_id < u_n; u_id++)
+  {
+    fas_view_t coarse = _parentU(p, u_id);
+    arr_t & u = p.u[u_id];
+
+    #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+    FAS_LOOP3_N(i, j, k, nx, ny, nz)
+    {
+      u[H_INDEX(i, j, k, nx, ny, nz)] = _interpolatePt(p, coarse, i, j, k,
+        false);
+    }
+  }
+}
+
+/**
+ * @brief set up sources and initial solutions of the patches
+ * @details Molecules with a source on the parent but none set on a patch
+ *  get the interpolated source of the parent. Parent sources under a patch
+ *  need not match the patch's: the FAS source set by every FAC cycle
+ *  cancels them. Patch solutions start from the interpolated parent
+ *  solution.
+ */
+void FASRefinement::initialize()
+{
+  idx_t i, j, k;
+
+  r = base.stencil_order / 2;
+
+  // interpolated sources, coarsest level first
+  for(idx_t level = 1; level <= max_level; level++)
+    for(size_t p_id = 0; p_id < patch_list.size(); p_id++)
+    {
+      FASRefinementPatch & p = patch_list[p_id];
+      if(p.level != level)
+        continue;
+
+      for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+        for(idx_t mol_id = 0; mol_id < base.molecule_n[eqn_id]; mol_id++)
+        {
+          fas_view_t coarse = _parentRho(p, eqn_id, mol_id);
+          arr_t & rho = p.rho[eqn_id][mol_id];
+          if(p.rho_set[eqn_id][mol_id] || coarse.pts == 0)
+            continue;
+
+          if(rho.pts == 0)
+            fas_init_patch_grid(rho, p.nx, p.ny, p.nz);
+
+          #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+          FAS_LOOP3_N(i, j, k, p.nx, p.ny, p.nz)
+          {
+            rho[H_INDEX(i, j, k, p.nx, p.ny, p.nz)] = _interpolatePt(p,
+              coarse, i, j, k, false);
+          }
+        }
+    }
+
+  for(idx_t level = 1; level <= max_level; level++)
+    for(size_t p_id = 0; p_id < patch_list.size(); p_id++)
+      if(patch_list[p_id].level == level)
+        _setFromParent(patch_list[p_id]);
+
+  initialized = true;
+}
+
+/**
+ * @brief one FAC cycle, see class description
+ */
+void FASRefinement::FACCycle()
+{
+  if(!initialized)
+    initialize();
+
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    base._zeroGrid(base.coarse_src_h[eqn_id][base.max_depth_idx]);
+    for(size_t p_id = 0; p_id < patch_list.size(); p_id++)
+      fas_fill_patch_grid(patch_list[p_id].src[eqn_id], 0.0);
+  }
+
+  for(idx_t level = max_level; level >= 1; level--)
+    for(size_t p_id = 0; p_id < patch_list.size(); p_id++)
+    {
+      FASRefinementPatch & p = patch_list[p_id];
+      if(p.level != level)
+        continue;
+      _relaxPatch(p, pre_sweeps);
+      _restrictToParent(p);
+    }
+
+  base.VCycle();
+
+  for(idx_t level = 1; level <= max_level; level++)
+    for(size_t p_id = 0; p_id < patch_list.size(); p_id++)
+    {
+      FASRefinementPatch & p = patch_list[p_id];
+      if(p.level != level)
+        continue;
+      _correctFromParent(p);
+      _relaxPatch(p, post_sweeps);
+    }
+
+  if(verbosity > 0)
+  {
+    real_t patch_residual = 0.0;
+    for(size_t p_id = 0; p_id < patch_list.size(); p_id++)
+      patch_residual = std::max(patch_residual, getMaxResidual(p_id));
+    std::cout << "  FAC cycle max. residual on base grid / patches: "
+              << base._getMaxResidualAllEqs(base.max_depth) << " / "
+              << patch_residual << ".\n" << std::flush;
+  }
+}
+
+/**
+ * @brief FAC cycles, the base solver using the interleaved layout if set
+ */
+void FASRefinement::FACCycles(idx_t num_cycles)
+{
+  base._syncInterleavedSolution(true);
+
+  for(idx_t n = 0; n < num_cycles; ++n)
+    FACCycle();
+
+  base._syncInterleavedSolution(false);
+}
+
+/**
+ * @brief max. residual |src - F(u)| over the solved points of a patch
+ */
+real_t FASRefinement::getMaxResidual(idx_t patch_id)
+{
+  FASRefinementPatch & p = patch_list[patch_id];
+  idx_t i, j, k;
+  real_t max_residual = 0.0;
+
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    arr_t & src = p.src[eqn_id];
+
+    #pragma omp parallel for default(shared) private(i,j,k) reduction(max:max_residual) schedule(static)
+    FAS_LOOP3_N(i, j, k, p.nx, p.ny, p.nz)
+    {
+      if(!_solved(p, i, j, k))
+        continue;
+      real_t residual = std::fabs(src[H_INDEX(i, j, k, p.nx, p.ny, p.nz)]
+        - _evaluateEquationPt(p, eqn_id, i, j, k));
+      max_residual = std::max(max_residual, residual);
+    }
+  }
+  return max_residual;
+}
+
+/**
+ * @brief max. residual of the composite grid (base grid and all patches)
+ */
+real_t FASRefinement::getMaxResidualAll()
+{
+  real_t max_residual = base._getMaxResidualAllEqs(base.max_depth);
+  for(size_t p_id = 0; p_id < patch_list.size(); p_id++)
+    max_residual = std::max(max_residual, getMaxResidual(p_id));
+  return max_residual;
+}
+
+} // namespace cosmo
@@ -0,0 +1,221 @@
+#ifndef FAS_REFINEMENT_H
+#define FAS_REFINEMENT_H
+
+#include <vector>
+
+#include "full_multigrid.h"
+#include "fas_kernels.h"
+
+namespace cosmo
+{
+
+/**
+ * @brief rectangular region refined by a factor of 2 in every direction
+ * @details Refines n[d] cells of its parent (the fine grid of the base
+ *  solver at level 1, a patch of level - 1 otherwise) and stores the
+ *  2 n[d] + 1 points along each axis that cover them, point 2 m coinciding
+ *  with point p_off[d] + m of the parent. Points within r = stencil order / 2
+ *  of a face are the interface: they are interpolated from the parent, the
+ *  others are solved for. All grids are indexed with H_INDEX over the patch
+ *  dimensions; stencils of solved points never reach past the storage.
+ */
+class FASRefinementPatch
+{
+ public:
+  idx_t level;     ///< refinements of the base grid (1 or more)
+  idx_t parent;    ///< patch refined by this one (-1: the base grid)
+  idx_t lo[3];     ///< first parent point, in the global points of level - 1
+  idx_t n[3];      ///< parent cells covered
+  idx_t p_off[3];  ///< first parent point, in the storage of the parent
+  idx_t nx, ny, nz;
+  real_t dx[3];    ///< spacing along x, y and z
+
+  arr_t * u;      ///< solution of each variable
+  arr_t * src;    ///< FAS source of each equation (from refining patches)
+  arr_t * tmp;    ///< relaxed values / residuals
+  arr_t * u_old;  ///< parent solution around the patch before the coarse solve
+  arr_t ** rho;   ///< sources of each molecule (pts = 0: none)
+  bool ** rho_set; ///< rho of a molecule was set by the user
+
+  // cubic interpolation from the parent along each axis: fine point f uses
+  // the parent (storage) points interp_first[d][f] .. + 3
+  std::vector<idx_t> interp_first[3];
+  std::vector<real_t> interp_w[3];  ///< 4 weights per fine point
+};
+
+/**
+ * @brief fast adaptive composite (FAC) solves with locally refined patches
+ * @details Adds block-structured refinement to a FASMultigrid solver: its
+ *  fine grid is the coarsest level of a composite grid, refined by the
+ *  patches registered with addPatch. Patches of a level must not overlap,
+ *  and patches of level 2 and up must lie inside a patch of the level
+ *  below, a few points from its interface.
+ *
+ *  A FAC cycle works like a V-cycle whose finer levels only exist on the
+ *  patches. From the finest level down, the patches are relaxed (damped
+ *  nonlinear Jacobi), their solution is injected into the parent at the
+ *  covered parent points and their residual restricted there (full
+ *  weighting) into the FAS source: the parent equation becomes
+ *
+ *    F_parent(R u) = F_parent(R u) + R (src - F_patch(u)),
+ *
+ *  so the parent solves for the restriction of the patch solution. Full
+ *  weighting gives every fine point the same total weight, so the fine
+ *  residual, i.e. the balance of fine grid fluxes, is carried into the
+ *  parent equations without loss (flux matching). The base grid is then
+ *  solved with one V-cycle of the base solver (coarse_src of its fine grid
+ *  holds the FAS sources), and from the coarsest level up the patches are
+ *  corrected by the interpolated change of their parent, their interface
+ *  points set from the parent, and relaxed again.
+ *
+ *  Relaxation of the patches uses the diagonal of the Jacobian of every
+ *  equation with respect to its own variable; equations must depend on it.
+ *  Periodic problems with a constant null space (e.g. a pure Poisson
+ *  equation) should use inexact_newton_constrained on the base grid,
+ *  since the composite sources only sum to zero up to truncation errors.
+ */
+class FASRefinement
+{
+ public:
+  idx_t pre_sweeps;     ///< relaxation sweeps of a patch before the coarse solve
+  idx_t post_sweeps;    ///< and after
+  real_t jacobi_weight; ///< damping of the Jacobi updates
+  idx_t verbosity;      ///< 1: max. residuals after every FAC cycle
+
+  FASRefinement(FASMultigrid & base_in);
+  ~FASRefinement();
+
+  idx_t addPatch(idx_t level, idx_t i0, idx_t j0, idx_t k0, idx_t ni,
+    idx_t nj, idx_t nk);
+
+  void setPolySrcAtPt(idx_t patch_id, idx_t eqn_id, idx_t mol_id, idx_t i,
+    idx_t j, idx_t k, real_t value);
+
+  void initialize();
+
+  void FACCycle();
+
+  void FACCycles(idx_t num_cycles);
+
+  real_t getMaxResidual(idx_t patch_id);
+
+  real_t getMaxResidualAll();
+
+  inline idx_t patches()
+  {
+    return patch_list.size();
+  }
+
+  inline FASRefinementPatch & getPatch(idx_t patch_id)
+  {
+    return patch_list[patch_id];
+  }
+
+  /**
+   * @brief solution of a variable on a patch
+   * @details point (i, j, k) is at global point 2 lo + (i, j, k) of the
+   *  patch level
+   */
+  inline arr_t & getSolution(idx_t patch_id, idx_t u_id)
+  {
+    return patch_list[patch_id].u[u_id];
+  }
+
+ private:
+
+  // views of parent grids (see _parentU) and of patch grids
+  typedef FASGridView<real_t> fas_view_t;
+  typedef FASPatchView<real_t> fas_patch_view_t;
+
+  FASMultigrid & base;
+  std::vector<FASRefinementPatch> patch_list;
+  idx_t max_level;
+  bool initialized;
+
+  idx_t u_n, r;
+
+  // a patch as read by the point kernels (fas_kernels.h)
+  class fas_patch_fields_t
+  {
+   public:
+    typedef fas_patch_view_t view_t;
+
+    molecule ** eqns;
+    idx_t * molecule_n;
+    FASRefinementPatch & p;
+    idx_t nx, ny, nz;
+
+    fas_patch_fields_t(FASMultigrid & base_in, FASRefinementPatch & p_in)
+      : eqns(base_in.eqns), molecule_n(base_in.molecule_n), p(p_in),
+        nx(p_in.nx), ny(p_in.ny), nz(p_in.nz)
+    {
+    }
+
+    inline idx_t molecules(idx_t eqn_id)
+    {
+      return molecule_n[eqn_id];
+    }
+
+    inline molecule & mol(idx_t eqn_id, idx_t mol_id)
+    {
+      return eqns[eqn_id][mol_id];
+    }
+
+    inline view_t u(idx_t u_id)
+    {
+      return view_t(p.u[u_id]._array, nx, ny, nz, p.dx);
+    }
+
+    inline real_t coef(idx_t eqn_id, idx_t mol_id, idx_t pos_idx)
+    {
+      real_t val = eqns[eqn_id][mol_id].const_coef;
+      if(p.rho[eqn_id][mol_id].pts > 0)
+        val *= p.rho[eqn_id][mol_id][pos_idx];
+      return val;
+    }
+  };
+
+  /**
+   * @brief point (i, j, k) of a patch is solved for (not interface)
+   */
+  inline bool _solved(FASRefinementPatch & p, idx_t i, idx_t j, idx_t k)
+  {
+    return i >= r && i < p.nx - r && j >= r && j < p.ny - r
+      && k >= r && k < p.nz - r;
+  }
+
+  fas_view_t _parentU(FASRefinementPatch & p, idx_t u_id);
+
+  fas_view_t _parentSrc(FASRefinementPatch & p, idx_t eqn_id);
+
+  fas_view_t _parentRho(FASRefinementPatch & p, idx_t eqn_id, idx_t mol_id);
+
+  real_t _parentEquationPt(FASRefinementPatch & p, idx_t eqn_id, idx_t i,
+    idx_t j, idx_t k);
+
+  void _buildInterpolation(FASRefinementPatch & p);
+
+  real_t _interpolatePt(FASRefinementPatch & p, fas_view_t coarse, idx_t i,
+    idx_t j, idx_t k, bool around);
+
+  real_t _evaluateEquationPt(FASRefinementPatch & p, idx_t eqn_id, idx_t i,
+    idx_t j, idx_t k);
+
+  real_t _diagDerivativePt(FASRefinementPatch & p, idx_t eqn_id, idx_t i,
+    idx_t j, idx_t k);
+
+  void _relaxPatch(FASRefinementPatch & p, idx_t sweeps);
+
+  void _restrictToParent(FASRefinementPatch & p);
+
+  void _correctFromParent(FASRefinementPatch & p);
+
+  void _setFromParent(FASRefinementPatch & p);
+
+  void _covered(FASRefinementPatch & p, idx_t d, idx_t & m_first,
+    idx_t & m_last);
+};
+
+} // namespace cosmo
+
+#endif
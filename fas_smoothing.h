@@ -0,0 +1,139 @@
+#ifndef FAS_SMOOTHING_H
+#define FAS_SMOOTHING_H
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <vector>
+
+#include "../../cosmo_types.h"
+
+namespace cosmo
+{
+
+/**
+ * @brief adaptive number of Newton iterations per smoothing call
+ * @details Each smoothing call (a "slot": one per depth index, plus a last
+ *  one for the pre-smoothing of the fine grid) measures how much every
+ *  Newton iteration reduces |F(u)| (the two norm accepted by the line
+ *  search) and the work it took, counted in sweeps over the fine grid
+ *  (sweeps over the level times its share of fine grid points).
+ *  An iteration whose convergence rate, ln(residual reduction) per unit of
+ *  work, is below min_rate is not worth its cost and ends the call. Fine
+ *  levels, where a sweep costs the most, therefore stop as soon as the
+ *  smoother stalls, while coarse levels keep iterating.
+ *
+ *  The number of useful iterations is remembered per slot and used as the
+ *  budget of the next call (at most max_relax_iters): it shrinks after a
+ *  wasted iteration and grows by one when the last iteration of a call
+ *  was still clearly (2 x min_rate) worthwhile. Budgets persist across
+ *  V-cycles and solves; assign one solver's controller to another to
+ *  start from its budgets.
+ */
+class FASSmoothingController
+{
+ public:
+  bool enabled;     ///< adapt iterations (off: max_relax_iters everywhere)
+  real_t min_rate;  ///< smallest ln(residual reduction) per fine grid sweep worth doing
+
+  std::vector<idx_t> budget;      ///< learned iterations per slot (0: none yet)
+  std::vector<idx_t> last_iters;  ///< iterations done by the last call, per slot
+  std::vector<real_t> last_rate;  ///< rate of the last measured iteration, per slot
+
+  FASSmoothingController()
+  {
+    enabled = false;
+    min_rate = 0.05;
+  }
+
+  /**
+   * @brief size for a number of slots, keeping learned budgets
+   */
+  void init(idx_t slots)
+  {
+    budget.resize(slots, 0);
+    last_iters.resize(slots, 0);
+    last_rate.resize(slots, 0.0);
+  }
+
+  /**
+   * @brief iterations allowed for a call
+   * @param slot slot of the call, negative if not adaptive
+   */
+  inline idx_t iterations(idx_t slot, idx_t max_iterations)
+  {
+    if(!enabled || slot < 0 || budget[slot] == 0)
+      return max_iterations;
+    return std::min(budget[slot], max_iterations);
+  }
+
+  /**
+   * @brief record an iteration of a call
+   *
+   * @param res_before |F(u)| before the iteration
+   * @param res_after |F(u)| after it
+   * @param work fine grid sweeps it took
+   * @return false if it was not worth its work
+   */
+  inline bool worthwhile(idx_t slot, real_t res_before, real_t res_after,
+    real_t work)
+  {
+    real_t rate = std::numeric_limits<real_t>::max();
+    if(res_after > 0.0 && work > 0.0)
+      rate = std::log(res_before / res_after) / work;
+
+    last_rate[slot] = rate;
+    return rate >= min_rate;
+  }
+
+  /**
+   * @brief update the budget of a slot at the end of a call
+   *
+   * @param iters iterations done
+   * @param wasted the last one was not worthwhile
+   * @param converged the call reached the relaxation tolerance
+   */
+  void update(idx_t slot, idx_t iters, bool wasted, bool converged,
+    idx_t max_iterations)
+  {
+    last_iters[slot] = iters;
+
+    if(wasted)
+      budget[slot] = std::max((idx_t) 1, iters - 1);
+    else if(converged)
+      budget[slot] = std::max(budget[slot], std::max((idx_t) 1, iters));
+    else if(last_rate[slot] >= 2.0 * min_rate)
+      budget[slot] = std::min(max_iterations, iters + 1);
+    else
+      budget[slot] = std::max((idx_t) 1, iters);
+  }
+
+  /**
+   * @brief print the budgets and the last call of every slot
+   * @details slots are depth indexes; the last one is the fine grid
+   *  pre-smoothing
+   */
+  void print(std::ostream & out)
+  {
+    out << "slot     budget  last_iters    last_rate\n";
+    for(size_t s = 0; s < budget.size(); s++)
+    {
+      std::ostringstream name;
+      if(s + 1 == budget.size())
+        name << "pre";
+      else
+        name << "d" << s;
+
+      out << std::left << std::setw(6) << name.str() << std::right
+          << std::setw(9) << budget[s] << std::setw(12) << last_iters[s]
+          << std::setw(13) << std::setprecision(4) << last_rate[s] << "\n";
+    }
+  }
+};
+
+} // namespace cosmo
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef FAS_STENCILS_H
+#define FAS_STENCILS_H
+
+#include "../../cosmo_types.h"
+#include "../../cosmo_macros.h"
+#include "fas_grid_view.h"
+
+namespace cosmo
+{
+
+/**
+ * @brief finite difference stencils used by the multigrid solver
+ * @details Templated on the stencil order and on the derivative
+ *  direction(s), so every atom type is instantiated with its offsets and
+ *  coefficients known at compile time and fully unrolled, and on the grid
+ *  type, so the same kernels serve double grids, single precision
+ *  (correction) grids and strided views. Arithmetic is always done in
+ *  real_t. Coefficients are the standard central differences; mixed
+ *  derivatives are nested first derivatives. Supported orders are 2, 4, 6
+ *  and 8; STENCIL_ORDER only provides the default.
+ */
+
+/**
+ * @brief central difference coefficients for a stencil order
+ * @details d1(s): coefficient of f(x + s*dx) in the first derivative, s > 0
+ *  (coefficient of f(x - s*dx) is minus this);
+ *  d2(s): coefficient of f(x +/- s*dx) in the second derivative, s >= 0
+ */
+template<int ORDER>
+struct FASStencilCoefs;
+
+template<>
+struct FASStencilCoefs<2>
+{
+  static constexpr real_t d1(idx_t s)
+  {
+    return s == 1 ? 1.0/2.0 : 0.0;
+  }
+  static constexpr real_t d2(idx_t s)
+  {
+    return s == 0 ? -2.0 : (s == 1 ? 1.0 : 0.0);
+  }
+};
+
+template<>
+struct FASStencilCoefs<4>
+{
+  static constexpr real_t d1(idx_t s)
+  {
+    return s == 1 ? 2.0/3.0 : (s == 2 ? -1.0/12.0 : 0.0);
+  }
+  static constexpr real_t d2(idx_t s)
+  {
+    return s == 0 ? -5.0/2.0 : (s == 1 ? 4.0/3.0 : (s == 2 ? -1.0/12.0 : 0.0));
+  }
+};
+
+template<>
+struct FASStencilCoefs<6>
+{
+  static constexpr real_t d1(idx_t s)
+  {
+    return s == 1 ? 3.0/4.0 : (s == 2 ? -3.0/20.0 : (s == 3 ? 1.0/60.0 : 0.0));
+  }
+  static constexpr real_t d2(idx_t s)
+  {
+    return s == 0 ? -49.0/18.0 : (s == 1 ? 3.0/2.0 : (s == 2 ? -3.0/20.0
+      : (s == 3 ? 1.0/90.0 : 0.0)));
+  }
+};
+
+template<>
+struct FASStencilCoefs<8>
+{
+  static constexpr real_t d1(idx_t s)
+  {
+    return s == 1 ? 4.0/5.0 : (s == 2 ? -1.0/5.0 : (s == 3 ? 4.0/105.0
+      : (s == 4 ? -1.0/280.0 : 0.0)));
+  }
+  static constexpr real_t d2(idx_t s)
+  {
+    return s == 0 ? -205.0/72.0 : (s == 1 ? 8.0/5.0 : (s == 2 ? -1.0/5.0
+      : (s == 3 ? 8.0/315.0 : (s == 4 ? -1.0/560.0 : 0.0))));
+  }
+};
+
+/**
+ * @brief grid spacing along direction D (1 = x, 2 = y, 3 = z)
+ */
+template<int D>
+inline real_t fas_dir_spacing(idx_t nx, idx_t ny, idx_t nz)
+{
+  return H_LEN_FRAC / (real_t) (D == 1 ? nx : (D == 2 ? ny : nz));
+}
+
+/**
+ * @brief spacing of a field along direction D
+ * @details that of a periodic grid with the field's dimensions, except for
+ *  refinement patches, which carry their own
+ */
+template<int D, typename GT>
+inline real_t fas_grid_spacing(GT & field, idx_t nx, idx_t ny, idx_t nz)
+{
+  return fas_dir_spacing<D>(nx, ny, nz);
+}
+
+template<int D, typename RT>
+inline real_t fas_grid_spacing(FASPatchView<RT> & field, idx_t nx, idx_t ny,
+  idx_t nz)
+{
+  return field.dx[D-1];
+}
+
+/**
+ * @brief first derivative of field along direction D at (i, j, k)
+ */
+template<int ORDER, int D, typename GT>
+inline real_t fas_derivative(idx_t i, idx_t j, idx_t k, idx_t nx, idx_t ny,
+  idx_t nz, GT & field)
+{
+  const idx_t di = (D == 1), dj = (D == 2), dk = (D == 3);
+  real_t res = 0.0;
+
+  for(idx_t s = 1; s <= ORDER/2; ++s)
+    res += FASStencilCoefs<ORDER>::d1(s) * (
+        field[H_INDEX(i+s*di, j+s*dj, k+s*dk, nx, ny, nz)]
+      - field[H_INDEX(i-s*di, j-s*dj, k-s*dk, nx, ny, nz)] );
+
+  return res / fas_grid_spacing<D>(field, nx, ny, nz);
+}
+
+/**
+ * @brief second derivative of field along directions D1, D2 at (i, j, k)
+ */
+template<int ORDER, int D1, int D2, typename GT>
+inline real_t fas_double_derivative(idx_t i, idx_t j, idx_t k, idx_t nx,
+  idx_t ny, idx_t nz, GT & field)
+{
+  const idx_t di = (D2 == 1), dj = (D2 == 2), dk = (D2 == 3);
+  real_t dx = fas_grid_spacing<D2>(field, nx, ny, nz);
+  real_t res = 0.0;
+
+  if(D1 != D2)
+  {
+    for(idx_t s = 1; s <= ORDER/2; ++s)
+      res += FASStencilCoefs<ORDER>::d1(s) * (
+          fas_derivative<ORDER, D1>(i+s*di, j+s*dj, k+s*dk, nx, ny, nz, field)
+        - fas_derivative<ORDER, D1>(i-s*di, j-s*dj, k-s*dk, nx, ny, nz, field) );
+
+    return res / dx;
+  }
+
+  res = FASStencilCoefs<ORDER>::d2(0) * field[H_INDEX(i, j, k, nx, ny, nz)];
+  for(idx_t s = 1; s <= ORDER/2; ++s)
+    res += FASStencilCoefs<ORDER>::d2(s) * (
+        field[H_INDEX(i+s*di, j+s*dj, k+s*dk, nx, ny, nz)]
+      + field[H_INDEX(i-s*di, j-s*dj, k-s*dk, nx, ny, nz)] );
+
+  return res / (dx * dx);
+}
+
+/**
+ * @brief laplacian of field at (i, j, k)
+ */
+template<int ORDER, typename GT>
+inline real_t fas_laplacian(idx_t i, idx_t j, idx_t k, idx_t nx, idx_t ny,
+  idx_t nz, GT & field)
+{
+  return fas_double_derivative<ORDER, 1, 1>(i, j, k, nx, ny, nz, field)
+    + fas_double_derivative<ORDER, 2, 2>(i, j, k, nx, ny, nz, field)
+    + fas_double_derivative<ORDER, 3, 3>(i, j, k, nx, ny, nz, field);
+}
+
+} // namespace cosmo
+
+#endif
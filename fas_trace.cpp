@@ -0,0 +1,77 @@
+#include "fas_trace.h"
+#include <fstream>
+#include <iomanip>
+
+namespace cosmo
+{
+
+/**
+ * @brief discard recorded events and start recording
+ * @details buffers are sized for omp_get_max_threads(); call again if the
+ *  number of threads changes
+ */
+void FASTrace::start()
+{
+  buffers.clear();
+  buffers.resize(omp_get_max_threads());
+  t0 = omp_get_wtime();
+  enabled = true;
+}
+
+void FASTrace::stop()
+{
+  enabled = false;
+}
+
+/**
+ * @brief write recorded events in Chrome trace event format
+ * @details complete ("X") events with microsecond timestamps relative to
+ *  start(); depth and equation id are event arguments
+ */
+void FASTrace::writeChromeTrace(std::ostream & out)
+{
+  std::streamsize precision = out.precision();
+  std::ios::fmtflags flags = out.flags();
+  bool first = true;
+
+  out << std::fixed << std::setprecision(3);
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+
+  for(size_t tid = 0; tid < buffers.size(); tid++)
+  {
+    out << (first ? "" : ",\n")
+        << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": "
+        << tid << ", \"args\": {\"name\": \"OpenMP thread " << tid << "\"}}";
+    first = false;
+
+    std::vector<event> & events = buffers[tid].events;
+    for(size_t e = 0; e < events.size(); e++)
+    {
+      out << ",\n{\"name\": \"" << events[e].name
+          << "\", \"cat\": \"fas\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << tid
+          << ", \"ts\": " << (events[e].begin - t0) * 1e6
+          << ", \"dur\": " << (events[e].end - events[e].begin) * 1e6
+          << ", \"args\": {\"depth\": " << events[e].depth
+          << ", \"eqn\": " << events[e].eqn << "}}";
+    }
+  }
+
+  out << "\n]}\n";
+  out.flags(flags);
+  out.precision(precision);
+}
+
+/**
+ * @brief write recorded events as a Chrome trace file
+ * @return false if the file could not be written
+ */
+bool FASTrace::writeChromeTrace(const std::string & file_name)
+{
+  std::ofstream out(file_name.c_str());
+  if(!out)
+    return false;
+  writeChromeTrace(out);
+  return (bool) out;
+}
+
+} // namespace cosmo
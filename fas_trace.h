@@ -0,0 +1,125 @@
+#ifndef FAS_TRACE_H
+#define FAS_TRACE_H
+
+#include <omp.h>
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "../../cosmo_types.h"
+
+// record per-thread timelines of the multigrid kernels (Chrome trace format)
+#ifndef FAS_TRACE
+  #define FAS_TRACE 0
+#endif
+
+namespace cosmo
+{
+
+/**
+ * @brief timeline of a multigrid solve
+ * @details Every thread appends begin/end events of the kernel chunks it
+ *  executes to its own buffer, so recording needs no synchronization;
+ *  events end before the barrier closing the parallel region, so gaps in a
+ *  thread's timeline show load imbalance and time spent waiting. Serial
+ *  phases (smoothing, V-cycles) are recorded on thread 0. The result can be
+ *  written as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+ *  Recording only happens between start() and stop().
+ */
+class FASTrace
+{
+ public:
+
+  typedef struct {
+    const char * name;  ///< kernel name (string literal)
+    double begin, end;  ///< omp_get_wtime() at begin / end
+    idx_t depth;        ///< multigrid depth, -1 if not applicable
+    idx_t eqn;          ///< equation id, -1 if all / not applicable
+  } event;
+
+  // one buffer per thread, padded to avoid false sharing of the headers
+  typedef struct {
+    std::vector<event> events;
+    char pad[64];
+  } thread_buffer;
+
+  bool enabled;
+  double t0;   ///< omp_get_wtime() at start()
+
+  idx_t ctx_depth; ///< depth tag of kernels that do not know it (set from serial code)
+  idx_t ctx_eqn;   ///< equation tag of kernels that do not know it
+
+  std::vector<thread_buffer> buffers;
+
+  FASTrace()
+  {
+    enabled = false;
+    t0 = 0.0;
+    ctx_depth = -1;
+    ctx_eqn = -1;
+  }
+
+  void start();
+
+  void stop();
+
+  inline void record(const char * name, double begin, double end,
+    idx_t depth, idx_t eqn)
+  {
+    if(!enabled)
+      return;
+
+    size_t tid = omp_get_thread_num();
+    if(tid < buffers.size())
+    {
+      event e = {name, begin, end, depth, eqn};
+      buffers[tid].events.push_back(e);
+    }
+  }
+
+  void writeChromeTrace(std::ostream & out);
+
+  bool writeChromeTrace(const std::string & file_name);
+};
+
+/**
+ * @brief records an event from construction to the end of the enclosing scope
+ */
+class FASTraceScope
+{
+  FASTrace & trace;
+  const char * name;
+  idx_t depth, eqn;
+  double begin;
+
+ public:
+  FASTraceScope(FASTrace & trace_in, const char * name_in, idx_t depth_in,
+    idx_t eqn_in)
+    : trace(trace_in), name(name_in), depth(depth_in), eqn(eqn_in)
+  {
+    begin = trace.enabled ? omp_get_wtime() : 0.0;
+  }
+
+  ~FASTraceScope()
+  {
+    if(trace.enabled)
+      trace.record(name, begin, omp_get_wtime(), depth, eqn);
+  }
+};
+
+} // namespace cosmo
+
+#define FAS_TRACE_CAT_(a, b) a##b
+#define FAS_TRACE_CAT(a, b) FAS_TRACE_CAT_(a, b)
+
+#if FAS_TRACE
+  #define FAS_TRACE_SCOPE(trace, name, depth, eqn) \
+    FASTraceScope FAS_TRACE_CAT(fas_trace_scope_, __LINE__)((trace), (name), (depth), (eqn))
+  #define FAS_TRACE_CONTEXT(trace, depth, eqn) \
+    do { (trace).ctx_depth = (depth); (trace).ctx_eqn = (eqn); } while(0)
+#else
+  #define FAS_TRACE_SCOPE(trace, name, depth, eqn)
+  #define FAS_TRACE_CONTEXT(trace, depth, eqn)
+#endif
+
+#endif
@@ -1,5 +1,15 @@
 #include "full_multigrid.h"
 #include "../../utils/math.h"
+#include "fas_kernels.h"
+#include "fas_operator_cache.h"
+#include <limits>
+#include <sstream>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
 
 namespace cosmo
 {
@@ -12,11 +22,22 @@ namespace cosmo
  * @param[in]  set how many layers we want
  * @param[in]  set number of interations for each relaxation
  * @param[in]  set relaxation jump out precision
+ * @param[in]  storage layout of the solution heirarchies
  */
 FASMultigrid::FASMultigrid(fas_heirarchy_t u_in, idx_t u_n_in, idx_t molecule_n_in [],
-              idx_t max_depth_in, idx_t max_relax_iters_in,  real_t relaxation_tolerance_in)
+              idx_t max_depth_in, idx_t max_relax_iters_in,  real_t relaxation_tolerance_in,
+              layout_t layout_in, const std::string & out_of_core_dir)
 {
   relax_scheme = relax_t::inexact_newton;
+  jacobian_block_sweeps = 1;
+  verbosity = 0;
+  layout = layout_in;
+  cycle = 0;
+  checkpoint_interval = 0;
+  tuning_cache_file = FAS_TUNING_CACHE_FILE;
+  tuned_threads = 0;
+  relax_sweeps = 0;
+  line_search_norm = 0.0;
 
   max_relax_iters = max_relax_iters_in;
   max_depth = max_depth_in;
@@ -24,34 +45,55 @@ FASMultigrid::FASMultigrid(fas_heirarchy_t u_in, idx_t u_n_in, idx_t molecule_n_
   max_depth_idx = _dIdx(max_depth);
   min_depth_idx = _dIdx(min_depth);
   total_depths = max_depth - min_depth + 1;
+  cycle_depths = total_depths;
   relaxation_tolerance = relaxation_tolerance_in;
   u_n = u_n_in;
+
+  // a single problem unless set up by FASMultigridBatch
+  batch_n = 1;
+  member_u_n = u_n;
+  for(idx_t b = 0; b < FAS_BATCH_MAX; b++)
+    member_active[b] = b < batch_n;
   
   molecule_n = molecule_n_in;
   
   u_h = new fas_heirarchy_t[u_n_in];
   coarse_src_h = new fas_heirarchy_t[u_n_in];
-  damping_v_h = new fas_heirarchy_t[u_n_in];
-  jac_rhs_h = new fas_heirarchy_t[u_n_in];
+  damping_v_h = new fas_corr_heirarchy_t[u_n_in];
+  jac_rhs_h = new fas_corr_heirarchy_t[u_n_in];
   tmp_h = new fas_heirarchy_t[u_n_in];
 
+  jac_rhs_mean = new real_t[u_n_in];
+  damping_v_mean = new real_t[u_n_in];
+
+  op_cache = new FASOperatorCache();
+  src_cache_h = new fas_heirarchy_t[u_n_in];
+  op_cache_valid = false;
+
   eqns = new molecule *[u_n_in];
 
   rho_h = new fas_heirarchy_set_t[u_n];
+
+  nx_h = new idx_t[total_depths];
+  ny_h = new idx_t[total_depths];
+  nz_h = new idx_t[total_depths];
+
+  if(!out_of_core_dir.empty())
+    ooc.init(out_of_core_dir, u_in[0].nx);
   
   for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
   {
     u_h[eqn_id] = new fas_grid_t[total_depths];
     coarse_src_h[eqn_id] = new fas_grid_t[total_depths];
-    damping_v_h[eqn_id] = new fas_grid_t[total_depths];
-    jac_rhs_h[eqn_id] = new fas_grid_t[total_depths];
+    damping_v_h[eqn_id] = new fas_corr_grid_t[total_depths];
+    jac_rhs_h[eqn_id] = new fas_corr_grid_t[total_depths];
     tmp_h[eqn_id] = new fas_grid_t[total_depths];
+    src_cache_h[eqn_id] = new fas_grid_t[total_depths];
+
+    jac_rhs_mean[eqn_id] = 0.0;
+    damping_v_mean[eqn_id] = 0.0;
     
     rho_h[eqn_id] = new fas_heirarchy_t[molecule_n[eqn_id]];
-    
-    nx_h = new idx_t[total_depths];
-    ny_h = new idx_t[total_depths];
-    nz_h = new idx_t[total_depths];
 
     eqns[eqn_id] = new molecule[molecule_n[eqn_id]]; 
     
@@ -62,9 +104,10 @@ FASMultigrid::FASMultigrid(fas_heirarchy_t u_in, idx_t u_n_in, idx_t molecule_n_
       {
         u_h[eqn_id][depth_idx]._array = u_in[eqn_id]._array;
 
-        nx_h[depth_idx] = NX;
-        ny_h[depth_idx] = NY;
-        nz_h[depth_idx] = NZ;
+        // fine grid dimensions are those of the supplied grids
+        nx_h[depth_idx] = u_in[0].nx;
+        ny_h[depth_idx] = u_in[0].ny;
+        nz_h[depth_idx] = u_in[0].nz;
         
         u_h[eqn_id][depth_idx].nx = nx_h[depth_idx];
         u_h[eqn_id][depth_idx].ny = ny_h[depth_idx];
@@ -73,123 +116,297 @@ FASMultigrid::FASMultigrid(fas_heirarchy_t u_in, idx_t u_n_in, idx_t molecule_n_
       }
       else
       {
-        nx_h[depth_idx] = nx_h[depth_idx+1] / 2 + (nx_h[depth_idx+1] % 2);
-        ny_h[depth_idx] = ny_h[depth_idx+1] / 2 + (ny_h[depth_idx+1] % 2);
-        nz_h[depth_idx] = nz_h[depth_idx+1] / 2 + (nz_h[depth_idx+1] % 2);
+        _coarsenDims(depth_idx);
 
-        u_h[eqn_id][depth_idx].init(nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
+        if(layout == layout_separate)
+          _initGrid(u_h[eqn_id][depth_idx], nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
       }
       
-      coarse_src_h[eqn_id][depth_idx].init(nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
+      _initGrid(coarse_src_h[eqn_id][depth_idx], nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
 
-      damping_v_h[eqn_id][depth_idx].init(nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
+      _initGrid(damping_v_h[eqn_id][depth_idx], nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
       
-      jac_rhs_h[eqn_id][depth_idx].init(nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
+      _initGrid(jac_rhs_h[eqn_id][depth_idx], nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
 
-      tmp_h[eqn_id][depth_idx].init(nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
+      _initGrid(tmp_h[eqn_id][depth_idx], nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
     }
 
     for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
       rho_h[eqn_id][mol_id] = new fas_grid_t[total_depths];
   }
+
+  // restriction / interpolation weights along each axis
+  for(idx_t d = 0; d < 3; d++)
+    transfer_h[d] = new fas_transfer_t[total_depths];
+  for(idx_t depth_idx = 0; depth_idx < max_depth_idx; depth_idx++)
+  {
+    _buildTransfer(transfer_h[0][depth_idx], nx_h[depth_idx+1], nx_h[depth_idx]);
+    _buildTransfer(transfer_h[1][depth_idx], ny_h[depth_idx+1], ny_h[depth_idx]);
+    _buildTransfer(transfer_h[2][depth_idx], nz_h[depth_idx+1], nz_h[depth_idx]);
+  }
+
+  instr.init(total_depths, min_depth, nx_h, ny_h, nz_h);
+  smoothing.init(total_depths + 1);
+#if FAS_INSTRUMENTATION && FAS_PERF_COUNTERS
+  if(!instr.enablePerfCounters())
+    std::cout << "Unable to open hardware performance counters.\n";
+#endif
+
+  // all variables of a point stored contiguously, one grid per depth
+  u_aos_h = NULL;
+  if(layout == layout_interleaved)
+  {
+    u_aos_h = new fas_grid_t[total_depths];
+    for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+      _initGrid(u_aos_h[depth_idx], nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx] * u_n);
+  }
   
-  // initializing x, y and z derivative
-  der_type[der1][0] = 1;
-  der_type[der2][0] = 2;
-  der_type[der3][0] = 3;
+  setStencilOrder(STENCIL_ORDER);
+}
+
+/**
+ * @brief dimensions of a depth from those of the next finer one
+ * @details An axis is halved (rounding up) if it is strongly coupled: its
+ *  spacing is at most sqrt(2) times the smallest one, so its stencil weight
+ *  1/h^2 is at least half of the largest. Axes with coarser spacing keep
+ *  their points until the others catch up, which keeps point smoothing
+ *  effective on anisotropic grids (semi-coarsening); isotropic grids are
+ *  halved along every axis. Out-of-core solves always halve x, since fine
+ *  grids are told apart by their number of x planes (FASOutOfCore::plane).
+ *
+ * @param depth_idx depth index to set up
+ */
+void FASMultigrid::_coarsenDims(idx_t depth_idx)
+{
+  idx_t fine[3] = {nx_h[depth_idx+1], ny_h[depth_idx+1], nz_h[depth_idx+1]};
+  idx_t coarse[3];
+  idx_t n_max = std::max(fine[0], std::max(fine[1], fine[2]));
+
+  for(idx_t d = 0; d < 3; d++)
+  {
+    bool coarsen = !FAS_SEMI_COARSENING || 2 * fine[d] * fine[d] >= n_max * n_max
+      || (d == 0 && ooc.enabled);
+    coarse[d] = coarsen ? fine[d] / 2 + (fine[d] % 2) : fine[d];
+  }
+
+  nx_h[depth_idx] = coarse[0];
+  ny_h[depth_idx] = coarse[1];
+  nz_h[depth_idx] = coarse[2];
+}
+
+/**
+ * @brief floor of a / b for b > 0
+ */
+static idx_t fas_floor_div(idx_t a, idx_t b)
+{
+  return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+/**
+ * @brief interpolation and restriction weights along one axis
+ * @details Both grids are periodic and uniform, fine point f at f / n_fine
+ *  and coarse point c at c / n_coarse of the box. Interpolation is linear
+ *  between the two coarse points around a fine point; restriction is its
+ *  transpose, normalized so every coarse point gets a weighted mean of the
+ *  fine points within one coarse spacing. For n_fine = 2 n_coarse these are
+ *  the usual (1/2, 1) and (1/4, 1/2, 1/4) weights, for odd sizes the grids
+ *  do not nest but the weights stay consistent, and for n_fine = n_coarse
+ *  both are the identity.
+ */
+void FASMultigrid::_buildTransfer(fas_transfer_t & transfer, idx_t n_fine,
+  idx_t n_coarse)
+{
+  transfer.halved = (n_fine == 2 * n_coarse);
+
+  transfer.p_idx.resize(n_fine);
+  transfer.p_w.resize(n_fine);
+  for(idx_t f = 0; f < n_fine; f++)
+  {
+    // position of f in coarse spacings is (f * n_coarse) / n_fine
+    transfer.p_idx[f] = (f * n_coarse) / n_fine;
+    transfer.p_w[f] = (real_t) (f * n_coarse - transfer.p_idx[f] * n_fine)
+      / (real_t) n_fine;
+  }
+
+  transfer.r_first.resize(n_coarse);
+  transfer.r_n.resize(n_coarse);
+  transfer.r_w.assign(n_coarse * FAS_TRANSFER_WIDTH, 0.0);
+  for(idx_t c = 0; c < n_coarse; c++)
+  {
+    // fine points strictly within one coarse spacing of c
+    idx_t first = fas_floor_div((c - 1) * n_fine, n_coarse) + 1;
+    idx_t last = fas_floor_div((c + 1) * n_fine - 1, n_coarse);
+    real_t total = 0.0;
+
+    transfer.r_first[c] = first;
+    transfer.r_n[c] = last - first + 1;
+    if(transfer.r_n[c] > FAS_TRANSFER_WIDTH)
+    {
+      std::cout << "Unable to coarsen " << n_fine << " points to " << n_coarse
+                << ".\n";
+      throw -1;
+    }
 
-  // initializing 9 kinds of double derivative
-  der_type[der11][0] = 1;
-  der_type[der11][1] = 1;
+    for(idx_t f = first; f <= last; f++)
+    {
+      real_t w = 1.0 - (real_t) std::abs(f * n_coarse - c * n_fine)
+        / (real_t) n_fine;
+      transfer.r_w[c * FAS_TRANSFER_WIDTH + f - first] = w;
+      total += w;
+    }
+    for(idx_t f = first; f <= last; f++)
+      transfer.r_w[c * FAS_TRANSFER_WIDTH + f - first] /= total;
+  }
+}
 
-  der_type[der22][0] = 2;
-  der_type[der22][1] = 2;
+/**
+ * @brief select the finite difference order of the stencils
+ * @details point evaluators are instantiated for every supported order;
+ *  the ones matching the requested order are selected here, once, so the
+ *  kernels run fully unrolled with no per-point checks of the order.
+ *
+ * @param order 2, 4, 6 or 8
+ */
+void FASMultigrid::setStencilOrder(idx_t order)
+{
+  switch(order)
+  {
+    case 2:
+      _selectEvaluators<2>();
+      break;
+    case 4:
+      _selectEvaluators<4>();
+      break;
+    case 6:
+      _selectEvaluators<6>();
+      break;
+    case 8:
+      _selectEvaluators<8>();
+      break;
+    default:
+      std::cout << "Unsupported stencil order " << order
+        << " (2, 4, 6 or 8 expected)\n";
+      throw -1;
+  }
+  stencil_order = order;
+  ooc.stencil_radius = order / 2;
+}
 
-  der_type[der33][0] = 3;
-  der_type[der33][1] = 3;
 
-  der_type[der12][0] = 1;
-  der_type[der12][1] = 2;
+/**
+ * @brief point evaluators of one stencil order, using op_cache if valid
+ * @details also sets the diagonal weights of the cached linear molecules,
+ *  which depend on the order
+ */
+template<int ORDER>
+void FASMultigrid::_selectEvaluators()
+{
+  if(op_cache_valid)
+  {
+    eval_pt_fn = &FASMultigrid::_evaluateEllipticEquationPtOrd<ORDER, true>;
+    iter_jac_fn = &FASMultigrid::_evaluateIterationForJacEquationOrd<ORDER, true>;
+    der_eqn_fn = &FASMultigrid::_evaluateDerEllipticEquationOrd<ORDER, true>;
 
-  der_type[der13][0] = 1;
-  der_type[der13][1] = 3;
+    op_cache->setDiagonals<ORDER>(nx_h, ny_h, nz_h);
+  }
+  else
+  {
+    eval_pt_fn = &FASMultigrid::_evaluateEllipticEquationPtOrd<ORDER, false>;
+    iter_jac_fn = &FASMultigrid::_evaluateIterationForJacEquationOrd<ORDER, false>;
+    der_eqn_fn = &FASMultigrid::_evaluateDerEllipticEquationOrd<ORDER, false>;
+  }
+}
 
-  der_type[der23][0] = 2;
-  der_type[der23][1] = 3;
+/**
+ * @brief set up the per-level operator cache
+ * @details groups the molecules into op_cache (see FASOperatorCache) and
+ *  sums the molecules without atoms of every depth into src_cache_h.
+ *  Called by initializeRhoHeirarchy and readCheckpoint; changing the
+ *  equations or sources afterwards drops the cache until the next call.
+ */
+void FASMultigrid::_buildOperatorCache()
+{
+#if FAS_OPERATOR_CACHE
+  fas_depth_fields_t fields(*this, max_depth_idx);
+  op_cache->build(fields, u_n, total_depths);
 
-  // type == 11 means laplacian!
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    fas_op_cache_t & op = (*op_cache)[eqn_id];
+    for(idx_t depth_idx = 0; depth_idx < total_depths && op.cached_src; depth_idx++)
+    {
+      fas_grid_t & src = src_cache_h[eqn_id][depth_idx];
+      if(src.pts == 0)
+        _initGrid(src, nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
+
+      idx_t i, j, k;
+      idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+      #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+      FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
+      {
+        idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+        real_t val = 0.0;
+        for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+          if(eqns[eqn_id][mol_id].atom_n == 0)
+          {
+            if(rho_h[eqn_id][mol_id][depth_idx].pts > 0)
+              val += eqns[eqn_id][mol_id].const_coef
+                * rho_h[eqn_id][mol_id][depth_idx][idx];
+            else
+              val += eqns[eqn_id][mol_id].const_coef;
+          }
+        src[idx] = val;
+      }
+    }
+  }
 
-  // initilizing coeficient of double derivative for different sencil orders
-  double_der_coef[2] = 2.0;
-  double_der_coef[4] = 2.5;
-  double_der_coef[6] = 49.0 / 18.0;
-  double_der_coef[8] = 205.0 / 72.0;
+  op_cache_valid = true;
+  setStencilOrder(stencil_order);
+#endif
 }
 
+/**
+ * @brief go back to symbolic evaluation of every molecule
+ */
+void FASMultigrid::_dropOperatorCache()
+{
+  if(op_cache_valid)
+  {
+    op_cache_valid = false;
+    setStencilOrder(stencil_order);
+  }
+}
 
 void FASMultigrid::add_atom_to_eqn(atom atom_in, idx_t molecule_id, idx_t eqn_id)
 {
+  _dropOperatorCache();
   eqns[eqn_id][molecule_id].add_atom(atom_in);
 }
 
 /**
  * @brief evaluating the value of equation at a point
+ * @details with CACHED, source and linear molecules come from op_cache and
+ *  the symbolic ones from their term list (fas_cached_equation_pt)
  * @param[in]  id of equation to calculate
  * @param[in]  index of depth
  * @param[in]  index of x direction
  * @param[in]  index of y direction
  * @param[in]  index of z direction
  */
-real_t FASMultigrid::_evaluateEllipticEquationPt(idx_t eqn_id, idx_t depth_idx,
-  idx_t i, idx_t j, idx_t k)
+template<int ORDER, bool CACHED>
+real_t FASMultigrid::_evaluateEllipticEquationPtOrd(idx_t eqn_id,
+  idx_t depth_idx, idx_t i, idx_t j, idx_t k)
 {
-  real_t res = 0.0;
-   
-  for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
-  {
-    // value will end up being the value of a particular term in an equation
-    real_t val = eqns[eqn_id][mol_id].const_coef;
-    real_t pos_idx = H_INDEX(i, j, k,
-       nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
-
-    if(rho_h[eqn_id][mol_id][depth_idx].pts > 0) // constant
-      val *= rho_h[eqn_id][mol_id][depth_idx][pos_idx];
-    
-    
-    for(idx_t atom_id = 0; atom_id < eqns[eqn_id][mol_id].atom_n; atom_id++)
-    {
-      atom & ad = eqns[eqn_id][mol_id].atoms[atom_id];
-      
-      if(ad.type == 1) // polynomial type
-      {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        val *= pow(vd[pos_idx], ad.value);
-      }
-      else if(ad.type <= 4) // first derivative type
-      {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        val *= derivative(i, j, k, vd.nx, vd.ny, vd.nz,
-          der_type[ad.type][0], vd);
-      }
-      else if(ad.type <= 10)
-      {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        val *= double_derivative(i, j, k, vd.nx, vd.ny, vd.nz,
-          der_type[ad.type][0], der_type[ad.type][1], vd);
-      }
-      else
-      {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        val *= laplacian(i, j, k, vd.nx, vd.ny, vd.nz, vd);
-      }
-    }
-    res += val;
-  }
-  return res;
+  fas_depth_fields_t fields(*this, depth_idx);
+  if(CACHED)
+    return fas_cached_equation_pt<ORDER>(fields, *op_cache, eqn_id, i, j, k);
+  return fas_equation_pt<ORDER>(fields, eqn_id, i, j, k);
 }
 
 /**
  * @brief evaluate value of v * \partial F(u) / \partial u, storing coefficient a and b for interation
+ * @details with CACHED, symbolic molecules use the derivative lists of
+ *  op_cache; otherwise the product rule is applied atom by atom
  *
  * @param id of equation which needs to be calculated
  * @param index of depth
@@ -200,224 +417,93 @@ real_t FASMultigrid::_evaluateEllipticEquationPt(idx_t eqn_id, idx_t depth_idx,
  * @param z grid index
  * @param id of variable in differentiation
  */
-void FASMultigrid::_evaluateIterationForJacEquation(idx_t eqn_id,
+template<int ORDER, bool CACHED>
+void FASMultigrid::_evaluateIterationForJacEquationOrd(idx_t eqn_id,
   idx_t depth_idx, real_t &coef_a, real_t &coef_b,
   idx_t i, idx_t j, idx_t k, idx_t u_id)
 {
-  real_t dx = H_LEN_FRAC / (real_t)nx_h[depth_idx];
-
-  // Currently can only deal with the case dx = dy = dz, needs to be generilized
-  
-  for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
-  {
-    real_t mol_to_a = 0.0, mol_to_b = 0.0;
-    real_t non_der_val = eqns[eqn_id][mol_id].const_coef;
-    real_t pos_idx = H_INDEX(i,j,k,nx_h[depth_idx],ny_h[depth_idx],nz_h[depth_idx]);
-
-    if(rho_h[eqn_id][mol_id][depth_idx].pts > 0) // constant
-     non_der_val *= rho_h[eqn_id][mol_id][depth_idx][pos_idx];
-
-    // pre_val to help keep track of the result of terms with only one derivative
-    for(idx_t atom_id = 0; atom_id < eqns[eqn_id][mol_id].atom_n; atom_id++)
-    {
-      atom & ad =  eqns[eqn_id][mol_id].atoms[atom_id];
-      
-      if(ad.type == 1) // polynomial type
-      {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        if(u_id == ad.u_id)
-        {
-          mol_to_b = mol_to_b * pow(vd[pos_idx], ad.value)
-            + non_der_val * ad.value * pow(vd[pos_idx], ad.value-1.0);
-          non_der_val = non_der_val * pow(vd[pos_idx], ad.value);
-          mol_to_a *= pow(vd[pos_idx], ad.value);
-        }
-        else
-        {
-          mol_to_b *= pow(vd[pos_idx], ad.value);
-          mol_to_a *= pow(vd[pos_idx], ad.value);
-          non_der_val *= pow(vd[pos_idx], ad.value);
-        }
-      }
-      else if(ad.type <= 4) // first derivative type
-      {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        fas_grid_t & jac_vd =  damping_v_h[u_id][depth_idx];
-        if(u_id == ad.u_id)
-        {
-          mol_to_a = mol_to_a * derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd)
-            + non_der_val * derivative(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, der_type[ad.type][0], jac_vd);
-          mol_to_b = mol_to_b * derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
-          non_der_val =non_der_val * derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
-        }
-        else
-        {
-          non_der_val *= derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
-          mol_to_b *= derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
-          mol_to_a *= derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
-        }
-      }
-      else if(ad.type <= 10)
-      {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        fas_grid_t & jac_vd =  damping_v_h[u_id][depth_idx];
-
-        if(u_id == ad.u_id)
-        {
-          mol_to_a = mol_to_a * double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd)
-            + non_der_val * (double_derivative(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, der_type[ad.type][0], der_type[ad.type][1], jac_vd) +
-                             (ad.type <= 7) * double_der_coef[STENCIL_ORDER] * jac_vd[pos_idx] / (dx*dx));
-          mol_to_b = mol_to_b * double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd)
-            - (ad.type <= 7) * non_der_val * double_der_coef[STENCIL_ORDER]/(dx * dx);
-          non_der_val = non_der_val * double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd);
-        }
-        else
-        {
-          non_der_val *= double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd);
-          mol_to_a *= double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd);
-          mol_to_b *= double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd);
-        }
-      }
-      else
-      {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        fas_grid_t & jac_vd =  damping_v_h[u_id][depth_idx];
-
-        if(u_id == ad.u_id)
-        {
-          mol_to_a = mol_to_a * laplacian(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, vd)
-            + non_der_val * (laplacian(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, jac_vd) + 3.0 * double_der_coef[STENCIL_ORDER] * jac_vd[pos_idx] / (dx * dx));
-          mol_to_b = mol_to_b * laplacian(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, vd)
-            - non_der_val * 3.0 * double_der_coef[STENCIL_ORDER] / (dx*dx);
-          non_der_val = non_der_val * laplacian(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, vd);
-        }
-        else
-        {
-          non_der_val *= laplacian(i, j, k, vd.nx, vd.ny, vd.nz, vd);
-          mol_to_a *= laplacian(i, j, k, vd.nx, vd.ny, vd.nz, vd);
-          mol_to_b *= laplacian(i, j, k, vd.nx, vd.ny, vd.nz, vd);
-        }
-      }
-    }
-    coef_a += mol_to_a;
-    coef_b += mol_to_b;
-  }
-
-  return;
+  fas_corr_grid_t & jac_vd = damping_v_h[u_id][depth_idx];
+  fas_depth_fields_t fields(*this, depth_idx);
+  if(CACHED)
+    fas_cached_iteration_pt<ORDER>(fields, *op_cache, eqn_id, coef_a, coef_b,
+      i, j, k, u_id, jac_vd);
+  else
+    fas_iteration_pt<ORDER>(fields, eqn_id, coef_a, coef_b, i, j, k, u_id,
+      &jac_vd);
 }
 
 /**
  * @brief evaluate value of v * \partial F(u) / \partial u
+ * @details with CACHED, symbolic molecules use the derivative lists of
+ *  op_cache; otherwise the product rule is applied atom by atom
  *
  * @param id of equation which needs to be calculated
  * @param index of depth
- * @param coeficient a, stores the right hand side of iteration equation
- * @param coeficient b, stores the left hand coefficient for iteration
  * @param x grid index
  * @param y grid index
  * @param z grid index
  * @param id of variable in differentiation
  */    
-real_t FASMultigrid::_evaluateDerEllipticEquation(idx_t eqn_id, idx_t depth_idx, idx_t i, idx_t j, idx_t k, idx_t u_id)
+template<int ORDER, bool CACHED>
+real_t FASMultigrid::_evaluateDerEllipticEquationOrd(idx_t eqn_id,
+  idx_t depth_idx, idx_t i, idx_t j, idx_t k, idx_t u_id)
 {
-  real_t res = 0.0;
-  for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
-  {
-    real_t non_der_val = eqns[eqn_id][mol_id].const_coef, der_val = 0.0;
-    // pre_val to help keep track of the result of terms with only one derivative
+  fas_corr_grid_t & jac_vd = damping_v_h[u_id][depth_idx];
+  fas_depth_fields_t fields(*this, depth_idx);
+  if(CACHED)
+    return fas_cached_der_equation_pt<ORDER>(fields, *op_cache, eqn_id, i, j, k,
+      u_id, jac_vd);
+  return fas_der_equation_pt<ORDER>(fields, eqn_id, i, j, k, u_id, jac_vd);
+}
 
-    real_t pos_idx = H_INDEX(i,j,k,nx_h[depth_idx],ny_h[depth_idx],nz_h[depth_idx]);
+/**
+ * @brief sum of all values in a grid
+ */
+real_t FASMultigrid::_totalGrid(fas_grid_t & grid)
+{
+  real_t total = 0.0;
 
-    if(rho_h[eqn_id][mol_id][depth_idx].pts > 0) // constant
-      non_der_val *= rho_h[eqn_id][mol_id][depth_idx][pos_idx];
+  #pragma omp parallel for reduction(+:total) schedule(static)
+  for(idx_t i = 0; i < grid.pts; i++)
+    total += grid[i];
 
-    for(idx_t atom_id = 0; atom_id < eqns[eqn_id][mol_id].atom_n; atom_id++)
-    {
-      atom & ad =  eqns[eqn_id][mol_id].atoms[atom_id];
+  return total;
+}
 
-      if(ad.type == 1) // polynomial type
-      {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        fas_grid_t & jac_vd =  damping_v_h[u_id][depth_idx];
-        if(u_id == ad.u_id)
-        {
-          der_val = non_der_val * ad.value * pow(vd[pos_idx], ad.value-1.0) * jac_vd[pos_idx]
-            + der_val * pow(vd[pos_idx], ad.value);
+/**
+ * @brief mean of all values in a grid
+ */
+real_t FASMultigrid::_averageGrid(fas_grid_t & grid)
+{
+  return _totalGrid(grid) / (real_t) grid.pts;
+}
 
-          non_der_val = non_der_val * pow(vd[pos_idx], ad.value);
-        }
-        else
-        {
-          non_der_val *= pow(vd[pos_idx], ad.value);
-          der_val *= pow(vd[pos_idx], ad.value);
-        }
-      }
-      else if(ad.type <= 4)// first derivative type
-      {
-        fas_grid_t & vd = u_h[ad.u_id][depth_idx];
-        fas_grid_t & jac_vd = damping_v_h[u_id][depth_idx];
-        if(u_id == ad.u_id)
-        {
-          der_val = non_der_val * derivative(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, der_type[ad.type][0], jac_vd)
-            + der_val * derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
-          non_der_val = non_der_val * derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
-        }
-        else
-        {
-          non_der_val *= derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
-          der_val *= derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], vd);
-        }
-      }
-      else if(ad.type <= 10)
-      {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        fas_grid_t & jac_vd =  damping_v_h[u_id][depth_idx];
+/**
+ * @brief largest value in a grid
+ */
+real_t FASMultigrid::_maxGrid(fas_grid_t & grid)
+{
+  real_t max_val = grid[0];
 
-        if(u_id == ad.u_id)
-        {
-          der_val = non_der_val *  double_derivative(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, der_type[ad.type][0], der_type[ad.type][1], jac_vd)
-            + der_val * double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd); 
-          non_der_val = non_der_val * double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd);
-        }
-        else
-        {
-          non_der_val *=  double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd);
-          der_val  *=  double_derivative(i, j, k, vd.nx, vd.ny, vd.nz, der_type[ad.type][0], der_type[ad.type][1], vd);
-        }
-      }
-      else
-      {
-        fas_grid_t & vd =  u_h[ad.u_id][depth_idx];
-        fas_grid_t & jac_vd =  damping_v_h[u_id][depth_idx];
+  #pragma omp parallel for reduction(max:max_val) schedule(static)
+  for(idx_t i = 0; i < grid.pts; i++)
+    max_val = std::max(max_val, grid[i]);
 
-        if(u_id == ad.u_id)
-        {
-          der_val = non_der_val * laplacian(i, j, k, vd.nx, vd.ny, vd.nz, jac_vd)
-            + der_val * laplacian(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, vd);
-          non_der_val = non_der_val * laplacian(i, j, k, jac_vd.nx, jac_vd.ny, jac_vd.nz, vd);
-        }
-        else
-        {
-          non_der_val *= laplacian(i, j, k, vd.nx, vd.ny, vd.nz, vd);
-          der_val *= laplacian(i, j, k, vd.nx, vd.ny, vd.nz, vd);
-        }
-      }
-    }
-    res += der_val;
-  }
-  return res;
+  return max_val;
 }
 
 /**
- * @brief      initialize a grid to 0
- *
- * @param      grid    grid (array) to initialize
- * @param[in]  points  # points in array / on grid
+ * @brief smallest value in a grid
  */
-void FASMultigrid::_zeroGrid(fas_grid_t & grid)
+real_t FASMultigrid::_minGrid(fas_grid_t & grid)
 {
+  real_t min_val = grid[0];
+
+  #pragma omp parallel for reduction(min:min_val) schedule(static)
   for(idx_t i = 0; i < grid.pts; i++)
-    grid[i] = 0;
+    min_val = std::min(min_val, grid[i]);
+
+  return min_val;
 }
 
 /**
@@ -430,37 +516,43 @@ void FASMultigrid::_zeroGrid(fas_grid_t & grid)
  */
 void FASMultigrid::_shiftGridVals(fas_grid_t & grid, real_t shift)
 {
-  #pragma omp parallel for
+  #pragma omp parallel for schedule(static)
   for(idx_t i = 0; i < grid.pts; i++)
     grid[i] += shift;
 }
 
 /**
- * @brief "restrict" a fine grid to coarser grid
- * @details Restriction scheme:
- *  (1 given cell)*(1/8) + (6 adjacent "faces") * (1/16)
- *  + (12 adjacent "edges") * (1/32) + (8 adjacent "corners") * (1/64)
+ * @brief restriction kernel, see _restrictFine2coarse
  * 
- * @param field_heirarchy field to restrict
- * @param fine_depth "depth" of finer grid
+ * @param fine_grid grid (or view) to restrict
+ * @param coarse_grid grid (or view) to store result in
+ * @param coarse_idx depth index of the coarse grid
  */
-void FASMultigrid::_restrictFine2coarse(fas_heirarchy_t grid_heirarchy, idx_t fine_depth)
+template<typename FT, typename CT>
+void FASMultigrid::_restrictGrid(FT & fine_grid, CT & coarse_grid,
+  idx_t coarse_idx)
 {
-  idx_t fine_idx = _dIdx(fine_depth);
-  idx_t coarse_idx = fine_idx - 1;
+  idx_t n_fine_x = fine_grid.nx,
+        n_fine_y = fine_grid.ny,
+        n_fine_z = fine_grid.nz;
+  idx_t n_coarse_x = coarse_grid.nx, n_coarse_y = coarse_grid.ny, n_coarse_z = coarse_grid.nz;
 
-  idx_t n_fine_x = grid_heirarchy[fine_idx].nx,
-        n_fine_y = grid_heirarchy[fine_idx].ny,
-        n_fine_z = grid_heirarchy[fine_idx].nz;
-  idx_t n_coarse_x = n_fine_x / 2, n_coarse_y = n_fine_y / 2, n_coarse_z = n_fine_z / 2 ;
+  fas_transfer_t & tx = transfer_h[0][coarse_idx],
+                 & ty = transfer_h[1][coarse_idx],
+                 & tz = transfer_h[2][coarse_idx];
 
-  fas_grid_t & fine_grid = grid_heirarchy[fine_idx];
-  fas_grid_t & coarse_grid = grid_heirarchy[coarse_idx];
   idx_t i, j, k; // coarse grid iterator
   idx_t fi, fj, fk; // fine grid indexes
 
-  #pragma omp parallel for default(shared) private(i,j,k)
-  FAS_LOOP3_N(i, j, k, n_coarse_x, n_coarse_y, n_coarse_z)
+  if(tx.halved && ty.halved && tz.halved)
+  {
+  #pragma omp parallel default(shared) private(i,j,k,fi,fj,fk)
+  {
+  FAS_TRACE_SCOPE(trace, "restrict", trace.ctx_depth, trace.ctx_eqn);
+
+  #pragma omp for schedule(static) nowait
+  FAS_LOOP3_PLANES(i, j, k, n_coarse_x, n_coarse_y, n_coarse_z,
+    ooc.plane(n_fine_x, 2*i))
   {
     fi = i*2;
     fj = j*2;
@@ -500,13 +592,81 @@ void FASMultigrid::_restrictFine2coarse(fas_heirarchy_t grid_heirarchy, idx_t fi
       );
 
   } // end loop
+  } // end parallel region
+  return;
+  }
+
+  // general sizes and semi-coarsening
+  #pragma omp parallel default(shared) private(i,j,k)
+  {
+  FAS_TRACE_SCOPE(trace, "restrict", trace.ctx_depth, trace.ctx_eqn);
+
+  #pragma omp for schedule(static) nowait
+  FAS_LOOP3_PLANES(i, j, k, n_coarse_x, n_coarse_y, n_coarse_z,
+    ooc.plane(n_fine_x, std::max((idx_t) 0, tx.r_first[i])))
+  {
+    const real_t * wx = &tx.r_w[i * FAS_TRANSFER_WIDTH],
+                 * wy = &ty.r_w[j * FAS_TRANSFER_WIDTH],
+                 * wz = &tz.r_w[k * FAS_TRANSFER_WIDTH];
+    real_t res = 0.0;
+
+    // tensor product of the weights along each axis
+    for(idx_t a = 0; a < tx.r_n[i]; ++a)
+      for(idx_t b = 0; b < ty.r_n[j]; ++b)
+      {
+        real_t wxy = wx[a] * wy[b];
+        for(idx_t c = 0; c < tz.r_n[k]; ++c)
+          res += wxy * wz[c] * fine_grid[H_INDEX(tx.r_first[i] + a,
+            ty.r_first[j] + b, tz.r_first[k] + c, n_fine_x, n_fine_y, n_fine_z)];
+      }
+
+    coarse_grid[H_INDEX(i,j,k,n_coarse_x, n_coarse_y, n_coarse_z)] = res;
+
+  } // end loop
+  } // end parallel region
+
+}
+
+/**
+ * @brief "restrict" a fine grid to coarser grid
+ * @details Restriction scheme, where all axes are halved:
+ *  (1 given cell)*(1/8) + (6 adjacent "faces") * (1/16)
+ *  + (12 adjacent "edges") * (1/32) + (8 adjacent "corners") * (1/64);
+ *  in general the tensor product of the axis weights of _buildTransfer
+ * 
+ * @param field_heirarchy field to restrict
+ * @param fine_depth "depth" of finer grid
+ */
+void FASMultigrid::_restrictFine2coarse(fas_heirarchy_t grid_heirarchy, idx_t fine_depth)
+{
+  idx_t fine_idx = _dIdx(fine_depth);
+
+  FAS_TRACE_CONTEXT(trace, fine_depth - 1, trace.ctx_eqn);
+  _restrictGrid(grid_heirarchy[fine_idx], grid_heirarchy[fine_idx - 1],
+    fine_idx - 1);
+}
+
+/**
+ * @brief "restrict" the solution of a variable to a coarser grid
+ * 
+ * @param u_id variable to restrict
+ * @param fine_depth "depth" of finer grid
+ */
+void FASMultigrid::_restrictSolution(idx_t u_id, idx_t fine_depth)
+{
+  idx_t fine_idx = _dIdx(fine_depth);
+  fas_view_t fine_grid = _uView(u_id, fine_idx);
+  fas_view_t coarse_grid = _uView(u_id, fine_idx - 1);
 
+  FAS_TRACE_CONTEXT(trace, fine_depth - 1, u_id);
+  _restrictGrid(fine_grid, coarse_grid, fine_idx - 1);
 }
 
 /**
  * @brief interpolate a coarse grid to a finer grid
- * @details using a lot of "if" before updating to deal with the boundary probs when
- * n_coarse * 2 != n_fine 
+ * @details trilinear in the coarse points around each fine point (gathered
+ *  per fine point, see _buildTransfer); along axes that are not coarsened
+ *  the values are copied
  */
 void FASMultigrid::_interpolateCoarse2fine(fas_heirarchy_t grid_heirarchy, idx_t coarse_depth)
 {
@@ -516,48 +676,40 @@ void FASMultigrid::_interpolateCoarse2fine(fas_heirarchy_t grid_heirarchy, idx_t
   idx_t n_coarse_x = nx_h[coarse_idx],
     n_coarse_y = ny_h[coarse_idx],
     n_coarse_z = nz_h[coarse_idx];
-  idx_t n_fine_x = n_coarse_x *2, n_fine_y = n_coarse_y * 2, n_fine_z = n_coarse_z *2;
+  idx_t n_fine_x = nx_h[fine_idx], n_fine_y = ny_h[fine_idx], n_fine_z = nz_h[fine_idx];
 
   fas_grid_t & coarse_grid = grid_heirarchy[coarse_idx];
   fas_grid_t & fine_grid = grid_heirarchy[fine_idx];
+  fas_transfer_t & tx = transfer_h[0][coarse_idx],
+                 & ty = transfer_h[1][coarse_idx],
+                 & tz = transfer_h[2][coarse_idx];
   idx_t i, j, k;
-  idx_t fi, fj, fk;
 
-  _zeroGrid(fine_grid);
+  #pragma omp parallel default(shared) private(i, j, k)
+  {
+  FAS_TRACE_SCOPE(trace, "interpolate", coarse_depth + 1, trace.ctx_eqn);
 
-  
-  #pragma omp parallel for private(i, j, k, fi, fj, fk)
-  FAS_LOOP3_N(i, j, k, n_coarse_x, n_coarse_y, n_coarse_z)
+  #pragma omp for schedule(static) nowait
+  FAS_LOOP3_PLANES(i, j, k, n_fine_x, n_fine_y, n_fine_z,
+    ooc.plane(n_fine_x, i))
   {
-    fi = i*2;
-    fj = j*2;
-    fk = k*2;
+    idx_t ci = tx.p_idx[i], cj = ty.p_idx[j], ck = tz.p_idx[k];
+    real_t wx = tx.p_w[i], wy = ty.p_w[j], wz = tz.p_w[k];
+    real_t res = 0.0;
 
-    real_t coarse_grid_val = coarse_grid[H_INDEX(i,j,k,n_coarse_x, n_coarse_y, n_coarse_z)];
-    // loop over adjacent cells.
-    for(idx_t  i_adj = -1; i_adj <= 1; ++i_adj )
-      for(idx_t  j_adj = -1; j_adj <= 1; ++j_adj )
-        for(idx_t  k_adj = -1; k_adj <= 1; ++k_adj )
-        {
-          idx_t fine_grid_loc = H_INDEX(fi + i_adj, fj + j_adj, fk + k_adj,
-            n_fine_x, n_fine_y, n_fine_z);
-          idx_t coarse_grid_loc = H_INDEX(fi + i_adj, fj + j_adj, fk + k_adj,
-            n_coarse_x*2, n_coarse_y*2, n_coarse_z*2);
-
-          if(i_adj == 0 && j_adj == 0 && k_adj == 0)
-          {            
-            #pragma omp atomic
-            fine_grid[fine_grid_loc] += coarse_grid_val;
-          }
-          else if(fine_grid_loc == coarse_grid_loc)
-          {
-            real_t divisor = std::pow( 2.0,
-              std::abs(i_adj) + std::abs(j_adj) + std::abs(k_adj) );
-            #pragma omp atomic
-            fine_grid[fine_grid_loc] += coarse_grid_val/divisor;
-          }
-        } // end for loop
+    // loop over the (up to 8) coarse points around the fine point
+    for(idx_t a = 0; a <= (wx > 0.0); ++a)
+      for(idx_t b = 0; b <= (wy > 0.0); ++b)
+      {
+        real_t wxy = (a ? wx : 1.0 - wx) * (b ? wy : 1.0 - wy);
+        for(idx_t c = 0; c <= (wz > 0.0); ++c)
+          res += wxy * (c ? wz : 1.0 - wz) * coarse_grid[H_INDEX(ci + a,
+            cj + b, ck + c, n_coarse_x, n_coarse_y, n_coarse_z)];
+      }
+
+    fine_grid[H_INDEX(i, j, k, n_fine_x, n_fine_y, n_fine_z)] = res;
   }
+  } // end parallel region
 
 }
 
@@ -576,8 +728,8 @@ void FASMultigrid::_evaluateEllipticEquation(fas_heirarchy_t result_h, idx_t eqn
 
   fas_grid_t & result = result_h[depth_idx];
 
-  #pragma omp parallel for default(shared) private(i,j,k)
-  FAS_LOOP3_N(i, j, k, nx, ny, nz)
+  #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+  FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
   {
     idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
     result[idx] = _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k); 
@@ -602,8 +754,8 @@ void FASMultigrid::_computeResidual(fas_heirarchy_t residual_h, idx_t eqn_id, id
 
   _evaluateEllipticEquation(residual_h, eqn_id, depth);
 
-  #pragma omp parallel for default(shared) private(i,j,k)
-  FAS_LOOP3_N(i,j,k,nx,ny,nz)
+  #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+  FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
   {
     idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
     residual[idx] = coarse_src[idx] - residual[idx];
@@ -623,10 +775,17 @@ real_t FASMultigrid::_getMaxResidual(idx_t eqn_id, idx_t depth)
   idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
   fas_grid_t & coarse_src = coarse_src_h[eqn_id][depth_idx];
 
+  FAS_TIME_PHASE(instr, depth_idx, phase_residual);
+  FAS_COUNT_PHASE(instr, depth_idx, phase_residual, 1, nx*ny*nz);
+
   real_t max_residual = 0.0;
 
-  #pragma omp parallel for default(shared) private(j,k)
-  FAS_LOOP3_N(i,j,k,nx,ny,nz)
+  #pragma omp parallel default(shared) private(i,j,k)
+  {
+  FAS_TRACE_SCOPE(trace, "max_residual", depth, eqn_id);
+
+  #pragma omp for schedule(static) nowait
+  FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
   {
     idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
     real_t current_residual = std::fabs(coarse_src[idx]
@@ -638,6 +797,7 @@ real_t FASMultigrid::_getMaxResidual(idx_t eqn_id, idx_t depth)
         max_residual = current_residual;
     }
   }
+  } // end parallel region
 
   return max_residual;
 }
@@ -658,6 +818,25 @@ real_t FASMultigrid::_getMaxResidualAllEqs(idx_t depth)
   return max_for_all;
 }
 
+/**
+ * @brief get maximum residual of each active member, see batch_n
+ *
+ * @param depth to perform calculation
+ * @param max_residual residual of each member (0 for inactive ones)
+ */
+void FASMultigrid::_getMaxResidualMembers(idx_t depth, real_t * max_residual)
+{
+  for(idx_t b = 0; b < batch_n; b++)
+    max_residual[b] = 0.0;
+
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    idx_t b = _member(eqn_id);
+    if(member_active[b])
+      max_residual[b] = std::max(max_residual[b], _getMaxResidual(eqn_id, depth));
+  }
+}
+
 
 /**
  * @brief      Compute coarse_src and u on a coarser grid
@@ -668,8 +847,15 @@ real_t FASMultigrid::_getMaxResidualAllEqs(idx_t depth)
 void FASMultigrid::_computeCoarseRestrictions(idx_t eqn_id, idx_t fine_depth)
 {
   idx_t i, j, k;
+  idx_t coarse_idx = _dIdx(fine_depth -1);
+
+  FAS_TIME_PHASE(instr, coarse_idx, phase_restrict);
+  FAS_TRACE_SCOPE(trace, "coarse_restrictions", fine_depth - 1, eqn_id);
+  FAS_TRACE_CONTEXT(trace, fine_depth - 1, eqn_id);
+  FAS_COUNT_PHASE(instr, coarse_idx, phase_restrict, 1, nx_h[coarse_idx+1]
+    * ny_h[coarse_idx+1] * nz_h[coarse_idx+1]);
 
-  _restrictFine2coarse(u_h[eqn_id], fine_depth);
+  _restrictSolution(eqn_id, fine_depth);
 
   _computeResidual(tmp_h[eqn_id], eqn_id, fine_depth);
 
@@ -677,15 +863,13 @@ void FASMultigrid::_computeCoarseRestrictions(idx_t eqn_id, idx_t fine_depth)
 
   _evaluateEllipticEquation(coarse_src_h[eqn_id], eqn_id, fine_depth - 1);
 
-  idx_t coarse_idx = _dIdx(fine_depth -1);
-
   idx_t nx = nx_h[coarse_idx], ny = ny_h[coarse_idx], nz = nz_h[coarse_idx];
 
   fas_grid_t & coarse_src = coarse_src_h[eqn_id][coarse_idx];
   fas_grid_t & tmp = tmp_h[eqn_id][coarse_idx];
 
-  #pragma omp parallel for default(shared) private(i,j,k)
-  FAS_LOOP3_N(i,j,k,nx,ny,nz)
+  #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+  FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
   {
     idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
     coarse_src[idx] += tmp[idx];
@@ -697,11 +881,11 @@ void FASMultigrid::_computeCoarseRestrictions(idx_t eqn_id, idx_t fine_depth)
  *  to a grid containing the solution error, err = true - appx.
  *
  * @param      appx_to_err_h  grid heirarchy containing appx'n to convert
- * @param      exact_soln_h   heirarchy containing exact solution
+ * @param      u_id           variable whose solution is the exact solution
  * @param[in]  depth          depth to perform computation at
  */  
 void FASMultigrid::_changeApproximateSolutionToError(fas_heirarchy_t  appx_to_err_h,
-    fas_heirarchy_t  exact_soln_h, idx_t depth)
+    idx_t u_id, idx_t depth)
 {
   idx_t i, j, k;
 
@@ -709,10 +893,10 @@ void FASMultigrid::_changeApproximateSolutionToError(fas_heirarchy_t  appx_to_er
   idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
 
   fas_grid_t & appx_to_err = appx_to_err_h[depth_idx];
-  fas_grid_t & exact_soln = exact_soln_h[depth_idx];
+  fas_view_t exact_soln = _uView(u_id, depth_idx);
 
-  #pragma omp parallel for default(shared) private(i,j,k)
-  FAS_LOOP3_N(i,j,k,nx,ny,nz)
+  #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+  FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
   {
     idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
     appx_to_err[idx] = exact_soln[idx] - appx_to_err[idx];
@@ -723,12 +907,12 @@ void FASMultigrid::_changeApproximateSolutionToError(fas_heirarchy_t  appx_to_er
  * @brief Compute and add in correction to fine grid from error
  * on coarser grid; replace error with appx. solution
  * 
- * @param err_h grid heirarchy containing error
- * @param err2appx_h heirarchy containing approximate solution
+ * @param err2appx_h grid heirarchy containing error
+ * @param u_id variable whose solution is corrected
  * @param fine_depth depth of fine grid to correct
  */
 void FASMultigrid::_correctFineFromCoarseErr_Err2Appx(fas_heirarchy_t err2appx_h,
-          fas_heirarchy_t  appx_soln_h, idx_t fine_depth)
+          idx_t u_id, idx_t fine_depth)
 {
   idx_t i, j, k;
   idx_t coarse_depth = fine_depth-1;
@@ -736,13 +920,19 @@ void FASMultigrid::_correctFineFromCoarseErr_Err2Appx(fas_heirarchy_t err2appx_h
   idx_t fine_depth_idx = _dIdx(fine_depth);
 
   idx_t n_fine_x = nx_h[fine_depth_idx], n_fine_y = ny_h[fine_depth_idx], n_fine_z = nz_h[fine_depth_idx];
+
+  FAS_TIME_PHASE(instr, fine_depth_idx, phase_prolong);
+  FAS_TRACE_SCOPE(trace, "prolong", fine_depth, u_id);
+  FAS_TRACE_CONTEXT(trace, fine_depth, u_id);
+  FAS_COUNT_PHASE(instr, fine_depth_idx, phase_prolong, 1, n_fine_x*n_fine_y*n_fine_z);
+
   _interpolateCoarse2fine(err2appx_h, coarse_depth);
 
   fas_grid_t & err2appx = err2appx_h[fine_depth_idx];
-  fas_grid_t & appx_soln = appx_soln_h[fine_depth_idx];
+  fas_view_t appx_soln = _uView(u_id, fine_depth_idx);
 
-  #pragma omp parallel for default(shared) private(i,j,k)
-  FAS_LOOP3_N(i,j,k, n_fine_x, n_fine_y, n_fine_z)
+  #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+  FAS_LOOP3_PLANES(i, j, k, n_fine_x, n_fine_y, n_fine_z, ooc.plane(n_fine_x, i))
   {
     idx_t idx = H_INDEX(i, j, k, n_fine_x,n_fine_y,n_fine_z);
     // appx. solution in intermediate variable
@@ -755,177 +945,526 @@ void FASMultigrid::_correctFineFromCoarseErr_Err2Appx(fas_heirarchy_t err2appx_h
 }
 
 /**
- * @brief Copy grid from one heirarchy to another
+ * @brief Copy the solution of a variable to a grid in another heirarchy
  * 
- * @param from_h copy from this heirarchy
- * @param to_h to this heirarchy
+ * @param to_h copy to this heirarchy
+ * @param u_id variable to copy
  * @param depth at this depth
  */
-void FASMultigrid::_copyGrid(fas_heirarchy_t from_h[], fas_heirarchy_t to_h[], idx_t eqn_id, idx_t depth)
+void FASMultigrid::_copySolution(fas_heirarchy_t to_h, idx_t u_id, idx_t depth)
 {
+  idx_t i, j, k;
   idx_t depth_idx = _dIdx(depth);
-  fas_grid_t & from = from_h[eqn_id][depth_idx];
-  fas_grid_t & to = to_h[eqn_id][depth_idx];
-  to = from;
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+
+  fas_view_t from = _uView(u_id, depth_idx);
+  fas_grid_t & to = to_h[depth_idx];
+
+  #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+  FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
+  {
+    idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+    to[idx] = from[idx];
+  }
+}
+
+/**
+ * @brief Copy fine-grid solutions between the user supplied grids and
+ *  interleaved storage; no-op for layout_separate
+ * 
+ * @param to_interleaved copy direction
+ */
+void FASMultigrid::_syncInterleavedSolution(bool to_interleaved)
+{
+  if(layout != layout_interleaved)
+    return;
+
+  for(idx_t u_id = 0; u_id < u_n; u_id++)
+  {
+    fas_grid_t & u = u_h[u_id][max_depth_idx];
+    fas_view_t u_aos = _uView(u_id, max_depth_idx);
+    idx_t i, j, k;
+    idx_t nx = u.nx, ny = u.ny, nz = u.nz;
+
+    #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+    FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
+    {
+      idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+      if(to_interleaved)
+        u_aos[idx] = u[idx];
+      else
+        u[idx] = u_aos[idx];
+    }
+  }
 }
 
 /**
  * @brief iterative method to find a \lambda between 1 and zero,
  *        returning the largest value that satisfies
  *        norm less than the norm of F(u)
+ * @details each active member (see batch_n) is searched separately and
+ *  stops backtracking once its own norm decreased; line_search_norm is
+ *  left with the sum of the accepted norms
  * @param depth
- * @param norm
+ * @param norm of F(u) of each member
  */
-bool FASMultigrid::_getLambda( idx_t depth, real_t norm)
+bool FASMultigrid::_getLambda( idx_t depth, const real_t * norm)
 {
   idx_t i, j, k, s;
   idx_t depth_idx = _dIdx(depth);
   idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
-  real_t  sum = 0.0;
+  real_t  sum[FAS_BATCH_MAX];
+  bool searching[FAS_BATCH_MAX];
+
+  FAS_TIME_PHASE(instr, depth_idx, phase_line_search);
+
+  for(idx_t b = 0; b < batch_n; b++)
+    searching[b] = member_active[b];
+  line_search_norm = 0.0;
 
   for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
   {
-    fas_grid_t & u = u_h[eqn_id][depth_idx];
-    fas_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
-    FAS_LOOP3_N(i,j,k,nx,ny,nz)
+    if(!searching[_member(eqn_id)])
+      continue;
+
+    fas_view_t u = _uView(eqn_id, depth_idx);
+    fas_corr_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
+    real_t v_mean = damping_v_mean[eqn_id];
+    #pragma omp parallel default(shared) private(i,j,k)
+    {
+    FAS_TRACE_SCOPE(trace, "line_search_update", depth, eqn_id);
+
+    #pragma omp for schedule(static) nowait
+    FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
     {
       idx_t idx = H_INDEX(i, j, k, nx,ny,nz);
-      u[idx] +=  1.0 * damping_v[idx] ;
+      u[idx] +=  1.0 * (damping_v[idx] - v_mean);
     }
+    } // end parallel region
   }
   
   for( s = 0; s < 100; s++)
   {
     //lambda = 1.0 - (real_t)s * 0.01; //should always start with \lambda = 1
 
-    sum = 0.0;
+    for(idx_t b = 0; b < batch_n; b++)
+      sum[b] = 0.0;
 
     for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
     {
+      if(!searching[_member(eqn_id)])
+        continue;
+
       fas_grid_t & coarse_src = coarse_src_h[eqn_id][depth_idx];
-      #pragma omp parallel for default(shared) private(j,k) reduction(+:sum)
-      FAS_LOOP3_N(i,j,k,nx,ny,nz)
+      real_t eqn_sum = 0.0;
+      #pragma omp parallel default(shared) private(i,j,k) reduction(+:eqn_sum)
+      {
+      FAS_TRACE_SCOPE(trace, "line_search_trial", depth, eqn_id);
+
+      #pragma omp for schedule(static) nowait
+      FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
       {
         idx_t idx = H_INDEX(i, j, k, nx,ny,nz);
         real_t temp = _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k) - coarse_src[idx];
-        sum += temp * temp;
+        eqn_sum += temp * temp;
       }
-      
+      } // end parallel region
+
+      sum[_member(eqn_id)] += eqn_sum;
     }
 
-    if(sum <= norm)  // when | F(u + \lambda v) | < | F(u) | stop
+    FAS_COUNT_PHASE(instr, depth_idx, phase_line_search, 1, nx*ny*nz*u_n);
+    relax_sweeps++;
+
+    bool any = false;
+    for(idx_t b = 0; b < batch_n; b++)
+    {
+      if(searching[b] && sum[b] <= norm[b])  // when | F(u + \lambda v) | < | F(u) | stop
+      {
+        searching[b] = false;
+        line_search_norm += sum[b];
+      }
+      any = any || searching[b];
+    }
+    if(!any)
       return 1;
 
     for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
     {
-      fas_grid_t & u = u_h[eqn_id][depth_idx];
-      #pragma omp parallel for default(shared) private(j,k)
-      FAS_LOOP3_N(i,j,k,nx,ny,nz)
+      if(!searching[_member(eqn_id)])
+        continue;
+
+      fas_view_t u = _uView(eqn_id, depth_idx);
+      fas_corr_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
+      real_t v_mean = damping_v_mean[eqn_id];
+      #pragma omp parallel default(shared) private(i,j,k)
+      {
+      FAS_TRACE_SCOPE(trace, "line_search_update", depth, eqn_id);
+
+      #pragma omp for schedule(static) nowait
+      FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
       {
-        fas_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
         idx_t idx = H_INDEX(i, j, k, nx,ny,nz);
-        u[idx] -= (0.01) * damping_v[idx];
+        u[idx] -= (0.01) * (damping_v[idx] - v_mean);
       }
+      } // end parallel region
     }
   }
   
   return 0;
 }
 
+/**
+ * @brief compute the updated value of v for one equation at a point
+ * @details solves the linearized equation at (i, j, k) for v, keeping
+ *  neighbouring values (and other variables of its member) fixed
+ *
+ * @param id of equation / variable to update
+ * @param index of depth
+ * @param x grid index
+ * @param y grid index
+ * @param z grid index
+ * @return new value of damping_v at the point
+ */
+real_t FASMultigrid::_jacobianUpdatePt(idx_t eqn_id, idx_t depth_idx,
+  idx_t i, idx_t j, idx_t k)
+{
+  idx_t idx = H_INDEX(i,j,k,nx_h[depth_idx],ny_h[depth_idx],nz_h[depth_idx]);
+  real_t coef_a =0, coef_b = 0, temp = 0;
+  idx_t first = _member(eqn_id) * member_u_n;
+  _evaluateIterationForJacEquation(eqn_id, depth_idx, coef_a, coef_b, i, j, k, eqn_id);
+  for(idx_t u_id = first; u_id < first + member_u_n; u_id++)
+  {
+    if(u_id != eqn_id)
+      temp += _evaluateDerEllipticEquation(eqn_id, depth_idx, i, j, k, u_id);
+  }
+  return (coef_a - (jac_rhs_h[eqn_id][depth_idx][idx] - jac_rhs_mean[eqn_id])
+    + temp)/ (-coef_b);
+}
+
+/**
+ * @brief squared residual of the linearized (Jacobian) equations at a point,
+ *  summed over the equations of a member (all equations if batch_n = 1)
+ */
+real_t FASMultigrid::_jacobianResidualPt(idx_t member, idx_t depth_idx,
+  idx_t i, idx_t j, idx_t k)
+{
+  idx_t idx = H_INDEX(i,j,k,nx_h[depth_idx],ny_h[depth_idx],nz_h[depth_idx]);
+  idx_t first = member * member_u_n;
+  real_t res = 0;
+  for(idx_t eqn_id = first; eqn_id < first + member_u_n; eqn_id++)
+  {
+    real_t temp = 0;
+    for(idx_t u_id = first; u_id < first + member_u_n; u_id++)
+      temp += _evaluateDerEllipticEquation(eqn_id, depth_idx, i, j, k, u_id);
+    temp -= jac_rhs_h[eqn_id][depth_idx][idx] - jac_rhs_mean[eqn_id];
+    res += temp * temp;
+  }
+  return res;
+}
+
+/**
+ * @brief add the corrections of all variables at a point to (per-thread)
+ *  totals; only used with inexact_newton_constrained
+ */
+void FASMultigrid::_sumCorrectionPt(idx_t depth_idx, idx_t idx,
+  real_t * v_total)
+{
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+    v_total[eqn_id] += damping_v_h[eqn_id][depth_idx][idx];
+}
+
+/**
+ * @brief add (per-thread) correction totals to damping_v_mean
+ * @details called once by every thread of a parallel region
+ */
+void FASMultigrid::_addCorrectionMeans(idx_t depth_idx, const real_t * v_total)
+{
+  real_t pts = (real_t) (nx_h[depth_idx] * ny_h[depth_idx] * nz_h[depth_idx]);
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    #pragma omp atomic
+    damping_v_mean[eqn_id] += v_total[eqn_id] / pts;
+  }
+}
+
+/**
+ * @brief number of Jacobian sweeps that can be temporally blocked at a depth
+ * @details each sweep trails the previous one by (stencil radius + 1)
+ *  x-planes, and the residual stage trails the last sweep, so the whole
+ *  wavefront must fit in the grid without wrapping onto itself
+ */
+idx_t FASMultigrid::_jacobianBlockSweeps(idx_t depth_idx)
+{
+  idx_t r = stencil_order / 2;
+  idx_t fit = (nx_h[depth_idx] - 2*r - 1) / (r + 1);
+  return std::max((idx_t) 0, std::min(jacobian_block_sweeps, fit));
+}
+
+/**
+ * @brief perform several Jacobian sweeps in a single pass over memory
+ * @details Wavefront (temporal) blocking over x-planes: at each step,
+ *  sweep t updates plane s - t*(r+1), where r is the stencil radius, and a
+ *  final stage accumulates the residual norm of the last sweep. Only
+ *  sweeps * (r+1) planes are live at once, so they stay cache resident and
+ *  DRAM is streamed roughly once for all sweeps. Like the parallel
+ *  point-wise sweep, updates are in place; near the periodic x boundary a
+ *  plane may see neighbours one sweep older or newer.
+ *
+ * @param index of depth
+ * @param number of sweeps to perform
+ * @param solving members to update (see batch_n)
+ * @param norm_r squared norm of the linearized residual of each of them
+ *  after the last sweep, added to
+ */
+void FASMultigrid::_jacobianRelaxBlocked(idx_t depth_idx, idx_t sweeps,
+  const bool * solving, real_t * norm_r)
+{
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+  idx_t r = stencil_order / 2, lag = r + 1;
+  idx_t stages = sweeps + 1;
+  idx_t steps = nx + sweeps * lag;
+  bool constrained = (relax_scheme == inexact_newton_constrained);
+
+  #pragma omp parallel default(shared) reduction(+:norm_r[:FAS_BATCH_MAX])
+  {
+  std::vector<real_t> v_total(u_n, 0.0);
+
+  for(idx_t s = 0; s < steps; s++)
+  {
+    {
+      FAS_TRACE_SCOPE(trace, "jacobi_block_step", min_depth + depth_idx, -1);
+
+      #pragma omp for schedule(static) nowait
+      for(idx_t tj = 0; tj < stages * ny; tj++)
+      {
+        idx_t t = tj / ny, j = tj % ny;
+        idx_t i = s - t * lag;
+        if(i < 0 || i >= nx)
+          continue;
+
+        if(t < sweeps)
+        {
+          for(idx_t k = 0; k < nz; k++)
+            for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+              if(solving[_member(eqn_id)])
+                damping_v_h[eqn_id][depth_idx][H_INDEX(i,j,k,nx,ny,nz)]
+                  = _jacobianUpdatePt(eqn_id, depth_idx, i, j, k);
+        }
+        else if(i >= r)
+        {
+          // planes i < r read across the periodic boundary from planes
+          // that have not finished all sweeps yet; done below instead.
+          for(idx_t k = 0; k < nz; k++)
+          {
+            for(idx_t b = 0; b < batch_n; b++)
+              if(solving[b])
+                norm_r[b] += _jacobianResidualPt(b, depth_idx, i, j, k);
+            if(constrained)
+              _sumCorrectionPt(depth_idx, H_INDEX(i,j,k,nx,ny,nz), &v_total[0]);
+          }
+        }
+      }
+    }
+
+    // step s+1 reads planes written in step s
+    #pragma omp barrier
+  }
+
+  idx_t i, j, k;
+  #pragma omp for schedule(static) nowait
+  FAS_LOOP3_N(i, j, k, r, ny, nz)
+  {
+    for(idx_t b = 0; b < batch_n; b++)
+      if(solving[b])
+        norm_r[b] += _jacobianResidualPt(b, depth_idx, i, j, k);
+    if(constrained)
+      _sumCorrectionPt(depth_idx, H_INDEX(i,j,k,nx,ny,nz), &v_total[0]);
+  }
+
+  if(constrained)
+    _addCorrectionMeans(depth_idx, &v_total[0]);
+  } // end parallel region
+}
+
 /**
  * @brief perform Jacobian relaxation until a desired precision is reached
- * @details can be controled to use constrait or not, 
+ * @details with inexact_newton_constrained the mean of the corrections is
+ *  accumulated by the residual sweeps (damping_v_mean) and removed by
+ *  _getLambda; when jacobian_block_sweeps > 1 sweeps are temporally
+ *  blocked and the precision is only checked after each block. Every
+ *  active member (see batch_n) has its own target and is no longer swept
+ *  once it reaches it; members that cannot reach it are made inactive.
  * @param depth
- * @param norm of F(u)
+ * @param norm of F(u) of each member
  * @param parameter can control the converge speed
  * @param parameter can control the converge speed
  *
  */
-bool FASMultigrid::_jacobianRelax( idx_t depth, real_t norm, real_t C, idx_t p)
+bool FASMultigrid::_jacobianRelax( idx_t depth, const real_t * norm, real_t C, idx_t p)
 {
   idx_t i, j, k;
   idx_t depth_idx = _dIdx(depth);
   idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx], cnt = 0;
+  idx_t block_sweeps = _jacobianBlockSweeps(depth_idx);
+  bool constrained = (relax_scheme == inexact_newton_constrained);
+
+  real_t   norm_r[FAS_BATCH_MAX], norm_pre, target[FAS_BATCH_MAX];
+  bool solving[FAS_BATCH_MAX], any = false;
 
-  real_t   norm_r = 1e100,    norm_pre;
+  FAS_TIME_PHASE(instr, depth_idx, phase_jacobi);
 
   //initilizing value of damping_v
-  #pragma omp parallel for default(shared) private(j,k)
-  FAS_LOOP3_N(i, j, k, nx, ny, nz)
+  #pragma omp parallel for default(shared) private(j,k) schedule(static)
+  FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
   {
     for(idx_t eqn_id =0; eqn_id < u_n; eqn_id++)
       damping_v_h[eqn_id][depth_idx][H_INDEX(i,j,k,nx, ny, nz)] = 0.0;
   }
   
-  while( norm_r >= std::min(pow(norm, (real_t)(p+1)) * C, norm)) 
+  for(idx_t b = 0; b < batch_n; b++)
+  {
+    target[b] = std::min(pow(norm[b], (real_t)(p+1)) * C, norm[b]);
+
+    // corrections stored in single precision cannot resolve the linear
+    // residual below roughly epsilon * |F(u)|; the outer Newton iteration
+    // (residual in double, line search in _getLambda) refines beyond that.
+    target[b] = std::max(target[b],
+      norm[b] * pw2(16 * std::numeric_limits<fas_corr_real_t>::epsilon()));
+
+    solving[b] = member_active[b];
+    any = any || solving[b];
+  }
+
+  while(any)
   {
     //relax until the convergent condition got satisfy 
-    norm_r = 0.0;
+    for(idx_t b = 0; b < batch_n; b++)
+      norm_r[b] = 0.0;
     norm_pre = 0.0;
 
-    // TODO: parallelize
+    // mean of the corrections, summed with the residual of each sweep
     for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+      damping_v_mean[eqn_id] = 0.0;
+
+    if(block_sweeps > 1)
+    {
+      _jacobianRelaxBlocked(depth_idx, block_sweeps, solving, norm_r);
+      cnt += block_sweeps;
+    }
+    else
     {
-      fas_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
-      fas_grid_t & jac_rhs = jac_rhs_h[eqn_id][depth_idx];
-      #pragma omp parallel for default(shared) private(j,k)
-      FAS_LOOP3_N(i,j,k,nx,ny,nz)
+      // TODO: parallelize
+      for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
       {
-        idx_t idx = H_INDEX(i,j,k,nx,ny,nz);
-        real_t coef_a =0, coef_b = 0, temp = 0;
-        _evaluateIterationForJacEquation(eqn_id, depth_idx, coef_a, coef_b, i, j, k, eqn_id);
-        for(idx_t u_id = 0; u_id < u_n; u_id++)
+        if(!solving[_member(eqn_id)])
+          continue;
+
+        fas_corr_grid_t & damping_v = damping_v_h[eqn_id][depth_idx];
+        #pragma omp parallel default(shared) private(i,j,k)
         {
-          
-          if(u_id != eqn_id)
-            temp += _evaluateDerEllipticEquation(eqn_id, depth_idx, i, j, k, u_id);
-        }
-        damping_v[idx] = (coef_a - jac_rhs[idx] + temp)/ (-coef_b);
-      }      
+        FAS_TRACE_SCOPE(trace, "jacobi_sweep", depth, eqn_id);
+
+        #pragma omp for schedule(static) nowait
+        FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
+        {
+          idx_t idx = H_INDEX(i,j,k,nx,ny,nz);
+          damping_v[idx] = _jacobianUpdatePt(eqn_id, depth_idx, i, j, k);
+        }      
+        } // end parallel region
+      }
+
+      #pragma omp parallel default(shared) private(i,j,k) reduction(+:norm_r[:FAS_BATCH_MAX])
+      {
+      FAS_TRACE_SCOPE(trace, "jacobi_residual", depth, -1);
+      std::vector<real_t> v_total(u_n, 0.0);
+
+      #pragma omp for schedule(static) nowait
+      FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
+      {
+        for(idx_t b = 0; b < batch_n; b++)
+          if(solving[b])
+            norm_r[b] += _jacobianResidualPt(b, depth_idx, i, j, k);
+        if(constrained)
+          _sumCorrectionPt(depth_idx, H_INDEX(i,j,k,nx,ny,nz), &v_total[0]);
+      }
+
+      if(constrained)
+        _addCorrectionMeans(depth_idx, &v_total[0]);
+      } // end parallel region
+
+      cnt++;
     }
-    
-    #pragma omp parallel for default(shared) private(i,j,k) reduction(+:norm_r)
-    FAS_LOOP3_N(i,j,k,nx,ny,nz)
+
+    bool failed = false;
+    any = false;
+    for(idx_t b = 0; b < batch_n; b++)
     {
-      idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
-      for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+      if(!solving[b])
+        continue;
+      solving[b] = norm_r[b] >= target[b];
+      if(cnt > 500 && norm_r[b] > norm_pre)
       {
-        real_t temp = 0;
-        fas_grid_t & jac_rhs = jac_rhs_h[eqn_id][depth_idx];
-        for(idx_t u_id =0; u_id < u_n; u_id++)
-          temp += _evaluateDerEllipticEquation(eqn_id, depth_idx, i, j, k, u_id);
-        temp -= jac_rhs[idx];
-        norm_r += temp * temp;      
+        // the member is not relaxed any further at this depth
+        solving[b] = member_active[b] = false;
+        failed = true;
       }
+      any = any || solving[b];
     }
-          
-    cnt++;
 
-    if(cnt > 500 && norm_r > norm_pre) 
+    if(failed) 
     {
       //cannot solve Jacobian equation to precision needed
-      std::cout << "Unable to achieve a precise enough solution within "
-                << cnt << " iterations.\n";
-      return false;
+      instr.jacobi_failures++;
+      if(verbosity > 0)
+        std::cout << "Unable to achieve a precise enough solution within "
+                  << cnt << " iterations.\n";
     }
   }
 
-  return true;
+  FAS_COUNT_PHASE(instr, depth_idx, phase_jacobi, cnt, cnt*nx*ny*nz*u_n);
+  relax_sweeps += cnt;
+
+  // false if no member is left to relax
+  for(idx_t b = 0; b < batch_n; b++)
+    if(member_active[b])
+      return true;
+  return false;
 }
 
 /**
  * @brief relax u using the inexact Newton iterative method
+ * @details with adaptive smoothing enabled and a slot given, the number of
+ *  iterations comes from the smoothing controller, which also sees the
+ *  reduction of |F(u)| (measured by the line search) and the work of every
+ *  iteration. Members (see batch_n) whose residual is below the level
+ *  tolerance are left alone for the rest of the relaxation.
  * @param depth
  * @param max interation number
+ * @param slot of the smoothing controller, -1 for a fixed number of iterations
  */
-void FASMultigrid::_relaxSolution_GaussSeidel( idx_t depth, idx_t max_iterations)
+void FASMultigrid::_relaxSolution_GaussSeidel( idx_t depth, idx_t max_iterations,
+  idx_t slot)
 {
   idx_t i, j, k, s;
   idx_t depth_idx = _dIdx(depth);
   idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
-  real_t   norm;
+  real_t   norm[FAS_BATCH_MAX], max_residual[FAS_BATCH_MAX];
+  bool level_active[FAS_BATCH_MAX];
 
-  for(s=0; s<max_iterations; ++s)
+  bool adaptive = smoothing.enabled && slot >= 0;
+  idx_t iterations = smoothing.iterations(slot, max_iterations);
+  bool wasted = false, converged = false;
+  // work of a sweep over this level, in sweeps over the fine grid
+  real_t level_work = (real_t) (nx*ny*nz)
+    / (real_t) (nx_h[max_depth_idx]*ny_h[max_depth_idx]*nz_h[max_depth_idx]);
+
+  FAS_TIME_PHASE(instr, depth_idx, phase_smooth);
+  FAS_TRACE_SCOPE(trace, "smooth", depth, -1);
+
+  std::copy(member_active, member_active + batch_n, level_active);
+
+  for(s=0; s<iterations; ++s)
   {
     
     // move this precision condition to the beginning in case
@@ -933,34 +1472,69 @@ void FASMultigrid::_relaxSolution_GaussSeidel( idx_t depth, idx_t max_iterations
     // iterations for function: _jacobianRelax()
 
     // set tolenrance precision, which should be smaller when grids become more coarse
-    if(_getMaxResidualAllEqs( depth) < (relaxation_tolerance / pw2(1<<(max_depth_idx - depth_idx)) )) 
+    bool any = false;
+    _getMaxResidualMembers(depth, max_residual);
+    for(idx_t b = 0; b < batch_n; b++)
+    {
+      member_active[b] = member_active[b] && !(max_residual[b]
+        < (relaxation_tolerance / pw2(1<<(max_depth_idx - depth_idx))));
+      any = any || member_active[b];
+    }
+    if(!any)
+    {
+      converged = true;
       break;
+    }
+
+    // this residual and the one setting up jac_rhs
+    relax_sweeps = 2;
+
+    FAS_COUNT_PHASE(instr, depth_idx, phase_smooth, 1, nx*ny*nz*u_n);
 
     if(relax_scheme == inexact_newton
         || relax_scheme == inexact_newton_constrained)
     {
-      norm = 0.0;
+      real_t norm_total = 0.0;
+      for(idx_t b = 0; b < batch_n; b++)
+        norm[b] = 0.0;
       
       for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
       {
-        fas_grid_t & jac_rhs = jac_rhs_h[eqn_id][depth_idx];
+        if(!member_active[_member(eqn_id)])
+          continue;
+
+        FAS_TIME_PHASE(instr, depth_idx, phase_residual);
+        FAS_COUNT_PHASE(instr, depth_idx, phase_residual, 1, nx*ny*nz);
+        fas_corr_grid_t & jac_rhs = jac_rhs_h[eqn_id][depth_idx];
         fas_grid_t & coarse_src = coarse_src_h[eqn_id][depth_idx];
+        real_t eqn_norm = 0.0, total = 0.0;
         
-        #pragma omp parallel for default(shared) private(i,j,k) reduction(+:norm)
-        FAS_LOOP3_N(i,j,k,nx,ny,nz)
+        #pragma omp parallel for default(shared) private(i,j,k) reduction(+:eqn_norm,total) schedule(static)
+        FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
         {
       
           idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
 
           real_t temp = _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k) - coarse_src[idx];
 
-          norm += temp * temp;
-
+          eqn_norm += temp * temp;
+          total += temp;
 
           //evalue jac_source at right hand side of Jacobian linear equation
           jac_rhs[idx] = -temp;  
         }
+
+        norm[_member(eqn_id)] += eqn_norm;
+
+        // the Jacobian equations are solved with a zero-mean rhs, which
+        // a periodic Laplacian (constant null space) can satisfy
+        jac_rhs_mean[eqn_id] = (relax_scheme == inexact_newton_constrained)
+          ? -total / (real_t) (nx*ny*nz) : 0.0;
       }
+      for(idx_t b = 0; b < batch_n; b++)
+        if(member_active[b])
+          norm_total += norm[b];
+
       if( _jacobianRelax(depth, norm, 1, 0) == false)
       {
         break;
@@ -972,14 +1546,28 @@ void FASMultigrid::_relaxSolution_GaussSeidel( idx_t depth, idx_t max_iterations
         std::cout<<"Can't fine suitable damping factor!!!\n";
         throw -1;
       }
+
+      // the line search leaves |F(u)|^2 after the step in line_search_norm
+      if(adaptive && !smoothing.worthwhile(slot, std::sqrt(norm_total),
+        std::sqrt(line_search_norm), relax_sweeps * level_work))
+      {
+        wasted = true;
+        s++;
+        break;
+      }
     }
 
   } // end iterations loop
 
+  std::copy(level_active, level_active + batch_n, member_active);
+
+  if(adaptive)
+    smoothing.update(slot, s, wasted, converged, max_iterations);
+
 }
 
 
-void FASMultigrid::_printStrip(fas_grid_t &out)
+void FASMultigrid::_printStrip(fas_view_t out)
 {
   idx_t i;
   idx_t nx = out.nx, ny = out.ny, nz = out.nz;
@@ -1003,12 +1591,14 @@ FASMultigrid::~FASMultigrid()
       idx_t depth_idx = _dIdx(depth);
     
 
-      if(depth != max_depth) // can not delete the solution!!!!
-        delete [] u_h[eqn_id][depth_idx]._array;
-      delete [] coarse_src_h[eqn_id][depth_idx]._array;
-      delete [] tmp_h[eqn_id][depth_idx]._array;
-      delete [] damping_v_h[eqn_id][depth_idx]._array;
-      delete [] jac_rhs_h[eqn_id][depth_idx]._array;
+      if(depth != max_depth && layout == layout_separate) // can not delete the solution!!!!
+        _freeGrid(u_h[eqn_id][depth_idx]);
+      _freeGrid(coarse_src_h[eqn_id][depth_idx]);
+      _freeGrid(tmp_h[eqn_id][depth_idx]);
+      _freeGrid(damping_v_h[eqn_id][depth_idx]);
+      _freeGrid(jac_rhs_h[eqn_id][depth_idx]);
+      if(src_cache_h[eqn_id][depth_idx].pts > 0)
+        _freeGrid(src_cache_h[eqn_id][depth_idx]);
     }
     for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
     {
@@ -1016,11 +1606,44 @@ FASMultigrid::~FASMultigrid()
       {
         idx_t depth_idx = _dIdx(depth);
         if(rho_h[eqn_id][mol_id][depth_idx].pts > 0)
-        delete [] rho_h[eqn_id][mol_id][depth_idx]._array;
+        _freeGrid(rho_h[eqn_id][mol_id][depth_idx]);
       }
+      delete [] rho_h[eqn_id][mol_id];
     }
+    delete [] u_h[eqn_id];
+    delete [] coarse_src_h[eqn_id];
+    delete [] tmp_h[eqn_id];
+    delete [] damping_v_h[eqn_id];
+    delete [] jac_rhs_h[eqn_id];
+    delete [] src_cache_h[eqn_id];
+    delete [] rho_h[eqn_id];
+    delete [] eqns[eqn_id];
+  }
+
+  if(layout == layout_interleaved)
+  {
+    for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+      _freeGrid(u_aos_h[depth_idx]);
+    delete [] u_aos_h;
   }
 
+  delete [] u_h;
+  delete [] coarse_src_h;
+  delete [] tmp_h;
+  delete [] damping_v_h;
+  delete [] jac_rhs_mean;
+  delete [] damping_v_mean;
+  delete op_cache;
+  delete [] src_cache_h;
+  delete [] jac_rhs_h;
+  delete [] rho_h;
+  delete [] eqns;
+  delete [] nx_h;
+  delete [] ny_h;
+  delete [] nz_h;
+
+  for(idx_t d = 0; d < 3; d++)
+    delete [] transfer_h[d];
 }
 
 /**
@@ -1039,7 +1662,7 @@ void FASMultigrid::initializeRhoHeirarchy()
       {
         idx_t depth_idx = _dIdx(depth);
         if(rho_h[eqn_id][mol_id][depth_idx+1].pts > 0) //there is rho needs to be built
-          rho_h[eqn_id][mol_id][depth_idx].init(
+          _initGrid(rho_h[eqn_id][mol_id][depth_idx],
             nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
 
       }
@@ -1062,62 +1685,185 @@ void FASMultigrid::initializeRhoHeirarchy()
     }
   }
 
+  _buildOperatorCache();
+
+  if(!tuning_cache_file.empty())
+    loadTuning(tuning_cache_file);
+}
+
+/**
+ * @brief      structure of the equations, part of tuning cache keys
+ * @details    stencil order and the atoms of every molecule (stencil type
+ *  or power, and variable), and whether it is multiplied by a rho;
+ *  coefficients and source values are left out
+ */
+std::string FASMultigrid::equationSignature()
+{
+  std::ostringstream sig;
+  sig << "o" << stencil_order;
+
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    sig << ";";
+    for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+    {
+      molecule & mol = eqns[eqn_id][mol_id];
+      sig << (mol_id > 0 ? "," : "") << "c";
+      for(idx_t a = 0; a < mol.atom_n; a++)
+      {
+        atom & at = mol.atoms[a];
+        if(at.type == poly)
+          sig << "*u" << at.u_id << "^" << at.value;
+        else
+          sig << "*d" << at.type << "u" << at.u_id;
+      }
+      if(rho_h[eqn_id][mol_id][max_depth_idx].pts > 0)
+        sig << "*rho";
+    }
+  }
+  return sig.str();
+}
+
+/**
+ * @brief      use settings found by FASAutoTuner
+ * @details    the number of V-cycle levels is limited to the depths this
+ *  solver was built with; the thread count is kept in tuned_threads for the
+ *  caller to use (e.g. omp_set_num_threads before allocating the grids), the
+ *  solver does not change the OpenMP settings of the program
+ */
+void FASMultigrid::applyTuning(const FASTuningCache::config_t & config)
+{
+  cycle_depths = std::max((idx_t) 1, std::min(total_depths, config.depths));
+  max_relax_iters = config.relax_iters;
+  jacobian_block_sweeps = config.block_sweeps;
+
+  smoothing.enabled = config.adaptive_rate > 0.0;
+  if(smoothing.enabled)
+    smoothing.min_rate = config.adaptive_rate;
+
+  tuned_threads = config.threads;
+}
+
+/**
+ * @brief      use the cached settings of this problem, if any
+ * @details    looked up by fine grid dimensions, equationSignature and CPU
+ *  model, see FASTuningCache
+ *
+ * @param      file_name  cache file written by FASAutoTuner
+ * @return     true if settings were found
+ */
+bool FASMultigrid::loadTuning(const std::string & file_name)
+{
+  FASTuningCache::config_t config;
+  std::string key = FASTuningCache::key(nx_h[max_depth_idx],
+    ny_h[max_depth_idx], nz_h[max_depth_idx], equationSignature());
+
+  if(!FASTuningCache::find(file_name, key, config))
+    return false;
+
+  applyTuning(config);
+  if(verbosity > 0)
+    std::cout << "Using tuned settings from " << file_name << ": "
+              << cycle_depths << " levels, " << max_relax_iters
+              << " relaxation iterations.\n";
+  return true;
 }
 
-  
 void FASMultigrid::VCycle()
 {
-  _relaxSolution_GaussSeidel(max_depth, max_relax_iters);
+  double cycle_start = omp_get_wtime();
+  FAS_TRACE_SCOPE(trace, "vcycle", -1, -1);
 
-   std::cout << "  Initial max. residual on fine grid is: "
+  // fine grid pre-smoothing has the last smoothing slot
+  _relaxSolution_GaussSeidel(max_depth, max_relax_iters, total_depths);
+
+  if(verbosity > 1)
+    std::cout << "  Initial max. residual on fine grid is: "
       << _getMaxResidualAllEqs(max_depth) << ".\n" << std::flush;
 
    idx_t depth, coarse_depth;
+   // coarsest level of the cycle (see cycle_depths)
+   idx_t bottom_depth = std::max(min_depth, max_depth - cycle_depths + 1);
 
+   // members that are not active (see batch_n) are left as they are
    for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
    {
-     for(depth = max_depth; min_depth < depth; --depth)
+     if(!member_active[_member(eqn_id)])
+       continue;
+     for(depth = max_depth; bottom_depth < depth; --depth)
        _computeCoarseRestrictions(eqn_id, depth);
-     _copyGrid(u_h, tmp_h, eqn_id, min_depth);
+     _copySolution(tmp_h[eqn_id], eqn_id, bottom_depth);
    }
 
-   for(coarse_depth = min_depth; coarse_depth < max_depth; coarse_depth++)
+   for(coarse_depth = bottom_depth; coarse_depth < max_depth; coarse_depth++)
    {
-     _relaxSolution_GaussSeidel(coarse_depth, max_relax_iters);
-    
-    std::cout << "    Working on upward stroke at depth " << coarse_depth
-              << "; residual after solving is: "
-              << _getMaxResidualAllEqs(coarse_depth) << ".\n" << std::flush;
+     _relaxSolution_GaussSeidel(coarse_depth, max_relax_iters,
+       _dIdx(coarse_depth));
+
+    if(verbosity > 1)
+      std::cout << "    Working on upward stroke at depth " << coarse_depth
+                << "; residual after solving is: "
+                << _getMaxResidualAllEqs(coarse_depth) << ".\n" << std::flush;
     
     // tmp should hold appx. soln; convert to error
     for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
-      _changeApproximateSolutionToError(tmp_h[eqn_id], u_h[eqn_id], coarse_depth);
+      if(member_active[_member(eqn_id)])
+        _changeApproximateSolutionToError(tmp_h[eqn_id], eqn_id, coarse_depth);
 
     // tmp should hold error
     for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
-      _correctFineFromCoarseErr_Err2Appx(tmp_h[eqn_id], u_h[eqn_id], coarse_depth+1);
+      if(member_active[_member(eqn_id)])
+        _correctFineFromCoarseErr_Err2Appx(tmp_h[eqn_id], eqn_id, coarse_depth+1);
 
     // tmp now holds appx. soln on finer grid;
     // phi_h now holds corrected solution on finer grid
    }
 
-    _relaxSolution_GaussSeidel(max_depth, max_relax_iters);
+  _relaxSolution_GaussSeidel(max_depth, max_relax_iters, max_depth_idx);
+  cycle++;
+
+#if FAS_INSTRUMENTATION
+  instr.cycle_times.push_back(omp_get_wtime() - cycle_start);
+  // the residual costs a sweep over the fine grid, only taken when asked for
+  if(verbosity > 0 || instr.record_residuals)
+  {
+    real_t residual = _getMaxResidualAllEqs(max_depth);
+    if(instr.record_residuals)
+      instr.cycle_residuals.push_back(residual);
+    if(verbosity > 0)
+      std::cout << "  Final max. residual on fine grid is: "
+                << residual << ".\n" << std::flush;
+  }
+#else
+  (void) cycle_start;
+  if(verbosity > 0)
     std::cout << "  Final max. residual on fine grid is: "
               << _getMaxResidualAllEqs(max_depth) << ".\n" << std::flush;
+#endif
 }
 
 void FASMultigrid::VCycles(idx_t num_cycles)
 {
-  for(idx_t cycle = 0; cycle < num_cycles; ++cycle)
+  _syncInterleavedSolution(true);
+
+  for(idx_t n = 0; n < num_cycles; ++n)
   {
     VCycle();
+
+    if(checkpoint_interval > 0 && !checkpoint_file.empty()
+      && cycle % checkpoint_interval == 0)
+      writeCheckpoint(checkpoint_file, true);
   }
   
   _relaxSolution_GaussSeidel(max_depth, 10);
-  std::cout << "  Final solution residual is: "
-      << _getMaxResidualAllEqs(max_depth) << "\n" << std::flush;
+  if(verbosity > 0)
+    std::cout << "  Final solution residual is: "
+        << _getMaxResidualAllEqs(max_depth) << "\n" << std::flush;
+
+  _syncInterleavedSolution(false);
+  waitCheckpoint();
   
-  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  for(idx_t eqn_id = 0; eqn_id < u_n && verbosity > 0; eqn_id++)
   {
     std::cout << " Solution for variable "<< eqn_id<<" has average / min / max value: "
               << u_h[eqn_id][max_depth_idx].avg() << " / " << u_h[eqn_id][max_depth_idx].min() << " / " << u_h[eqn_id][max_depth_idx].max() << ".\n" << std::flush;
@@ -1125,9 +1871,309 @@ void FASMultigrid::VCycles(idx_t num_cycles)
   }
 }
 
+template<typename GT>
+static void fas_checkpoint_grid(std::vector<FASCheckpoint::grid_t> & grids,
+  idx_t kind, idx_t var, idx_t sub, idx_t depth_idx, GT & grid)
+{
+  FASCheckpoint::grid_t g = {{kind, var, sub, depth_idx, grid.nx, grid.ny,
+    grid.nz, (int64_t) sizeof(grid[0]), 0}, grid._array};
+  grids.push_back(g);
+}
+
+/**
+ * @brief all grids of the solver state, in checkpoint order
+ * @details rho grids are included if set; the last entry holds the
+ *  smoothing budgets
+ */
+void FASMultigrid::_checkpointGrids(std::vector<FASCheckpoint::grid_t> & grids)
+{
+  grids.clear();
+
+  for(idx_t u_id = 0; u_id < u_n; u_id++)
+    for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+      if(layout == layout_separate || depth_idx == max_depth_idx)
+        fas_checkpoint_grid(grids, FASCheckpoint::grid_u, u_id, 0, depth_idx,
+          u_h[u_id][depth_idx]);
+
+  for(idx_t depth_idx = 0; depth_idx < total_depths && layout == layout_interleaved;
+    depth_idx++)
+    fas_checkpoint_grid(grids, FASCheckpoint::grid_u_aos, 0, 0, depth_idx,
+      u_aos_h[depth_idx]);
+
+  for(idx_t eqn_id = 0; eqn_id < u_n; eqn_id++)
+  {
+    for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+    {
+      fas_checkpoint_grid(grids, FASCheckpoint::grid_coarse_src, eqn_id, 0,
+        depth_idx, coarse_src_h[eqn_id][depth_idx]);
+      fas_checkpoint_grid(grids, FASCheckpoint::grid_tmp, eqn_id, 0,
+        depth_idx, tmp_h[eqn_id][depth_idx]);
+      fas_checkpoint_grid(grids, FASCheckpoint::grid_damping_v, eqn_id, 0,
+        depth_idx, damping_v_h[eqn_id][depth_idx]);
+      fas_checkpoint_grid(grids, FASCheckpoint::grid_jac_rhs, eqn_id, 0,
+        depth_idx, jac_rhs_h[eqn_id][depth_idx]);
+    }
+
+    for(idx_t mol_id = 0; mol_id < molecule_n[eqn_id]; mol_id++)
+      for(idx_t depth_idx = 0; depth_idx < total_depths; depth_idx++)
+        if(rho_h[eqn_id][mol_id][depth_idx].pts > 0)
+          fas_checkpoint_grid(grids, FASCheckpoint::grid_rho, eqn_id, mol_id,
+            depth_idx, rho_h[eqn_id][mol_id][depth_idx]);
+  }
+
+  // learned smoothing budgets, so a restart smooths as the run would have
+  FASCheckpoint::grid_t budgets = {{FASCheckpoint::grid_smoothing, 0, 0, 0,
+    (int64_t) smoothing.budget.size(), 1, 1, (int64_t) sizeof(idx_t), 0},
+    &smoothing.budget[0]};
+  grids.push_back(budgets);
+}
+
+/**
+ * @brief write the solver state (all heirarchies, V-cycles completed,
+ *  relaxation settings and smoothing budgets) to a checkpoint file, see
+ *  FASCheckpoint
+ * @details Call between V-cycles. Equations are not stored: a restart
+ *  constructs the solver and sets up the equations as before, then calls
+ *  readCheckpoint. With async the file is written by a background thread
+ *  and the solve can continue right away.
+ *
+ * @param file_name checkpoint file
+ * @param async write in the background; see waitCheckpoint
+ * @return false if a synchronous write failed
+ */
+bool FASMultigrid::writeCheckpoint(const std::string & file_name, bool async)
+{
+  // the fine solution is written in both layouts
+  _syncInterleavedSolution(false);
+
+  FASCheckpoint::header_t header;
+  FASCheckpoint::initHeader(header);
+  header.u_n = u_n;
+  header.total_depths = total_depths;
+  header.min_depth = min_depth;
+  header.layout = layout;
+  header.stencil_order = stencil_order;
+  header.relax_scheme = relax_scheme;
+  header.max_relax_iters = max_relax_iters;
+  header.jacobian_block_sweeps = jacobian_block_sweeps;
+  header.cycle = cycle;
+  header.relaxation_tolerance = relaxation_tolerance;
+  header.smoothing_enabled = smoothing.enabled;
+  header.smoothing_min_rate = smoothing.min_rate;
+
+  std::vector<FASCheckpoint::grid_t> grids;
+  _checkpointGrids(grids);
+
+  return checkpoint.write(file_name, header, grids, async);
+}
+
+/**
+ * @brief wait until an asynchronous checkpoint is on disk
+ * @return false if writing it failed
+ */
+bool FASMultigrid::waitCheckpoint()
+{
+  return checkpoint.wait();
+}
+
+/**
+ * @brief restore the solver state from a checkpoint
+ * @details The solver must have been constructed with the same number of
+ *  variables, molecules, depths, grid sizes and layout. Grids are copied
+ *  from the memory mapped file; rho grids missing in the solver are
+ *  allocated. The fine solution is also copied to the user's grids.
+ *
+ * @param file_name checkpoint file
+ * @return false if the file could not be read or does not match the solver
+ */
+bool FASMultigrid::readCheckpoint(const std::string & file_name)
+{
+  if(!checkpoint.open(file_name))
+    return false;
+
+  const FASCheckpoint::header_t & header = checkpoint.header();
+  if(header.u_n != u_n || header.total_depths != total_depths
+    || header.min_depth != min_depth || header.layout != layout)
+  {
+    std::cout << "Checkpoint " << file_name << " does not match the solver\n";
+    checkpoint.close();
+    return false;
+  }
+
+  for(idx_t g = 0; g < header.grid_n; g++)
+  {
+    const FASCheckpoint::entry_t & e = checkpoint.entry(g);
+    if(e.kind == FASCheckpoint::grid_rho && e.var >= 0 && e.var < u_n
+      && e.sub >= 0 && e.sub < molecule_n[e.var]
+      && e.depth_idx >= 0 && e.depth_idx < total_depths
+      && rho_h[e.var][e.sub][e.depth_idx].pts == 0)
+      _initGrid(rho_h[e.var][e.sub][e.depth_idx], nx_h[e.depth_idx],
+        ny_h[e.depth_idx], nz_h[e.depth_idx]);
+  }
+
+  std::vector<FASCheckpoint::grid_t> grids;
+  _checkpointGrids(grids);
+  bool ok = checkpoint.restore(grids);
+
+  if(ok)
+  {
+    cycle = header.cycle;
+    relax_scheme = (relax_t) header.relax_scheme;
+    max_relax_iters = header.max_relax_iters;
+    jacobian_block_sweeps = header.jacobian_block_sweeps;
+    relaxation_tolerance = header.relaxation_tolerance;
+    smoothing.enabled = header.smoothing_enabled;
+    smoothing.min_rate = header.smoothing_min_rate;
+    setStencilOrder(header.stencil_order);
+    _buildOperatorCache();
+  }
+
+  checkpoint.close();
+  return ok;
+}
+
+/**
+ * @brief      Pin OpenMP threads to CPUs
+ * @details    Should be called before constructing the solver so that the
+ *  parallel first-touch of the grids happens from the pinned threads.
+ *  "compact" places thread t on the t-th allowed CPU, "spread" distributes
+ *  threads evenly over all allowed CPUs (and so over sockets). Only has an
+ *  effect on Linux; OMP_PROC_BIND / OMP_PLACES can be used instead.
+ *
+ * @param[in]  affinity  binding policy
+ */
+void FASMultigrid::bindThreads(affinity_t affinity)
+{
+  if(affinity == affinity_none)
+    return;
+
+#ifdef __linux__
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if(sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0)
+  {
+    std::cout << "Unable to read process CPU affinity; threads not bound.\n";
+    return;
+  }
+
+  idx_t cpu_n = CPU_COUNT(&allowed);
+  idx_t * cpus = new idx_t[cpu_n];
+  for(idx_t cpu = 0, c = 0; cpu < CPU_SETSIZE && c < cpu_n; cpu++)
+    if(CPU_ISSET(cpu, &allowed))
+      cpus[c++] = cpu;
+
+  #pragma omp parallel
+  {
+    idx_t thread_id = omp_get_thread_num();
+    idx_t thread_n = omp_get_num_threads();
+    idx_t slot = (affinity == affinity_compact) ? thread_id % cpu_n
+      : (thread_id * cpu_n / thread_n) % cpu_n;
+
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(cpus[slot], &mask);
+    sched_setaffinity(0, sizeof(cpu_set_t), &mask);
+  }
+
+  delete [] cpus;
+#else
+  std::cout << "Explicit thread binding is only supported on Linux.\n";
+#endif
+}
+
+/**
+ * @brief      Print the CPU and NUMA node each OpenMP thread runs on
+ */
+void FASMultigrid::reportThreadAffinity()
+{
+  std::cout << "Thread affinity (OMP_PROC_BIND = " << omp_get_proc_bind()
+            << ", " << omp_get_max_threads() << " threads):\n";
+
+  #pragma omp parallel
+  {
+    idx_t thread_id = omp_get_thread_num();
+    int cpu = -1, node = -1;
+#ifdef __linux__
+    unsigned int c = 0, n = 0;
+    if(syscall(SYS_getcpu, &c, &n, NULL) == 0)
+    {
+      cpu = c;
+      node = n;
+    }
+#endif
+    #pragma omp for ordered schedule(static, 1)
+    for(idx_t t = 0; t < omp_get_num_threads(); t++)
+    {
+      #pragma omp ordered
+      std::cout << "  thread " << thread_id << ": cpu " << cpu
+                << ", NUMA node " << node << "\n";
+    }
+  }
+  std::cout << std::flush;
+}
+
 void FASMultigrid::printSolutionStrip(idx_t depth)
 {
-  _printStrip(u_h[0][depth]);
+  _printStrip(_uView(0, _dIdx(depth)));
+}
+
+/**
+ * @brief      queue the solution (and residual) of every variable at a depth
+ *             for output
+ * @details    fields are named u_<id> and residual_<id>; values are copied
+ *  (residuals computed) into the writer's buffers in parallel and written in
+ *  the background, so the solve may continue before out.close(). Works
+ *  with either layout.
+ *
+ * @param      out  open field writer
+ * @param[in]  depth  depth of the grids
+ * @param[in]  residual  also write the residual of each equation
+ * @return     false if a field could not be added
+ */
+bool FASMultigrid::writeFields(FASFieldWriter & out, idx_t depth, bool residual)
+{
+  idx_t i, j, k;
+  idx_t depth_idx = _dIdx(depth);
+  idx_t nx = nx_h[depth_idx], ny = ny_h[depth_idx], nz = nz_h[depth_idx];
+
+  for(idx_t u_id = 0; u_id < u_n; u_id++)
+  {
+    std::stringstream name;
+    name << "u_" << u_id;
+    real_t * field = out.beginField(name.str(), depth, nx, ny, nz);
+    if(field == NULL)
+      return false;
+
+    fas_view_t u = _uView(u_id, depth_idx);
+    #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+    FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
+    {
+      idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+      field[idx] = u[idx];
+    }
+    out.commitField();
+  }
+
+  for(idx_t eqn_id = 0; eqn_id < u_n && residual; eqn_id++)
+  {
+    std::stringstream name;
+    name << "residual_" << eqn_id;
+    real_t * field = out.beginField(name.str(), depth, nx, ny, nz);
+    if(field == NULL)
+      return false;
+
+    fas_grid_t & coarse_src = coarse_src_h[eqn_id][depth_idx];
+    #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+    FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
+    {
+      idx_t idx = H_INDEX(i, j, k, nx, ny, nz);
+      field[idx] = coarse_src[idx]
+        - _evaluateEllipticEquationPt(eqn_id, depth_idx, i, j, k);
+    }
+    out.commitField();
+  }
+
+  return true;
 }
 
 
@@ -1136,9 +2182,11 @@ void FASMultigrid::setPolySrcAtPt(idx_t eqn_id, idx_t mol_id, idx_t i, idx_t j,
   idx_t idx = H_INDEX(i, j, k,
     nx_h[max_depth_idx], ny_h[max_depth_idx], nz_h[max_depth_idx]);
 
+  _dropOperatorCache();
+
   if(rho_h[eqn_id][mol_id][max_depth_idx].pts == 0)
   {
-    rho_h[eqn_id][mol_id][max_depth_idx].init(
+    _initGrid(rho_h[eqn_id][mol_id][max_depth_idx],
       nx_h[max_depth_idx], ny_h[max_depth_idx], nz_h[max_depth_idx]);
   }
 
@@ -7,17 +7,67 @@
 #include <iomanip>
 #include <cmath>
 #include <cstdio>
+#include <type_traits>
+#include <vector>
 
 #include "../../cosmo_types.h"
 #include "../../cosmo_macros.h"
+#include "fas_grid_view.h"
+#include "fas_instrumentation.h"
+#include "fas_trace.h"
+#include "fas_checkpoint.h"
+#include "fas_field_output.h"
+#include "fas_out_of_core.h"
+#include "fas_smoothing.h"
+#include "fas_autotune.h"
+#include "fas_powers.h"
 
 #define PI  (4.0*atan(1.0))
 
+// store Newton correction fields (damping_v_h, jac_rhs_h) in single precision
+#ifndef FAS_MIXED_PRECISION
+  #define FAS_MIXED_PRECISION 0
+#endif
+
+// evaluate source and linear molecules from per-level caches, see
+// FASMultigrid::_buildOperatorCache and FASOperatorCache (0: every molecule
+// symbolically)
+#ifndef FAS_OPERATOR_CACHE
+  #define FAS_OPERATOR_CACHE 1
+#endif
+
+// coarsen only the strongly coupled axes of anisotropic grids, see
+// FASMultigrid::_coarsenDims (0: halve every axis at every depth)
+#ifndef FAS_SEMI_COARSENING
+  #define FAS_SEMI_COARSENING 1
+#endif
+
+// max. fine points restricted to a coarse point along an axis
+#define FAS_TRANSFER_WIDTH 4
+
+// max. distinct atoms and stencils in the derivative of an equation with
+// respect to one variable, see FASOperatorCache::_buildJacobianTerms
+#define FAS_JAC_MAX_ATOMS 32
+// max. registers of the power chain of such a list (FASPowerChain)
+#define FAS_JAC_MAX_REGS 128
+
+// max. independent problems solved together, see FASMultigridBatch
+#ifndef FAS_BATCH_MAX
+  #define FAS_BATCH_MAX 32
+#endif
+
 #define FAS_LOOP3_N(i, j, k, nx, ny, nz)  \
   for(i=0; i<nx; ++i)                     \
     for(j=0; j<ny; ++j)                   \
       for(k=0; k<nz; ++k)
 
+// FAS_LOOP3_N evaluating plane_hook at the start of every i plane
+#define FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, plane_hook) \
+  for(i=0; i<nx; ++i)                                     \
+    if((plane_hook), true)                                \
+      for(j=0; j<ny; ++j)                                 \
+        for(k=0; k<nz; ++k)
+
 namespace cosmo
 {
 
@@ -46,6 +96,7 @@ class molecule
   molecule()
   {
     atom_n = 0;
+    atoms = NULL;
   }
 
   ~molecule()
@@ -67,8 +118,15 @@ class molecule
   }
 };
 
+class FASOperatorCache;
+
 class FASMultigrid
 {
+  // FAC solves use the fine grid as the coarsest composite level
+  friend class FASRefinement;
+  // batched solves are member groups of variables, see batch_n
+  friend class FASMultigridBatch;
+
   private:
 
   // grid (array) type
@@ -78,16 +136,41 @@ class FASMultigrid
   // set of heirarchies (one for each variable/equation)
   typedef fas_heirarchy_t * fas_heirarchy_set_t;
 
+  // storage type of Newton correction fields
+#if FAS_MIXED_PRECISION
+  typedef float fas_corr_real_t;
+#else
+  typedef real_t fas_corr_real_t;
+#endif
+  typedef CosmoArray<idx_t, fas_corr_real_t> fas_corr_grid_t;
+  typedef fas_corr_grid_t * fas_corr_heirarchy_t;
+  typedef fas_corr_heirarchy_t * fas_corr_heirarchy_set_t;
+
+  // view of a single variable's solution at one depth, in either layout
+  typedef FASGridView<real_t> fas_view_t;
+
   // define heirarchy of references to grids
   fas_heirarchy_set_t u_h;             ///< field seeking a solution for
   fas_heirarchy_set_t tmp_h;           ///< reusable grid for storing intermediate calculations
   fas_heirarchy_set_t coarse_src_h;    ///< multigrid source term
-  fas_heirarchy_set_t jac_rhs_h;       ///< - F(u) which is rhs of Jacob Linear function
-  fas_heirarchy_set_t damping_v_h;     ///< _lap (u) - f, used to calculate F(u + \lambda v)
+  fas_corr_heirarchy_set_t jac_rhs_h;   ///< - F(u) which is rhs of Jacob Linear function
+  fas_corr_heirarchy_set_t damping_v_h; ///< _lap (u) - f, used to calculate F(u + \lambda v)
   fas_heirarchy_set_t * rho_h;         ///< source matter terms with number being rho_num;
- 
+  fas_heirarchy_t u_aos_h;             ///< solutions of all variables interleaved per point (layout_interleaved)
+
+  // zero-mean projection for inexact_newton_constrained (0 otherwise)
+  real_t * jac_rhs_mean;    ///< mean of jac_rhs at the depth being relaxed
+  real_t * damping_v_mean;  ///< mean of damping_v after the last Jacobian sweep
+
   idx_t u_n;          ///< number of variables ( = number of equations)
 
+  // FASMultigridBatch solves batch_n independent problems as one system:
+  // variable (and equation) member * member_u_n + e belongs to member.
+  // Newton iterations, line searches and convergence are per member.
+  idx_t batch_n;      ///< number of members (1 for a single problem)
+  idx_t member_u_n;   ///< variables of each member (u_n / batch_n)
+  bool member_active[FAS_BATCH_MAX]; ///< members updated by the kernels currently running
+
   idx_t * molecule_n; ///< number of molecules for each equation
 
   idx_t *nx_h, *ny_h, *nz_h;  ///< number of grid points in each direction at different depths
@@ -98,9 +181,130 @@ class FASMultigrid
   idx_t min_depth, min_depth_idx;
   idx_t total_depths, max_relax_iters;
 
-  idx_t der_type[12 /* number of items in enum atom_type */][2 /* derivative directions(s) */];      ///< vectors that stores devivative directions
+  idx_t stencil_order; ///< finite difference order of all stencils (2, 4, 6 or 8)
+
+  FASInstrumentation instr; ///< timers and counters of the solve
+  FASTrace trace;           ///< per-thread timeline of the solve (FAS_TRACE)
+  FASCheckpoint checkpoint; ///< checkpoint being written / read
+  FASOutOfCore ooc;         ///< file-backed fine grids (out-of-core mode)
+  FASSmoothingController smoothing; ///< adaptive Newton iterations per level
+
+  idx_t relax_sweeps; ///< grid sweeps of the current Newton iteration (Jacobian solve, line search)
+  real_t line_search_norm; ///< |F(u)|^2 accepted by the last line search
+
+  idx_t cycle; ///< V-cycles completed (restored from checkpoints)
+
+  // point evaluators instantiated for the selected stencil order
+  typedef real_t (FASMultigrid::*eval_pt_fn_t)(idx_t, idx_t, idx_t, idx_t,
+    idx_t);
+  typedef void (FASMultigrid::*iter_jac_fn_t)(idx_t, idx_t, real_t &,
+    real_t &, idx_t, idx_t, idx_t, idx_t);
+  typedef real_t (FASMultigrid::*der_eqn_fn_t)(idx_t, idx_t, idx_t, idx_t,
+    idx_t, idx_t);
+
+  eval_pt_fn_t eval_pt_fn;   ///< _evaluateEllipticEquationPtOrd<stencil_order, op_cache_valid>
+  iter_jac_fn_t iter_jac_fn; ///< _evaluateIterationForJacEquationOrd<stencil_order, op_cache_valid>
+  der_eqn_fn_t der_eqn_fn;   ///< _evaluateDerEllipticEquationOrd<stencil_order, op_cache_valid>
+
+  // transfer along one axis between depth_idx + 1 and depth_idx, see
+  // _buildTransfer; the identity along axes that are not coarsened
+  typedef struct
+  {
+    std::vector<idx_t> p_idx;    ///< coarse point at or before each fine point
+    std::vector<real_t> p_w;     ///< interpolation weight of p_idx + 1 (p_idx has 1 - p_w)
+    std::vector<idx_t> r_first;  ///< first fine point restricted to each coarse point (may wrap)
+    std::vector<idx_t> r_n;      ///< number of fine points restricted to it
+    std::vector<real_t> r_w;     ///< their weights, FAS_TRANSFER_WIDTH per coarse point
+    bool halved;                 ///< n_fine = 2 n_coarse (fixed 1/4, 1/2, 1/4 weights)
+  } fas_transfer_t;
+
+  fas_transfer_t * transfer_h[3]; ///< x, y and z transfers of every depth index but the finest
+
+  FASOperatorCache * op_cache;     ///< term lists of the equations (fas_operator_cache.h)
+  fas_heirarchy_set_t src_cache_h; ///< sum of the molecules without atoms of an equation, per depth
+  bool op_cache_valid;             ///< evaluators use op_cache (set up by _buildOperatorCache)
+
+  void _checkpointGrids(std::vector<FASCheckpoint::grid_t> & grids);
+
+  // one depth as read by the point kernels (fas_kernels.h)
+  class fas_depth_fields_t
+  {
+   public:
+    typedef fas_view_t view_t;
+
+    FASMultigrid & mg;
+    idx_t depth_idx;
+    idx_t nx, ny, nz;
+
+    fas_depth_fields_t(FASMultigrid & mg_in, idx_t depth_idx_in)
+      : mg(mg_in), depth_idx(depth_idx_in), nx(mg_in.nx_h[depth_idx_in]),
+        ny(mg_in.ny_h[depth_idx_in]), nz(mg_in.nz_h[depth_idx_in])
+    {
+    }
+
+    inline idx_t molecules(idx_t eqn_id)
+    {
+      return mg.molecule_n[eqn_id];
+    }
+
+    inline molecule & mol(idx_t eqn_id, idx_t mol_id)
+    {
+      return mg.eqns[eqn_id][mol_id];
+    }
+
+    inline view_t u(idx_t u_id)
+    {
+      return mg._uView(u_id, depth_idx);
+    }
+
+    inline real_t coef(idx_t eqn_id, idx_t mol_id, idx_t pos_idx)
+    {
+      fas_grid_t & rho = mg.rho_h[eqn_id][mol_id][depth_idx];
+      real_t val = mg.eqns[eqn_id][mol_id].const_coef;
+      if(rho.pts > 0) // constant
+        val *= rho[pos_idx];
+      return val;
+    }
+
+    inline bool hasRho(idx_t eqn_id, idx_t mol_id)
+    {
+      return mg.rho_h[eqn_id][mol_id][mg.max_depth_idx].pts > 0;
+    }
+
+    inline real_t rho(idx_t eqn_id, idx_t mol_id, idx_t pos_idx)
+    {
+      return mg.rho_h[eqn_id][mol_id][depth_idx][pos_idx];
+    }
+
+    inline real_t src(idx_t eqn_id, idx_t pos_idx)
+    {
+      return mg.src_cache_h[eqn_id][depth_idx][pos_idx];
+    }
+  };
+
+  template<int ORDER, bool CACHED>
+  real_t _evaluateEllipticEquationPtOrd(idx_t eqn_id, idx_t depth_idx,
+    idx_t i, idx_t j, idx_t k);
+
+  template<int ORDER, bool CACHED>
+  void _evaluateIterationForJacEquationOrd(idx_t eqn_id, idx_t depth_idx,
+    real_t &coef_a, real_t &coef_b, idx_t i, idx_t j, idx_t k, idx_t u_id);
+
+  template<int ORDER, bool CACHED>
+  real_t _evaluateDerEllipticEquationOrd(idx_t eqn_id, idx_t depth_idx,
+    idx_t i, idx_t j, idx_t k, idx_t u_id);
+
+  template<int ORDER>
+  void _selectEvaluators();
+
+  void _buildOperatorCache();
+
+  void _coarsenDims(idx_t depth_idx);
+
+  static void _buildTransfer(fas_transfer_t & transfer, idx_t n_fine,
+    idx_t n_coarse);
 
-  real_t double_der_coef[9];  ///< vectors that stores coefficients of f(x,y,z) for different order stencils, used for jac equation iteration
+  void _dropOperatorCache();
 
   /**
    * @brief indexing scheme of a grid heirarchy
@@ -115,6 +319,32 @@ class FASMultigrid
     return depth - min_depth;
   }
 
+  /**
+   * @brief member a variable or equation belongs to, see batch_n
+   */
+  inline idx_t _member(idx_t eqn_id)
+  {
+    return eqn_id / member_u_n;
+  }
+
+  /**
+   * @brief view of the solution of a variable at a depth
+   * @details with layout_interleaved all variables of a point are stored
+   *  contiguously (fine grid included, see _syncInterleavedSolution)
+   * 
+   * @param u_id id of variable
+   * @param depth_idx index of depth
+   * @return view of the grid
+   */
+  inline fas_view_t _uView(idx_t u_id, idx_t depth_idx)
+  {
+    if(layout == layout_interleaved)
+      return fas_view_t(u_aos_h[depth_idx]._array + u_id, u_n,
+        nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
+    return fas_view_t(u_h[u_id][depth_idx]._array, 1,
+      nx_h[depth_idx], ny_h[depth_idx], nz_h[depth_idx]);
+  }
+
   /**
    * @brief return sign of argument
    * @details return zerp when argument is zero
@@ -163,11 +393,39 @@ class FASMultigrid
   enum relax_t
   {
     inexact_newton,
-    inexact_newton_constrained, // inexact Newton with volume constraint enforced
+    inexact_newton_constrained, // inexact Newton with zero-mean (volume preserving) corrections
     newton
   };
 
   relax_t relax_scheme;
+
+  // enum for storage layout of the solution heirarchies
+  enum layout_t
+  {
+    layout_separate,   // one grid per variable (u_h[u_id][depth])
+    layout_interleaved // all variables of a point stored contiguously
+  };
+
+  layout_t layout;
+
+  idx_t jacobian_block_sweeps; ///< Jacobian sweeps per wavefront block (1 = unblocked)
+
+  idx_t verbosity; ///< 0: silent, 1: residual after each V-cycle, 2: also each level
+
+  idx_t cycle_depths; ///< levels used by V-cycles (at most max_depth_in)
+  std::string tuning_cache_file; ///< settings cache read by initializeRhoHeirarchy ("" = none)
+  idx_t tuned_threads; ///< thread count of the applied tuned settings (0 = not tuned)
+
+  idx_t checkpoint_interval;    ///< VCycles writes a checkpoint every this many cycles (0 = never)
+  std::string checkpoint_file;  ///< file written by VCycles
+
+  // enum for explicit thread binding
+  enum affinity_t
+  {
+    affinity_none,
+    affinity_compact, // consecutive threads on consecutive CPUs
+    affinity_spread   // threads distributed evenly over all CPUs / sockets
+  };
   
   enum atom_type
   {
@@ -188,21 +446,144 @@ class FASMultigrid
 
   FASMultigrid(fas_grid_t u_in[], idx_t u_n_in, idx_t molecule_n_in [],
                idx_t max_depth_in, idx_t max_relax_iters_in,
-               real_t relaxation_tolerance_in);
+               real_t relaxation_tolerance_in,
+               layout_t layout_in = layout_separate,
+               const std::string & out_of_core_dir = "");
   ~FASMultigrid();
 
   void add_atom_to_eqn(atom atom_in, idx_t molecule_id, idx_t eqn_id);
 
-  real_t _evaluateEllipticEquationPt(idx_t eqn_id, idx_t depth_idx, idx_t i,
-    idx_t j, idx_t k);
+  void setStencilOrder(idx_t order);
 
-  void _evaluateIterationForJacEquation(idx_t eqn_id, idx_t depth_idx,
-    real_t &coef_a, real_t &coef_b, idx_t i, idx_t j, idx_t k, idx_t u_id);
+  /**
+   * @brief timers and counters collected during the solve
+   * @details empty when compiled with FAS_INSTRUMENTATION=0
+   */
+  inline FASInstrumentation & getInstrumentation()
+  {
+    return instr;
+  }
+
+  /**
+   * @brief per-thread timeline of the kernels, see FASTrace
+   * @details only recorded when compiled with FAS_TRACE=1
+   */
+  inline FASTrace & getTrace()
+  {
+    return trace;
+  }
+
+  /**
+   * @brief adaptive smoothing, see FASSmoothingController
+   * @details off unless getSmoothing().enabled is set
+   */
+  inline FASSmoothingController & getSmoothing()
+  {
+    return smoothing;
+  }
+
+  inline idx_t getStencilOrder()
+  {
+    return stencil_order;
+  }
+
+  inline idx_t getCycle()
+  {
+    return cycle;
+  }
+
+  std::string equationSignature();
+
+  void applyTuning(const FASTuningCache::config_t & config);
+
+  bool loadTuning(const std::string & file_name);
+
+  bool writeCheckpoint(const std::string & file_name, bool async = true);
+
+  bool waitCheckpoint();
+
+  bool readCheckpoint(const std::string & file_name);
+
+  inline real_t _evaluateEllipticEquationPt(idx_t eqn_id, idx_t depth_idx,
+    idx_t i, idx_t j, idx_t k)
+  {
+    return (this->*eval_pt_fn)(eqn_id, depth_idx, i, j, k);
+  }
+
+  inline void _evaluateIterationForJacEquation(idx_t eqn_id, idx_t depth_idx,
+    real_t &coef_a, real_t &coef_b, idx_t i, idx_t j, idx_t k, idx_t u_id)
+  {
+    (this->*iter_jac_fn)(eqn_id, depth_idx, coef_a, coef_b, i, j, k, u_id);
+  }
+
+  inline real_t _evaluateDerEllipticEquation(idx_t eqn_id, idx_t depth_idx,
+    idx_t i, idx_t j, idx_t k, idx_t var_id)
+  {
+    return (this->*der_eqn_fn)(eqn_id, depth_idx, i, j, k, var_id);
+  }
+
+  /**
+   * @brief      allocate a grid and zero it in parallel
+   * @details    memory is not touched by the allocation itself, so pages are
+   *  placed (first-touch) on the NUMA node of the thread that will later
+   *  work on them, given kernels use the same static schedule.
+   *
+   * @param      grid    grid (array) to allocate
+   * @param[in]  nx, ny, nz  grid dimensions
+   */
+  template<typename GT>
+  void _initGrid(GT & grid, idx_t nx, idx_t ny, idx_t nz)
+  {
+    typedef typename std::remove_reference<decltype(grid[0])>::type elem_t;
+
+    grid.nx = nx;
+    grid.ny = ny;
+    grid.nz = nz;
+    grid.pts = nx * ny * nz;
+
+    // fine grids of an out-of-core solve are file-backed, already zero
+    if(ooc.enabled && nx == ooc.fine_nx)
+    {
+      grid._array = (elem_t *) ooc.allocate(grid.pts * sizeof(elem_t),
+        ny * nz * sizeof(elem_t));
+      return;
+    }
 
-  real_t _evaluateDerEllipticEquation(idx_t eqn_id, idx_t depth_idx, idx_t i,
-    idx_t j, idx_t k, idx_t var_id);
+    grid._array = new elem_t[grid.pts];
 
-  void _zeroGrid(fas_grid_t & grid);
+    _zeroGrid(grid);
+  }
+
+  /**
+   * @brief      free a grid from _initGrid
+   */
+  template<typename GT>
+  void _freeGrid(GT & grid)
+  {
+    if(!ooc.release(grid._array))
+      delete [] grid._array;
+  }
+
+  /**
+   * @brief      initialize a grid to 0
+   * @details    loops in the same order and with the same static schedule
+   *  as the stencil kernels so the first touch of each page is made by its
+   *  owning thread.
+   *
+   * @param      grid    grid (array) to initialize
+   */
+  template<typename GT>
+  void _zeroGrid(GT & grid)
+  {
+    idx_t i, j, k;
+    idx_t nx = grid.nx, ny = grid.ny, nz = grid.nz;
+
+    #pragma omp parallel for default(shared) private(i,j,k) schedule(static)
+    FAS_LOOP3_PLANES(i, j, k, nx, ny, nz, ooc.plane(nx, i))
+    {
+      grid[H_INDEX(i, j, k, nx, ny, nz)] = 0;
+    }
+  }
 
   real_t _totalGrid(fas_grid_t & grid);
 
@@ -214,8 +595,13 @@ class FASMultigrid
 
   void _shiftGridVals(fas_grid_t & grid, real_t shift);
 
+  template<typename FT, typename CT>
+  void _restrictGrid(FT & fine_grid, CT & coarse_grid, idx_t coarse_idx);
+
   void _restrictFine2coarse(fas_heirarchy_t grid_heirarchy, idx_t fine_depth);
 
+  void _restrictSolution(idx_t u_id, idx_t fine_depth);
+
   void _interpolateCoarse2fine(fas_heirarchy_t grid_heirarchy,
     idx_t coarse_depth);
 
@@ -228,26 +614,45 @@ class FASMultigrid
 
   real_t _getMaxResidualAllEqs(idx_t depth);
 
+  void _getMaxResidualMembers(idx_t depth, real_t * max_residual);
+
   void _computeCoarseRestrictions(idx_t eqn_id, idx_t fine_depth);
 
   void _changeApproximateSolutionToError(fas_heirarchy_t  appx_to_err_h,
-    fas_heirarchy_t  exact_soln_h, idx_t depth);
+    idx_t u_id, idx_t depth);
 
   void _correctFineFromCoarseErr_Err2Appx(fas_heirarchy_t err2appx_h,
-    fas_heirarchy_t  appx_soln_h, idx_t fine_depth);
+    idx_t u_id, idx_t fine_depth);
+
+  void _copySolution(fas_heirarchy_t to_h, idx_t u_id, idx_t depth);
+
+  void _syncInterleavedSolution(bool to_interleaved);
 
-  void _copyGrid(fas_heirarchy_t from_h[], fas_heirarchy_t to_h[],
-    idx_t eqn_id, idx_t depth);
+  bool _getLambda( idx_t depth, const real_t * norm);
 
-  bool _getLambda( idx_t depth, real_t norm);
+  real_t _jacobianUpdatePt(idx_t eqn_id, idx_t depth_idx, idx_t i, idx_t j,
+    idx_t k);
 
-  bool _jacobianRelax( idx_t depth, real_t norm, real_t C, idx_t p);
+  real_t _jacobianResidualPt(idx_t member, idx_t depth_idx, idx_t i, idx_t j,
+    idx_t k);
+
+  void _sumCorrectionPt(idx_t depth_idx, idx_t idx, real_t * v_total);
+
+  void _addCorrectionMeans(idx_t depth_idx, const real_t * v_total);
+
+  idx_t _jacobianBlockSweeps(idx_t depth_idx);
+
+  void _jacobianRelaxBlocked(idx_t depth_idx, idx_t sweeps,
+    const bool * solving, real_t * norm_r);
+
+  bool _jacobianRelax( idx_t depth, const real_t * norm, real_t C, idx_t p);
 
   bool _singularityExists(idx_t eqn_id, idx_t depth);
 
-  void _relaxSolution_GaussSeidel( idx_t depth, idx_t max_iterations);
+  void _relaxSolution_GaussSeidel( idx_t depth, idx_t max_iterations,
+    idx_t slot = -1);
 
-  void _printStrip(fas_grid_t & out_h);
+  void _printStrip(fas_view_t out);
 
   void build_rho();
 
@@ -261,6 +666,12 @@ class FASMultigrid
   void initializeRhoHeirarchy();
   
   void printSolutionStrip(idx_t depth);
+
+  bool writeFields(FASFieldWriter & out, idx_t depth, bool residual = true);
+
+  static void bindThreads(affinity_t affinity);
+
+  static void reportThreadAffinity();
 };
 
 } // namespace cosmo
@@ -40,8 +40,11 @@ int main(int argc, char **argv)
   std::cout << "  done.\n";
 
   std::cout << "Performing V-Cycles...\n";
+  multigrid.verbosity = 1;
   multigrid.VCycles(3);
   std::cout << "  done.\n";
+
+  multigrid.getInstrumentation().print(std::cout);
   
   multigrid.printSolutionStrip(max_depth);
 
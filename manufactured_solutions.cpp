@@ -0,0 +1,610 @@
+/**
+ * Manufactured solution checks of the multigrid solver.
+ *
+ * Every problem prescribes an analytic solution made of products of sines
+ * (periodic on the box), builds its equations from atoms and sets the source
+ * term rho of each equation to minus the remaining terms evaluated exactly,
+ * so the analytic fields solve the continuous system. Solving on a sequence of
+ * grid sizes then measures, per problem, stencil order and size:
+ *
+ *   err         max. |u - u_exact| after the last V-cycle (discretization error)
+ *   rate        observed order of accuracy between consecutive sizes
+ *   factor      mean residual reduction per V-cycle (cycles stop once the
+ *               residual is reduced by --rtol or stops decreasing)
+ *   t_err       wall time of the V-cycles needed to get within --err-factor of
+ *               the final error
+ *
+ * Problems:
+ *   poisson     lap(u) + rho = 0 (u up to a constant; rho has zero mean)
+ *   power_law   lap(u) - u^3 / 4 + 2 u^-1 + rho = 0
+ *   coupled     two equations that between them use every atom_type
+ *
+ * --sizes are cubes, --shapes further grids with odd or differing numbers of
+ * points per axis (e.g. 33,31x30x33,64x16x16), which are compared with the
+ * largest cube no finer along any axis instead of getting a rate.
+ *
+ * The run fails (exit status 1) if the error at a size is above the
+ * problem's limit, the observed order falls more than 1 below the stencil
+ * order, the error on a shape exceeds that of its cube by more than
+ * --err-slack, or the V-cycles diverge (coupled gets 3 * --max-cycles
+ * V-cycles). With --baseline FILE (as written by --write-baseline FILE) it
+ * also fails if the error or time to error grew by more than --err-slack or
+ * --time-slack over the recorded values.
+ * --adaptive-rate R runs the solves with adaptive smoothing (min_rate R).
+ *
+ * Example:
+ *   g++ manufactured_solutions.cpp full_multigrid.cpp fas_batch.cpp fas_instrumentation.cpp \
+ *     fas_trace.cpp fas_perf_counters.cpp fas_checkpoint.cpp fas_field_output.cpp fas_out_of_core.cpp fas_autotune.cpp fas_refinement.cpp fas_equations.cpp -O3 -Wall --std=c++11 -fopenmp -o manufactured_solutions
+ *   ./manufactured_solutions --sizes 16,32,64 --orders 2,4 --write-baseline mms_baseline.txt
+ *   ./manufactured_solutions --sizes 16,32,64 --orders 2,4 --baseline mms_baseline.txt
+ */
+#include "full_multigrid.h"
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+using namespace cosmo;
+
+/**
+ * @brief analytic field offset + amp * prod_d sin(2 pi k_d x_d / L + phase_d)
+ */
+typedef struct {
+  real_t offset, amp;
+  idx_t k[3];
+  real_t phase[3];
+} mms_field;
+
+typedef struct {
+  real_t coef;
+  std::vector<atom> atoms;
+} mms_term;
+
+typedef struct {
+  std::string name;
+  std::vector<mms_field> exact;               ///< solution of each variable
+  std::vector< std::vector<mms_term> > eqns;  ///< terms of each equation (without rho)
+  bool up_to_constant;  ///< solution only defined up to a constant per variable
+  real_t max_err;       ///< error limit at every size
+  bool check_rate;      ///< check the observed order of accuracy
+  idx_t cycle_factor;   ///< V-cycles allowed, in multiples of --max-cycles
+} mms_problem;
+
+typedef struct {
+  std::vector<idx_t> sizes, orders;
+  std::vector< std::vector<idx_t> > shapes;  ///< nx, ny, nz of further grids
+  std::vector<std::string> problems;
+  idx_t max_cycles, max_relax_iters;
+  real_t rtol, err_factor, err_slack, time_slack;
+  real_t adaptive_rate;  ///< min_rate of adaptive smoothing (0: off)
+  std::string baseline, write_baseline;
+} mms_config;
+
+typedef struct {
+  real_t err, factor;
+  double time, t_err;
+  idx_t cycles, cycles_err;
+  bool converged;
+} mms_result;
+
+/**
+ * @brief mixed partial derivative of an analytic field
+ * @param m derivative order in each direction
+ */
+static real_t mmsDerivative(const mms_field & f, const idx_t m[3],
+  real_t x, real_t y, real_t z)
+{
+  const real_t pos[3] = {x, y, z};
+  real_t res = f.amp;
+
+  for(idx_t d = 0; d < 3; d++)
+  {
+    real_t w = 2.0 * PI * f.k[d] / H_LEN_FRAC;
+    res *= pow(w, (real_t) m[d]) * sin(w * pos[d] + f.phase[d] + 0.5 * PI * m[d]);
+  }
+
+  if(m[0] + m[1] + m[2] == 0)
+    res += f.offset;
+  return res;
+}
+
+/**
+ * @brief exact value of an atom, see FASMultigrid::atom_type
+ */
+static real_t mmsAtom(const atom & a, const std::vector<mms_field> & exact,
+  real_t x, real_t y, real_t z)
+{
+  const mms_field & f = exact[a.u_id];
+  idx_t m[3] = {0, 0, 0};
+
+  switch(a.type)
+  {
+    case FASMultigrid::poly:
+      return pow(mmsDerivative(f, m, x, y, z), a.value);
+    case FASMultigrid::der1:  m[0] = 1; break;
+    case FASMultigrid::der2:  m[1] = 1; break;
+    case FASMultigrid::der3:  m[2] = 1; break;
+    case FASMultigrid::der11: m[0] = 2; break;
+    case FASMultigrid::der22: m[1] = 2; break;
+    case FASMultigrid::der33: m[2] = 2; break;
+    case FASMultigrid::der12: m[0] = 1; m[1] = 1; break;
+    case FASMultigrid::der13: m[0] = 1; m[2] = 1; break;
+    case FASMultigrid::der23: m[1] = 1; m[2] = 1; break;
+    case FASMultigrid::lap:
+    {
+      const idx_t mx[3] = {2, 0, 0}, my[3] = {0, 2, 0}, mz[3] = {0, 0, 2};
+      return mmsDerivative(f, mx, x, y, z) + mmsDerivative(f, my, x, y, z)
+        + mmsDerivative(f, mz, x, y, z);
+    }
+    default:
+      std::cout << "Unknown atom type " << a.type << "\n";
+      throw -1;
+  }
+
+  return mmsDerivative(f, m, x, y, z);
+}
+
+static mms_field mmsField(real_t offset, real_t amp, idx_t kx, idx_t ky,
+  idx_t kz, real_t px, real_t py, real_t pz)
+{
+  mms_field f = {offset, amp, {kx, ky, kz}, {px, py, pz}};
+  return f;
+}
+
+static mms_term mmsTerm(real_t coef, idx_t type1, idx_t u_id1, real_t value1,
+  idx_t type2 = 0, idx_t u_id2 = 0, real_t value2 = 0)
+{
+  mms_term t;
+  t.coef = coef;
+  atom a1 = {type1, u_id1, value1};
+  t.atoms.push_back(a1);
+  if(type2 != 0)
+  {
+    atom a2 = {type2, u_id2, value2};
+    t.atoms.push_back(a2);
+  }
+  return t;
+}
+
+static std::vector<mms_problem> mmsProblems()
+{
+  std::vector<mms_problem> problems;
+  mms_problem p;
+
+  p.name = "poisson";
+  p.exact.assign(1, mmsField(0.0, 1.0, 1, 1, 1, 0.0, 0.3, 0.7));
+  p.eqns.assign(1, std::vector<mms_term>());
+  p.eqns[0].push_back(mmsTerm(1.0, FASMultigrid::lap, 0, 0));
+  p.up_to_constant = true;
+  p.max_err = 0.05;
+  p.check_rate = true;
+  p.cycle_factor = 1;
+  problems.push_back(p);
+
+  p.name = "power_law";
+  p.exact.assign(1, mmsField(2.0, 0.5, 1, 2, 1, 0.2, 0.0, 0.5));
+  p.eqns.assign(1, std::vector<mms_term>());
+  p.eqns[0].push_back(mmsTerm(1.0, FASMultigrid::lap, 0, 0));
+  p.eqns[0].push_back(mmsTerm(-0.25, FASMultigrid::poly, 0, 3.0));
+  p.eqns[0].push_back(mmsTerm(2.0, FASMultigrid::poly, 0, -1.0));
+  p.up_to_constant = false;
+  p.max_err = 0.05;
+  p.check_rate = true;
+  p.cycle_factor = 1;
+  problems.push_back(p);
+
+  // V-cycles converge slowly (~0.8 per cycle) once the residual is small,
+  // the error at 32^3 only reaches the discretization error after ~25 cycles
+  p.name = "coupled";
+  p.exact.clear();
+  p.exact.push_back(mmsField(0.0, 1.0, 1, 1, 1, 0.0, 0.4, 0.9));
+  p.exact.push_back(mmsField(1.5, 0.5, 1, 1, 1, 0.6, 0.1, 0.0));
+  p.eqns.assign(2, std::vector<mms_term>());
+  p.eqns[0].push_back(mmsTerm(1.0, FASMultigrid::lap, 0, 0));
+  p.eqns[0].push_back(mmsTerm(-1.0, FASMultigrid::poly, 0, 1.0));
+  p.eqns[0].push_back(mmsTerm(0.02, FASMultigrid::der12, 1, 0));
+  p.eqns[0].push_back(mmsTerm(0.02, FASMultigrid::der3, 1, 0, FASMultigrid::poly, 0, 1.0));
+  p.eqns[1].push_back(mmsTerm(1.0, FASMultigrid::der11, 1, 0));
+  p.eqns[1].push_back(mmsTerm(1.0, FASMultigrid::der22, 1, 0));
+  p.eqns[1].push_back(mmsTerm(1.0, FASMultigrid::der33, 1, 0));
+  p.eqns[1].push_back(mmsTerm(-0.1, FASMultigrid::poly, 1, 3.0));
+  p.eqns[1].push_back(mmsTerm(0.02, FASMultigrid::der13, 0, 0));
+  p.eqns[1].push_back(mmsTerm(0.02, FASMultigrid::der23, 1, 0));
+  p.eqns[1].push_back(mmsTerm(0.02, FASMultigrid::der1, 0, 0, FASMultigrid::der2, 1, 0));
+  p.up_to_constant = false;
+  p.max_err = 0.05;
+  p.check_rate = true;
+  p.cycle_factor = 3;
+  problems.push_back(p);
+
+  return problems;
+}
+
+/**
+ * @brief max. error of the solution, ignoring a constant offset if the
+ *  problem only defines it up to one
+ */
+static real_t mmsError(const mms_problem & p, arr_t * u, idx_t nx, idx_t ny,
+  idx_t nz)
+{
+  real_t err = 0.0;
+
+  for(idx_t e = 0; e < (idx_t) p.exact.size(); e++)
+  {
+    const idx_t m0[3] = {0, 0, 0};
+    real_t shift = 0.0;
+    idx_t i, j, k;
+
+    if(p.up_to_constant)
+    {
+      FAS_LOOP3_N(i, j, k, nx, ny, nz)
+        shift += u[e][H_INDEX(i, j, k, nx, ny, nz)] - mmsDerivative(p.exact[e],
+          m0, H_LEN_FRAC * i / nx, H_LEN_FRAC * j / ny, H_LEN_FRAC * k / nz);
+      shift /= (real_t) nx * ny * nz;
+    }
+
+    FAS_LOOP3_N(i, j, k, nx, ny, nz)
+      err = std::max(err, std::fabs(u[e][H_INDEX(i, j, k, nx, ny, nz)] - shift
+        - mmsDerivative(p.exact[e], m0,
+            H_LEN_FRAC * i / nx, H_LEN_FRAC * j / ny, H_LEN_FRAC * k / nz)));
+  }
+
+  return err;
+}
+
+/**
+ * @brief solve a problem on an nx * ny * nz grid from a constant initial
+ *  guess
+ */
+static mms_result mmsSolve(const mms_problem & p, idx_t nx, idx_t ny,
+  idx_t nz, idx_t order, const mms_config & cfg)
+{
+  idx_t u_n = p.exact.size();
+  arr_t * u = new arr_t[u_n];
+  idx_t * molecule_n = new idx_t[u_n];
+  mms_result res;
+
+  // coarsest grid has about 4 points along the longest axis
+  idx_t max_depth = 1;
+  for(idx_t m = std::max(nx, std::max(ny, nz)); m > 4; m = (m + 1) / 2)
+    max_depth++;
+
+  for(idx_t e = 0; e < u_n; e++)
+  {
+    u[e].init(nx, ny, nz);
+    for(idx_t idx = 0; idx < nx * ny * nz; idx++)
+      u[e][idx] = p.exact[e].offset;
+    molecule_n[e] = p.eqns[e].size() + 1;
+  }
+
+  FASMultigrid * mg_p = new FASMultigrid(u, u_n, molecule_n, max_depth,
+    cfg.max_relax_iters, 1e-12);
+  FASMultigrid & mg = *mg_p;
+  mg.tuning_cache_file = "";
+  mg.setStencilOrder(order);
+  if(cfg.adaptive_rate > 0.0)
+  {
+    mg.getSmoothing().enabled = true;
+    mg.getSmoothing().min_rate = cfg.adaptive_rate;
+  }
+
+  for(idx_t e = 0; e < u_n; e++)
+  {
+    idx_t rho_id = p.eqns[e].size();
+
+    for(idx_t t = 0; t < rho_id; t++)
+    {
+      mg.eqns[e][t].init(p.eqns[e][t].atoms.size(), p.eqns[e][t].coef);
+      for(size_t a = 0; a < p.eqns[e][t].atoms.size(); a++)
+        mg.add_atom_to_eqn(p.eqns[e][t].atoms[a], t, e);
+    }
+
+    mg.eqns[e][rho_id].init(0, 1.0);
+    idx_t i, j, k;
+    FAS_LOOP3_N(i, j, k, nx, ny, nz)
+    {
+      real_t x = H_LEN_FRAC * i / nx, y = H_LEN_FRAC * j / ny,
+        z = H_LEN_FRAC * k / nz;
+      real_t rho = 0.0;
+      for(idx_t t = 0; t < rho_id; t++)
+      {
+        real_t val = p.eqns[e][t].coef;
+        for(size_t a = 0; a < p.eqns[e][t].atoms.size(); a++)
+          val *= mmsAtom(p.eqns[e][t].atoms[a], p.exact, x, y, z);
+        rho -= val;
+      }
+      mg.setPolySrcAtPt(e, rho_id, i, j, k, rho);
+    }
+  }
+  mg.initializeRhoHeirarchy();
+
+  // cycle until the residual is reduced by rtol or stops decreasing
+  std::vector<real_t> residuals(1, mg._getMaxResidualAllEqs(max_depth));
+  std::vector<real_t> errs;
+  std::vector<double> times;
+  res.time = 0.0;
+  res.converged = true;
+
+  for(idx_t c = 0; c < p.cycle_factor * cfg.max_cycles; c++)
+  {
+    double start = omp_get_wtime();
+    mg.VCycle();
+    res.time += omp_get_wtime() - start;
+
+    residuals.push_back(mg._getMaxResidualAllEqs(max_depth));
+    errs.push_back(mmsError(p, u, nx, ny, nz));
+    times.push_back(res.time);
+
+    if(!(residuals.back() < residuals[0]))
+    {
+      res.converged = false;
+      break;
+    }
+    if(residuals.back() < cfg.rtol * residuals[0]
+       || residuals.back() > 0.95 * residuals[residuals.size() - 2])
+      break;
+  }
+
+  res.cycles = errs.size();
+  res.err = errs.back();
+
+  res.factor = pow(residuals.back() / residuals[0], 1.0 / res.cycles);
+
+  res.cycles_err = res.cycles;
+  for(idx_t c = res.cycles - 1; c >= 0; c--)
+    if(errs[c] <= cfg.err_factor * res.err)
+      res.cycles_err = c + 1;
+  res.t_err = times[res.cycles_err - 1];
+
+  delete mg_p;
+  for(idx_t e = 0; e < u_n; e++)
+    delete [] u[e]._array;
+  delete [] u;
+  delete [] molecule_n;
+
+  return res;
+}
+
+static std::vector<std::string> splitList(const std::string & list)
+{
+  std::vector<std::string> res;
+  std::stringstream ss(list);
+  std::string item;
+  while(std::getline(ss, item, ','))
+    if(!item.empty())
+      res.push_back(item);
+  return res;
+}
+
+static std::vector<idx_t> splitIdxList(const std::string & list)
+{
+  std::vector<std::string> items = splitList(list);
+  std::vector<idx_t> res;
+  for(size_t i = 0; i < items.size(); i++)
+    res.push_back(atol(items[i].c_str()));
+  return res;
+}
+
+/**
+ * @brief "nx" for a cube, "nxxnyxnz" otherwise
+ */
+static std::string mmsGridName(const std::vector<idx_t> & g)
+{
+  std::stringstream ss;
+  ss << g[0];
+  if(g[1] != g[0] || g[2] != g[0])
+    ss << "x" << g[1] << "x" << g[2];
+  return ss.str();
+}
+
+/**
+ * @brief parse "n" (a cube) or "nxxnyxnz"
+ */
+static bool parseShape(const std::string & item, std::vector<idx_t> & g)
+{
+  std::stringstream ss(item);
+  std::string n;
+  g.clear();
+  while(std::getline(ss, n, 'x'))
+    g.push_back(atol(n.c_str()));
+  if(g.size() == 1)
+    g.assign(3, g[0]);
+  return g.size() == 3 && g[0] > 0 && g[1] > 0 && g[2] > 0;
+}
+
+static std::string mmsKey(const std::string & name, idx_t order,
+  const std::string & grid)
+{
+  std::stringstream ss;
+  ss << name << " " << order << " " << grid;
+  return ss.str();
+}
+
+static void usage()
+{
+  std::cout << "Usage: manufactured_solutions [--sizes 16,32] [--orders 4]\n"
+            << "  [--shapes 33,31x30x33,64x16x16]\n"
+            << "  [--problems poisson,power_law,coupled] [--max-cycles 10]\n"
+            << "  [--relax-iters 10] [--rtol 1e-8] [--err-factor 1.1] [--baseline FILE]\n"
+            << "  [--write-baseline FILE] [--err-slack 0.05] [--time-slack 0.5]\n"
+            << "  [--adaptive-rate 0 (min. rate of adaptive smoothing, 0: off)]\n";
+}
+
+int main(int argc, char **argv)
+{
+  mms_config cfg;
+  std::vector<std::string> shapes = splitList("33,31x30x33,64x16x16");
+  cfg.sizes = splitIdxList("16,32");
+  cfg.orders = splitIdxList("4");
+  cfg.problems = splitList("poisson,power_law,coupled");
+  cfg.max_cycles = 10;
+  cfg.max_relax_iters = 10;
+  cfg.rtol = 1e-8;
+  cfg.err_factor = 1.1;
+  cfg.err_slack = 0.05;
+  cfg.time_slack = 0.5;
+  cfg.adaptive_rate = 0.0;
+
+  for(int a = 1; a < argc; a++)
+  {
+    std::string opt = argv[a];
+    if(opt == "--help" || opt == "-h" || a + 1 >= argc)
+    {
+      usage();
+      return opt == "--help" || opt == "-h" ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    std::string val = argv[++a];
+
+    if(opt == "--sizes") cfg.sizes = splitIdxList(val);
+    else if(opt == "--shapes") shapes = splitList(val);
+    else if(opt == "--orders") cfg.orders = splitIdxList(val);
+    else if(opt == "--problems") cfg.problems = splitList(val);
+    else if(opt == "--max-cycles") cfg.max_cycles = atol(val.c_str());
+    else if(opt == "--relax-iters") cfg.max_relax_iters = atol(val.c_str());
+    else if(opt == "--rtol") cfg.rtol = atof(val.c_str());
+    else if(opt == "--err-factor") cfg.err_factor = atof(val.c_str());
+    else if(opt == "--err-slack") cfg.err_slack = atof(val.c_str());
+    else if(opt == "--time-slack") cfg.time_slack = atof(val.c_str());
+    else if(opt == "--adaptive-rate") cfg.adaptive_rate = atof(val.c_str());
+    else if(opt == "--baseline") cfg.baseline = val;
+    else if(opt == "--write-baseline") cfg.write_baseline = val;
+    else
+    {
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if(cfg.max_cycles < 1)
+  {
+    std::cout << "--max-cycles must be at least 1\n";
+    return EXIT_FAILURE;
+  }
+  for(size_t s = 0; s < shapes.size(); s++)
+  {
+    std::vector<idx_t> g;
+    if(!parseShape(shapes[s], g))
+    {
+      std::cout << "Invalid shape " << shapes[s] << "\n";
+      return EXIT_FAILURE;
+    }
+    cfg.shapes.push_back(g);
+  }
+
+  // baseline lines: problem order n err t_err
+  std::map<std::string, std::pair<real_t, double> > baseline;
+  if(!cfg.baseline.empty())
+  {
+    std::ifstream in(cfg.baseline.c_str());
+    if(!in)
+    {
+      std::cout << "Unable to read baseline " << cfg.baseline << "\n";
+      return EXIT_FAILURE;
+    }
+    std::string name, grid;
+    idx_t order;
+    real_t err;
+    double t_err;
+    while(in >> name >> order >> grid >> err >> t_err)
+      baseline[mmsKey(name, order, grid)] = std::make_pair(err, t_err);
+  }
+
+  std::ofstream baseline_out;
+  if(!cfg.write_baseline.empty())
+    baseline_out.open(cfg.write_baseline.c_str());
+
+  std::vector<mms_problem> problems = mmsProblems();
+  idx_t failures = 0;
+
+  // cubes first, so shapes can be compared with them
+  std::vector< std::vector<idx_t> > grids;
+  for(size_t s = 0; s < cfg.sizes.size(); s++)
+    grids.push_back(std::vector<idx_t>(3, cfg.sizes[s]));
+  grids.insert(grids.end(), cfg.shapes.begin(), cfg.shapes.end());
+
+  std::cout << "problem    order      grid  cycles   factor          err   rate    t_err (s)\n";
+  for(size_t q = 0; q < cfg.problems.size(); q++)
+  {
+    size_t p_id = 0;
+    while(p_id < problems.size() && problems[p_id].name != cfg.problems[q])
+      p_id++;
+    if(p_id == problems.size())
+    {
+      std::cout << "Unknown problem " << cfg.problems[q] << "\n";
+      return EXIT_FAILURE;
+    }
+    const mms_problem & p = problems[p_id];
+
+    for(size_t o = 0; o < cfg.orders.size(); o++)
+    {
+      idx_t order = cfg.orders[o];
+      std::map<idx_t, real_t> cube_errs;
+
+      for(size_t s = 0; s < grids.size(); s++)
+      {
+        const std::vector<idx_t> & g = grids[s];
+        bool cube = s < cfg.sizes.size();
+        mms_result r = mmsSolve(p, g[0], g[1], g[2], order, cfg);
+        std::string key = mmsKey(p.name, order, mmsGridName(g));
+        std::stringstream fail;
+
+        real_t rate = 0.0;
+        if(cube && s > 0)
+          rate = log(cube_errs[cfg.sizes[s - 1]] / r.err)
+            / log((real_t) g[0] / cfg.sizes[s - 1]);
+
+        // largest cube no finer along any axis
+        idx_t ref_n = 0;
+        for(std::map<idx_t, real_t>::iterator it = cube_errs.begin();
+          !cube && it != cube_errs.end(); ++it)
+          if(it->first <= std::min(g[0], std::min(g[1], g[2])))
+            ref_n = it->first;
+        if(cube)
+          cube_errs[g[0]] = r.err;
+
+        if(!r.converged)
+          fail << " V-cycles diverged;";
+        if(r.err > p.max_err)
+          fail << " error above " << p.max_err << ";";
+        if(cube && s > 0 && p.check_rate && rate < order - 1)
+          fail << " order of accuracy below " << order - 1 << ";";
+        if(ref_n > 0 && r.err > cube_errs[ref_n] * (1.0 + cfg.err_slack))
+          fail << " error above that of " << ref_n << "^3;";
+        if(baseline.count(key))
+        {
+          if(r.err > baseline[key].first * (1.0 + cfg.err_slack))
+            fail << " error regressed from " << baseline[key].first << ";";
+          if(r.t_err > baseline[key].second * (1.0 + cfg.time_slack))
+            fail << " time to error regressed from " << baseline[key].second << ";";
+        }
+        if(baseline_out.is_open())
+          baseline_out << key << " " << r.err << " " << r.t_err << "\n";
+
+        std::cout << std::setw(10) << std::left << p.name << std::right
+                  << std::setw(6) << order << std::setw(10) << mmsGridName(g)
+                  << std::setw(8) << r.cycles << std::setw(9) << std::setprecision(3)
+                  << r.factor << std::setw(13) << std::setprecision(4) << std::scientific
+                  << r.err << std::fixed << std::setw(7) << std::setprecision(2)
+                  << rate << std::setw(13) << std::setprecision(4)
+                  << r.t_err << std::defaultfloat << std::setprecision(6);
+        if(!fail.str().empty())
+        {
+          std::cout << "  FAIL:" << fail.str();
+          failures++;
+        }
+        std::cout << "\n" << std::flush;
+      }
+    }
+  }
+
+  if(failures > 0)
+  {
+    std::cout << failures << " manufactured solution check(s) failed.\n";
+    return EXIT_FAILURE;
+  }
+  std::cout << "All manufactured solution checks passed.\n";
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,403 @@
+/**
+ * Checks of the distributed (MPI) multigrid solver against the serial one.
+ *
+ * Every problem prescribes an analytic solution made of sines (periodic on
+ * the box) and sets the source of each equation so the analytic fields
+ * solve the continuous system. FASMultigridMPI solves it on all ranks of
+ * MPI_COMM_WORLD, the solution is gathered on rank 0, which solves the same
+ * problem with FASMultigrid and reports, per problem and size:
+ *
+ *   ranks       ranks of each level, fine to coarse (agglomeration)
+ *   residual    max. fine grid residual of the distributed solve
+ *   res_serial  the same for the serial solve
+ *   err         max. |u - u_exact| of the distributed solve
+ *   err_serial  the same for the serial solve
+ *   diff        max. |u - u_serial|
+ *
+ * Problems:
+ *   screened    lap(u) - u + rho = 0
+ *   poisson     lap(u) + rho = 0 (zero-mean rho and u), solved with
+ *               inexact_newton_constrained
+ *   coupled     lap(u0) - u0 + u1 / 2 + rho0 = 0,
+ *               lap(u1) - u1^2 + der1(u0) / 2 + rho1 = 0
+ *
+ * --adaptive-rate R runs both solvers with adaptive smoothing (min_rate R).
+ *
+ * In-place Jacobian updates see neighbouring slabs one sweep late, so the
+ * two solves take slightly different paths and stop at different residuals
+ * (the operators are bounded below by about 1, so a residual r allows an
+ * error of about r). The run fails (exit status 1) if diff is more than
+ * --diff-factor times err_serial plus both residuals, or the error is more
+ * than --err-slack above the serial one plus the residuals. On one rank the
+ * solves agree to rounding.
+ *
+ * Example:
+ *   mpicxx mpi_check.cpp fas_mpi.cpp full_multigrid.cpp fas_batch.cpp fas_instrumentation.cpp \
+ *     fas_trace.cpp fas_perf_counters.cpp fas_checkpoint.cpp fas_field_output.cpp fas_out_of_core.cpp fas_autotune.cpp fas_refinement.cpp fas_equations.cpp \
+ *     -O3 -Wall --std=c++11 -fopenmp -o mpi_check
+ *   mpirun -np 4 ./mpi_check --sizes 32,64 --order 4
+ */
+#include "fas_mpi.h"
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iomanip>
+
+using namespace cosmo;
+
+/**
+ * @brief analytic field offset + amp * prod_d sin(2 pi x_d / L + phase_d)
+ */
+typedef struct {
+  real_t offset, amp;
+  real_t phase[3];
+} mpi_field;
+
+typedef struct {
+  std::vector<idx_t> sizes;
+  std::vector<std::string> problems;
+  idx_t order, cycles, max_relax_iters;
+  real_t diff_factor, err_slack;
+  real_t adaptive_rate;  ///< min_rate of adaptive smoothing (0: off)
+} mpi_config;
+
+typedef struct {
+  std::string ranks;
+  real_t residual, residual_serial, err, err_serial, diff;
+} mpi_result;
+
+/**
+ * @brief value (d = 0) or derivative along x (d = 1) of a field
+ */
+static real_t mpiField(const mpi_field & f, idx_t d, real_t x, real_t y, real_t z)
+{
+  real_t w = 2.0 * PI / H_LEN_FRAC;
+  real_t sx = (d == 1) ? w * cos(w * x + f.phase[0]) : sin(w * x + f.phase[0]);
+  return (d == 0 ? f.offset : 0.0)
+    + f.amp * sx * sin(w * y + f.phase[1]) * sin(w * z + f.phase[2]);
+}
+
+static real_t mpiLaplacian(const mpi_field & f, real_t x, real_t y, real_t z)
+{
+  real_t w = 2.0 * PI / H_LEN_FRAC;
+  return -3.0 * w * w * (mpiField(f, 0, x, y, z) - f.offset);
+}
+
+/**
+ * @brief exact solution and sources of a problem at a point
+ */
+static void mpiProblem(const std::string & name, real_t x, real_t y, real_t z,
+  real_t * u, real_t * rho)
+{
+  static const mpi_field f0 = {0.0, 1.0, {0.0, 0.0, 0.0}};
+  static const mpi_field f1 = {1.0, 0.5, {0.3, 0.7, 1.1}};
+  static const mpi_field f2 = {1.0, 0.25, {1.3, 0.2, 0.5}};
+
+  if(name == "screened")
+  {
+    u[0] = mpiField(f0, 0, x, y, z);
+    rho[0] = u[0] - mpiLaplacian(f0, x, y, z);
+  }
+  else if(name == "poisson")
+  {
+    u[0] = mpiField(f0, 0, x, y, z);
+    rho[0] = -mpiLaplacian(f0, x, y, z);
+  }
+  else
+  {
+    u[0] = mpiField(f1, 0, x, y, z);
+    u[1] = mpiField(f2, 0, x, y, z);
+    rho[0] = u[0] - 0.5 * u[1] - mpiLaplacian(f1, x, y, z);
+    rho[1] = u[1] * u[1] - mpiLaplacian(f2, x, y, z)
+      - 0.5 * mpiField(f1, 1, x, y, z);
+  }
+}
+
+/**
+ * @brief add the equations of a problem (rho as the last molecule)
+ */
+template<typename MG>
+static void mpiEquations(const std::string & name, MG & mg)
+{
+  atom a_lap0 = {FASMultigrid::lap, 0, 0}, a_lap1 = {FASMultigrid::lap, 1, 0};
+  atom a_u0 = {FASMultigrid::poly, 0, 1.0}, a_u1 = {FASMultigrid::poly, 1, 1.0};
+  atom a_dx0 = {FASMultigrid::der1, 0, 0};
+
+  if(name == "screened")
+  {
+    mg.eqns[0][0].init(1, 1.0);
+    mg.add_atom_to_eqn(a_lap0, 0, 0);
+    mg.eqns[0][1].init(1, -1.0);
+    mg.add_atom_to_eqn(a_u0, 1, 0);
+    mg.eqns[0][2].init(0, 1.0);
+    return;
+  }
+
+  if(name == "poisson")
+  {
+    mg.eqns[0][0].init(1, 1.0);
+    mg.add_atom_to_eqn(a_lap0, 0, 0);
+    mg.eqns[0][1].init(0, 1.0);
+    return;
+  }
+
+  mg.eqns[0][0].init(1, 1.0);
+  mg.add_atom_to_eqn(a_lap0, 0, 0);
+  mg.eqns[0][1].init(1, -1.0);
+  mg.add_atom_to_eqn(a_u0, 1, 0);
+  mg.eqns[0][2].init(1, 0.5);
+  mg.add_atom_to_eqn(a_u1, 2, 0);
+  mg.eqns[0][3].init(0, 1.0);
+
+  mg.eqns[1][0].init(1, 1.0);
+  mg.add_atom_to_eqn(a_lap1, 0, 1);
+  mg.eqns[1][1].init(2, -1.0);
+  mg.add_atom_to_eqn(a_u1, 1, 1);
+  mg.add_atom_to_eqn(a_u1, 1, 1);
+  mg.eqns[1][2].init(1, 0.5);
+  mg.add_atom_to_eqn(a_dx0, 2, 1);
+  mg.eqns[1][3].init(0, 1.0);
+}
+
+static mpi_result mpiSolve(const std::string & name, idx_t n,
+  const mpi_config & cfg, int rank)
+{
+  mpi_result res;
+  idx_t u_n = (name == "coupled") ? 2 : 1;
+  idx_t molecule_n[2] = {3, 4};
+  if(u_n == 2)
+    molecule_n[0] = 4;
+  else if(name == "poisson")
+    molecule_n[0] = 2;
+  // the periodic Laplacian alone only fixes u up to a constant
+  FASMultigrid::relax_t scheme = (name == "poisson")
+    ? FASMultigrid::inexact_newton_constrained : FASMultigrid::inexact_newton;
+  idx_t max_depth = 1;
+  while((n >> max_depth) >= 4)
+    max_depth++;
+
+  // distributed solve
+  FASMultigridMPI mg(MPI_COMM_WORLD, n, n, n, u_n, molecule_n, max_depth,
+    cfg.max_relax_iters, 1e-8, cfg.order);
+  mg.relax_scheme = scheme;
+  if(cfg.adaptive_rate > 0.0)
+  {
+    mg.getSmoothing().enabled = true;
+    mg.getSmoothing().min_rate = cfg.adaptive_rate;
+  }
+  mpiEquations(name, mg);
+
+  idx_t i, j, k;
+  real_t u[2], rho[2];
+  FAS_LOOP3_N(i, j, k, n, n, n)
+  {
+    mpiProblem(name, H_LEN_FRAC * i / n, H_LEN_FRAC * j / n, H_LEN_FRAC * k / n,
+      u, rho);
+    for(idx_t e = 0; e < u_n; e++)
+    {
+      mg.setSolutionAtPt(e, i, j, k, (u_n == 1) ? 0.0 : 1.0);
+      mg.setPolySrcAtPt(e, molecule_n[e] - 1, i, j, k, rho[e]);
+    }
+  }
+  mg.initializeRhoHeirarchy();
+  mg.VCycles(cfg.cycles);
+  res.residual = mg._getMaxResidualAllEqs(max_depth);
+
+  std::stringstream ranks;
+  for(idx_t depth = max_depth; depth >= 1; --depth)
+    ranks << mg.getRanks(depth) << (depth > 1 ? "," : "");
+  res.ranks = ranks.str();
+
+  arr_t * u_mpi = new arr_t[u_n];
+  for(idx_t e = 0; e < u_n; e++)
+  {
+    if(rank == 0)
+      u_mpi[e].init(n, n, n);
+    mg.gatherSolution(e, u_mpi[e]);
+  }
+
+  // serial solve of the same problem on rank 0
+  res.err = res.err_serial = res.diff = res.residual_serial = 0.0;
+  if(rank == 0)
+  {
+    arr_t * u_ser = new arr_t[u_n];
+    for(idx_t e = 0; e < u_n; e++)
+      u_ser[e].init(n, n, n);
+
+    FASMultigrid * ser = new FASMultigrid(u_ser, u_n, molecule_n, max_depth,
+      cfg.max_relax_iters, 1e-8);
+    ser->tuning_cache_file = "";
+    ser->setStencilOrder(cfg.order);
+    ser->relax_scheme = scheme;
+    if(cfg.adaptive_rate > 0.0)
+    {
+      ser->getSmoothing().enabled = true;
+      ser->getSmoothing().min_rate = cfg.adaptive_rate;
+    }
+    mpiEquations(name, *ser);
+    FAS_LOOP3_N(i, j, k, n, n, n)
+    {
+      mpiProblem(name, H_LEN_FRAC * i / n, H_LEN_FRAC * j / n, H_LEN_FRAC * k / n,
+        u, rho);
+      for(idx_t e = 0; e < u_n; e++)
+      {
+        u_ser[e][H_INDEX(i, j, k, n, n, n)] = (u_n == 1) ? 0.0 : 1.0;
+        ser->setPolySrcAtPt(e, molecule_n[e] - 1, i, j, k, rho[e]);
+      }
+    }
+    ser->initializeRhoHeirarchy();
+    ser->VCycles(cfg.cycles);
+    res.residual_serial = ser->_getMaxResidualAllEqs(max_depth);
+
+    FAS_LOOP3_N(i, j, k, n, n, n)
+    {
+      idx_t idx = H_INDEX(i, j, k, n, n, n);
+      mpiProblem(name, H_LEN_FRAC * i / n, H_LEN_FRAC * j / n, H_LEN_FRAC * k / n,
+        u, rho);
+      for(idx_t e = 0; e < u_n; e++)
+      {
+        res.err = std::max(res.err, (real_t) std::fabs(u_mpi[e][idx] - u[e]));
+        res.err_serial = std::max(res.err_serial, (real_t) std::fabs(u_ser[e][idx] - u[e]));
+        res.diff = std::max(res.diff, (real_t) std::fabs(u_mpi[e][idx] - u_ser[e][idx]));
+      }
+    }
+
+    delete ser;
+    for(idx_t e = 0; e < u_n; e++)
+    {
+      delete [] u_ser[e]._array;
+      delete [] u_mpi[e]._array;
+    }
+    delete [] u_ser;
+  }
+  delete [] u_mpi;
+
+  return res;
+}
+
+static std::vector<std::string> splitList(const std::string & list)
+{
+  std::vector<std::string> res;
+  std::stringstream ss(list);
+  std::string item;
+  while(std::getline(ss, item, ','))
+    if(!item.empty())
+      res.push_back(item);
+  return res;
+}
+
+static void usage()
+{
+  std::cout << "Usage: mpirun -np N mpi_check [--sizes 16,32] [--order 4]\n"
+            << "  [--problems screened,poisson,coupled] [--cycles 6] [--relax-iters 10]\n"
+            << "  [--diff-factor 0.1] [--err-slack 0.1]\n"
+            << "  [--adaptive-rate 0 (min. rate of adaptive smoothing, 0: off)]\n";
+}
+
+int main(int argc, char **argv)
+{
+  int provided, rank, ranks;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+
+  mpi_config cfg;
+  std::vector<std::string> sizes = splitList("16,32");
+  cfg.problems = splitList("screened,poisson,coupled");
+  cfg.order = 4;
+  cfg.cycles = 6;
+  cfg.max_relax_iters = 10;
+  cfg.diff_factor = 0.1;
+  cfg.err_slack = 0.1;
+  cfg.adaptive_rate = 0.0;
+
+  for(int a = 1; a < argc; a++)
+  {
+    std::string opt = argv[a];
+    if(opt == "--help" || opt == "-h" || a + 1 >= argc)
+    {
+      if(rank == 0)
+        usage();
+      MPI_Finalize();
+      return opt == "--help" || opt == "-h" ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    std::string val = argv[++a];
+
+    if(opt == "--sizes") sizes = splitList(val);
+    else if(opt == "--order") cfg.order = atol(val.c_str());
+    else if(opt == "--problems") cfg.problems = splitList(val);
+    else if(opt == "--cycles") cfg.cycles = atol(val.c_str());
+    else if(opt == "--relax-iters") cfg.max_relax_iters = atol(val.c_str());
+    else if(opt == "--diff-factor") cfg.diff_factor = atof(val.c_str());
+    else if(opt == "--err-slack") cfg.err_slack = atof(val.c_str());
+    else if(opt == "--adaptive-rate") cfg.adaptive_rate = atof(val.c_str());
+    else
+    {
+      if(rank == 0)
+        usage();
+      MPI_Finalize();
+      return EXIT_FAILURE;
+    }
+  }
+  for(size_t s = 0; s < sizes.size(); s++)
+    cfg.sizes.push_back(atol(sizes[s].c_str()));
+
+  idx_t failures = 0;
+  if(rank == 0)
+    std::cout << "problem      n  ranks        residual   res_serial          err   err_serial         diff\n";
+
+  for(size_t q = 0; q < cfg.problems.size(); q++)
+  {
+    if(cfg.problems[q] != "screened" && cfg.problems[q] != "poisson"
+      && cfg.problems[q] != "coupled")
+    {
+      if(rank == 0)
+        std::cout << "Unknown problem " << cfg.problems[q] << "\n";
+      MPI_Finalize();
+      return EXIT_FAILURE;
+    }
+
+    for(size_t s = 0; s < cfg.sizes.size(); s++)
+    {
+      mpi_result r = mpiSolve(cfg.problems[q], cfg.sizes[s], cfg, rank);
+      if(rank != 0)
+        continue;
+
+      std::stringstream fail;
+      real_t res_sum = r.residual + r.residual_serial;
+      if(!(r.diff <= cfg.diff_factor * r.err_serial + res_sum))
+        fail << " differs from the serial solution;";
+      if(!(r.err <= r.err_serial * (1.0 + cfg.err_slack) + res_sum))
+        fail << " error above the serial error;";
+
+      std::cout << std::setw(10) << std::left << cfg.problems[q] << std::right
+                << std::setw(5) << cfg.sizes[s] << "  " << std::setw(10) << std::left
+                << r.ranks << std::right << std::scientific << std::setprecision(4)
+                << std::setw(13) << r.residual << std::setw(13) << r.residual_serial
+                << std::setw(13) << r.err
+                << std::setw(13) << r.err_serial << std::setw(13) << r.diff
+                << std::defaultfloat << std::setprecision(6);
+      if(!fail.str().empty())
+      {
+        std::cout << "  FAIL:" << fail.str();
+        failures++;
+      }
+      std::cout << "\n" << std::flush;
+    }
+  }
+
+  MPI_Bcast(&failures, sizeof(failures), MPI_BYTE, 0, MPI_COMM_WORLD);
+  if(rank == 0)
+  {
+    if(failures > 0)
+      std::cout << failures << " distributed solver check(s) failed on "
+                << ranks << " ranks.\n";
+    else
+      std::cout << "All distributed solver checks passed on " << ranks
+                << " ranks.\n";
+  }
+
+  MPI_Finalize();
+  return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
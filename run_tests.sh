@@ -1,7 +1,7 @@
 #!/bin/bash
 
 # Just try to compile and run for now.
-g++ main.cpp full_multigrid.cpp -O3 -Wall --std=c++11 -fopenmp
+g++ main.cpp full_multigrid.cpp fas_batch.cpp fas_instrumentation.cpp fas_trace.cpp fas_perf_counters.cpp fas_checkpoint.cpp fas_field_output.cpp fas_out_of_core.cpp fas_autotune.cpp fas_refinement.cpp fas_equations.cpp -O3 -Wall --std=c++11 -fopenmp
 if [ $? -ne 0 ]; then
     echo "Error: compile failed."
     exit 1
@@ -12,3 +12,57 @@ if [ $? -ne 0 ]; then
     echo "Error: run failed."
     exit 1
 fi
+
+# Check accuracy and convergence against manufactured solutions; pass
+# --baseline FILE to also check for regressions in error and time to error.
+g++ manufactured_solutions.cpp full_multigrid.cpp fas_batch.cpp fas_instrumentation.cpp fas_trace.cpp fas_perf_counters.cpp fas_checkpoint.cpp fas_field_output.cpp fas_out_of_core.cpp fas_autotune.cpp fas_refinement.cpp fas_equations.cpp -O3 -Wall --std=c++11 -fopenmp -o manufactured_solutions
+if [ $? -ne 0 ]; then
+    echo "Error: manufactured solutions compile failed."
+    exit 1
+fi
+
+./manufactured_solutions "$@"
+if [ $? -ne 0 ]; then
+    echo "Error: manufactured solution checks failed."
+    exit 1
+fi
+
+# Unit checks of solver components against independent references.
+g++ solver_checks.cpp full_multigrid.cpp fas_batch.cpp fas_instrumentation.cpp fas_trace.cpp fas_perf_counters.cpp fas_checkpoint.cpp fas_field_output.cpp fas_out_of_core.cpp fas_autotune.cpp fas_refinement.cpp fas_equations.cpp -O3 -Wall --std=c++11 -fopenmp -o solver_checks
+if [ $? -ne 0 ]; then
+    echo "Error: solver checks compile failed."
+    exit 1
+fi
+
+./solver_checks
+if [ $? -ne 0 ]; then
+    echo "Error: solver checks failed."
+    exit 1
+fi
+
+# Check the distributed solver against the serial one on several local
+# ranks (skipped without MPI); set MPIRUN_FLAGS for the launcher, e.g. to
+# allow more ranks than cores.
+if command -v mpicxx > /dev/null && command -v mpirun > /dev/null; then
+    mpicxx mpi_check.cpp fas_mpi.cpp full_multigrid.cpp fas_batch.cpp fas_instrumentation.cpp fas_trace.cpp fas_perf_counters.cpp fas_checkpoint.cpp fas_field_output.cpp fas_out_of_core.cpp fas_autotune.cpp fas_refinement.cpp fas_equations.cpp -O3 -Wall --std=c++11 -fopenmp -o mpi_check
+    if [ $? -ne 0 ]; then
+        echo "Error: MPI checks compile failed."
+        exit 1
+    fi
+
+    for np in 1 2 4; do
+        mpirun ${MPIRUN_FLAGS---oversubscribe} -np $np ./mpi_check
+        if [ $? -ne 0 ]; then
+            echo "Error: MPI checks failed on $np ranks."
+            exit 1
+        fi
+    done
+
+    mpirun ${MPIRUN_FLAGS---oversubscribe} -np 2 ./mpi_check --adaptive-rate 0.1
+    if [ $? -ne 0 ]; then
+        echo "Error: MPI checks with adaptive smoothing failed."
+        exit 1
+    fi
+else
+    echo "mpicxx / mpirun not found, skipping MPI checks."
+fi
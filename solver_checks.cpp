@@ -0,0 +1,1119 @@
+/**
+ * Unit checks of solver components against independent references.
+ *
+ * Checks:
+ *   equations   FASEquations: simplification of products, powers and like
+ *               terms (toString and terms), "=", stencil aliases and the
+ *               errors thrown for unsupported text
+ *   powers      fas_pow, fas_pow_pair, fas_pow_lanes and FASPowerChain
+ *               against pow for zero, negative and positive bases and
+ *               integer, half-integer and other exponents up to and beyond
+ *               +-FAS_POW_MAX_CHAIN
+ *   jacobian    equations, Jacobian coefficients and directional derivatives
+ *               from the operator cache against symbolic evaluation, for
+ *               molecules with repeated atoms (u0*u0^2, d1(u0)*d1(u0)),
+ *               sources, negative and half powers, in both layouts and all
+ *               stencil orders
+ *   restart     a solve with adaptive smoothing restarted from a checkpoint
+ *               halfway ends bitwise identical to the uninterrupted solve
+ *               (one thread)
+ *   field_output
+ *               FASFieldWriter files (several chunks per field, bounded
+ *               queue, buffered and O_DIRECT) read back with plain reads:
+ *               header, table, alignment and data
+ *   out_of_core out-of-core solves end bitwise identical to in-core ones
+ *               (one thread; four threads to 1e-4)
+ *   refinement  FAC solve of a Gaussian with a level 1 and a level 2 patch:
+ *               its error on the level 2 patch against uniform solves on
+ *               the base grid and on a grid as fine as level 2
+ *   batch       FASMultigridBatch members (coupled equations, different
+ *               sources, converging after different numbers of V-cycles)
+ *               end bitwise identical to solves of each member on its own
+ *               (one thread)
+ *
+ * Every check prints one line per failed comparison and a summary; the run
+ * fails (exit status 1) if any comparison fails. --checks a,b runs a subset.
+ *
+ * Example:
+ *   g++ solver_checks.cpp full_multigrid.cpp fas_batch.cpp fas_instrumentation.cpp \
+ *     fas_trace.cpp fas_perf_counters.cpp fas_checkpoint.cpp fas_field_output.cpp fas_out_of_core.cpp fas_autotune.cpp fas_refinement.cpp fas_equations.cpp -O3 -Wall --std=c++11 -fopenmp -o solver_checks
+ *   ./solver_checks --checks equations
+ */
+#include "full_multigrid.h"
+#include "fas_equations.h"
+#include "fas_powers.h"
+#include "fas_field_output.h"
+#include "fas_refinement.h"
+#include "fas_batch.h"
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sstream>
+
+using namespace cosmo;
+
+/**
+ * @brief count and report a failed comparison
+ */
+static bool expect(bool ok, const std::string & what, idx_t & failures)
+{
+  if(!ok)
+  {
+    std::cout << "  FAIL: " << what << "\n";
+    failures++;
+  }
+  return ok;
+}
+
+/**
+ * @brief set an equation, discarding the message of an expected error
+ * @return false if setEquation threw
+ */
+static bool setQuietly(FASEquations & equations, idx_t eqn_id,
+  const std::string & text, bool quiet)
+{
+  std::ostringstream sink;
+  std::streambuf * out = std::cout.rdbuf();
+  if(quiet)
+    std::cout.rdbuf(sink.rdbuf());
+
+  bool ok = true;
+  try
+  {
+    equations.setEquation(eqn_id, text);
+  }
+  catch(int)
+  {
+    ok = false;
+  }
+  std::cout.rdbuf(out);
+  return ok;
+}
+
+static idx_t checkEquations()
+{
+  idx_t failures = 0;
+
+  // text, simplified text
+  const char * simplified[][2] = {
+    // distribution and cancellation
+    {"(u0+1)^2 - u0^2 - 2*u0", "1"},
+    {"lap(u0) + u0*u1 - u1*u0", "lap(u0)"},
+    {"(u0 - u1)*(u0 + u1) + u1^2", "u0^2"},
+    {"2*(lap(u0) + 3*u0)/4", "0.5*lap(u0) + 1.5*u0"},
+    // "=" moves the right hand side over
+    {"lap(u0) = u0^3 - rho", "lap(u0) - u0^3 + rho"},
+    {"u0 = u0 + u1", "-u1"},
+    // negative and half powers are merged within a term
+    {"u0^-1*u0^0.5", "u0^-0.5"},
+    {"u0^1.5*u0^0.5 + u0*u0^-1", "u0^2 + 1"},
+    {"u0^-2*u0^2*d1(u0)", "d1(u0)"},
+    {"4^0.5*u1^-3", "2*u1^-3"},
+    // d21, d31 and d32 are d12, d13 and d23
+    {"d21(u1) + d12(u1)", "2*d12(u1)"},
+    {"d31(u0) - d13(u0) + d32(u1)", "d23(u1)"},
+    // like terms with sources, atoms sorted by variable and type
+    {"2*rho*u0^5 + u0^5*rho", "3*rho*u0^5"},
+    {"d2(u1)*u0*d1(u0)", "u0*d1(u0)*d2(u1)"}
+  };
+  idx_t simplified_n = sizeof(simplified) / sizeof(simplified[0]);
+
+  for(idx_t t = 0; t < simplified_n; t++)
+  {
+    FASEquations equations(2);
+    if(!expect(setQuietly(equations, 0, simplified[t][0], false),
+      std::string("\"") + simplified[t][0] + "\" was rejected", failures))
+      continue;
+    std::string res = equations.toString(0);
+    expect(res == simplified[t][1], std::string("\"") + simplified[t][0]
+      + "\" simplified to \"" + res + "\" instead of \"" + simplified[t][1]
+      + "\"", failures);
+
+    // the simplified text reads back to the same equation
+    FASEquations again(2);
+    if(setQuietly(again, 0, res, false))
+      expect(again.toString(0) == res, "\"" + res + "\" does not read back",
+        failures);
+  }
+
+  // molecules handed to the solver
+  FASEquations equations(2);
+  equations.setEquation(0, "lap(u0) - 2*rho*u1^-0.5*d3(u0) + u0^2*u1 = sigma");
+  const std::vector<FASEquations::term_t> & terms = equations.terms(0);
+  if(expect(terms.size() == 4, "expected 4 molecules", failures))
+  {
+    expect(terms[0].coef == 1.0 && terms[0].src.empty()
+      && terms[0].atoms.size() == 1 && terms[0].atoms[0].type == FASMultigrid::lap
+      && terms[0].atoms[0].u_id == 0, "lap(u0) molecule", failures);
+    expect(terms[1].coef == -2.0 && terms[1].src == "rho"
+      && terms[1].atoms.size() == 2
+      && terms[1].atoms[0].type == FASMultigrid::der3 && terms[1].atoms[0].u_id == 0
+      && terms[1].atoms[1].type == FASMultigrid::poly && terms[1].atoms[1].u_id == 1
+      && terms[1].atoms[1].value == -0.5, "rho*d3(u0)*u1^-0.5 molecule", failures);
+    expect(terms[2].coef == 1.0 && terms[2].src.empty()
+      && terms[2].atoms.size() == 2
+      && terms[2].atoms[0].u_id == 0 && terms[2].atoms[0].value == 2.0
+      && terms[2].atoms[1].u_id == 1 && terms[2].atoms[1].value == 1.0,
+      "u0^2*u1 molecule", failures);
+    expect(terms[3].coef == -1.0 && terms[3].src == "sigma"
+      && terms[3].atoms.empty(), "sigma molecule", failures);
+  }
+  std::vector<idx_t> rho_mols = equations.sourceMolecules(0, "rho");
+  expect(rho_mols.size() == 1 && rho_mols[0] == 1, "molecules of rho", failures);
+
+  // text that must be rejected
+  const char * rejected[] = {
+    "lap(u0", "u0 )", "u2", "foo(u0)", "lap(u0*u1)", "lap(2)", "u0/u1",
+    "u0/0", "(u0 + u1)^0.5", "(u0 + 1)^-1", "u0^u1", "(-2)^0.5", "0^-1",
+    "rho*sigma*u0", "u0 - u0", "d1(u0) = d1(u0)", "", "2*"
+  };
+  idx_t rejected_n = sizeof(rejected) / sizeof(rejected[0]);
+
+  for(idx_t t = 0; t < rejected_n; t++)
+  {
+    FASEquations bad(2);
+    expect(!setQuietly(bad, 0, rejected[t], true),
+      std::string("\"") + rejected[t] + "\" was accepted", failures);
+  }
+
+  FASEquations unset(2);
+  unset.setEquation(0, "lap(u0)");
+  expect(!setQuietly(unset, 2, "lap(u1)", true), "equation 2 of 2 was accepted",
+    failures);
+
+  std::cout << "equations: " << simplified_n << " simplifications, "
+            << rejected_n << " rejected texts, " << failures << " failure(s)\n";
+  return failures;
+}
+
+/**
+ * @brief a equals the reference b up to a relative tolerance; infinities
+ *  and NaNs have to match
+ */
+static bool closeTo(real_t a, real_t b, real_t rel_tol)
+{
+  if(std::isnan(b))
+    return std::isnan(a);
+  if(std::isinf(b) || b == 0.0)
+    return a == b;
+  return std::fabs(a - b) <= rel_tol * std::fabs(b);
+}
+
+static std::string powCase(const char * fn, real_t x, real_t p, real_t res,
+  real_t ref)
+{
+  std::ostringstream out;
+  out.precision(17);
+  out << fn << "(" << x << ", " << p << ") = " << res << " instead of " << ref;
+  return out.str();
+}
+
+static idx_t checkPowers()
+{
+  idx_t failures = 0, cases = 0;
+  // a few ulp per multiplication of the longest chains
+  real_t tol = 1e-13;
+
+  const real_t bases[] = {0.0, 1.0, -1.0, 0.7, -0.7, 1.3, -1.3, 2.5, -2.5};
+  const real_t chain = FAS_POW_MAX_CHAIN;
+  const real_t exps[] = {0.0, 1.0, -1.0, 0.5, -0.5, 1.5, -1.5, 2.0, -2.0,
+    3.0, -3.0, 5.0, -7.0, 7.5, -7.5, chain - 0.5, -(chain - 0.5), chain,
+    -chain, chain + 0.5, -(chain + 0.5), chain + 1.0, -(chain + 1.0), 2.25,
+    -1.3};
+  idx_t base_n = sizeof(bases) / sizeof(bases[0]);
+  idx_t exp_n = sizeof(exps) / sizeof(exps[0]);
+
+  // every base as one lane array
+  real_t lanes[sizeof(bases) / sizeof(bases[0])];
+  real_t lane_res[sizeof(bases) / sizeof(bases[0])];
+  real_t lane_der[sizeof(bases) / sizeof(bases[0])];
+
+  for(idx_t e = 0; e < exp_n; e++)
+  {
+    real_t p = exps[e];
+    for(idx_t b = 0; b < base_n; b++)
+    {
+      real_t x = bases[b], ref = std::pow(x, p), val, der_pow;
+      cases++;
+
+      real_t res = fas_pow(x, p);
+      expect(closeTo(res, ref, tol), powCase("fas_pow", x, p, res, ref),
+        failures);
+
+      // the derivative power is only defined where x^p / x is
+      fas_pow_pair(x, p, val, der_pow);
+      expect(closeTo(val, ref, tol), powCase("fas_pow_pair", x, p, val, ref),
+        failures);
+      if(x != 0.0)
+        expect(closeTo(der_pow, std::pow(x, p - 1.0), tol),
+          powCase("fas_pow_pair (p - 1)", x, p, der_pow, std::pow(x, p - 1.0)),
+          failures);
+      lanes[b] = x;
+    }
+
+    fas_pow_lanes(lanes, p, base_n, lane_res);
+    for(idx_t b = 0; b < base_n; b++)
+      expect(closeTo(lane_res[b], std::pow(lanes[b], p), tol),
+        powCase("fas_pow_lanes", lanes[b], p, lane_res[b],
+          std::pow(lanes[b], p)), failures);
+
+    fas_pow_pair_lanes(lanes, p, base_n, lane_res, lane_der);
+    for(idx_t b = 0; b < base_n; b++)
+      expect(closeTo(lane_res[b], std::pow(lanes[b], p), tol),
+        powCase("fas_pow_pair_lanes", lanes[b], p, lane_res[b],
+          std::pow(lanes[b], p)), failures);
+  }
+
+  // more lanes than one chunk of fas_pow_lanes
+  idx_t n = 3 * FAS_POW_LANE_CHUNK + 5;
+  std::vector<real_t> x(n), res(n);
+  for(idx_t l = 0; l < n; l++)
+    x[l] = 0.5 + 0.01 * l;
+  fas_pow_lanes(&x[0], -7.5, n, &res[0]);
+  for(idx_t l = 0; l < n; l++)
+    expect(closeTo(res[l], std::pow(x[l], -7.5), tol),
+      powCase("fas_pow_lanes", x[l], -7.5, res[l], std::pow(x[l], -7.5)),
+      failures);
+
+  // all exponents of two variables from one chain, registers reused
+  FASPowerChain pc;
+  std::vector<idx_t> regs[2];
+  for(idx_t v = 0; v < 2; v++)
+    for(idx_t e = 0; e < exp_n; e++)
+      regs[v].push_back(pc.power(v, exps[e]));
+  expect(pc.power(0, 7.5) == regs[0][13], "FASPowerChain recomputes u0^7.5",
+    failures);
+
+  std::vector<real_t> reg(pc.registers());
+  for(idx_t b = 0; b < base_n; b++)
+  {
+    real_t vals[2] = {bases[b], bases[base_n - 1 - b]};
+    for(size_t v = 0; v < pc.u_ids.size(); v++)
+      reg[pc.base_regs[v]] = vals[pc.u_ids[v]];
+    pc.evaluate(&reg[0]);
+
+    for(idx_t v = 0; v < 2; v++)
+      for(idx_t e = 0; e < exp_n; e++)
+      {
+        real_t ref = std::pow(vals[v], exps[e]);
+        expect(closeTo(reg[regs[v][e]], ref, tol), powCase("FASPowerChain",
+          vals[v], exps[e], reg[regs[v][e]], ref), failures);
+      }
+  }
+
+  std::cout << "powers: " << cases << " base / exponent pairs, "
+            << pc.steps.size() << " chain steps, " << failures
+            << " failure(s)\n";
+  return failures;
+}
+
+/**
+ * @brief pseudo-random number in [0, 1), reproducible across runs
+ */
+static real_t checkRandom(unsigned long long & state)
+{
+  state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (real_t) (state >> 11) / (real_t) (1ULL << 53);
+}
+
+/**
+ * @brief equations whose molecules repeat atoms and powers:
+ *  lap(u0) + u0*u0^2 + d1(u0)*d1(u0) + 0.3*rho3*u0^-1.5*u1^2 - u0^0.5 + rho5
+ *  d11(u1) + d22(u1) + d33(u1) + 0.2*d12(u1)*u0^3 + 0.1*u1*d3(u0)*d2(u1)
+ *    - 0.5*u1^-1 + rho6
+ *  with sources rhoN of molecule N
+ */
+static void jacobianEquations(FASMultigrid & mg)
+{
+  atom a_lap = {FASMultigrid::lap, 0, 0}, a_d1 = {FASMultigrid::der1, 0, 0},
+    a_d3 = {FASMultigrid::der3, 0, 0}, a_d2 = {FASMultigrid::der2, 1, 0},
+    a_d11 = {FASMultigrid::der11, 1, 0}, a_d22 = {FASMultigrid::der22, 1, 0},
+    a_d33 = {FASMultigrid::der33, 1, 0}, a_d12 = {FASMultigrid::der12, 1, 0};
+  atom a_u0 = {FASMultigrid::poly, 0, 1.0}, a_u0_2 = {FASMultigrid::poly, 0, 2.0},
+    a_u0_3 = {FASMultigrid::poly, 0, 3.0}, a_u0_05 = {FASMultigrid::poly, 0, 0.5},
+    a_u0_m15 = {FASMultigrid::poly, 0, -1.5}, a_u1 = {FASMultigrid::poly, 1, 1.0},
+    a_u1_2 = {FASMultigrid::poly, 1, 2.0}, a_u1_m1 = {FASMultigrid::poly, 1, -1.0};
+
+  mg.eqns[0][0].init(1, 1.0);
+  mg.add_atom_to_eqn(a_lap, 0, 0);
+  mg.eqns[0][1].init(2, 1.0);
+  mg.add_atom_to_eqn(a_u0, 1, 0);
+  mg.add_atom_to_eqn(a_u0_2, 1, 0);
+  mg.eqns[0][2].init(2, 1.0);
+  mg.add_atom_to_eqn(a_d1, 2, 0);
+  mg.add_atom_to_eqn(a_d1, 2, 0);
+  mg.eqns[0][3].init(2, 0.3);
+  mg.add_atom_to_eqn(a_u0_m15, 3, 0);
+  mg.add_atom_to_eqn(a_u1_2, 3, 0);
+  mg.eqns[0][4].init(1, -1.0);
+  mg.add_atom_to_eqn(a_u0_05, 4, 0);
+  mg.eqns[0][5].init(0, 1.0);
+
+  mg.eqns[1][0].init(1, 1.0);
+  mg.add_atom_to_eqn(a_d11, 0, 1);
+  mg.eqns[1][1].init(1, 1.0);
+  mg.add_atom_to_eqn(a_d22, 1, 1);
+  mg.eqns[1][2].init(1, 1.0);
+  mg.add_atom_to_eqn(a_d33, 2, 1);
+  mg.eqns[1][3].init(2, 0.2);
+  mg.add_atom_to_eqn(a_d12, 3, 1);
+  mg.add_atom_to_eqn(a_u0_3, 3, 1);
+  mg.eqns[1][4].init(3, 0.1);
+  mg.add_atom_to_eqn(a_u1, 4, 1);
+  mg.add_atom_to_eqn(a_d3, 4, 1);
+  mg.add_atom_to_eqn(a_d2, 4, 1);
+  mg.eqns[1][5].init(1, -0.5);
+  mg.add_atom_to_eqn(a_u1_m1, 5, 1);
+  mg.eqns[1][6].init(0, 1.0);
+}
+
+/**
+ * @brief the operator cache (term lists, power chains, linear molecules)
+ *  evaluates equations, Jacobian coefficients and directional derivatives
+ *  like the symbolic product rule it replaces
+ */
+static idx_t checkJacobian()
+{
+  idx_t failures = 0, points = 0;
+  idx_t n = 8, u_n = 2, samples = 64;
+  idx_t molecule_n[2] = {6, 7};
+  real_t tol = 1e-12;
+  unsigned long long state = 12345;
+
+  for(idx_t l = 0; l < 2; l++)
+  for(idx_t order = 2; order <= 8; order += 2)
+  {
+    FASMultigrid::layout_t layout = l ? FASMultigrid::layout_interleaved
+      : FASMultigrid::layout_separate;
+    arr_t u[2];
+    for(idx_t e = 0; e < u_n; e++)
+    {
+      u[e].init(n, n, n);
+      for(idx_t idx = 0; idx < n * n * n; idx++)
+        u[e][idx] = 1.0 + checkRandom(state);
+    }
+
+    FASMultigrid * mg_p = new FASMultigrid(u, u_n, molecule_n, 2, 1, 1e-12,
+      layout);
+    FASMultigrid & mg = *mg_p;
+    mg.tuning_cache_file = "";
+    mg.setStencilOrder(order);
+    jacobianEquations(mg);
+    idx_t i, j, k;
+    real_t src_0 = 0.0;
+    FAS_LOOP3_N(i, j, k, n, n, n)
+    {
+      real_t src = checkRandom(state) - 0.5;
+      if(i == 0 && j == 0 && k == 0)
+        src_0 = src;
+      mg.setPolySrcAtPt(0, 3, i, j, k, 0.5 + checkRandom(state));
+      mg.setPolySrcAtPt(0, 5, i, j, k, src);
+      mg.setPolySrcAtPt(1, 6, i, j, k, checkRandom(state) - 0.5);
+    }
+    mg.initializeRhoHeirarchy();
+
+    // one Newton iteration leaves a correction in the Jacobian direction
+    mg._syncInterleavedSolution(true);
+    mg._relaxSolution_GaussSeidel(2, 1);
+
+    // cached values at sample points
+    idx_t depth_idx = 1;
+    std::vector<idx_t> pts;
+    std::vector<real_t> cached;
+    for(idx_t s = 0; s < samples; s++)
+    {
+      i = (idx_t) (n * checkRandom(state));
+      j = (idx_t) (n * checkRandom(state));
+      k = (idx_t) (n * checkRandom(state));
+      pts.push_back(i);
+      pts.push_back(j);
+      pts.push_back(k);
+      for(idx_t e = 0; e < u_n; e++)
+      {
+        cached.push_back(mg._evaluateEllipticEquationPt(e, depth_idx, i, j, k));
+        for(idx_t v = 0; v < u_n; v++)
+        {
+          real_t coef_a = 0.0, coef_b = 0.0;
+          mg._evaluateIterationForJacEquation(e, depth_idx, coef_a, coef_b,
+            i, j, k, v);
+          cached.push_back(coef_a);
+          cached.push_back(coef_b);
+          cached.push_back(mg._evaluateDerEllipticEquation(e, depth_idx, i, j,
+            k, v));
+        }
+      }
+    }
+
+    // setting a source (to its value) drops the cache
+    mg.setPolySrcAtPt(0, 5, 0, 0, 0, src_0);
+
+    size_t c = 0;
+    for(idx_t s = 0; s < samples; s++)
+    {
+      i = pts[3 * s];
+      j = pts[3 * s + 1];
+      k = pts[3 * s + 2];
+      for(idx_t e = 0; e < u_n; e++)
+      {
+        std::vector<real_t> symbolic;
+        symbolic.push_back(mg._evaluateEllipticEquationPt(e, depth_idx, i, j, k));
+        for(idx_t v = 0; v < u_n; v++)
+        {
+          real_t coef_a = 0.0, coef_b = 0.0;
+          mg._evaluateIterationForJacEquation(e, depth_idx, coef_a, coef_b,
+            i, j, k, v);
+          symbolic.push_back(coef_a);
+          symbolic.push_back(coef_b);
+          symbolic.push_back(mg._evaluateDerEllipticEquation(e, depth_idx, i,
+            j, k, v));
+        }
+
+        const char * names[] = {"F", "coef_a(u0)", "coef_b(u0)", "v.dF/du0",
+          "coef_a(u1)", "coef_b(u1)", "v.dF/du1"};
+        for(size_t q = 0; q < symbolic.size(); q++, c++)
+        {
+          real_t scale = std::max((real_t) 1.0, std::fabs(symbolic[q]));
+          std::ostringstream what;
+          what.precision(17);
+          what << names[q] << " of equation " << e << " at (" << i << ", "
+               << j << ", " << k << "), order " << order << (l ? ", interleaved" : "")
+               << ": cached " << cached[c] << ", symbolic " << symbolic[q];
+          expect(std::fabs(cached[c] - symbolic[q]) <= tol * scale, what.str(),
+            failures);
+        }
+      }
+      points++;
+    }
+
+    delete mg_p;
+    for(idx_t e = 0; e < u_n; e++)
+      delete [] u[e]._array;
+  }
+
+  std::cout << "jacobian: " << points << " points, " << failures
+            << " failure(s)\n";
+  return failures;
+}
+
+/**
+ * @brief solver for lap(u0) + 0.1*u0^5 - rho = 0 on an n^3 grid, with
+ *  adaptive smoothing
+ */
+static FASMultigrid * restartSolver(arr_t * u, idx_t n,
+  FASMultigrid::layout_t layout, bool smoothing,
+  const std::string & out_of_core_dir = "")
+{
+  static idx_t molecule_n[1] = {3};
+  u[0].init(n, n, n);
+  for(idx_t idx = 0; idx < n * n * n; idx++)
+    u[0][idx] = 1.0;
+
+  FASMultigrid * mg = new FASMultigrid(u, 1, molecule_n, 3, 5, 1e-12, layout,
+    out_of_core_dir);
+  mg->tuning_cache_file = "";
+  mg->setStencilOrder(4);
+  mg->getSmoothing().enabled = smoothing;
+  mg->getSmoothing().min_rate = 0.5;
+
+  atom a_lap = {FASMultigrid::lap, 0, 0}, a_u0_5 = {FASMultigrid::poly, 0, 5.0};
+  mg->eqns[0][0].init(1, 1.0);
+  mg->add_atom_to_eqn(a_lap, 0, 0);
+  mg->eqns[0][1].init(1, 0.1);
+  mg->add_atom_to_eqn(a_u0_5, 1, 0);
+  mg->eqns[0][2].init(0, -1.0);
+
+  idx_t i, j, k;
+  FAS_LOOP3_N(i, j, k, n, n, n)
+    mg->setPolySrcAtPt(0, 2, i, j, k, 0.1 + 0.05 * std::sin(2.0 * PI * i / n)
+      * std::cos(2.0 * PI * j / n));
+  mg->initializeRhoHeirarchy();
+  mg->_syncInterleavedSolution(true);
+  return mg;
+}
+
+/**
+ * @brief a solve restarted from a checkpoint halfway continues exactly as
+ *  the uninterrupted solve
+ */
+static idx_t checkRestart()
+{
+  idx_t failures = 0;
+  idx_t n = 16, cycles = 6;
+  std::string file_name = "solver_checks_restart.chk";
+
+  // reductions over several threads are not summed in a fixed order
+  idx_t threads = omp_get_max_threads();
+  omp_set_num_threads(1);
+
+  for(idx_t l = 0; l < 2; l++)
+  {
+    FASMultigrid::layout_t layout = l ? FASMultigrid::layout_interleaved
+      : FASMultigrid::layout_separate;
+    std::string name = l ? "interleaved" : "separate";
+    arr_t u_full[1], u_half[1], u_restart[1];
+
+    // uninterrupted
+    FASMultigrid * full = restartSolver(u_full, n, layout, true);
+    for(idx_t c = 0; c < cycles; c++)
+      full->VCycle();
+    full->_syncInterleavedSolution(false);
+
+    // half the cycles, checkpoint, then the rest in a new solver (which
+    // also takes the smoothing settings from the checkpoint)
+    FASMultigrid * half = restartSolver(u_half, n, layout, true);
+    for(idx_t c = 0; c < cycles / 2; c++)
+      half->VCycle();
+    expect(half->writeCheckpoint(file_name, false), "writing " + file_name,
+      failures);
+
+    FASMultigrid * restart = restartSolver(u_restart, n, layout, false);
+    expect(restart->readCheckpoint(file_name), "reading " + file_name,
+      failures);
+    expect(restart->getCycle() == cycles / 2, name + ": restarted at cycle "
+      + std::to_string(restart->getCycle()), failures);
+    expect(restart->getSmoothing().enabled
+      && restart->getSmoothing().budget == half->getSmoothing().budget,
+      name + ": smoothing budgets not restored", failures);
+    for(idx_t c = cycles / 2; c < cycles; c++)
+      restart->VCycle();
+    restart->_syncInterleavedSolution(false);
+
+    idx_t differ = 0;
+    for(idx_t idx = 0; idx < n * n * n; idx++)
+      if(std::memcmp(&u_full[0][idx], &u_restart[0][idx], sizeof(real_t)) != 0)
+        differ++;
+    expect(differ == 0, name + ": " + std::to_string(differ)
+      + " points differ from the uninterrupted solve", failures);
+    expect(restart->getSmoothing().budget == full->getSmoothing().budget,
+      name + ": smoothing budgets differ from the uninterrupted solve",
+      failures);
+
+    delete full;
+    delete half;
+    delete restart;
+    delete [] u_full[0]._array;
+    delete [] u_half[0]._array;
+    delete [] u_restart[0]._array;
+  }
+
+  omp_set_num_threads(threads);
+  std::remove(file_name.c_str());
+  std::cout << "restart: " << cycles << " cycles vs " << cycles / 2
+            << " + checkpoint + " << cycles / 2 << ", " << failures
+            << " failure(s)\n";
+  return failures;
+}
+
+/**
+ * @brief fields written by FASFieldWriter read back with plain reads
+ */
+static idx_t checkFieldOutput()
+{
+  idx_t failures = 0, fields = 0;
+  idx_t n = 16;
+  std::string file_name = "solver_checks_fields.bin";
+
+  arr_t u[1];
+  FASMultigrid * mg = restartSolver(u, n, FASMultigrid::layout_separate, false);
+  for(idx_t c = 0; c < 2; c++)
+    mg->VCycle();
+
+  // a field whose size is not a multiple of the alignment
+  idx_t dims[3] = {7, 9, 5};
+  idx_t odd_pts = dims[0] * dims[1] * dims[2];
+
+  for(idx_t direct = 0; direct < 2; direct++)
+  {
+    FASFieldWriter out;
+    // several writes per field and a bounded queue
+    out.chunk_bytes = 8192;
+    out.max_buffer_bytes = 3 * n * n * n * sizeof(real_t);
+    expect(out.open(file_name, 8, direct), "opening " + file_name, failures);
+
+    real_t * odd = out.beginField("odd", -1, dims[0], dims[1], dims[2]);
+    for(idx_t idx = 0; idx < odd_pts && odd != NULL; idx++)
+      odd[idx] = 0.5 * idx - 3.0;
+    out.commitField();
+    expect(mg->writeFields(out, 3), "writeFields", failures);
+    expect(out.close(), "closing " + file_name, failures);
+
+    std::FILE * f = std::fopen(file_name.c_str(), "rb");
+    FASFieldWriter::header_t header;
+    expect(f != NULL && std::fread(&header, sizeof(header), 1, f) == 1,
+      "reading the header", failures);
+    if(f == NULL)
+      continue;
+
+    std::fseek(f, 0, SEEK_END);
+    long file_bytes = std::ftell(f);
+    expect(std::memcmp(header.magic, "FASFIELD", 8) == 0
+      && header.version == FAS_FIELD_OUTPUT_VERSION
+      && header.real_bytes == sizeof(real_t) && header.field_n == 3
+      && header.file_bytes == file_bytes, "header", failures);
+
+    std::vector<FASFieldWriter::entry_t> entries(header.field_n);
+    std::fseek(f, sizeof(header), SEEK_SET);
+    expect(header.field_n > 0 && std::fread(&entries[0],
+      sizeof(FASFieldWriter::entry_t), header.field_n, f)
+      == (size_t) header.field_n, "reading the table", failures);
+
+    const char * names[] = {"odd", "u_0", "residual_0"};
+    for(idx_t e = 0; e < header.field_n && e < 3; e++)
+    {
+      const FASFieldWriter::entry_t & entry = entries[e];
+      bool is_odd = (e == 0);
+      idx_t pts = is_odd ? odd_pts : n * n * n;
+      std::string what = std::string(direct ? "direct " : "") + names[e];
+      fields++;
+
+      expect(std::string(entry.name) == names[e]
+        && entry.depth == (is_odd ? -1 : 3)
+        && entry.nx == (is_odd ? dims[0] : n)
+        && entry.ny == (is_odd ? dims[1] : n)
+        && entry.nz == (is_odd ? dims[2] : n)
+        && entry.elem_bytes == sizeof(real_t) && entry.offset % 4096 == 0
+        && entry.offset + pts * (idx_t) sizeof(real_t) <= file_bytes,
+        what + ": table entry", failures);
+
+      std::vector<real_t> data(pts);
+      std::fseek(f, entry.offset, SEEK_SET);
+      expect(std::fread(&data[0], sizeof(real_t), pts, f) == (size_t) pts,
+        what + ": reading the data", failures);
+
+      // the residual is checked through its maximum
+      idx_t differ = 0;
+      real_t max_residual = 0.0;
+      for(idx_t idx = 0; idx < pts; idx++)
+      {
+        real_t ref = is_odd ? 0.5 * idx - 3.0 : u[0][idx];
+        if(e == 2)
+          max_residual = std::max(max_residual, std::fabs(data[idx]));
+        else if(data[idx] != ref)
+          differ++;
+      }
+      if(e == 2)
+        differ = (max_residual != mg->_getMaxResidualAllEqs(3)) ? pts : 0;
+      expect(differ == 0, what + ": " + std::to_string(differ)
+        + " values differ", failures);
+    }
+    std::fclose(f);
+  }
+
+  delete mg;
+  delete [] u[0]._array;
+  std::remove(file_name.c_str());
+  std::cout << "field_output: " << fields << " fields read back, " << failures
+            << " failure(s)\n";
+  return failures;
+}
+
+/**
+ * @brief an out-of-core solve (fine grids in files, prefetched and paged
+ *  out per thread chunk) ends as the in-core solve
+ * @details bitwise with one thread; several threads, each sweeping chunks
+ *  of more than window_planes planes, do not reproduce bitwise even in core
+ *  (order of reductions and of updates at chunk boundaries), so they are
+ *  compared to 1e-4
+ */
+static idx_t checkOutOfCore()
+{
+  idx_t failures = 0;
+  idx_t n = 64, cycles = 3;
+  idx_t threads = omp_get_max_threads();
+
+  for(idx_t t = 1; t <= 4; t *= 4)
+  for(idx_t l = 0; l < 2; l++)
+  {
+    omp_set_num_threads(t);
+    FASMultigrid::layout_t layout = l ? FASMultigrid::layout_interleaved
+      : FASMultigrid::layout_separate;
+    std::string name = std::string(l ? "interleaved" : "separate") + ", "
+      + std::to_string(t) + " thread(s)";
+    real_t tol = (t == 1) ? 0.0 : 1e-4;
+    arr_t u_mem[1], u_ooc[1];
+
+    FASMultigrid * mem = restartSolver(u_mem, n, layout, true);
+    FASMultigrid * ooc = restartSolver(u_ooc, n, layout, true, ".");
+    for(idx_t c = 0; c < cycles; c++)
+    {
+      mem->VCycle();
+      ooc->VCycle();
+    }
+    mem->_syncInterleavedSolution(false);
+    ooc->_syncInterleavedSolution(false);
+
+    idx_t differ = 0;
+    for(idx_t idx = 0; idx < n * n * n; idx++)
+      if(!(std::fabs(u_mem[0][idx] - u_ooc[0][idx])
+        <= tol * std::fabs(u_mem[0][idx])))
+        differ++;
+    expect(differ == 0, name + ": " + std::to_string(differ)
+      + " points differ from the in-core solve", failures);
+
+    delete mem;
+    delete ooc;
+    delete [] u_mem[0]._array;
+    delete [] u_ooc[0]._array;
+  }
+
+  omp_set_num_threads(threads);
+  std::cout << "out_of_core: " << cycles << " cycles in both layouts, "
+            << failures << " failure(s)\n";
+  return failures;
+}
+
+// width of the Gaussian solution of the refinement check, in box lengths
+#define FAC_CHECK_WIDTH 0.04
+
+/**
+ * @brief solution of facSolver: a Gaussian at the centre of the box
+ * @param r2 squared distance from the centre
+ */
+static real_t facExact(real_t r2)
+{
+  real_t s = FAC_CHECK_WIDTH * H_LEN_FRAC;
+  return std::exp(-r2 / (2.0 * s * s));
+}
+
+/**
+ * @brief source of facSolver, rho = u - lap(u) for u = facExact
+ */
+static real_t facSource(real_t r2)
+{
+  real_t s2 = FAC_CHECK_WIDTH * H_LEN_FRAC * FAC_CHECK_WIDTH * H_LEN_FRAC;
+  return facExact(r2) * (1.0 - r2 / (s2 * s2) + 3.0 / s2);
+}
+
+/**
+ * @brief squared distance of global point (i, j, k) of a grid with spacing
+ *  h from the centre of the box
+ */
+static real_t facR2(idx_t i, idx_t j, idx_t k, real_t h)
+{
+  real_t c = 0.5 * H_LEN_FRAC, x = i * h - c, y = j * h - c, z = k * h - c;
+  return x * x + y * y + z * z;
+}
+
+/**
+ * @brief solver for lap(u0) - u0 + rho = 0 on an n^3 grid, solved by
+ *  facExact
+ */
+static FASMultigrid * facSolver(arr_t * u, idx_t n)
+{
+  static idx_t molecule_n[1] = {3};
+  idx_t depth = 1;
+  for(idx_t m = n; m > 4; m /= 2)
+    depth++;
+
+  u[0].init(n, n, n);
+  for(idx_t idx = 0; idx < n * n * n; idx++)
+    u[0][idx] = 0.0;
+
+  FASMultigrid * mg = new FASMultigrid(u, 1, molecule_n, depth, 5, 1e-8);
+  mg->tuning_cache_file = "";
+  mg->setStencilOrder(4);
+
+  atom a_lap = {FASMultigrid::lap, 0, 0}, a_u0 = {FASMultigrid::poly, 0, 1.0};
+  mg->eqns[0][0].init(1, 1.0);
+  mg->add_atom_to_eqn(a_lap, 0, 0);
+  mg->eqns[0][1].init(1, -1.0);
+  mg->add_atom_to_eqn(a_u0, 1, 0);
+  mg->eqns[0][2].init(0, 1.0);
+
+  idx_t i, j, k;
+  FAS_LOOP3_N(i, j, k, n, n, n)
+    mg->setPolySrcAtPt(0, 2, i, j, k, facSource(facR2(i, j, k,
+      H_LEN_FRAC / n)));
+  mg->initializeRhoHeirarchy();
+  return mg;
+}
+
+/**
+ * @brief a composite solve is as accurate on its finest patch as a uniform
+ *  solve at that resolution
+ * @details The base grid has 16^3 points (2.5 Gaussian widths per spacing);
+ *  a level 1 patch covers the middle 3/4 of the box and a level 2 patch
+ *  inside it the middle half, beyond which the Gaussian is below 1e-8, so
+ *  the coarse levels add no error of their own. On the level 2 patch the
+ *  composite error must be within 1.5 times that of a uniform 64^3 solve
+ *  and below 1% of that of a uniform solve on the base grid.
+ */
+static idx_t checkRefinement()
+{
+  idx_t failures = 0;
+  idx_t n = 16, fine_n = 4 * n;
+  real_t fine_h = H_LEN_FRAC / fine_n;
+  arr_t u[1], u_fine[1], u_base[1];
+
+  FASMultigrid * mg = facSolver(u, n);
+  FASRefinement * fac = new FASRefinement(*mg);
+  fac->addPatch(1, n/8, n/8, n/8, 3*n/4, 3*n/4, 3*n/4);
+  idx_t top = fac->addPatch(2, n/2, n/2, n/2, n, n, n);
+  for(idx_t p_id = 0; p_id < fac->patches(); p_id++)
+  {
+    FASRefinementPatch & p = fac->getPatch(p_id);
+    real_t h = H_LEN_FRAC / (n << p.level);
+    idx_t i, j, k;
+    FAS_LOOP3_N(i, j, k, p.nx, p.ny, p.nz)
+      fac->setPolySrcAtPt(p_id, 0, 2, i, j, k, facSource(facR2(2*p.lo[0] + i,
+        2*p.lo[1] + j, 2*p.lo[2] + k, h)));
+  }
+  fac->FACCycles(16);
+
+  FASMultigrid * fine = facSolver(u_fine, fine_n);
+  fine->VCycles(6);
+  FASMultigrid * base = facSolver(u_base, n);
+  base->VCycles(16);
+
+  // errors at the points of the level 2 patch (global points of level 2,
+  // which are those of the fine grid and every fourth one of the base grid)
+  FASRefinementPatch & p = fac->getPatch(top);
+  arr_t & u_patch = fac->getSolution(top, 0);
+  real_t err = 0.0, fine_err = 0.0, base_err = 0.0;
+  idx_t i, j, k;
+  FAS_LOOP3_N(i, j, k, p.nx, p.ny, p.nz)
+  {
+    idx_t gi = 2*p.lo[0] + i, gj = 2*p.lo[1] + j, gk = 2*p.lo[2] + k;
+    real_t exact = facExact(facR2(gi, gj, gk, fine_h));
+    err = std::max(err, std::fabs(u_patch[H_INDEX(i, j, k, p.nx, p.ny,
+      p.nz)] - exact));
+    fine_err = std::max(fine_err, std::fabs(u_fine[0][H_INDEX(gi, gj, gk,
+      fine_n, fine_n, fine_n)] - exact));
+    if(gi % 4 == 0 && gj % 4 == 0 && gk % 4 == 0)
+      base_err = std::max(base_err, std::fabs(u_base[0][H_INDEX(gi/4, gj/4,
+        gk/4, n, n, n)] - exact));
+  }
+
+  std::ostringstream errors;
+  errors << "composite error " << err << ", uniform " << fine_n << "^3 "
+         << fine_err << ", uniform " << n << "^3 " << base_err;
+  expect(err <= 1.5 * fine_err, errors.str()
+    + ": composite worse than the uniform fine solve", failures);
+  expect(err <= 0.01 * base_err, errors.str()
+    + ": composite not better than the base grid", failures);
+
+  delete fac;
+  delete mg;
+  delete fine;
+  delete base;
+  delete [] u[0]._array;
+  delete [] u_fine[0]._array;
+  delete [] u_base[0]._array;
+
+  std::cout << "refinement: " << errors.str() << ", " << failures
+            << " failure(s)\n";
+  return failures;
+}
+
+/**
+ * @brief equations of the batch check (FASMultigrid or FASMultigridBatch):
+ *  lap(u0) - u0 - 0.1*u0^3 + rho3 = 0
+ *  lap(u1) - u1 + 0.5*u0 - rho3 = 0
+ */
+template<typename MG>
+static void batchEquations(MG & mg)
+{
+  atom a_lap0 = {FASMultigrid::lap, 0, 0}, a_lap1 = {FASMultigrid::lap, 1, 0},
+    a_u0 = {FASMultigrid::poly, 0, 1.0}, a_u0_3 = {FASMultigrid::poly, 0, 3.0},
+    a_u1 = {FASMultigrid::poly, 1, 1.0};
+
+  mg.eqns[0][0].init(1, 1.0);
+  mg.add_atom_to_eqn(a_lap0, 0, 0);
+  mg.eqns[0][1].init(1, -1.0);
+  mg.add_atom_to_eqn(a_u0, 1, 0);
+  mg.eqns[0][2].init(1, -0.1);
+  mg.add_atom_to_eqn(a_u0_3, 2, 0);
+  mg.eqns[0][3].init(0, 1.0);
+
+  mg.eqns[1][0].init(1, 1.0);
+  mg.add_atom_to_eqn(a_lap1, 0, 1);
+  mg.eqns[1][1].init(1, -1.0);
+  mg.add_atom_to_eqn(a_u1, 1, 1);
+  mg.eqns[1][2].init(1, 0.5);
+  mg.add_atom_to_eqn(a_u0, 2, 1);
+  mg.eqns[1][3].init(0, -1.0);
+}
+
+/**
+ * @brief source of an equation of the batch check for a member, at (i, j, k)
+ *  of an n^3 grid
+ */
+static real_t batchSource(idx_t member, idx_t eqn_id, idx_t i, idx_t j,
+  idx_t k, idx_t n)
+{
+  if(eqn_id == 0)
+    return (1 + member) * std::sin(2.0 * PI * i / n)
+      * std::cos(2.0 * PI * j / n);
+  return 0.2 * member * std::cos(2.0 * PI * k / n);
+}
+
+/**
+ * @brief every member of a batched solve ends as a solve of that member
+ *  alone with as many V-cycles
+ * @details members stop once converged, so the solo solve runs
+ *  cycles_n[member] V-cycles; its final relaxation then does nothing for
+ *  converged members, as in the batch
+ */
+static idx_t checkBatch()
+{
+  idx_t failures = 0;
+  idx_t n = 16, batch_n = 3, depths = 3, max_cycles = 15;
+  real_t tol = 5e-4;
+  static idx_t molecule_n[2] = {4, 4};
+  std::ostringstream cycles;
+
+  // reductions over several threads are not summed in a fixed order
+  idx_t threads = omp_get_max_threads();
+  omp_set_num_threads(1);
+
+  std::vector<arr_t> u(2 * batch_n);
+  for(idx_t v = 0; v < 2 * batch_n; v++)
+  {
+    u[v].init(n, n, n);
+    for(idx_t idx = 0; idx < n * n * n; idx++)
+      u[v][idx] = 0.0;
+  }
+
+  FASMultigridBatch batch(&u[0], 2, batch_n, molecule_n, depths, 5, tol);
+  batch.setStencilOrder(4);
+  batchEquations(batch);
+  idx_t i, j, k;
+  FAS_LOOP3_N(i, j, k, n, n, n)
+    for(idx_t b = 0; b < batch_n; b++)
+      for(idx_t eqn_id = 0; eqn_id < 2; eqn_id++)
+        batch.setPolySrcAtPt(eqn_id, 3, b, i, j, k,
+          batchSource(b, eqn_id, i, j, k, n));
+  batch.initializeRhoHeirarchy();
+  batch.VCycles(max_cycles);
+
+  for(idx_t b = 0; b < batch_n; b++)
+  {
+    std::string name = "member " + std::to_string(b);
+    arr_t u_one[2];
+    for(idx_t v = 0; v < 2; v++)
+    {
+      u_one[v].init(n, n, n);
+      for(idx_t idx = 0; idx < n * n * n; idx++)
+        u_one[v][idx] = 0.0;
+    }
+
+    FASMultigrid one(u_one, 2, molecule_n, depths, 5, tol);
+    one.setStencilOrder(4);
+    batchEquations(one);
+    FAS_LOOP3_N(i, j, k, n, n, n)
+      for(idx_t eqn_id = 0; eqn_id < 2; eqn_id++)
+        one.setPolySrcAtPt(eqn_id, 3, i, j, k,
+          batchSource(b, eqn_id, i, j, k, n));
+    one.initializeRhoHeirarchy();
+    one.VCycles(batch.cycles_n[b]);
+
+    expect(batch.final_residual[b] < tol, name + ": final residual "
+      + std::to_string(batch.final_residual[b]), failures);
+
+    idx_t differ = 0;
+    for(idx_t v = 0; v < 2; v++)
+      for(idx_t idx = 0; idx < n * n * n; idx++)
+        if(std::memcmp(&u[2 * b + v][idx], &u_one[v][idx], sizeof(real_t)) != 0)
+          differ++;
+    expect(differ == 0, name + ": " + std::to_string(differ)
+      + " points differ from the solve of the member alone", failures);
+
+    cycles << (b > 0 ? "/" : "") << batch.cycles_n[b];
+    delete [] u_one[0]._array;
+    delete [] u_one[1]._array;
+  }
+
+  for(idx_t v = 0; v < 2 * batch_n; v++)
+    delete [] u[v]._array;
+
+  omp_set_num_threads(threads);
+  std::cout << "batch: " << batch_n << " members in " << cycles.str()
+            << " V-cycles, " << failures << " failure(s)\n";
+  return failures;
+}
+
+typedef idx_t (*check_fn)();
+
+typedef struct {
+  const char * name;
+  check_fn fn;
+} solver_check;
+
+static const solver_check checks[] = {
+  {"equations", checkEquations},
+  {"powers", checkPowers},
+  {"jacobian", checkJacobian},
+  {"restart", checkRestart},
+  {"field_output", checkFieldOutput},
+  {"out_of_core", checkOutOfCore},
+  {"refinement", checkRefinement},
+  {"batch", checkBatch}
+};
+
+static std::vector<std::string> splitList(const std::string & list)
+{
+  std::vector<std::string> res;
+  std::stringstream ss(list);
+  std::string item;
+  while(std::getline(ss, item, ','))
+    if(!item.empty())
+      res.push_back(item);
+  return res;
+}
+
+static void usage()
+{
+  std::cout << "Usage: solver_checks [--checks";
+  for(size_t c = 0; c < sizeof(checks) / sizeof(checks[0]); c++)
+    std::cout << (c ? "," : " ") << checks[c].name;
+  std::cout << "]\n";
+}
+
+int main(int argc, char **argv)
+{
+  idx_t check_n = sizeof(checks) / sizeof(checks[0]);
+  std::vector<std::string> names;
+  for(idx_t c = 0; c < check_n; c++)
+    names.push_back(checks[c].name);
+
+  for(int a = 1; a < argc; a++)
+  {
+    std::string opt = argv[a];
+    if(opt == "--help" || opt == "-h" || a + 1 >= argc)
+    {
+      usage();
+      return opt == "--help" || opt == "-h" ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    std::string val = argv[++a];
+
+    if(opt == "--checks") names = splitList(val);
+    else
+    {
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  idx_t failures = 0;
+  for(size_t n = 0; n < names.size(); n++)
+  {
+    idx_t c = 0;
+    while(c < check_n && names[n] != checks[c].name)
+      c++;
+    if(c == check_n)
+    {
+      std::cout << "Unknown check " << names[n] << "\n";
+      return EXIT_FAILURE;
+    }
+    failures += checks[c].fn();
+  }
+
+  if(failures > 0)
+  {
+    std::cout << failures << " solver check(s) failed.\n";
+    return EXIT_FAILURE;
+  }
+  std::cout << "All solver checks passed.\n";
+  return EXIT_SUCCESS;
+}